@@ -3,7 +3,6 @@
 // ==============================
 #include <windows.h>
 #include <shellapi.h>
-#include <wincodec.h>
 
 #include <utility>
 
@@ -12,7 +11,7 @@
 #include <dxgi.h>
 
 #include <wrl/client.h>
-#include "DirectXMath.h"
+#include "skin_core.h"
 
 #include <cstdint>
 #include <vector>
@@ -23,6 +22,23 @@
 #include <algorithm>
 #include <stdexcept>
 #include <cmath>
+#include <cfloat>
+#include <fstream>
+#include <cwctype>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <numeric>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
 
 #include "imgui.h"
 #include "imgui_impl_win32.h"
@@ -32,7 +48,6 @@
 #include <cstddef>
 
 using Microsoft::WRL::ComPtr;
-using namespace DirectX;
 
 // ------------------------------
 // Small helpers
@@ -43,23 +58,6 @@ static void ThrowIfFailed(HRESULT hr, const char* msg) {
   }
 }
 
-static std::string NarrowFromWide(std::wstring_view w) {
-  if (w.empty()) return {};
-  int n = WideCharToMultiByte(CP_UTF8, 0, w.data(), (int)w.size(), nullptr, 0, nullptr, nullptr);
-  std::string out(n, '\0');
-  WideCharToMultiByte(CP_UTF8, 0, w.data(), (int)w.size(), out.data(), n, nullptr, nullptr);
-  return out;
-}
-
-static std::wstring WideFromUtf8(std::string_view s) {
-  if (s.empty()) return {};
-  int n = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
-  std::wstring out(n, L'\0');
-  MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), out.data(), n);
-  return out;
-}
-
-static float Clamp(float v, float lo, float hi) { return std::max(lo, std::min(hi, v)); }
 
 // ------------------------------
 // D3D state
@@ -76,6 +74,7 @@ struct D3DState {
 
   ComPtr<ID3D11VertexShader> vs;
   ComPtr<ID3D11PixelShader> ps;
+  ComPtr<ID3D11PixelShader> psCutout;   // alpha-test (discard) for binary-alpha overlay
   ComPtr<ID3D11InputLayout> il;
   ComPtr<ID3D11Buffer> vb;
   ComPtr<ID3D11Buffer> ib;
@@ -83,702 +82,64 @@ struct D3DState {
   ComPtr<ID3D11SamplerState> samp;
   ComPtr<ID3D11RasterizerState> rs;
   ComPtr<ID3D11DepthStencilState> dsDefault;
+  ComPtr<ID3D11DepthStencilState> dsNoWrite;  // translucent faces: test, no write
   ComPtr<ID3D11BlendState> blendAlpha;
 
   UINT ibCountBase = 0;
   UINT ibCountOverlay = 0;
   UINT ibOffsetOverlay = 0;
 
+  // Translucent overlay faces: CPU copy for per-frame back-to-front sorting
+  ComPtr<ID3D11Buffer> ibTranslucent;   // dynamic, rewritten when the order changes
+  UINT vbCapacity = 0;                  // vb/ib/ibTranslucent are dynamic; capacities in elements
+  UINT ibCapacity = 0;
+  UINT ibTranslucentCapacity = 0;
+  std::vector<uint32_t> translucentIdx;
+  std::vector<XMFLOAT3> translucentCentroids;
+  std::vector<uint32_t> translucentOrder;   // scratch
+  std::vector<uint32_t> translucentSorted;  // scratch
+
+  // Grid mode: one shared mesh per layout variant (0 = classic, 1 = slim)
+  ComPtr<ID3D11Buffer> gridVb;
+  ComPtr<ID3D11Buffer> gridIb;
+  ComPtr<ID3D11RasterizerState> rsScissor;
+  struct GridMeshRange {
+    UINT baseStart = 0, baseCount = 0;
+    UINT overlayStart = 0, overlayCount = 0;
+    INT vertexBase = 0;
+    UINT lod1Start = 0, lod1Count = 0;   // crowd LOD1 (BuildLod1Mesh)
+    INT lod1VertexBase = 0;
+  } gridMesh[2];
+  // Grid overlay faces per arm variant, for skins with translucent overlay
+  // texels: sorted back to front once per frame (all cells share the camera)
+  // into gridIbSorted, with the centroids in gridOverlayCentroids.
+  std::vector<uint32_t> gridOverlayIdx[2];
+  std::vector<XMFLOAT3> gridOverlayCentroids[2];
+  ComPtr<ID3D11Buffer> gridIbSorted;    // dynamic, sized for the larger variant
+
+  // Crowd LOD2: camera-facing impostor quads, rewritten every frame
+  ComPtr<ID3D11Buffer> impostorVb;
+  UINT impostorVbCapacity = 0;          // vertices
+
   int fbW = 1280;
   int fbH = 720;
 };
 
 // ------------------------------
-// Skin + analysis
+// Skin textures
 // ------------------------------
-struct SkinInfo {
-  std::wstring path;
-  uint32_t width = 0;
-  uint32_t height = 0;
-  uint32_t scale = 1;   // 1 for 64x*, 2 for 128x128, etc.
-  bool legacy64x32 = false;
-  bool hasAlpha = true;
-
-  std::vector<uint8_t> rgba; // width * height * 4 (RGBA)
+// SkinInfo::gpu; shared by SkinInfos that show the same pixels.
+struct SkinGpuTexture {
+  ComPtr<ID3D11Texture2D> tex;  // kept for incremental updates (painting)
   ComPtr<ID3D11ShaderResourceView> srv;
 };
 
-struct UvRectPx {
-  int x = 0, y = 0, w = 0, h = 0; // pixel-space
-};
-
-struct BoxUv {
-  UvRectPx top, bottom, right, front, left, back;
-};
-
-static bool AnyNonTransparent(const SkinInfo& s, const UvRectPx& r) {
-  if (s.rgba.empty() || s.width == 0 || s.height == 0) return false;
-  int x0 = std::max(0, r.x), y0 = std::max(0, r.y);
-  int x1 = std::min((int)s.width, r.x + r.w);
-  int y1 = std::min((int)s.height, r.y + r.h);
-  if (x1 <= x0 || y1 <= y0) return false;
-
-  for (int y = y0; y < y1; ++y) {
-    for (int x = x0; x < x1; ++x) {
-      const size_t idx = (size_t)(y * s.width + x) * 4;
-      if (idx + 3 < s.rgba.size() && s.rgba[idx + 3] != 0) return true;
-    }
-  }
-  return false;
-}
-
-static UvRectPx ScaleRect(const UvRectPx& r, uint32_t scale) {
-  return UvRectPx{ (int)(r.x * (int)scale), (int)(r.y * (int)scale), (int)(r.w * (int)scale), (int)(r.h * (int)scale) };
-}
-
-static BoxUv ScaleBoxUv(const BoxUv& b, uint32_t scale) {
-  return BoxUv{
-    ScaleRect(b.top, scale),
-    ScaleRect(b.bottom, scale),
-    ScaleRect(b.right, scale),
-    ScaleRect(b.front, scale),
-    ScaleRect(b.left, scale),
-    ScaleRect(b.back, scale),
-  };
-}
-
-// Base layer coordinates (64x64 reference).
-static BoxUv UV_Head() {
-  return BoxUv{
-    /*top*/    { 8,  0, 8, 8},
-    /*bottom*/ {16,  0, 8, 8},
-    /*right*/  { 0,  8, 8, 8},
-    /*front*/  { 8,  8, 8, 8},
-    /*left*/   {16,  8, 8, 8},
-    /*back*/   {24,  8, 8, 8},
-  };
-}
-static BoxUv UV_Hat() {
-  return BoxUv{
-    {40,  0, 8, 8},
-    {48,  0, 8, 8},
-    {32,  8, 8, 8},
-    {40,  8, 8, 8},
-    {48,  8, 8, 8},
-    {56,  8, 8, 8},
-  };
-}
-static BoxUv UV_Torso() {
-  return BoxUv{
-    {20, 16, 8, 4},   // top
-    {28, 16, 8, 4},   // bottom
-    {16, 20, 4, 12},  // right
-    {20, 20, 8, 12},  // front
-    {28, 20, 4, 12},  // left
-    {32, 20, 8, 12},  // back
-  };
-}
-static BoxUv UV_Jacket() {
-  return BoxUv{
-    {20, 32, 8, 4},
-    {28, 32, 8, 4},
-    {16, 36, 4, 12},
-    {20, 36, 8, 12},
-    {28, 36, 4, 12},
-    {32, 36, 8, 12},
-  };
-}
-static BoxUv UV_RightLeg() {
-  return BoxUv{
-    { 4, 16, 4, 4},
-    { 8, 16, 4, 4},
-    { 0, 20, 4, 12},
-    { 4, 20, 4, 12},
-    { 8, 20, 4, 12},
-    {12, 20, 4, 12},
-  };
-}
-static BoxUv UV_RightLegPants() {
-  return BoxUv{
-    { 4, 32, 4, 4},
-    { 8, 32, 4, 4},
-    { 0, 36, 4, 12},
-    { 4, 36, 4, 12},
-    { 8, 36, 4, 12},
-    {12, 36, 4, 12},
-  };
-}
-static BoxUv UV_RightArm() {
-  return BoxUv{
-    {44, 16, 4, 4},
-    {48, 16, 4, 4},
-    {40, 20, 4, 12},
-    {44, 20, 4, 12},
-    {48, 20, 4, 12},
-    {52, 20, 4, 12},
-  };
-}
-static BoxUv UV_RightSleeve() {
-  return BoxUv{
-    {44, 32, 4, 4},
-    {48, 32, 4, 4},
-    {40, 36, 4, 12},
-    {44, 36, 4, 12},
-    {48, 36, 4, 12},
-    {52, 36, 4, 12},
-  };
-}
-static BoxUv UV_LeftLeg() {
-  return BoxUv{
-    {20, 48, 4, 4},
-    {24, 48, 4, 4},
-    {16, 52, 4, 12},
-    {20, 52, 4, 12},
-    {24, 52, 4, 12},
-    {28, 52, 4, 12},
-  };
-}
-static BoxUv UV_LeftLegPants() {
-  return BoxUv{
-    { 4, 48, 4, 4},
-    { 8, 48, 4, 4},
-    { 0, 52, 4, 12},
-    { 4, 52, 4, 12},
-    { 8, 52, 4, 12},
-    {12, 52, 4, 12},
-  };
-}
-static BoxUv UV_LeftArm() {
-  return BoxUv{
-    {36, 48, 4, 4},
-    {40, 48, 4, 4},
-    {32, 52, 4, 12},
-    {36, 52, 4, 12},
-    {40, 52, 4, 12},
-    {44, 52, 4, 12},
-  };
-}
-static BoxUv UV_LeftSleeve() {
-  return BoxUv{
-    {52, 48, 4, 4},
-    {56, 48, 4, 4},
-    {48, 52, 4, 12},
-    {52, 52, 4, 12},
-    {56, 52, 4, 12},
-    {60, 52, 4, 12},
-  };
-}
-
-// ---- Slim (Alex) arm UVs (64x64+) ----
-static BoxUv UV_RightArmSlim() {
-  return BoxUv{
-    /*top*/    {44, 16, 3, 4},
-    /*bottom*/ {47, 16, 3, 4},
-    /*right*/  {40, 20, 4, 12},
-    /*front*/  {44, 20, 3, 12},
-    /*left*/   {47, 20, 4, 12},
-    /*back*/   {51, 20, 3, 12},
-  };
-}
-static BoxUv UV_RightSleeveSlim() {
-  return BoxUv{
-    /*top*/    {44, 32, 3, 4},
-    /*bottom*/ {47, 32, 3, 4},
-    /*right*/  {40, 36, 4, 12},
-    /*front*/  {44, 36, 3, 12},
-    /*left*/   {47, 36, 4, 12},
-    /*back*/   {51, 36, 3, 12},
-  };
-}
-static BoxUv UV_LeftArmSlim() {
-  return BoxUv{
-    /*top*/    {36, 48, 3, 4},
-    /*bottom*/ {39, 48, 3, 4},
-    /*right*/  {32, 52, 4, 12},
-    /*front*/  {36, 52, 3, 12},
-    /*left*/   {39, 52, 4, 12},
-    /*back*/   {43, 52, 3, 12},
-  };
-}
-static BoxUv UV_LeftSleeveSlim() {
-  return BoxUv{
-    /*top*/    {52, 48, 3, 4},
-    /*bottom*/ {55, 48, 3, 4},
-    /*right*/  {48, 52, 4, 12},
-    /*front*/  {52, 52, 3, 12},
-    /*left*/   {55, 52, 4, 12},
-    /*back*/   {59, 52, 3, 12},
-  };
-}
-
-// ------------------------------
-// Geometry
-// ------------------------------
-struct Vertex {
-  XMFLOAT3 pos;
-  XMFLOAT3 nrm;
-  XMFLOAT2 uv;
-};
-
-static XMFLOAT2 UVFromPx(int px, int py, uint32_t texW, uint32_t texH) {
-  return XMFLOAT2((float)px / (float)texW, (float)py / (float)texH);
-}
-
-
-
-
-// Forward declaration with defaults (definition below has NO defaults)
-static void AddFace(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2, const XMFLOAT3& p3,
-  const XMFLOAT3& n,
-  const UvRectPx& r,
-  uint32_t texW, uint32_t texH,
-  bool flipU = false,
-  bool flipV = false
-);
-
-// Definition (NO DEFAULTS HERE)
-static void AddFace(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2, const XMFLOAT3& p3,
-  const XMFLOAT3& n,
-  const UvRectPx& r,
-  uint32_t texW, uint32_t texH,
-  bool flipU,
-  bool flipV
-) {
-  XMFLOAT2 uv0 = UVFromPx(r.x,       r.y,       texW, texH);
-  XMFLOAT2 uv1 = UVFromPx(r.x + r.w, r.y,       texW, texH);
-  XMFLOAT2 uv2 = UVFromPx(r.x + r.w, r.y + r.h, texW, texH);
-  XMFLOAT2 uv3 = UVFromPx(r.x,       r.y + r.h, texW, texH);
-
-  if (flipU) { std::swap(uv0, uv1); std::swap(uv3, uv2); }
-  if (flipV) { std::swap(uv0, uv3); std::swap(uv1, uv2); }
-
-  uint32_t base = (uint32_t)v.size();
-  v.push_back(Vertex{ p0, n, uv0 });
-  v.push_back(Vertex{ p1, n, uv1 });
-  v.push_back(Vertex{ p2, n, uv2 });
-  v.push_back(Vertex{ p3, n, uv3 });
-
-  // keep your working winding
-  i.push_back(base + 0);
-  i.push_back(base + 1);
-  i.push_back(base + 2);
-  i.push_back(base + 0);
-  i.push_back(base + 2);
-  i.push_back(base + 3);
-}
-
-// Head box with 180° UV rotation on: bottom, left, right (front/back remain normal)
-// (keeping your existing behavior that you said looks good)
-static void AddHeadBox_FlippedFaces(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  XMFLOAT3 center,
-  XMFLOAT3 size,
-  const BoxUv& uv,
-  uint32_t texW, uint32_t texH
-) {
-  const float hx = size.x * 0.5f;
-  const float hy = size.y * 0.5f;
-  const float hz = size.z * 0.5f;
-
-  const float cx = center.x, cy = center.y, cz = center.z;
-
-  XMFLOAT3 LBF{cx - hx, cy - hy, cz - hz};
-  XMFLOAT3 RBF{cx + hx, cy - hy, cz - hz};
-  XMFLOAT3 RTF{cx + hx, cy + hy, cz - hz};
-  XMFLOAT3 LTF{cx - hx, cy + hy, cz - hz};
-
-  XMFLOAT3 LBB{cx - hx, cy - hy, cz + hz};
-  XMFLOAT3 RBB{cx + hx, cy - hy, cz + hz};
-  XMFLOAT3 RTB{cx + hx, cy + hy, cz + hz};
-  XMFLOAT3 LTB{cx - hx, cy + hy, cz + hz};
-
-  // Top (+Y)
-  AddFace(v, i, LTF, RTF, RTB, LTB, XMFLOAT3(0, 1, 0),  uv.top,    texW, texH, false, false);
-
-  // Bottom (-Y) flipped 180°
-  AddFace(v, i, LBB, RBB, RBF, LBF, XMFLOAT3(0,-1, 0),  uv.bottom, texW, texH, true, true);
-
-  // Front (+Z) normal
-  AddFace(v, i, LTB, RTB, RBB, LBB, XMFLOAT3(0, 0, 1),  uv.front,  texW, texH, false, false);
-
-  // Back (-Z) normal
-  AddFace(v, i, RTF, LTF, LBF, RBF, XMFLOAT3(0, 0,-1),  uv.back,   texW, texH, false, false);
-
-  // Right (+X) flipped 180°
-  AddFace(v, i, RTB, RTF, RBF, RBB, XMFLOAT3(1, 0, 0),  uv.right,  texW, texH, true, true);
-
-  // Left (-X) flipped 180°
-  AddFace(v, i, LTF, LTB, LBB, LBF, XMFLOAT3(-1,0, 0),  uv.left,   texW, texH, true, true);
-}
-
-
-// Arm box: swap the side UVs (inner <-> outer)
-// This swaps which texture rect is used on the +X and -X faces.
-static void AddArmBox_SwapSides(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  XMFLOAT3 center,
-  XMFLOAT3 size,
-  const BoxUv& uv,
-  uint32_t texW, uint32_t texH
-) {
-  const float hx = size.x * 0.5f;
-  const float hy = size.y * 0.5f;
-  const float hz = size.z * 0.5f;
-
-  const float cx = center.x, cy = center.y, cz = center.z;
-
-  XMFLOAT3 LBF{cx - hx, cy - hy, cz - hz};
-  XMFLOAT3 RBF{cx + hx, cy - hy, cz - hz};
-  XMFLOAT3 RTF{cx + hx, cy + hy, cz - hz};
-  XMFLOAT3 LTF{cx - hx, cy + hy, cz - hz};
-
-  XMFLOAT3 LBB{cx - hx, cy - hy, cz + hz};
-  XMFLOAT3 RBB{cx + hx, cy - hy, cz + hz};
-  XMFLOAT3 RTB{cx + hx, cy + hy, cz + hz};
-  XMFLOAT3 LTB{cx - hx, cy + hy, cz + hz};
-
-  // Normal faces
-  AddFace(v, i, LTF, RTF, RTB, LTB, XMFLOAT3(0, 1, 0),  uv.top,    texW, texH);
-  AddFace(v, i, LBB, RBB, RBF, LBF, XMFLOAT3(0,-1, 0),  uv.bottom, texW, texH);
-  AddFace(v, i, LTB, RTB, RBB, LBB, XMFLOAT3(0, 0, 1),  uv.front,  texW, texH);
-  AddFace(v, i, RTF, LTF, LBF, RBF, XMFLOAT3(0, 0,-1),  uv.back,   texW, texH);
-
-  // Swapped sides:
-  // +X face normally uses uv.right, -X uses uv.left
-  // We swap them: +X uses uv.left, -X uses uv.right
-  AddFace(v, i, RTB, RTF, RBF, RBB, XMFLOAT3(1, 0, 0),  uv.left,   texW, texH);  // +X now uses LEFT rect
-  AddFace(v, i, LTF, LTB, LBB, LBF, XMFLOAT3(-1,0, 0),  uv.right,  texW, texH);  // -X now uses RIGHT rect
-}
-
-
-
-static void AddLegBox(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  XMFLOAT3 center,
-  XMFLOAT3 size,
-  const BoxUv& uv,
-  uint32_t texW, uint32_t texH
-) {
-  const float hx = size.x * 0.5f;
-  const float hy = size.y * 0.5f;
-  const float hz = size.z * 0.5f;
-
-  const float cx = center.x, cy = center.y, cz = center.z;
-
-  XMFLOAT3 LBF{cx - hx, cy - hy, cz - hz};
-  XMFLOAT3 RBF{cx + hx, cy - hy, cz - hz};
-  XMFLOAT3 RTF{cx + hx, cy + hy, cz - hz};
-  XMFLOAT3 LTF{cx - hx, cy + hy, cz - hz};
-
-  XMFLOAT3 LBB{cx - hx, cy - hy, cz + hz};
-  XMFLOAT3 RBB{cx + hx, cy - hy, cz + hz};
-  XMFLOAT3 RTB{cx + hx, cy + hy, cz + hz};
-  XMFLOAT3 LTB{cx - hx, cy + hy, cz + hz};
-
-  // Top / Bottom / Front / Back unchanged
-  AddFace(v, i, LTF, RTF, RTB, LTB, XMFLOAT3(0, 1, 0), uv.top,    texW, texH);
-  AddFace(v, i, LBB, RBB, RBF, LBF, XMFLOAT3(0,-1, 0), uv.bottom, texW, texH);
-  AddFace(v, i, LTB, RTB, RBB, LBB, XMFLOAT3(0, 0, 1), uv.front,  texW, texH);
-  AddFace(v, i, RTF, LTF, LBF, RBF, XMFLOAT3(0, 0,-1), uv.back,   texW, texH);
-
-  // ✅ Swap these:
-  // +X face is player's LEFT side -> use uv.left
-  AddFace(v, i, RTB, RTF, RBF, RBB, XMFLOAT3( 1, 0, 0), uv.left,  texW, texH);
-
-  // -X face is player's RIGHT side -> use uv.right
-  AddFace(v, i, LTF, LTB, LBB, LBF, XMFLOAT3(-1, 0, 0), uv.right, texW, texH);
-}
-
-// ✅ NEW: Arm box that flips ONLY the *outer* arm side face 180°
-// - For the player's RIGHT arm (centered at negative X in our model), the outer face is -X => uv.left
-// - For the player's LEFT arm  (centered at positive X), the outer face is +X => uv.right
-static void AddArmBox_FlipOuterSide180(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  XMFLOAT3 center,
-  XMFLOAT3 size,
-  const BoxUv& uv,
-  uint32_t texW, uint32_t texH,
-  bool isPlayerRightArm
-) {
-  const float hx = size.x * 0.5f;
-  const float hy = size.y * 0.5f;
-  const float hz = size.z * 0.5f;
-
-  const float cx = center.x, cy = center.y, cz = center.z;
-
-  XMFLOAT3 LBF{cx - hx, cy - hy, cz - hz};
-  XMFLOAT3 RBF{cx + hx, cy - hy, cz - hz};
-  XMFLOAT3 RTF{cx + hx, cy + hy, cz - hz};
-  XMFLOAT3 LTF{cx - hx, cy + hy, cz - hz};
-
-  XMFLOAT3 LBB{cx - hx, cy - hy, cz + hz};
-  XMFLOAT3 RBB{cx + hx, cy - hy, cz + hz};
-  XMFLOAT3 RTB{cx + hx, cy + hy, cz + hz};
-  XMFLOAT3 LTB{cx - hx, cy + hy, cz + hz};
-
-  // Top / Bottom / Front / Back: unchanged
-  AddFace(v, i, LTF, RTF, RTB, LTB, XMFLOAT3(0, 1, 0), uv.top,    texW, texH);
-  AddFace(v, i, LBB, RBB, RBF, LBF, XMFLOAT3(0,-1, 0), uv.bottom, texW, texH);
-  AddFace(v, i, LTB, RTB, RBB, LBB, XMFLOAT3(0, 0, 1), uv.front,  texW, texH);
-  AddFace(v, i, RTF, LTF, LBF, RBF, XMFLOAT3(0, 0,-1), uv.back,   texW, texH);
-
-// Sides: flip ONLY the outer side horizontally (flipU=true, flipV=false)
-if (isPlayerRightArm) {
-  // right arm is at negative X -> outer face is -X (uv.left)
-  AddFace(v, i, RTB, RTF, RBF, RBB, XMFLOAT3( 1, 0, 0), uv.right, texW, texH, false, false); // inner (+X)
-  AddFace(v, i, LTF, LTB, LBB, LBF, XMFLOAT3(-1, 0, 0), uv.left,  texW, texH, true,  false); // outer (-X) mirror
-} else {
-  // left arm is at positive X -> outer face is +X (uv.right)
-  AddFace(v, i, RTB, RTF, RBF, RBB, XMFLOAT3( 1, 0, 0), uv.right, texW, texH, true,  false); // outer (+X) mirror
-  AddFace(v, i, LTF, LTB, LBB, LBF, XMFLOAT3(-1, 0, 0), uv.left,  texW, texH, false, false); // inner (-X)
-}
-
-
-
-}
-
-static void AddBox(
-  std::vector<Vertex>& v,
-  std::vector<uint32_t>& i,
-  XMFLOAT3 center,
-  XMFLOAT3 size,
-  const BoxUv& uv,
-  uint32_t texW, uint32_t texH
-) {
-  const float hx = size.x * 0.5f;
-  const float hy = size.y * 0.5f;
-  const float hz = size.z * 0.5f;
-
-  const float cx = center.x, cy = center.y, cz = center.z;
-
-  XMFLOAT3 LBF{cx - hx, cy - hy, cz - hz};
-  XMFLOAT3 RBF{cx + hx, cy - hy, cz - hz};
-  XMFLOAT3 RTF{cx + hx, cy + hy, cz - hz};
-  XMFLOAT3 LTF{cx - hx, cy + hy, cz - hz};
-
-  XMFLOAT3 LBB{cx - hx, cy - hy, cz + hz};
-  XMFLOAT3 RBB{cx + hx, cy - hy, cz + hz};
-  XMFLOAT3 RTB{cx + hx, cy + hy, cz + hz};
-  XMFLOAT3 LTB{cx - hx, cy + hy, cz + hz};
-
-  AddFace(v, i, LTF, RTF, RTB, LTB, XMFLOAT3(0, 1, 0), uv.top,    texW, texH);
-  AddFace(v, i, LBB, RBB, RBF, LBF, XMFLOAT3(0,-1, 0), uv.bottom, texW, texH);
-  AddFace(v, i, LTB, RTB, RBB, LBB, XMFLOAT3(0, 0, 1), uv.front,  texW, texH);
-  AddFace(v, i, RTF, LTF, LBF, RBF, XMFLOAT3(0, 0,-1), uv.back,   texW, texH);
-  AddFace(v, i, RTB, RTF, RBF, RBB, XMFLOAT3(1, 0, 0), uv.right,  texW, texH);
-  AddFace(v, i, LTF, LTB, LBB, LBF, XMFLOAT3(-1,0, 0), uv.left,   texW, texH);
-}
-
-struct BuiltMesh {
-  std::vector<Vertex> vertices;
-  std::vector<uint32_t> indicesBase;
-  std::vector<uint32_t> indicesOverlay;
-};
-
-static BuiltMesh BuildPlayerMesh(const SkinInfo& skin, bool slimArms) {
-  BuiltMesh m;
-  if (!skin.width || !skin.height) return m;
-
-  const uint32_t texW = skin.width;
-  const uint32_t texH = skin.height;
-  const uint32_t s = skin.scale;
-
-  auto S = [&](const BoxUv& b) { return ScaleBoxUv(b, s); };
-  const bool has64 = (!skin.legacy64x32 && skin.height >= 64 * s);
-
-  // Pixel units
-  const XMFLOAT3 headSize{8, 8, 8};
-  const XMFLOAT3 bodySize{8, 12, 4};
-  const XMFLOAT3 legSize{4, 12, 4};
+static ID3D11ShaderResourceView* SkinSrv(const SkinInfo& s) { return s.gpu ? s.gpu->srv.Get() : nullptr; }
 
-  const float armW = (has64 && slimArms) ? 3.0f : 4.0f;
-  const XMFLOAT3 armSize{armW, 12, 4};
-
-  const XMFLOAT3 headC{0, 12 + 12 + 4, 0}; // 28
-  const XMFLOAT3 bodyC{0, 12 + 6, 0};      // 18
-
-  const float armX = 4.0f + armW * 0.5f;   // body half-width + arm half-width
-  const XMFLOAT3 rArmC{-armX, 12 + 6, 0};
-  const XMFLOAT3 lArmC{ armX, 12 + 6, 0};
-
-  const XMFLOAT3 rLegC{-2, 6, 0};
-  const XMFLOAT3 lLegC{ 2, 6, 0};
-
-// Base geometry
-AddHeadBox_FlippedFaces(m.vertices, m.indicesBase, headC, headSize, S(UV_Head()), texW, texH);
-AddBox(m.vertices, m.indicesBase, bodyC, bodySize, S(UV_Torso()), texW, texH);
-
-// ✅ Arms: swap INNER/OUTER side faces (uv.left <-> uv.right)
-if (armW == 3.0f) AddArmBox_SwapSides(m.vertices, m.indicesBase, rArmC, armSize, S(UV_RightArmSlim()), texW, texH);
-else              AddArmBox_SwapSides(m.vertices, m.indicesBase, rArmC, armSize, S(UV_RightArm()),     texW, texH);
-
-AddLegBox(m.vertices, m.indicesBase, rLegC, legSize, S(UV_RightLeg()), texW, texH);
-
-if (has64) {
-  if (armW == 3.0f) AddArmBox_SwapSides(m.vertices, m.indicesBase, lArmC, armSize, S(UV_LeftArmSlim()), texW, texH);
-  else              AddArmBox_SwapSides(m.vertices, m.indicesBase, lArmC, armSize, S(UV_LeftArm()),     texW, texH);
-
-  AddLegBox(m.vertices, m.indicesBase, lLegC, legSize, S(UV_LeftLeg()), texW, texH);
-} else {
-  // legacy 64x32: left limbs mirror right (approx)
-  AddArmBox_SwapSides(m.vertices, m.indicesBase, lArmC, armSize, S(UV_RightArm()), texW, texH);
-  AddLegBox(m.vertices, m.indicesBase, lLegC, legSize, S(UV_RightLeg()), texW, texH);
-}
-
-// Overlay: only add if any non-transparent pixels exist
-auto Inflate = [](XMFLOAT3 size, float delta) { return XMFLOAT3(size.x + delta, size.y + delta, size.z + delta); };
-
-
-  // Hat
-  {
-    BoxUv hat = S(UV_Hat());
-    bool present =
-      AnyNonTransparent(skin, hat.top) || AnyNonTransparent(skin, hat.bottom) ||
-      AnyNonTransparent(skin, hat.left) || AnyNonTransparent(skin, hat.right) ||
-      AnyNonTransparent(skin, hat.front) || AnyNonTransparent(skin, hat.back);
-
-    if (present) AddHeadBox_FlippedFaces(m.vertices, m.indicesOverlay, headC, Inflate(headSize, 0.5f), hat, texW, texH);
-  }
-
-  // Jacket
-  {
-    BoxUv jacket = S(UV_Jacket());
-    bool present =
-      AnyNonTransparent(skin, jacket.top) || AnyNonTransparent(skin, jacket.bottom) ||
-      AnyNonTransparent(skin, jacket.left) || AnyNonTransparent(skin, jacket.right) ||
-      AnyNonTransparent(skin, jacket.front) || AnyNonTransparent(skin, jacket.back);
-    if (present) AddBox(m.vertices, m.indicesOverlay, bodyC, Inflate(bodySize, 0.5f), jacket, texW, texH);
-  }
-
-  // Right sleeve
-  {
-    BoxUv rs = (armW == 3.0f) ? S(UV_RightSleeveSlim()) : S(UV_RightSleeve());
-    bool present =
-      AnyNonTransparent(skin, rs.top) || AnyNonTransparent(skin, rs.bottom) ||
-      AnyNonTransparent(skin, rs.left) || AnyNonTransparent(skin, rs.right) ||
-      AnyNonTransparent(skin, rs.front) || AnyNonTransparent(skin, rs.back);
-    if (present) AddArmBox_FlipOuterSide180(m.vertices, m.indicesOverlay, rArmC, Inflate(armSize, 0.5f), rs, texW, texH, true);
-  }
-
-  // Right pants
-  {
-    BoxUv rp = S(UV_RightLegPants());
-    bool present =
-      AnyNonTransparent(skin, rp.top) || AnyNonTransparent(skin, rp.bottom) ||
-      AnyNonTransparent(skin, rp.left) || AnyNonTransparent(skin, rp.right) ||
-      AnyNonTransparent(skin, rp.front) || AnyNonTransparent(skin, rp.back);
-    if (present) AddBox(m.vertices, m.indicesOverlay, rLegC, Inflate(legSize, 0.5f), rp, texW, texH);
-  }
-
-  if (has64) {
-    // Left sleeve
-    {
-      BoxUv ls = (armW == 3.0f) ? S(UV_LeftSleeveSlim()) : S(UV_LeftSleeve());
-      bool present =
-        AnyNonTransparent(skin, ls.top) || AnyNonTransparent(skin, ls.bottom) ||
-        AnyNonTransparent(skin, ls.left) || AnyNonTransparent(skin, ls.right) ||
-        AnyNonTransparent(skin, ls.front) || AnyNonTransparent(skin, ls.back);
-      if (present) AddArmBox_FlipOuterSide180(m.vertices, m.indicesOverlay, lArmC, Inflate(armSize, 0.5f), ls, texW, texH, false);
-    }
-
-    // Left pants
-    {
-      BoxUv lp = S(UV_LeftLegPants());
-      bool present =
-        AnyNonTransparent(skin, lp.top) || AnyNonTransparent(skin, lp.bottom) ||
-        AnyNonTransparent(skin, lp.left) || AnyNonTransparent(skin, lp.right) ||
-        AnyNonTransparent(skin, lp.front) || AnyNonTransparent(skin, lp.back);
-      if (present) AddBox(m.vertices, m.indicesOverlay, lLegC, Inflate(legSize, 0.5f), lp, texW, texH);
-    }
-  }
-
-  return m;
-}
-
-static void ForceRectOpaque(SkinInfo& s, int x, int y, int w, int h) {
-  const int x0 = std::max(0, x);
-  const int y0 = std::max(0, y);
-  const int x1 = std::min((int)s.width, x + w);
-  const int y1 = std::min((int)s.height, y + h);
-  if (x1 <= x0 || y1 <= y0) return;
-
-  for (int yy = y0; yy < y1; ++yy) {
-    for (int xx = x0; xx < x1; ++xx) {
-      const size_t idx = (size_t)(yy * s.width + xx) * 4;
-      s.rgba[idx + 3] = 255;
-    }
-  }
-}
-
-static void SanitizeMinecraftBaseAlpha(SkinInfo& s) {
-  const int k = (int)s.scale;
-
-  ForceRectOpaque(s, 0  * k, 0  * k, 32 * k, 16 * k); // head base
-  ForceRectOpaque(s, 16 * k, 16 * k, 24 * k, 16 * k); // torso base
-  ForceRectOpaque(s, 40 * k, 16 * k, 16 * k, 16 * k); // right arm base
-  ForceRectOpaque(s, 0  * k, 16 * k, 16 * k, 16 * k); // right leg base
-
-  if (!s.legacy64x32 && s.height >= (uint32_t)(64 * k)) {
-    ForceRectOpaque(s, 32 * k, 48 * k, 16 * k, 16 * k); // left arm base
-    ForceRectOpaque(s, 16 * k, 48 * k, 16 * k, 16 * k); // left leg base
-  }
-}
-
-// ------------------------------
-// WIC PNG -> RGBA8 + D3D SRV
-// ------------------------------
-static SkinInfo LoadSkinPngWIC(ID3D11Device* dev, const std::wstring& path) {
-  SkinInfo out;
-  out.path = path;
-
-  ComPtr<IWICImagingFactory> wic;
-  ThrowIfFailed(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
-                                 IID_PPV_ARGS(&wic)), "CoCreateInstance(WIC)");
-
-  ComPtr<IWICBitmapDecoder> dec;
-  ThrowIfFailed(wic->CreateDecoderFromFilename(path.c_str(), nullptr, GENERIC_READ,
-                                               WICDecodeMetadataCacheOnLoad, &dec),
-                "CreateDecoderFromFilename");
-
-  ComPtr<IWICBitmapFrameDecode> frame;
-  ThrowIfFailed(dec->GetFrame(0, &frame), "GetFrame(0)");
-
-  UINT w = 0, h = 0;
-  ThrowIfFailed(frame->GetSize(&w, &h), "GetSize");
-  out.width = w;
-  out.height = h;
-
-  out.legacy64x32 = (w == 64 && h == 32);
-  if (w == h && (w % 64) == 0) out.scale = w / 64;
-  else out.scale = 1;
-
-  ComPtr<IWICFormatConverter> conv;
-  ThrowIfFailed(wic->CreateFormatConverter(&conv), "CreateFormatConverter");
-  ThrowIfFailed(conv->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA,
-                                 WICBitmapDitherTypeNone, nullptr, 0.0,
-                                 WICBitmapPaletteTypeCustom),
-                "FormatConverter.Initialize(32bppRGBA)");
-
-  out.rgba.resize((size_t)w * (size_t)h * 4);
-  ThrowIfFailed(conv->CopyPixels(nullptr, (UINT)(w * 4), (UINT)out.rgba.size(), out.rgba.data()),
-                "CopyPixels");
-
-  // Make Minecraft base layer opaque (prevents see-through skins)
-  SanitizeMinecraftBaseAlpha(out);
-
-  // Alpha detection
-  out.hasAlpha = std::any_of(out.rgba.begin() + 3, out.rgba.end(),
-                             [](uint8_t a) { return a != 255; });
+static void CreateSkinTexture(ID3D11Device* dev, SkinInfo& out) {
+  auto gpu = std::make_shared<SkinGpuTexture>();
+  const UINT w = out.width;
+  const UINT h = out.height;
 
   D3D11_TEXTURE2D_DESC td{};
   td.Width = w;
@@ -794,17 +155,32 @@ static SkinInfo LoadSkinPngWIC(ID3D11Device* dev, const std::wstring& path) {
   sd.pSysMem = out.rgba.data();
   sd.SysMemPitch = w * 4;
 
-  ComPtr<ID3D11Texture2D> tex;
-  ThrowIfFailed(dev->CreateTexture2D(&td, &sd, &tex), "CreateTexture2D");
+  ThrowIfFailed(dev->CreateTexture2D(&td, &sd, &gpu->tex), "CreateTexture2D");
 
   D3D11_SHADER_RESOURCE_VIEW_DESC srvd{};
   srvd.Format = td.Format;
   srvd.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
   srvd.Texture2D.MipLevels = 1;
 
-  ThrowIfFailed(dev->CreateShaderResourceView(tex.Get(), &srvd, &out.srv), "CreateShaderResourceView");
+  ThrowIfFailed(dev->CreateShaderResourceView(gpu->tex.Get(), &srvd, &gpu->srv), "CreateShaderResourceView");
+  out.gpu = std::move(gpu);
+}
 
-  return out;
+// First skin of a file, directory or archive that decodes, with its texture.
+static SkinInfo LoadSkinPng(ID3D11Device* dev, const std::wstring& path) {
+  std::optional<SkinInfo> skin;
+  std::string error = "no .png files found";
+  IngestSkins(path, [&](IngestedSkin&& r) {
+    if (!r.error.empty()) {
+      error = r.error;
+      return true;
+    }
+    skin = std::move(r.skin);
+    return false;
+  });
+  if (!skin) throw std::runtime_error(error);
+  CreateSkinTexture(dev, *skin);
+  return std::move(*skin);
 }
 
 // ------------------------------
@@ -816,28 +192,40 @@ cbuffer CB0 : register(b0) {
 };
 
 struct VSIn {
-  float3 pos : POSITION;
-  float3 nrm : NORMAL;
-  float2 uv  : TEXCOORD0;
+  float3 pos   : POSITION;
+  float3 nrm   : NORMAL;
+  float2 uv    : TEXCOORD0;
+  float  shade : COLOR0;
 };
 
 struct VSOut {
-  float4 pos : SV_POSITION;
-  float2 uv  : TEXCOORD0;
+  float4 pos   : SV_POSITION;
+  float2 uv    : TEXCOORD0;
+  float  shade : COLOR0;
 };
 
 VSOut VSMain(VSIn i) {
   VSOut o;
   o.pos = mul(float4(i.pos, 1.0), uMVP);
   o.uv = i.uv;
+  o.shade = i.shade;
   return o;
 }
 
 Texture2D uTex : register(t0);
 SamplerState uSamp : register(s0);
 
+// Lighting is baked into the vertices (BakedShade): one multiply per pixel
 float4 PSMain(VSOut i) : SV_Target {
-  return uTex.Sample(uSamp, i.uv);
+  float4 c = uTex.Sample(uSamp, i.uv);
+  return float4(c.rgb * i.shade, c.a);
+}
+
+// Binary-alpha overlay: discard instead of blending, keeps early-Z and order independence
+float4 PSCutout(VSOut i) : SV_Target {
+  float4 c = uTex.Sample(uSamp, i.uv);
+  clip(c.a - 0.5);
+  return float4(c.rgb * i.shade, 1.0);
 }
 )";
 
@@ -930,117 +318,1163 @@ static void InitD3D(D3DState& d) {
   ThrowIfFailed(d.device->CreatePixelShader(psb->GetBufferPointer(), psb->GetBufferSize(), nullptr, &d.ps),
                 "CreatePixelShader");
 
-  D3D11_INPUT_ELEMENT_DESC ild[] = {
-    {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,pos), D3D11_INPUT_PER_VERTEX_DATA, 0},
-    {"NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,nrm), D3D11_INPUT_PER_VERTEX_DATA, 0},
-    {"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, offsetof(Vertex,uv),  D3D11_INPUT_PER_VERTEX_DATA, 0},
-  };
-  ThrowIfFailed(d.device->CreateInputLayout(ild, (UINT)std::size(ild),
-                                           vsb->GetBufferPointer(), vsb->GetBufferSize(),
-                                           &d.il),
-                "CreateInputLayout");
+  ComPtr<ID3DBlob> pscb;
+  hr = D3DCompile(kShaderSrc, strlen(kShaderSrc), "skin.hlsl",
+                  nullptr, nullptr, "PSCutout", "ps_5_0",
+                  0, 0, &pscb, &err);
+  if (FAILED(hr)) {
+    std::string e = err ? std::string((const char*)err->GetBufferPointer(), err->GetBufferSize()) : "PS (cutout) compile failed";
+    throw std::runtime_error(e);
+  }
+  ThrowIfFailed(d.device->CreatePixelShader(pscb->GetBufferPointer(), pscb->GetBufferSize(), nullptr, &d.psCutout),
+                "CreatePixelShader(cutout)");
+
+  D3D11_INPUT_ELEMENT_DESC ild[] = {
+    {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,pos), D3D11_INPUT_PER_VERTEX_DATA, 0},
+    {"NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex,nrm), D3D11_INPUT_PER_VERTEX_DATA, 0},
+    {"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, offsetof(Vertex,uv),  D3D11_INPUT_PER_VERTEX_DATA, 0},
+    {"COLOR",    0, DXGI_FORMAT_R32_FLOAT,       0, offsetof(Vertex,shade), D3D11_INPUT_PER_VERTEX_DATA, 0},
+  };
+  ThrowIfFailed(d.device->CreateInputLayout(ild, (UINT)std::size(ild),
+                                           vsb->GetBufferPointer(), vsb->GetBufferSize(),
+                                           &d.il),
+                "CreateInputLayout");
+
+  // Constant buffer
+  D3D11_BUFFER_DESC cbd{};
+  cbd.ByteWidth = sizeof(CB0);
+  cbd.Usage = D3D11_USAGE_DYNAMIC;
+  cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+  cbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  ThrowIfFailed(d.device->CreateBuffer(&cbd, nullptr, &d.cb), "CreateCB");
+
+  // Sampler
+  D3D11_SAMPLER_DESC sd{};
+  sd.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+  sd.AddressU = sd.AddressV = sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+  sd.MaxLOD = D3D11_FLOAT32_MAX;
+  ThrowIfFailed(d.device->CreateSamplerState(&sd, &d.samp), "CreateSampler");
+
+  // Rasterizer
+  D3D11_RASTERIZER_DESC rsd{};
+  rsd.FillMode = D3D11_FILL_SOLID;
+  rsd.CullMode = D3D11_CULL_BACK;
+  rsd.FrontCounterClockwise = TRUE; // your mesh winding is CCW
+  rsd.DepthClipEnable = TRUE;
+  ThrowIfFailed(d.device->CreateRasterizerState(&rsd, &d.rs), "CreateRasterizer");
+
+  rsd.ScissorEnable = TRUE; // grid cells
+  ThrowIfFailed(d.device->CreateRasterizerState(&rsd, &d.rsScissor), "CreateRasterizer(scissor)");
+
+  // Depth
+  D3D11_DEPTH_STENCIL_DESC dsd{};
+  dsd.DepthEnable = TRUE;
+  dsd.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+  dsd.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+  ThrowIfFailed(d.device->CreateDepthStencilState(&dsd, &d.dsDefault), "CreateDepthStencilState");
+
+  dsd.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+  ThrowIfFailed(d.device->CreateDepthStencilState(&dsd, &d.dsNoWrite), "CreateDepthStencilState(no write)");
+
+  // Alpha blend
+  D3D11_BLEND_DESC bd{};
+  bd.RenderTarget[0].BlendEnable = TRUE;
+  bd.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+  bd.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+  bd.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+  bd.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+  bd.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+  bd.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+  bd.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+  ThrowIfFailed(d.device->CreateBlendState(&bd, &d.blendAlpha), "CreateBlendState");
+}
+
+// Dynamic buffers live as long as the device. They are recreated only when a
+// mesh outgrows them (GrowMeshBufferCapacity); every other upload is
+// Map(WRITE_DISCARD) + memcpy.
+static void EnsureDynamicBuffer(ID3D11Device* dev, ComPtr<ID3D11Buffer>& buf, UINT& capacity,
+                                UINT needed, UINT elemSize, UINT bindFlags, const char* what) {
+  if (!GrowMeshBufferCapacity(capacity, needed, buf != nullptr)) return;
+  D3D11_BUFFER_DESC bd{};
+  bd.ByteWidth = capacity * elemSize;
+  bd.Usage = D3D11_USAGE_DYNAMIC;
+  bd.BindFlags = bindFlags;
+  bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  buf.Reset();
+  ThrowIfFailed(dev->CreateBuffer(&bd, nullptr, &buf), what);
+}
+
+static void EnsureMeshBuffers(D3DState& d, const MeshBufferSizes& n) {
+  EnsureDynamicBuffer(d.device.Get(), d.vb, d.vbCapacity, n.vertices, sizeof(Vertex), D3D11_BIND_VERTEX_BUFFER, "CreateVB");
+  EnsureDynamicBuffer(d.device.Get(), d.ib, d.ibCapacity, n.indices, sizeof(uint32_t), D3D11_BIND_INDEX_BUFFER, "CreateIB");
+  EnsureDynamicBuffer(d.device.Get(), d.ibTranslucent, d.ibTranslucentCapacity, n.translucentIndices, sizeof(uint32_t),
+                      D3D11_BIND_INDEX_BUFFER, "CreateIB(translucent)");
+}
+
+// Sizes the mesh buffers for `model` with every part present, so switching
+// skins or arm variants never creates resources.
+static void ReserveMeshBuffers(D3DState& d, const ModelDesc& model) {
+  EnsureMeshBuffers(d, MeshBufferReserve(model));
+  d.translucentIdx.reserve(d.ibTranslucentCapacity);
+  d.translucentCentroids.reserve(d.ibTranslucentCapacity / 6);
+}
+
+static void UploadMesh(D3DState& d, const BuiltMesh& m) {
+  const UINT nv = (UINT)m.vertices.size();
+  const UINT nBase = (UINT)m.indicesBase.size();
+  const UINT nOverlay = (UINT)m.indicesOverlay.size();
+
+  EnsureMeshBuffers(d, MeshBufferNeeds(m));
+
+  d.ibCountBase = nBase;
+  d.ibCountOverlay = nOverlay;
+  d.ibOffsetOverlay = nBase;
+
+  D3D11_MAPPED_SUBRESOURCE map{};
+  if (nv > 0) {
+    ThrowIfFailed(d.ctx->Map(d.vb.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &map), "Map(VB)");
+    memcpy(map.pData, m.vertices.data(), nv * sizeof(Vertex));
+    d.ctx->Unmap(d.vb.Get(), 0);
+  }
+  if (nBase + nOverlay > 0) {
+    // Base and overlay ranges back to back, written straight into the mapping
+    ThrowIfFailed(d.ctx->Map(d.ib.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &map), "Map(IB)");
+    uint32_t* dst = (uint32_t*)map.pData;
+    if (nBase) memcpy(dst, m.indicesBase.data(), nBase * sizeof(uint32_t));
+    if (nOverlay) memcpy(dst + nBase, m.indicesOverlay.data(), nOverlay * sizeof(uint32_t));
+    d.ctx->Unmap(d.ib.Get(), 0);
+  }
+
+  // Translucent faces are re-sorted and written every frame by Render()
+  d.translucentIdx = m.indicesTranslucent;
+  ComputeFaceCentroids(m, d.translucentIdx, d.translucentCentroids);
+}
+
+// Grid cells share one vertex/index buffer holding both arm variants with every
+// overlay part present (transparent texels blend away). UVs are normalized, so
+// the same mesh serves any skin scale.
+static void UploadGridMeshes(D3DState& d) {
+  SkinInfo ref;
+  ref.width = ref.height = 64;
+
+  std::vector<Vertex> verts;
+  std::vector<uint32_t> idx;
+  for (int variant = 0; variant < 2; ++variant) {
+    const ModelDesc& model = PlayerModel(variant == 1);
+    const BuiltMesh m = BuildModelMesh(ref, model, std::vector<uint8_t>(model.parts.size(), 1));
+
+    D3DState::GridMeshRange& r = d.gridMesh[variant];
+    r.vertexBase = (INT)verts.size();
+    r.baseStart = (UINT)idx.size();
+    r.baseCount = (UINT)m.indicesBase.size();
+    idx.insert(idx.end(), m.indicesBase.begin(), m.indicesBase.end());
+    r.overlayStart = (UINT)idx.size();
+    r.overlayCount = (UINT)m.indicesOverlay.size();
+    idx.insert(idx.end(), m.indicesOverlay.begin(), m.indicesOverlay.end());
+    verts.insert(verts.end(), m.vertices.begin(), m.vertices.end());
+    d.gridOverlayIdx[variant] = m.indicesOverlay;
+    ComputeFaceCentroids(m, m.indicesOverlay, d.gridOverlayCentroids[variant]);
+
+    const BuiltMesh lod1 = BuildLod1Mesh(ref, model);
+    r.lod1VertexBase = (INT)verts.size();
+    r.lod1Start = (UINT)idx.size();
+    r.lod1Count = (UINT)lod1.indicesBase.size();
+    idx.insert(idx.end(), lod1.indicesBase.begin(), lod1.indicesBase.end());
+    verts.insert(verts.end(), lod1.vertices.begin(), lod1.vertices.end());
+  }
+
+  D3D11_BUFFER_DESC vbd{};
+  vbd.ByteWidth = (UINT)(verts.size() * sizeof(Vertex));
+  vbd.Usage = D3D11_USAGE_IMMUTABLE;
+  vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+  D3D11_SUBRESOURCE_DATA vsd{};
+  vsd.pSysMem = verts.data();
+  ThrowIfFailed(d.device->CreateBuffer(&vbd, &vsd, &d.gridVb), "CreateVB(grid)");
+
+  D3D11_BUFFER_DESC ibd{};
+  ibd.ByteWidth = (UINT)(idx.size() * sizeof(uint32_t));
+  ibd.Usage = D3D11_USAGE_IMMUTABLE;
+  ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+  D3D11_SUBRESOURCE_DATA isd{};
+  isd.pSysMem = idx.data();
+  ThrowIfFailed(d.device->CreateBuffer(&ibd, &isd, &d.gridIb), "CreateIB(grid)");
+
+  const size_t sortedCount = std::max(d.gridOverlayIdx[0].size(), d.gridOverlayIdx[1].size());
+  D3D11_BUFFER_DESC sbd{};
+  sbd.ByteWidth = (UINT)(sortedCount * sizeof(uint32_t));
+  sbd.Usage = D3D11_USAGE_DYNAMIC;
+  sbd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+  sbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  ThrowIfFailed(d.device->CreateBuffer(&sbd, nullptr, &d.gridIbSorted), "CreateIB(grid sorted)");
+  d.translucentOrder.reserve(sortedCount / 6);
+  d.translucentSorted.reserve(sortedCount);
+}
+
+// ------------------------------
+// Impostors (crowd LOD2)
+// ------------------------------
+// Per skin, the player pre-rendered on the CPU from kImpostorViews yaw angles
+// (columns) for the classic and slim variants (rows), orthographic, pitch 0.
+// Baking runs on ImpostorBaker's worker threads; the atlas is uploaded by the
+// render thread once it is ready and stays with the SkinInfo.
+static constexpr int kImpostorViews = 8;
+static constexpr int kImpostorCellW = 40;
+static constexpr int kImpostorCellH = 64;
+static constexpr int kImpostorAtlasW = kImpostorViews * kImpostorCellW;
+static constexpr int kImpostorAtlasH = 2 * kImpostorCellH;
+
+struct ImpostorAtlas {
+  std::vector<uint8_t> rgba;           // kImpostorAtlasW x kImpostorAtlasH, written once by the baker
+  std::atomic<bool> ready{ false };
+  ComPtr<ID3D11Texture2D> tex;         // render thread only
+  ComPtr<ID3D11ShaderResourceView> srv;
+};
+
+// World-space quad the impostor is drawn on; the bake frames the same box.
+struct ImpostorFrame {
+  float centerY, width, height;
+};
+
+static ImpostorFrame ComputeImpostorFrame() {
+  const CrowdBounds b = ComputeCrowdBounds(kWorldScale);
+  ImpostorFrame f;
+  f.height = 2.0f * b.halfY * 1.04f;
+  f.width = f.height * (float)kImpostorCellW / (float)kImpostorCellH;
+  f.centerY = b.centerY;
+  return f;
+}
+
+// View for a camera at model-space yaw `rel`; view k was baked at yaw k*2pi/N.
+static int ImpostorViewIndex(float rel) {
+  const float step = XM_2PI / (float)kImpostorViews;
+  const int k = (int)std::lround(rel / step) % kImpostorViews;
+  return k < 0 ? k + kImpostorViews : k;
+}
+
+static std::vector<uint8_t> BakeImpostorAtlas(const SkinInfo& skin) {
+  std::vector<uint8_t> atlas((size_t)kImpostorAtlasW * kImpostorAtlasH * 4, 0);
+  const ImpostorFrame frame = ComputeImpostorFrame();
+
+  CpuRenderParams p;
+  p.width = kImpostorCellW;
+  p.height = kImpostorCellH;
+  p.samplesPerAxis = 3;
+  p.threads = 1;                       // parallelism comes from the baker's workers
+  p.orthoHeight = frame.height;
+  p.cam.target = XMFLOAT3(0.0f, frame.centerY, 0.0f);
+  p.cam.dist = 100.0f;
+  p.cam.pitch = 0.0f;
+  for (float& c : p.background) c = 0.0f;
+
+  for (int variant = 0; variant < 2; ++variant) {
+    const BuiltMesh mesh = BuildPlayerMesh(skin, variant == 1);
+    for (int view = 0; view < kImpostorViews; ++view) {
+      p.cam.yaw = (float)view * XM_2PI / (float)kImpostorViews;
+      RenderOfflineCPU(skin, mesh, p, [&](int y0, int rows, const uint8_t* rgba, size_t stride) {
+        for (int r = 0; r < rows; ++r) {
+          uint8_t* dst = &atlas[(((size_t)variant * kImpostorCellH + y0 + r) * kImpostorAtlasW + (size_t)view * kImpostorCellW) * 4];
+          memcpy(dst, rgba + (size_t)r * stride, (size_t)kImpostorCellW * 4);
+        }
+      });
+    }
+  }
+  return atlas;
+}
+
+class ImpostorBaker {
+public:
+  ImpostorBaker() {
+    const unsigned n = std::max(1u, std::thread::hardware_concurrency() / 2);
+    for (unsigned i = 0; i < n; ++i) workers_.emplace_back([this] { Run(); });
+  }
+
+  ~ImpostorBaker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      jobs_.clear();
+    }
+    cv_.notify_all();
+    for (std::thread& t : workers_) t.join();
+  }
+
+  ImpostorBaker(const ImpostorBaker&) = delete;
+  ImpostorBaker& operator=(const ImpostorBaker&) = delete;
+
+  struct Stats {
+    uint64_t requested = 0;
+    uint64_t shared = 0;     // served by the atlas of a skin with the same canonical form
+  };
+
+  // Copies the pixels it needs; the returned atlas becomes ready later. Skins
+  // with the same canonical form (CanonicalSkinHash) share one atlas while any
+  // of them holds it.
+  std::shared_ptr<ImpostorAtlas> Enqueue(const SkinInfo& skin) {
+    Job job;
+    job.skin.width = skin.width;
+    job.skin.height = skin.height;
+    job.skin.scale = skin.scale;
+    job.skin.rgba = skin.rgba;
+    job.skin.palette = skin.palette;
+    UnpalettizeSkin(job.skin); // the bake scans rgba for part presence
+    job.skin.overlayTranslucent = skin.overlayTranslucent;
+    const uint64_t key = CanonicalSkinHash(job.skin);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.requested;
+    std::weak_ptr<ImpostorAtlas>& slot = byHash_[key];
+    if (std::shared_ptr<ImpostorAtlas> atlas = slot.lock()) {
+      ++stats_.shared;
+      return atlas;
+    }
+    if (byHash_.size() >= pruneAt_) {
+      std::erase_if(byHash_, [&](const auto& kv) { return kv.first != key && kv.second.expired(); });
+      pruneAt_ = std::max<size_t>(64, byHash_.size() * 2);
+    }
+    job.atlas = std::make_shared<ImpostorAtlas>();
+    std::shared_ptr<ImpostorAtlas> atlas = job.atlas;
+    slot = atlas;
+    jobs_.push_back(std::move(job));
+    cv_.notify_one();
+    return atlas;
+  }
+
+  Stats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+private:
+  struct Job {
+    SkinInfo skin;
+    std::shared_ptr<ImpostorAtlas> atlas;
+  };
+
+  void Run() {
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return stop_ || !jobs_.empty(); });
+        if (stop_) return;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      if (job.atlas.use_count() == 1) continue; // skin already replaced
+      job.atlas->rgba = BakeImpostorAtlas(job.skin);
+      job.atlas->ready.store(true, std::memory_order_release);
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Job> jobs_;
+  std::unordered_map<uint64_t, std::weak_ptr<ImpostorAtlas>> byHash_;
+  size_t pruneAt_ = 64;
+  Stats stats_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+// Render thread: uploads a finished atlas once; nullptr until then.
+static ID3D11ShaderResourceView* ImpostorSrv(ID3D11Device* dev, ImpostorAtlas* atlas) {
+  if (!atlas || !atlas->ready.load(std::memory_order_acquire)) return nullptr;
+  if (!atlas->srv) {
+    D3D11_TEXTURE2D_DESC td{};
+    td.Width = kImpostorAtlasW;
+    td.Height = kImpostorAtlasH;
+    td.MipLevels = 1;
+    td.ArraySize = 1;
+    td.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    td.SampleDesc.Count = 1;
+    td.Usage = D3D11_USAGE_IMMUTABLE;
+    td.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    D3D11_SUBRESOURCE_DATA sd{};
+    sd.pSysMem = atlas->rgba.data();
+    sd.SysMemPitch = kImpostorAtlasW * 4;
+    ThrowIfFailed(dev->CreateTexture2D(&td, &sd, &atlas->tex), "CreateTexture2D(impostor)");
+    ThrowIfFailed(dev->CreateShaderResourceView(atlas->tex.Get(), nullptr, &atlas->srv), "CreateSRV(impostor)");
+  }
+  return atlas->srv.Get();
+}
+
+// ------------------------------
+// Skin gallery (virtualized)
+// ------------------------------
+// A dropped folder (or a .txt list of paths) is listed in the background and
+// shown as a scrolling gallery. Only the rows in view, plus up to one screen
+// above and below, ask for thumbnails; SkinGallery's workers decode and render
+// them on the CPU, and the render thread copies a few per frame into one
+// shared atlas texture. The atlas holds as many cells as the VRAM budget
+// allows and reuses the least recently shown one when full. Requests that
+// scroll out of range are dropped from the queue before a worker starts them.
+static constexpr int kThumbW = 50;                 // ImpostorFrame aspect
+static constexpr int kThumbH = 80;
+static constexpr int kThumbAtlasCols = 40;
+static constexpr int kThumbAtlasMaxRows = 16384 / kThumbH; // D3D11 texture height limit
+static constexpr int kThumbUploadsPerFrame = 16;
+static constexpr size_t kThumbCellBytes = (size_t)kThumbW * kThumbH * 4;
+
+// Player front three-quarter view, transparent background; throws when the
+// file is not a readable skin. Reads through IngestSkins, so the entry size
+// limit and the skin-size probe before decoding apply as for any other source.
+static std::vector<uint8_t> RenderSkinThumbnail(const std::filesystem::path& path) {
+  SkinInfo skin;
+  std::string error = "no skin in " + path.string();
+  IngestOptions opt;
+  opt.threads = 1;                     // a plain file decodes on this worker anyway
+  IngestSkins(path, [&](IngestedSkin&& r) {
+    error = std::move(r.error);
+    if (error.empty()) skin = std::move(r.skin);
+    return false;                      // the first entry is the thumbnail
+  }, opt);
+  if (!error.empty()) throw std::runtime_error(error);
+
+  const ImpostorFrame frame = ComputeImpostorFrame();
+  CpuRenderParams p;
+  p.width = kThumbW;
+  p.height = kThumbH;
+  p.samplesPerAxis = 2;
+  p.threads = 1;                       // parallelism comes from the gallery's workers
+  p.orthoHeight = frame.height;
+  p.cam.target = XMFLOAT3(0.0f, frame.centerY, 0.0f);
+  p.cam.dist = 100.0f;
+  p.cam.yaw = 0.45f;
+  p.cam.pitch = 0.0f;
+  for (float& c : p.background) c = 0.0f;
+
+  std::vector<uint8_t> rgba(kThumbCellBytes);
+  RenderOfflineCPU(skin, BuildPlayerMesh(skin, false), p, [&](int y0, int rows, const uint8_t* src, size_t stride) {
+    for (int r = 0; r < rows; ++r) memcpy(&rgba[(size_t)(y0 + r) * kThumbW * 4], src + (size_t)r * stride, (size_t)kThumbW * 4);
+  });
+  return rgba;
+}
+
+struct GalleryStats {
+  size_t resident = 0, cells = 0, queued = 0;
+  uint64_t uploaded = 0, evicted = 0, cancelled = 0, failed = 0;
+  bool listing = false;
+};
+
+// Everything but the workers and the lister runs on the render thread.
+class SkinGallery {
+public:
+  SkinGallery(const std::filesystem::path& source, size_t budgetBytes) {
+    SetBudget(budgetBytes);
+    listing_ = true;
+    lister_ = std::thread([this, source] { List(source); });
+    const unsigned n = std::max(1u, std::thread::hardware_concurrency() / 2);
+    for (unsigned i = 0; i < n; ++i) workers_.emplace_back([this] { Run(); });
+  }
+
+  ~SkinGallery() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      jobs_.clear();
+    }
+    cv_.notify_all();
+    lister_.join();
+    for (std::thread& t : workers_) t.join();
+  }
+
+  SkinGallery(const SkinGallery&) = delete;
+  SkinGallery& operator=(const SkinGallery&) = delete;
+
+  size_t Size() const { return paths_.size(); }
+  const std::filesystem::path& Path(size_t i) const { return paths_[i]; }
+  bool Failed(size_t i) const { return state_[i] == State_Failed; }
+  size_t Capacity() const { return cells_.size(); }
+  ID3D11ShaderResourceView* Srv() const { return srv_.Get(); }
+
+  GalleryStats Stats() {
+    GalleryStats s = stats_;
+    s.cells = cells_.size();
+    s.resident = std::count_if(cells_.begin(), cells_.end(), [](const Cell& c) { return c.entry != kNone; });
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.queued = jobs_.size();
+    s.listing = listing_;
+    return s;
+  }
+
+  // Drops every thumbnail; the atlas is recreated by the next Update.
+  void SetBudget(size_t budgetBytes) {
+    const size_t maxCells = (size_t)kThumbAtlasCols * kThumbAtlasMaxRows;
+    cells_.assign(std::clamp<size_t>(budgetBytes / kThumbCellBytes, kThumbAtlasCols, maxCells), Cell{});
+    std::fill(cellOf_.begin(), cellOf_.end(), kNone);
+    for (uint32_t c = 0; c < cells_.size(); ++c) {
+      cells_[c].prev = c ? c - 1 : kNone;
+      cells_[c].next = c + 1 < cells_.size() ? c + 1 : kNone;
+    }
+    mru_ = 0;
+    lru_ = (uint32_t)cells_.size() - 1;
+    requeue_ = true;
+    tex_.Reset();
+    srv_.Reset();
+  }
+
+  // Atlas UVs (u0, v0, u1, v1) of a resident thumbnail, which is then kept
+  // until at least the next Update.
+  bool Thumb(size_t i, float uv[4]) {
+    const uint32_t c = cellOf_[i];
+    if (c == kNone || !srv_) return false;
+    Touch(c);
+    const int rows = (int)((cells_.size() + kThumbAtlasCols - 1) / kThumbAtlasCols);
+    uv[0] = (float)(c % kThumbAtlasCols) / kThumbAtlasCols;
+    uv[1] = (float)(c / kThumbAtlasCols) / rows;
+    uv[2] = uv[0] + 1.0f / kThumbAtlasCols;
+    uv[3] = uv[1] + 1.0f / rows;
+    return true;
+  }
+
+  // Once per frame, with the entries in view [first, last). Takes newly
+  // listed files, requeues what the wanted range is missing (nearest first)
+  // and uploads a bounded number of finished thumbnails.
+  void Update(ID3D11Device* dev, ID3D11DeviceContext* ctx, size_t first, size_t last) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::filesystem::path& p : listed_) paths_.push_back(std::move(p));
+      listed_.clear();
+    }
+    cellOf_.resize(paths_.size(), kNone);
+    state_.resize(paths_.size(), State_Idle);
+    if (!tex_) CreateAtlas(dev);
+
+    // The wanted range never needs more cells than the atlas has
+    last = std::min({ last, paths_.size(), first + cells_.size() });
+    first = std::min(first, last);
+    const size_t margin = std::min(last - first, (cells_.size() - (last - first)) / 2);
+    const size_t wantFirst = first - std::min(first, margin);
+    const size_t wantLast = std::min(paths_.size(), last + margin);
+    if (requeue_ || wantFirst != wantFirst_ || wantLast != wantLast_ || paths_.size() != requested_) {
+      wantFirst_ = wantFirst;
+      wantLast_ = wantLast;
+      requested_ = paths_.size();
+      requeue_ = false;
+      Requeue(first, last);
+    }
+
+    std::vector<Done> done;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const size_t n = std::min<size_t>(done_.size(), kThumbUploadsPerFrame);
+      done.assign(std::make_move_iterator(done_.begin()), std::make_move_iterator(done_.begin() + n));
+      done_.erase(done_.begin(), done_.begin() + n);
+    }
+    for (Done& d : done) {
+      state_[d.entry] = State_Idle;
+      if (d.rgba.empty()) {
+        state_[d.entry] = State_Failed;
+        ++stats_.failed;
+        continue;
+      }
+      if (d.entry < wantFirst_ || d.entry >= wantLast_) {
+        ++stats_.cancelled; // scrolled away meanwhile; asked again if it comes back
+        continue;
+      }
+      const uint32_t c = lru_;
+      if (cells_[c].frame == frame_) {
+        requeue_ = true;    // every cell is in view this frame
+        continue;
+      }
+      if (cells_[c].entry != kNone) {
+        cellOf_[cells_[c].entry] = kNone;
+        ++stats_.evicted;
+      }
+      cells_[c].entry = (uint32_t)d.entry;
+      cellOf_[d.entry] = c;
+      Touch(c);
+      const UINT x = (c % kThumbAtlasCols) * kThumbW, y = (c / kThumbAtlasCols) * kThumbH;
+      D3D11_BOX box{ x, y, 0, x + kThumbW, y + kThumbH, 1 };
+      ctx->UpdateSubresource(tex_.Get(), 0, &box, d.rgba.data(), kThumbW * 4, 0);
+      ++stats_.uploaded;
+    }
+    ++frame_;
+  }
+
+private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  enum State : uint8_t { State_Idle, State_Queued, State_Failed };
+
+  // Cells form an intrusive list from most to least recently shown.
+  struct Cell {
+    uint32_t entry = kNone;
+    uint32_t prev = kNone, next = kNone;
+    uint64_t frame = UINT64_MAX;       // last Update it was shown before
+  };
+
+  struct Job {
+    size_t entry;
+    std::filesystem::path path;
+  };
+
+  struct Done {
+    size_t entry;
+    std::vector<uint8_t> rgba;         // empty: not a readable skin
+  };
+
+  void Touch(uint32_t c) {
+    cells_[c].frame = frame_;
+    if (c == mru_) return;
+    Cell& cell = cells_[c];
+    cells_[cell.prev].next = cell.next;
+    if (cell.next != kNone) cells_[cell.next].prev = cell.prev;
+    else lru_ = cell.prev;
+    cell.prev = kNone;
+    cell.next = mru_;
+    cells_[mru_].prev = c;
+    mru_ = c;
+  }
+
+  void CreateAtlas(ID3D11Device* dev) {
+    D3D11_TEXTURE2D_DESC td{};
+    td.Width = kThumbAtlasCols * kThumbW;
+    td.Height = (UINT)((cells_.size() + kThumbAtlasCols - 1) / kThumbAtlasCols) * kThumbH;
+    td.MipLevels = 1;
+    td.ArraySize = 1;
+    td.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    td.SampleDesc.Count = 1;
+    td.Usage = D3D11_USAGE_DEFAULT;
+    td.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    ThrowIfFailed(dev->CreateTexture2D(&td, nullptr, &tex_), "CreateTexture2D(gallery)");
+    ThrowIfFailed(dev->CreateShaderResourceView(tex_.Get(), nullptr, &srv_), "CreateSRV(gallery)");
+  }
+
+  // Replaces the queue with the wanted entries that are neither resident nor
+  // being made: the view first, then outwards from it.
+  void Requeue(size_t first, size_t last) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Job& j : jobs_) {
+      state_[j.entry] = State_Idle;
+      if (j.entry < wantFirst_ || j.entry >= wantLast_) ++stats_.cancelled;
+    }
+    jobs_.clear();
+    auto want = [&](size_t i) {
+      if (cellOf_[i] != kNone || state_[i] != State_Idle) return;
+      state_[i] = State_Queued;
+      jobs_.push_back(Job{ i, paths_[i] });
+    };
+    for (size_t i = first; i < last; ++i) want(i);
+    for (size_t k = 1; last + k - 1 < wantLast_ || first >= wantFirst_ + k; ++k) {
+      if (last + k - 1 < wantLast_) want(last + k - 1);
+      if (first >= wantFirst_ + k) want(first - k);
+    }
+    cv_.notify_all();
+  }
+
+  // Lister thread: PNGs under a directory in walk order, or the paths of a
+  // list file, published in batches.
+  void List(const std::filesystem::path& source) {
+    std::vector<std::filesystem::path> batch;
+    auto publish = [&] {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::filesystem::path& p : batch) listed_.push_back(std::move(p));
+      batch.clear();
+      return !stop_;
+    };
+    std::error_code ec;
+    if (std::filesystem::is_directory(source, ec)) {
+      for (std::filesystem::recursive_directory_iterator it(source, std::filesystem::directory_options::skip_permission_denied, ec), end;
+           !ec && it != end && !stop_; it.increment(ec)) {
+        if (it->is_regular_file(ec) && LowerExtension(it->path()) == L".png") batch.push_back(it->path());
+        if (batch.size() >= 1024 && !publish()) return;
+      }
+    } else {
+      std::ifstream f(source);
+      for (std::string line; !stop_ && std::getline(f, line);) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) batch.push_back(std::filesystem::u8path(line));
+        if (batch.size() >= 1024 && !publish()) return;
+      }
+    }
+    publish();
+    std::lock_guard<std::mutex> lock(mutex_);
+    listing_ = false;
+  }
+
+  void Run() {
+    const HRESULT coHr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return stop_ || !jobs_.empty(); });
+        if (stop_) break;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      Done d{ job.entry, {} };
+      try {
+        d.rgba = RenderSkinThumbnail(job.path);
+      } catch (const std::exception&) {
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.push_back(std::move(d));
+    }
+    if (SUCCEEDED(coHr)) CoUninitialize();
+  }
+
+  // Render thread
+  std::deque<std::filesystem::path> paths_; // grows without moving what is listed
+  std::vector<uint32_t> cellOf_;       // per entry: atlas cell or kNone
+  std::vector<uint8_t> state_;         // per entry: State
+  std::vector<Cell> cells_;
+  uint32_t mru_ = 0, lru_ = 0;
+  uint64_t frame_ = 0;
+  size_t wantFirst_ = 0, wantLast_ = 0, requested_ = 0;
+  bool requeue_ = false;
+  GalleryStats stats_;
+  ComPtr<ID3D11Texture2D> tex_;
+  ComPtr<ID3D11ShaderResourceView> srv_;
+
+  // Shared, under mutex_
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Job> jobs_;
+  std::vector<Done> done_;
+  std::vector<std::filesystem::path> listed_;
+  bool listing_ = false;
+  std::atomic<bool> stop_{ false };    // written under mutex_; the lister polls it per entry
+
+  std::thread lister_;
+  std::vector<std::thread> workers_;
+};
+
+// ------------------------------
+// Texel picking + painting helpers
+// ------------------------------
+struct PaintSample {
+  int x = 0, y = 0;     // client pixels
+  bool down = false;    // left button held
+};
+
+// Coalesces modified texel rects; flushed to the GPU once per frame.
+struct DirtyRegion {
+  static constexpr size_t kMaxRects = 16;
+  std::vector<UvRectPx> rects;
+
+  static bool Touches(const UvRectPx& a, const UvRectPx& b) {
+    return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+  }
+  static UvRectPx Union(const UvRectPx& a, const UvRectPx& b) {
+    const int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+    const int x1 = std::max(a.x + a.w, b.x + b.w), y1 = std::max(a.y + a.h, b.y + b.h);
+    return UvRectPx{ x0, y0, x1 - x0, y1 - y0 };
+  }
+
+  void Add(UvRectPx r) {
+    // Merge until no existing rect touches r (a merge can make r touch others).
+    for (size_t i = 0; i < rects.size();) {
+      if (Touches(rects[i], r)) {
+        r = Union(rects[i], r);
+        rects[i] = rects.back();
+        rects.pop_back();
+        i = 0;
+      } else {
+        ++i;
+      }
+    }
+    rects.push_back(r);
+    if (rects.size() > kMaxRects) {
+      UvRectPx all = rects[0];
+      for (const UvRectPx& q : rects) all = Union(all, q);
+      rects.assign(1, all);
+    }
+  }
+  bool Empty() const { return rects.empty(); }
+  void Clear() { rects.clear(); }
+};
+
+struct TexelHit {
+  int part = -1;
+  BoxFace face = Face_Top;
+  int x = 0, y = 0;       // texel in the skin texture
+  UvRectPx faceRect{};    // texture rect of the hit face (brush is clipped to it)
+  float t = 0.0f;         // ray parameter
+};
+
+// Casts a ray through client pixel (mx, my) and returns the nearest texel on the
+// given layer of the model. Overlay parts are pickable even when currently
+// omitted from the mesh, so painting can bring them into existence.
+static std::optional<TexelHit> PickTexel(const SkinInfo& skin, const ModelDesc& model, PartLayer layer,
+                                         const Camera& cam, int fbW, int fbH, int mx, int my) {
+  const XMMATRIX mvp = MakeWorld() * MakeView(cam) * MakeProj(fbW, fbH);
+  const XMMATRIX inv = XMMatrixInverse(nullptr, mvp);
+  const float nx = 2.0f * ((float)mx + 0.5f) / (float)fbW - 1.0f;
+  const float ny = 1.0f - 2.0f * ((float)my + 0.5f) / (float)fbH;
+
+  XMFLOAT3 o, e;
+  XMStoreFloat3(&o, XMVector3TransformCoord(XMVectorSet(nx, ny, 0.0f, 1.0f), inv));
+  XMStoreFloat3(&e, XMVector3TransformCoord(XMVectorSet(nx, ny, 1.0f, 1.0f), inv));
+  const float ro[3] = { o.x, o.y, o.z };
+  const float rd[3] = { e.x - o.x, e.y - o.y, e.z - o.z };
+
+  const uint32_t s = ModelTexScale(skin, model);
+  std::optional<TexelHit> best;
+
+  for (size_t i = 0; i < model.parts.size(); ++i) {
+    const PartDesc& p = model.parts[i];
+    if (p.layer != layer) continue;
+
+    const float c[3] = { p.center.x, p.center.y, p.center.z };
+    const float h[3] = { p.size.x * 0.5f + p.inflate, p.size.y * 0.5f + p.inflate, p.size.z * 0.5f + p.inflate };
+
+    // Slab test; remember which axis/side the entry point lies on.
+    float tNear = 0.0f, tFar = 1.0f;
+    int axis = -1;
+    bool positive = false;
+    bool miss = false;
+    for (int k = 0; k < 3 && !miss; ++k) {
+      if (fabsf(rd[k]) < 1e-8f) {
+        if (fabsf(ro[k] - c[k]) > h[k]) miss = true;
+        continue;
+      }
+      float t0 = (c[k] - h[k] - ro[k]) / rd[k];
+      float t1 = (c[k] + h[k] - ro[k]) / rd[k];
+      const bool enterPositive = t0 > t1;
+      if (enterPositive) std::swap(t0, t1);
+      if (t0 > tNear) { tNear = t0; axis = k; positive = enterPositive; }
+      tFar = std::min(tFar, t1);
+      if (tNear > tFar) miss = true;
+    }
+    if (miss || axis < 0) continue;
+    if (best && best->t <= tNear) continue;
+
+    static constexpr BoxFace kAxisFace[3][2] = {
+      { Face_NegX,   Face_PosX },
+      { Face_Bottom, Face_Top },
+      { Face_Back,   Face_Front },
+    };
+    const BoxFace f = kAxisFace[axis][positive ? 1 : 0];
+
+    // Face-local coordinates along the c0->c1 and c0->c3 edges of the emitted quad.
+    float hit[3], corner[4][3];
+    for (int k = 0; k < 3; ++k) hit[k] = ro[k] + rd[k] * tNear;
+    for (int q = 0; q < 4; ++q) {
+      const int ci = kFaceCorners[f][q];
+      for (int k = 0; k < 3; ++k) corner[q][k] = c[k] + h[k] * (float)(((ci >> k) & 1) * 2 - 1);
+    }
+    float su = 0.0f, sv = 0.0f, lu = 0.0f, lv = 0.0f;
+    for (int k = 0; k < 3; ++k) {
+      const float eu = corner[1][k] - corner[0][k];
+      const float ev = corner[3][k] - corner[0][k];
+      su += (hit[k] - corner[0][k]) * eu; lu += eu * eu;
+      sv += (hit[k] - corner[0][k]) * ev; lv += ev * ev;
+    }
+    su = Clamp(su / lu, 0.0f, 0.9999f);
+    sv = Clamp(sv / lv, 0.0f, 0.9999f);
+
+    // Map through the same rect/flip tables as EmitPart.
+    const BoxUv uv = ScaleBoxUv(PartUv(p), s);
+    const UvRectPx& r = (&uv.top)[kFaceRect[p.swapSides][f]];
+    const float rc[4][2] = {
+      {(float)r.x, (float)r.y}, {(float)(r.x + r.w), (float)r.y},
+      {(float)(r.x + r.w), (float)(r.y + r.h)}, {(float)r.x, (float)(r.y + r.h)},
+    };
+    const uint8_t* perm = kUvCornerPerm[p.faceFlags[f] & 3];
+    const float tx = rc[perm[0]][0] + su * (rc[perm[1]][0] - rc[perm[0]][0]) + sv * (rc[perm[3]][0] - rc[perm[0]][0]);
+    const float ty = rc[perm[0]][1] + su * (rc[perm[1]][1] - rc[perm[0]][1]) + sv * (rc[perm[3]][1] - rc[perm[0]][1]);
+
+    TexelHit th;
+    th.part = (int)i;
+    th.face = f;
+    th.faceRect = r;
+    th.x = std::clamp((int)floorf(tx), r.x, r.x + r.w - 1);
+    th.y = std::clamp((int)floorf(ty), r.y, r.y + r.h - 1);
+    th.t = tNear;
+    best = th;
+  }
+  return best;
+}
+
+// Writes a square brush into skin.rgba, clipped to the hit face. Returns the touched rect.
+static UvRectPx StampBrush(SkinInfo& skin, const TexelHit& hit, int size, const uint8_t rgba[4]) {
+  const int r0 = (size - 1) / 2;
+  const UvRectPx& f = hit.faceRect;
+  const int x0 = std::max({ hit.x - r0, f.x, 0 });
+  const int y0 = std::max({ hit.y - r0, f.y, 0 });
+  const int x1 = std::min({ hit.x - r0 + size, f.x + f.w, (int)skin.width });
+  const int y1 = std::min({ hit.y - r0 + size, f.y + f.h, (int)skin.height });
+  if (x1 <= x0 || y1 <= y0) return UvRectPx{};
+
+  for (int y = y0; y < y1; ++y) {
+    uint8_t* row = &skin.rgba[((size_t)y * skin.width + x0) * 4];
+    for (int x = x0; x < x1; ++x, row += 4) memcpy(row, rgba, 4);
+  }
+  return UvRectPx{ x0, y0, x1 - x0, y1 - y0 };
+}
+
+// Pushes the coalesced dirty rects to the existing texture (no re-creation).
+static void FlushDirtyTexels(ID3D11DeviceContext* ctx, SkinInfo& skin, DirtyRegion& dirty) {
+  if (!skin.gpu) { dirty.Clear(); return; }
+  for (const UvRectPx& r : dirty.rects) {
+    D3D11_BOX box{ (UINT)r.x, (UINT)r.y, 0, (UINT)(r.x + r.w), (UINT)(r.y + r.h), 1 };
+    const uint8_t* src = &skin.rgba[((size_t)r.y * skin.width + r.x) * 4];
+    ctx->UpdateSubresource(skin.gpu->tex.Get(), 0, &box, src, skin.width * 4, 0);
+  }
+  dirty.Clear();
+}
+
+// ------------------------------
+// Session record / replay
+// ------------------------------
+// A session is a stream of frames; each frame carries its start time and the
+// inputs applied during it. Encoding: "SKRS", version, framebuffer size, then
+// one type byte per event followed by varint payloads (floats raw).
+enum class SessionEv : uint8_t {
+  Frame = 0,        // varint: microseconds since the previous frame
+  Orbit,            // zigzag varint dx, dy (pixels)
+  Wheel,            // float32 notches
+  ShowOverlay,      // u8
+  PointFilter,      // u8
+  SlimArms,         // u8
+  GridMode,         // u8
+  LoadSkin,         // varint length + UTF-8 path
+  AddGridSkin,      // varint length + UTF-8 path
+  // version 2
+  LoadModel,        // varint length + UTF-8 path
+  UsePlayerModel,   // -
+  ClearGrid,        // -
+  PaletteGridSkins, // u8
+  CrowdMode,        // u8
+  CrowdSize,        // varint
+  PaintMode,        // u8
+  PaintOverlay,     // u8
+  Brush,            // varint size, float32 x4 colour
+  Paint,            // zigzag varint x, y (client pixels), u8 button down
+  OpenGallery,      // varint length + UTF-8 path
+  CloseGallery,     // -
+};
+
+struct SessionEvent {
+  SessionEv type = SessionEv::Frame;
+  int dx = 0, dy = 0;   // orbit delta or paint position
+  float value = 0.0f;   // wheel notches, toggle state, crowd or brush size, paint button
+  float color[4]{};     // brush colour
+  std::wstring path;
+};
 
-  // Constant buffer
-  D3D11_BUFFER_DESC cbd{};
-  cbd.ByteWidth = sizeof(CB0);
-  cbd.Usage = D3D11_USAGE_DYNAMIC;
-  cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-  cbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-  ThrowIfFailed(d.device->CreateBuffer(&cbd, nullptr, &d.cb), "CreateCB");
+struct SessionFrame {
+  uint64_t timeUs = 0;  // since the first frame
+  std::vector<SessionEvent> events;
+};
 
-  // Sampler
-  D3D11_SAMPLER_DESC sd{};
-  sd.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
-  sd.AddressU = sd.AddressV = sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-  sd.MaxLOD = D3D11_FLOAT32_MAX;
-  ThrowIfFailed(d.device->CreateSamplerState(&sd, &d.samp), "CreateSampler");
+struct Session {
+  int fbW = 0, fbH = 0;
+  std::vector<SessionFrame> frames;
+};
 
-  // Rasterizer
-  D3D11_RASTERIZER_DESC rsd{};
-  rsd.FillMode = D3D11_FILL_SOLID;
-  rsd.CullMode = D3D11_CULL_BACK;
-  rsd.FrontCounterClockwise = TRUE; // your mesh winding is CCW
-  rsd.DepthClipEnable = TRUE;
-  ThrowIfFailed(d.device->CreateRasterizerState(&rsd, &d.rs), "CreateRasterizer");
+static constexpr uint32_t kSessionMagic = 0x53524B53; // "SKRS"
+static constexpr uint32_t kSessionVersion = 2;   // 1 is read too: it lacks the version 2 events
 
-  // Depth
-  D3D11_DEPTH_STENCIL_DESC dsd{};
-  dsd.DepthEnable = TRUE;
-  dsd.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-  dsd.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
-  ThrowIfFailed(d.device->CreateDepthStencilState(&dsd, &d.dsDefault), "CreateDepthStencilState");
+static void PutVarint(std::vector<uint8_t>& b, uint64_t v) {
+  while (v >= 0x80) { b.push_back((uint8_t)(v | 0x80)); v >>= 7; }
+  b.push_back((uint8_t)v);
+}
 
-  // Alpha blend
-  D3D11_BLEND_DESC bd{};
-  bd.RenderTarget[0].BlendEnable = TRUE;
-  bd.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
-  bd.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
-  bd.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-  bd.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
-  bd.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
-  bd.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-  bd.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-  ThrowIfFailed(d.device->CreateBlendState(&bd, &d.blendAlpha), "CreateBlendState");
+static uint64_t GetVarint(const uint8_t*& p, const uint8_t* end) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p >= end) throw std::runtime_error("Session: truncated varint");
+    const uint8_t byte = *p++;
+    v |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return v;
+  }
+  throw std::runtime_error("Session: bad varint");
 }
 
-static void UploadMesh(D3DState& d, const BuiltMesh& m) {
-  std::vector<uint32_t> allIdx;
-  allIdx.reserve(m.indicesBase.size() + m.indicesOverlay.size());
-  allIdx.insert(allIdx.end(), m.indicesBase.begin(), m.indicesBase.end());
-  d.ibOffsetOverlay = (UINT)m.indicesBase.size();
-  allIdx.insert(allIdx.end(), m.indicesOverlay.begin(), m.indicesOverlay.end());
+static uint64_t ZigZag(int v) { return ((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63); }
+static int UnZigZag(uint64_t v) { return (int)(int64_t)((v >> 1) ^ (~(v & 1) + 1)); }
+
+// Appends to the file as it goes, so a crash still leaves the session up to
+// the last flushed frame on disk.
+class SessionRecorder {
+public:
+  void Start(const std::filesystem::path& path, int fbW, int fbH) {
+    f_.open(path, std::ios::binary | std::ios::trunc);
+    if (!f_) throw std::runtime_error("Session: cannot open " + path.string() + " for writing");
+    const uint32_t hdr[4] = { kSessionMagic, kSessionVersion, (uint32_t)fbW, (uint32_t)fbH };
+    f_.write((const char*)hdr, sizeof(hdr));
+    active_ = true;
+    started_ = false;
+  }
 
-  d.ibCountBase = (UINT)m.indicesBase.size();
-  d.ibCountOverlay = (UINT)m.indicesOverlay.size();
+  bool Active() const { return active_; }
+
+  void BeginFrame() {
+    if (!active_) return;
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t dt = started_ ? (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - last_).count() : 0;
+    last_ = now;
+    started_ = true;
+    if (buf_.size() >= kFlushBytes) Flush();
+    buf_.push_back((uint8_t)SessionEv::Frame);
+    PutVarint(buf_, dt);
+  }
 
-  d.vb.Reset();
-  d.ib.Reset();
+  void Orbit(int dx, int dy) {
+    if (!active_ || (dx == 0 && dy == 0)) return;
+    buf_.push_back((uint8_t)SessionEv::Orbit);
+    PutVarint(buf_, ZigZag(dx));
+    PutVarint(buf_, ZigZag(dy));
+  }
 
-  if (m.vertices.empty() || allIdx.empty()) return;
+  void Wheel(float notches) {
+    if (!active_) return;
+    buf_.push_back((uint8_t)SessionEv::Wheel);
+    const uint8_t* p = (const uint8_t*)&notches;
+    buf_.insert(buf_.end(), p, p + sizeof(float));
+  }
 
-  D3D11_BUFFER_DESC vbd{};
-  vbd.ByteWidth = (UINT)(m.vertices.size() * sizeof(Vertex));
-  vbd.Usage = D3D11_USAGE_DEFAULT;
-  vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+  void Toggle(SessionEv type, bool on) {
+    if (!active_) return;
+    buf_.push_back((uint8_t)type);
+    buf_.push_back(on ? 1 : 0);
+  }
 
-  D3D11_SUBRESOURCE_DATA vsd{};
-  vsd.pSysMem = m.vertices.data();
-  ThrowIfFailed(d.device->CreateBuffer(&vbd, &vsd, &d.vb), "CreateVB");
+  void Event(SessionEv type) {
+    if (!active_) return;
+    buf_.push_back((uint8_t)type);
+  }
 
-  D3D11_BUFFER_DESC ibd{};
-  ibd.ByteWidth = (UINT)(allIdx.size() * sizeof(uint32_t));
-  ibd.Usage = D3D11_USAGE_DEFAULT;
-  ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+  void Value(SessionEv type, uint64_t v) {
+    if (!active_) return;
+    buf_.push_back((uint8_t)type);
+    PutVarint(buf_, v);
+  }
 
-  D3D11_SUBRESOURCE_DATA isd{};
-  isd.pSysMem = allIdx.data();
-  ThrowIfFailed(d.device->CreateBuffer(&ibd, &isd, &d.ib), "CreateIB");
-}
+  void Brush(int size, const float color[4]) {
+    if (!active_) return;
+    buf_.push_back((uint8_t)SessionEv::Brush);
+    PutVarint(buf_, (uint64_t)std::max(0, size));
+    const uint8_t* p = (const uint8_t*)color;
+    buf_.insert(buf_.end(), p, p + 4 * sizeof(float));
+  }
 
-// ------------------------------
-// Camera controls
-// ------------------------------
-struct Camera {
-  float yaw = 0.9f;
-  float pitch = 0.35f;
-  float dist = 70.0f;
-  XMFLOAT3 target{0, 16, 0};
-};
+  void Paint(int x, int y, bool down) {
+    if (!active_) return;
+    buf_.push_back((uint8_t)SessionEv::Paint);
+    PutVarint(buf_, ZigZag(x));
+    PutVarint(buf_, ZigZag(y));
+    buf_.push_back(down ? 1 : 0);
+  }
+
+  void Path(SessionEv type, const std::wstring& path) {
+    if (!active_) return;
+    const std::string u8 = NarrowFromWide(path);
+    buf_.push_back((uint8_t)type);
+    PutVarint(buf_, u8.size());
+    buf_.insert(buf_.end(), u8.begin(), u8.end());
+  }
+
+  // Also runs when an exception unwinds the App, so the buffered events of
+  // the frames before the failure still reach the file.
+  ~SessionRecorder() { Stop(); }
 
-static XMMATRIX MakeView(const Camera& c) {
-  const float cp = cosf(c.pitch), sp = sinf(c.pitch);
-  const float cy = cosf(c.yaw),   sy = sinf(c.yaw);
+  void Stop() {
+    if (!active_) return;
+    Flush();
+    f_.close();
+    active_ = false;
+  }
+
+private:
+  static constexpr size_t kFlushBytes = 64 * 1024;
+
+  void Flush() {
+    f_.write((const char*)buf_.data(), (std::streamsize)buf_.size());
+    buf_.clear();
+  }
 
-  XMVECTOR eye = XMVectorSet(
-    c.target.x + c.dist * cp * sy,
-    c.target.y + c.dist * sp,
-    c.target.z + c.dist * cp * cy,
-    1.0f
-  );
+  std::ofstream f_;
+  std::vector<uint8_t> buf_;
+  bool active_ = false;
+  bool started_ = false;
+  std::chrono::steady_clock::time_point last_;
+};
 
-  XMVECTOR at = XMVectorSet(c.target.x, c.target.y, c.target.z, 1.0f);
-  XMVECTOR up = XMVectorSet(0, 1, 0, 0);
-  return XMMatrixLookAtLH(eye, at, up);
+static Session LoadSession(const std::filesystem::path& path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("Session: cannot open " + path.string());
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+  uint32_t hdr[4]{};
+  if (data.size() < sizeof(hdr)) throw std::runtime_error("Session: bad header in " + path.string());
+  memcpy(hdr, data.data(), sizeof(hdr));
+  if (hdr[0] != kSessionMagic || hdr[1] < 1 || hdr[1] > kSessionVersion) throw std::runtime_error("Session: bad header in " + path.string());
+
+  Session s;
+  s.fbW = (int)hdr[2];
+  s.fbH = (int)hdr[3];
+  const uint8_t* p = data.data() + sizeof(hdr);
+  const uint8_t* end = data.data() + data.size();
+  uint64_t t = 0;
+  while (p < end) {
+    const SessionEv type = (SessionEv)*p++;
+    if (type == SessionEv::Frame) {
+      t += GetVarint(p, end);
+      s.frames.push_back(SessionFrame{ t, {} });
+      continue;
+    }
+    if (s.frames.empty()) throw std::runtime_error("Session: event before first frame");
+    SessionEvent e;
+    e.type = type;
+    switch (type) {
+      case SessionEv::Orbit:
+        e.dx = UnZigZag(GetVarint(p, end));
+        e.dy = UnZigZag(GetVarint(p, end));
+        break;
+      case SessionEv::Wheel:
+        if (end - p < (ptrdiff_t)sizeof(float)) throw std::runtime_error("Session: truncated event");
+        memcpy(&e.value, p, sizeof(float));
+        p += sizeof(float);
+        break;
+      case SessionEv::ShowOverlay:
+      case SessionEv::PointFilter:
+      case SessionEv::SlimArms:
+      case SessionEv::GridMode:
+      case SessionEv::PaletteGridSkins:
+      case SessionEv::CrowdMode:
+      case SessionEv::PaintMode:
+      case SessionEv::PaintOverlay:
+        if (p >= end) throw std::runtime_error("Session: truncated event");
+        e.value = *p++ ? 1.0f : 0.0f;
+        break;
+      case SessionEv::UsePlayerModel:
+      case SessionEv::ClearGrid:
+      case SessionEv::CloseGallery:
+        break;
+      case SessionEv::CrowdSize:
+        e.value = (float)std::min<uint64_t>(GetVarint(p, end), 1u << 24);
+        break;
+      case SessionEv::Brush:
+        e.value = (float)std::min<uint64_t>(GetVarint(p, end), 1u << 24);
+        if (end - p < (ptrdiff_t)sizeof(e.color)) throw std::runtime_error("Session: truncated event");
+        memcpy(e.color, p, sizeof(e.color));
+        p += sizeof(e.color);
+        break;
+      case SessionEv::Paint:
+        e.dx = UnZigZag(GetVarint(p, end));
+        e.dy = UnZigZag(GetVarint(p, end));
+        if (p >= end) throw std::runtime_error("Session: truncated event");
+        e.value = *p++ ? 1.0f : 0.0f;
+        break;
+      case SessionEv::LoadSkin:
+      case SessionEv::AddGridSkin:
+      case SessionEv::LoadModel:
+      case SessionEv::OpenGallery: {
+        const uint64_t n = GetVarint(p, end);
+        if ((uint64_t)(end - p) < n) throw std::runtime_error("Session: truncated path");
+        e.path = WideFromUtf8(std::string_view((const char*)p, (size_t)n));
+        p += n;
+        break;
+      }
+      default:
+        throw std::runtime_error("Session: unknown event type");
+    }
+    s.frames.back().events.push_back(std::move(e));
+  }
+  return s;
 }
 
 // ------------------------------
@@ -1049,6 +1483,7 @@ static XMMATRIX MakeView(const Camera& c) {
 struct App {
   D3DState d3d;
   std::optional<SkinInfo> skin;
+  std::optional<ModelDesc> customModel; // loaded geometry.json; player model when empty
   Camera cam;
 
   std::string status = "Drag & drop a Minecraft skin .png onto the window.";
@@ -1061,6 +1496,46 @@ struct App {
 
   bool rotating = false;
   POINT lastMouse{};
+
+  // Painting
+  std::vector<uint8_t> partPresent;    // per ActiveModel part, see ComputePartPresence
+  BuiltMesh meshArena;                 // reused by every rebuild, see BuildModelMeshInto
+  bool paintMode = false;
+  bool paintOverlay = false;           // paint the second layer instead of the base
+  int brushSize = 1;                   // texels
+  float brushColor[4]{ 1.0f, 0.0f, 0.0f, 1.0f };
+  std::vector<PaintSample> paintSamples; // client-space mouse samples from WndProc
+  bool strokeActive = false;
+  POINT strokeLast{};
+  DirtyRegion dirty;
+
+  // Grid comparison mode
+  static constexpr size_t kMaxGridSkins = 64;
+  bool gridMode = false;
+  std::vector<SkinInfo> gridSkins;
+  bool paletteGridSkins = true;        // keep grid skin pixels palettized (PalettizeSkin)
+  int gridScroll = 0;
+  std::vector<int> gridVisible;        // scratch, reused every frame
+
+  // Crowd scene
+  bool crowdMode = false;
+  int crowdCount = 2000;
+  CrowdInstances crowd;
+  size_t crowdSkinCount = 0;           // skin table size the crowd was populated for
+  std::vector<const SkinInfo*> crowdSkins; // scratch, rebuilt every frame
+  std::vector<uint8_t> crowdSkinFlags; // per crowdSkins entry: CrowdSkin_* bits
+  CrowdScratch crowdScratch;
+  CrowdStats crowdStats;
+  std::vector<Vertex> impostorVerts;   // scratch, LOD2 quads for this frame
+  ImpostorBaker impostorBaker;
+
+  // Gallery of a dropped folder
+  std::unique_ptr<SkinGallery> gallery;
+  int galleryBudgetMB = 32;            // thumbnail atlas VRAM
+
+  // Session record / replay
+  SessionRecorder recorder;
+  UINT presentInterval = 1;            // 0 while replaying at maximum speed
 };
 
 static void ApplySampler(App& a) {
@@ -1073,32 +1548,249 @@ static void ApplySampler(App& a) {
   ThrowIfFailed(a.d3d.device->CreateSamplerState(&sd, &a.d3d.samp), "CreateSamplerState(update)");
 }
 
+static const ModelDesc& ActiveModel(const App& a) {
+  return a.customModel ? *a.customModel : PlayerModel(a.slimArms);
+}
+
 static void RebuildMeshIfSkinLoaded(App& a) {
   if (!a.skin) return;
-  BuiltMesh mesh = BuildPlayerMesh(*a.skin, a.slimArms);
-  UploadMesh(a.d3d, mesh);
+  ComputePartPresence(*a.skin, ActiveModel(a), a.partPresent);
+  BuildModelMeshInto(*a.skin, ActiveModel(a), a.partPresent, a.meshArena);
+  UploadMesh(a.d3d, a.meshArena);
 }
 
 static void LoadSkinIntoApp(App& a, const std::wstring& path) {
+  a.recorder.Path(SessionEv::LoadSkin, path);
   try {
-    SkinInfo s = LoadSkinPngWIC(a.d3d.device.Get(), path);
+    SkinInfo s = LoadSkinPng(a.d3d.device.Get(), path);
 
-    const bool ok =
-      (s.width == 64 && (s.height == 32 || s.height == 64)) ||
-      (s.width == s.height && (s.width % 64) == 0);
+    // PNGs with other sizes are rejected by their header before decoding;
+    // other formats are only checked here.
+    a.status = IsSkinSize(s.width, s.height) ? "Skin loaded." : "Loaded image, but dimensions are not typical for Minecraft skins.";
 
-    a.status = ok ? "Skin loaded." : "Loaded image, but dimensions are not typical for Minecraft skins.";
-
-    BuiltMesh mesh = BuildPlayerMesh(s, a.slimArms);
-    UploadMesh(a.d3d, mesh);
+    ComputePartPresence(s, ActiveModel(a), a.partPresent);
+    BuildModelMeshInto(s, ActiveModel(a), a.partPresent, a.meshArena);
+    UploadMesh(a.d3d, a.meshArena);
+    s.impostor = a.impostorBaker.Enqueue(s);
 
     a.skin = std::move(s);
+    a.dirty.Clear();
   } catch (const std::exception& e) {
     a.skin.reset();
     a.status = std::string("Failed to load skin: ") + e.what();
   }
 }
 
+static void LoadModelIntoApp(App& a, const std::wstring& path) {
+  a.recorder.Path(SessionEv::LoadModel, path);
+  try {
+    a.customModel = LoadBedrockGeometry(path);
+    a.status = "Model loaded: " + a.customModel->name + " (" + std::to_string(a.customModel->parts.size()) + " cubes).";
+    RebuildMeshIfSkinLoaded(a);
+  } catch (const std::exception& e) {
+    a.status = std::string("Failed to load model: ") + e.what();
+  }
+}
+
+static void AddSkinToGrid(App& a, const std::wstring& path) {
+  a.recorder.Path(SessionEv::AddGridSkin, path);
+  if (a.gridSkins.size() >= App::kMaxGridSkins) {
+    a.status = "Grid is full (" + std::to_string(App::kMaxGridSkins) + " skins).";
+    return;
+  }
+  // A file adds one skin; an archive or directory adds skins until the grid is full
+  // Skins with the same canonical form share the texture of the first
+  size_t failed = 0, shared = 0;
+  std::string lastError;
+  try {
+    IngestSkins(path, [&](IngestedSkin&& r) {
+      if (!r.error.empty()) {
+        ++failed;
+        lastError = r.error;
+        return true;
+      }
+      const auto twin = std::find_if(a.gridSkins.begin(), a.gridSkins.end(), [&](const SkinInfo& g) {
+        return g.canonHash == r.skin.canonHash && g.width == r.skin.width && g.height == r.skin.height;
+      });
+      if (twin != a.gridSkins.end() && r.skin.canonHash) {
+        r.skin.gpu = twin->gpu;
+        ++shared;
+      } else {
+        CreateSkinTexture(a.d3d.device.Get(), r.skin);
+      }
+      r.skin.impostor = a.impostorBaker.Enqueue(r.skin);
+      if (a.paletteGridSkins) PalettizeSkin(r.skin); // the GPU copy is already made
+      a.gridSkins.push_back(std::move(r.skin));
+      return a.gridSkins.size() < App::kMaxGridSkins;
+    });
+    a.status = "Grid: " + std::to_string(a.gridSkins.size()) + " skins.";
+    if (shared) a.status += " " + std::to_string(shared) + " duplicates share a texture.";
+    if (failed) a.status += " " + std::to_string(failed) + " failed to load (" + lastError + ").";
+  } catch (const std::exception& e) {
+    a.status = std::string("Failed to load skin: ") + e.what();
+  }
+}
+
+static void UsePlayerModel(App& a) {
+  a.recorder.Event(SessionEv::UsePlayerModel);
+  a.customModel.reset();
+  RebuildMeshIfSkinLoaded(a);
+}
+
+static void ClearGrid(App& a) {
+  a.recorder.Event(SessionEv::ClearGrid);
+  a.gridSkins.clear();
+  a.gridScroll = 0;
+}
+
+static void OpenGallery(App& a, const std::wstring& path) {
+  a.recorder.Path(SessionEv::OpenGallery, path);
+  a.gallery.reset(); // joins the old workers before the new ones start
+  a.gallery = std::make_unique<SkinGallery>(path, (size_t)a.galleryBudgetMB << 20);
+  a.status = "Gallery: " + NarrowFromWide(path);
+}
+
+static void CloseGallery(App& a) {
+  a.recorder.Event(SessionEv::CloseGallery);
+  a.gallery.reset();
+}
+
+// Input handlers shared by live input and session replay, so a replayed
+// session goes through the same code as the original one.
+static void ApplyOrbit(App& a, int dx, int dy) {
+  a.recorder.Orbit(dx, dy);
+  a.cam.yaw += (float)dx * 0.01f;
+  a.cam.pitch = Clamp(a.cam.pitch + (float)dy * 0.01f, -1.2f, 1.2f);
+}
+
+static void ApplyZoom(App& a, float notches) {
+  a.recorder.Wheel(notches);
+  const float maxDist = a.crowdMode ? kCrowdMaxDist : 200.0f;
+  a.cam.dist = Clamp(a.cam.dist - notches * (a.crowdMode ? 40.0f : 4.0f), 20.0f, maxDist);
+}
+
+// Called after the flag itself has changed (ImGui checkbox or replay).
+static void OnToggle(App& a, SessionEv type) {
+  switch (type) {
+    case SessionEv::ShowOverlay: a.recorder.Toggle(type, a.showOverlay); break;
+    case SessionEv::PointFilter: a.recorder.Toggle(type, a.pointFilter); ApplySampler(a); break;
+    case SessionEv::SlimArms:    a.recorder.Toggle(type, a.slimArms); RebuildMeshIfSkinLoaded(a); break;
+    case SessionEv::GridMode:    a.recorder.Toggle(type, a.gridMode); break;
+    case SessionEv::PaintMode:   a.recorder.Toggle(type, a.paintMode); break;
+    case SessionEv::PaintOverlay: a.recorder.Toggle(type, a.paintOverlay); break;
+    case SessionEv::CrowdMode:
+      a.recorder.Toggle(type, a.crowdMode);
+      if (!a.crowdMode) a.cam.dist = Clamp(a.cam.dist, 20.0f, 200.0f);
+      break;
+    case SessionEv::PaletteGridSkins:
+      a.recorder.Toggle(type, a.paletteGridSkins);
+      for (SkinInfo& s : a.gridSkins) {
+        if (a.paletteGridSkins) PalettizeSkin(s);
+        else UnpalettizeSkin(s);
+      }
+      break;
+    default: break;
+  }
+}
+
+static void ProcessPaintSamples(App& a);
+
+static void ApplySessionEvent(App& a, const SessionEvent& e) {
+  // Samples of this frame are painted with the brush they were recorded with
+  if (e.type != SessionEv::Paint && !a.paintSamples.empty()) ProcessPaintSamples(a);
+  const bool on = e.value != 0.0f;
+  switch (e.type) {
+    case SessionEv::Orbit:       ApplyOrbit(a, e.dx, e.dy); break;
+    case SessionEv::Wheel:       ApplyZoom(a, e.value); break;
+    case SessionEv::ShowOverlay: a.showOverlay = on; OnToggle(a, e.type); break;
+    case SessionEv::PointFilter: a.pointFilter = on; OnToggle(a, e.type); break;
+    case SessionEv::SlimArms:    a.slimArms = on; OnToggle(a, e.type); break;
+    case SessionEv::GridMode:    a.gridMode = on; OnToggle(a, e.type); break;
+    case SessionEv::LoadSkin:    LoadSkinIntoApp(a, e.path); break;
+    case SessionEv::AddGridSkin: AddSkinToGrid(a, e.path); break;
+    case SessionEv::LoadModel:   LoadModelIntoApp(a, e.path); break;
+    case SessionEv::UsePlayerModel: UsePlayerModel(a); break;
+    case SessionEv::ClearGrid:   ClearGrid(a); break;
+    case SessionEv::PaletteGridSkins: a.paletteGridSkins = on; OnToggle(a, e.type); break;
+    case SessionEv::CrowdMode:   a.crowdMode = on; OnToggle(a, e.type); break;
+    case SessionEv::CrowdSize:   a.crowdCount = std::max(1, (int)e.value); break;
+    case SessionEv::PaintMode:   a.paintMode = on; OnToggle(a, e.type); break;
+    case SessionEv::PaintOverlay: a.paintOverlay = on; OnToggle(a, e.type); break;
+    case SessionEv::Brush:
+      a.brushSize = std::max(1, (int)e.value);
+      std::copy(e.color, e.color + 4, a.brushColor);
+      break;
+    case SessionEv::Paint:       a.paintSamples.push_back(PaintSample{ e.dx, e.dy, on }); break;
+    case SessionEv::OpenGallery: OpenGallery(a, e.path); break;
+    case SessionEv::CloseGallery: CloseGallery(a); break;
+    default: break;
+  }
+}
+
+// Applies one brush stamp at client pixel (x, y).
+static void PaintAt(App& a, int x, int y) {
+  const ModelDesc& model = ActiveModel(a);
+  const PartLayer layer = a.paintOverlay ? Layer_Overlay : Layer_Base;
+  std::optional<TexelHit> hit = PickTexel(*a.skin, model, layer, a.cam, a.d3d.fbW, a.d3d.fbH, x, y);
+  if (!hit) return;
+
+  uint8_t c[4];
+  for (int k = 0; k < 4; ++k) c[k] = (uint8_t)std::lround(Clamp(a.brushColor[k], 0.0f, 1.0f) * 255.0f);
+  if (layer == Layer_Base) c[3] = 255; // base stays opaque (SanitizeMinecraftBaseAlpha)
+
+  const UvRectPx r = StampBrush(*a.skin, *hit, a.brushSize, c);
+  if (r.w > 0) a.dirty.Add(r);
+
+  // Overlay presence: a hidden part becomes visible; only that flag changes, so
+  // the mesh is rebuilt from the mask without rescanning texels.
+  if (c[3] != 0 && (size_t)hit->part < a.partPresent.size() && !a.partPresent[hit->part]) {
+    a.partPresent[hit->part] = 1;
+    BuildModelMeshInto(*a.skin, model, a.partPresent, a.meshArena);
+    UploadMesh(a.d3d, a.meshArena);
+  }
+}
+
+// Consumes the mouse samples gathered since the last frame. Consecutive samples
+// of a stroke are joined in screen space (one stamp per pixel step), so fast
+// mice do not leave gaps. Texture upload happens once, after all samples.
+static void ProcessPaintSamples(App& a) {
+  if (!a.skin || !a.paintMode) { a.paintSamples.clear(); a.strokeActive = false; return; }
+
+  for (const PaintSample& ps : a.paintSamples) a.recorder.Paint(ps.x, ps.y, ps.down);
+  for (const PaintSample& ps : a.paintSamples) {
+    if (!ps.down) {
+      if (a.strokeActive) {
+        // Stroke finished: refresh the load-time analysis the stroke may have changed
+        a.skin->canonHash = CanonicalSkinHash(*a.skin);
+        a.skin->phash = ComputeSkinPHash(*a.skin);
+        a.skin->impostor = a.impostorBaker.Enqueue(*a.skin);
+        const bool translucent = HasPartialAlpha(*a.skin);
+        if (translucent || a.skin->overlayTranslucent) {
+          a.skin->overlayTranslucent = translucent;
+          BuildModelMeshInto(*a.skin, ActiveModel(a), a.partPresent, a.meshArena);
+          UploadMesh(a.d3d, a.meshArena);
+        }
+      }
+      a.strokeActive = false;
+      continue;
+    }
+    if (!a.strokeActive) {
+      PaintAt(a, ps.x, ps.y);
+    } else {
+      const int dx = ps.x - a.strokeLast.x, dy = ps.y - a.strokeLast.y;
+      const int steps = std::max(std::abs(dx), std::abs(dy));
+      for (int k = 1; k <= steps; ++k) {
+        PaintAt(a, a.strokeLast.x + dx * k / steps, a.strokeLast.y + dy * k / steps);
+      }
+    }
+    a.strokeActive = true;
+    a.strokeLast = POINT{ ps.x, ps.y };
+  }
+  a.paintSamples.clear();
+
+  if (!a.dirty.Empty()) FlushDirtyTexels(a.d3d.ctx.Get(), *a.skin, a.dirty);
+}
+
 // ------------------------------
 // Win32
 // ------------------------------
@@ -1120,6 +1812,18 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
       break;
     }
 
+    case WM_MOUSEMOVE:
+    case WM_LBUTTONDOWN:
+    case WM_LBUTTONUP: {
+      // Every mouse message is kept while painting; strokes are resolved once per frame.
+      // Button-up always ends the stroke, even over the UI.
+      if (g_app && g_app->paintMode && (msg == WM_LBUTTONUP || !ImGui::GetIO().WantCaptureMouse)) {
+        const bool down = (msg == WM_LBUTTONDOWN) || (msg != WM_LBUTTONUP && (wParam & MK_LBUTTON));
+        g_app->paintSamples.push_back(PaintSample{ (short)LOWORD(lParam), (short)HIWORD(lParam), down });
+      }
+      break;
+    }
+
     case WM_SIZE: {
       if (g_app) {
         g_app->minimized = (wParam == SIZE_MINIMIZED);
@@ -1136,8 +1840,27 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
       if (!g_app) return 0;
       HDROP drop = (HDROP)wParam;
       wchar_t filePath[MAX_PATH]{};
-      if (DragQueryFileW(drop, 0, filePath, MAX_PATH)) {
-        LoadSkinIntoApp(*g_app, filePath);
+      const UINT count = DragQueryFileW(drop, 0xFFFFFFFF, nullptr, 0);
+      std::error_code dirEc;
+      const bool first = DragQueryFileW(drop, 0, filePath, MAX_PATH) != 0;
+      const bool many = count > 1 || (first && IsSkinArchive(filePath));
+      if (count == 1 && first && (std::filesystem::is_directory(filePath, dirEc) || LowerExtension(filePath) == L".txt")) {
+        // One folder, or a list of paths: browse it in the gallery
+        OpenGallery(*g_app, filePath);
+      } else if (many || g_app->gridMode) {
+        // Several files or an archive (or grid mode on): add them all to the comparison grid
+        if (!g_app->gridMode) {
+          g_app->gridMode = true;
+          OnToggle(*g_app, SessionEv::GridMode);
+        }
+        for (UINT f = 0; f < count; ++f) {
+          if (DragQueryFileW(drop, f, filePath, MAX_PATH)) AddSkinToGrid(*g_app, filePath);
+        }
+      } else if (DragQueryFileW(drop, 0, filePath, MAX_PATH)) {
+        std::wstring ext = std::filesystem::path(filePath).extension().wstring();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+        if (ext == L".json") LoadModelIntoApp(*g_app, filePath);
+        else                 LoadSkinIntoApp(*g_app, filePath);
       }
       DragFinish(drop);
       return 0;
@@ -1156,6 +1879,307 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
 // ------------------------------
 // Render
 // ------------------------------
+static constexpr int kGridMinCell = 96;     // pixels; smaller cells scroll instead
+static constexpr int kGridGap = 4;
+
+// Draws every visible grid cell with shared pipeline state: all base passes,
+// then the alpha-tested overlays, then the sorted translucent overlays, so
+// state changes a fixed number of times per frame regardless of the cell
+// count. Per cell only viewport, scissor and SRV change.
+static void RenderGridCells(App& a) {
+  auto& d = a.d3d;
+  if (!d.gridVb || !d.gridIb) return;
+
+  const GridLayout g = ComputeGridLayout((int)a.gridSkins.size(), d.fbW, d.fbH, kGridMinCell, kGridGap);
+  a.gridScroll = std::clamp(a.gridScroll, 0, GridMaxScroll(g, d.fbH));
+  VisibleGridCells(g, (int)a.gridSkins.size(), a.gridScroll, d.fbW, d.fbH, a.gridVisible);
+  if (a.gridVisible.empty()) return;
+
+  UINT stride = sizeof(Vertex), offset = 0;
+  d.ctx->IASetVertexBuffers(0, 1, d.gridVb.GetAddressOf(), &stride, &offset);
+  d.ctx->IASetIndexBuffer(d.gridIb.Get(), DXGI_FORMAT_R32_UINT, 0);
+  d.ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+  d.ctx->RSSetState(d.rsScissor.Get());
+
+  // Shared camera; every cell has the same aspect, so one MVP serves all cells.
+  const XMMATRIX mvp = MakeWorld() * MakeView(a.cam) * MakeProj(g.cellW, g.cellH);
+  CB0 cb{};
+  XMStoreFloat4x4(&cb.mvp, XMMatrixTranspose(mvp));
+  D3D11_MAPPED_SUBRESOURCE map{};
+  ThrowIfFailed(d.ctx->Map(d.cb.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &map), "Map(CB)");
+  memcpy(map.pData, &cb, sizeof(cb));
+  d.ctx->Unmap(d.cb.Get(), 0);
+  d.ctx->VSSetConstantBuffers(0, 1, d.cb.GetAddressOf());
+
+  const int variant = a.slimArms ? 1 : 0;
+  const D3DState::GridMeshRange& mesh = d.gridMesh[variant];
+  float blendFactor[4]{};
+
+  auto setCell = [&](int i) {
+    const CellRect r = GridCellRect(g, i, a.gridScroll);
+    D3D11_VIEWPORT vp{ (float)r.x, (float)r.y, (float)r.w, (float)r.h, 0.0f, 1.0f };
+    D3D11_RECT sc{ std::max(0, r.x), std::max(0, r.y), std::min(d.fbW, r.x + r.w), std::min(d.fbH, r.y + r.h) };
+    d.ctx->RSSetViewports(1, &vp);
+    d.ctx->RSSetScissorRects(1, &sc);
+    ID3D11ShaderResourceView* srv = SkinSrv(a.gridSkins[i]);
+    d.ctx->PSSetShaderResources(0, 1, &srv);
+  };
+
+  // Base, then binary-alpha overlays alpha-tested with depth writes, like the
+  // single-skin path
+  d.ctx->OMSetBlendState(nullptr, blendFactor, 0xFFFFFFFF);
+  bool anyTranslucent = false;
+  for (int i : a.gridVisible) {
+    setCell(i);
+    d.ctx->DrawIndexed(mesh.baseCount, mesh.baseStart, mesh.vertexBase);
+    anyTranslucent |= a.gridSkins[i].overlayTranslucent;
+  }
+  if (a.showOverlay) {
+    d.ctx->PSSetShader(d.psCutout.Get(), nullptr, 0);
+    for (int i : a.gridVisible) {
+      if (a.gridSkins[i].overlayTranslucent) continue;
+      setCell(i);
+      d.ctx->DrawIndexed(mesh.overlayCount, mesh.overlayStart, mesh.vertexBase);
+    }
+    d.ctx->PSSetShader(d.ps.Get(), nullptr, 0);
+  }
+
+  // Translucent overlays: blended back to front without depth writes. Every
+  // cell uses the same MVP, so one sorted index list serves them all.
+  if (a.showOverlay && anyTranslucent && d.gridIbSorted) {
+    XMFLOAT3 eyeModel;
+    const XMFLOAT3 e = CameraEye(a.cam);
+    XMStoreFloat3(&eyeModel, XMVector3TransformCoord(XMVectorSet(e.x, e.y, e.z, 1.0f), XMMatrixInverse(nullptr, MakeWorld())));
+    SortFacesBackToFront(d.gridOverlayCentroids[variant], d.gridOverlayIdx[variant], eyeModel,
+                         d.translucentOrder, d.translucentSorted);
+
+    D3D11_MAPPED_SUBRESOURCE tmap{};
+    ThrowIfFailed(d.ctx->Map(d.gridIbSorted.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &tmap), "Map(IB grid sorted)");
+    memcpy(tmap.pData, d.translucentSorted.data(), d.translucentSorted.size() * sizeof(uint32_t));
+    d.ctx->Unmap(d.gridIbSorted.Get(), 0);
+
+    d.ctx->IASetIndexBuffer(d.gridIbSorted.Get(), DXGI_FORMAT_R32_UINT, 0);
+    d.ctx->OMSetBlendState(d.blendAlpha.Get(), blendFactor, 0xFFFFFFFF);
+    d.ctx->OMSetDepthStencilState(d.dsNoWrite.Get(), 0);
+    for (int i : a.gridVisible) {
+      if (!a.gridSkins[i].overlayTranslucent) continue;
+      setCell(i);
+      d.ctx->DrawIndexed((UINT)d.translucentSorted.size(), 0, mesh.vertexBase);
+    }
+    d.ctx->OMSetDepthStencilState(d.dsDefault.Get(), 0);
+    d.ctx->OMSetBlendState(nullptr, blendFactor, 0xFFFFFFFF);
+  }
+  d.ctx->RSSetState(d.rs.Get());
+}
+
+// Crowd: LOD0/LOD1 are one draw per instance from the shared grid meshes,
+// LOD2 is one draw per skin from a per-frame quad buffer. Everything is
+// submitted in the order PrepareCrowdFrame produced; only changes are bound.
+static void RenderCrowd(App& a) {
+  auto& d = a.d3d;
+  if (!d.gridVb || !d.gridIb) return;
+
+  // Skin table: the grid skins, or the single loaded skin
+  a.crowdSkins.clear();
+  a.crowdSkinFlags.clear();
+  for (const SkinInfo& s : a.gridSkins) a.crowdSkins.push_back(&s);
+  if (a.crowdSkins.empty() && a.skin) a.crowdSkins.push_back(&*a.skin);
+  for (const SkinInfo* s : a.crowdSkins) {
+    uint8_t flags = s->overlayTranslucent ? CrowdSkin_Blended : 0;
+    if (ImpostorSrv(d.device.Get(), s->impostor.get())) flags |= CrowdSkin_Impostor;
+    a.crowdSkinFlags.push_back(flags);
+  }
+  if (a.crowdSkins.empty()) { a.crowdStats = CrowdStats{}; return; }
+
+  if (a.crowd.Size() != (size_t)a.crowdCount || a.crowdSkinCount != a.crowdSkins.size()) {
+    PopulateCrowd(a.crowd, (size_t)a.crowdCount, a.crowdSkins.size(), kCrowdSpacing, 1234u);
+    a.crowdSkinCount = a.crowdSkins.size();
+  }
+
+  const XMMATRIX view = MakeView(a.cam);
+  const XMMATRIX proj = MakeProj(d.fbW, d.fbH, kCrowdFarZ);
+  const XMMATRIX viewProj = view * proj;
+  static const CrowdBounds bounds = ComputeCrowdBounds(kWorldScale);
+  a.crowdStats = PrepareCrowdFrame(a.crowd, view, proj, d.fbH, bounds, a.crowdSkinFlags, a.showOverlay, a.crowdScratch);
+
+  const CrowdInstances& c = a.crowd;
+  const std::vector<uint32_t>& order = a.crowdScratch.visible;
+  const std::vector<uint32_t>& keys = a.crowdScratch.keys;
+  const XMMATRIX scale = XMMatrixScaling(kWorldScale, kWorldScale, kWorldScale);
+  float blendFactor[4]{};
+
+  auto setMvp = [&](FXMMATRIX mvp) {
+    CB0 cb{};
+    XMStoreFloat4x4(&cb.mvp, XMMatrixTranspose(mvp));
+    D3D11_MAPPED_SUBRESOURCE map{};
+    ThrowIfFailed(d.ctx->Map(d.cb.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &map), "Map(CB)");
+    memcpy(map.pData, &cb, sizeof(cb));
+    d.ctx->Unmap(d.cb.Get(), 0);
+  };
+  auto bindSkin = [&](int& bound, int sk, ID3D11ShaderResourceView* srv) {
+    if (sk == bound) return;
+    bound = sk;
+    d.ctx->PSSetShaderResources(0, 1, &srv);
+  };
+
+  // LOD ranges are contiguous in the sorted order
+  size_t lodBegin[CrowdLod_Count + 1]{};
+  for (int lod = 0; lod < CrowdLod_Count; ++lod) lodBegin[lod + 1] = lodBegin[lod] + a.crowdStats.drawnLod[lod];
+
+  UINT stride = sizeof(Vertex), offset = 0;
+  d.ctx->IASetVertexBuffers(0, 1, d.gridVb.GetAddressOf(), &stride, &offset);
+  d.ctx->IASetIndexBuffer(d.gridIb.Get(), DXGI_FORMAT_R32_UINT, 0);
+  d.ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+  // LOD0 base (+ overlay) and LOD1 merged base
+  for (int pass = 0; pass < 3; ++pass) {
+    const bool overlay = pass == 1;
+    if (overlay && !a.showOverlay) continue;
+    const CrowdLod lod = pass == 2 ? CrowdLod_Merged : CrowdLod_Full;
+    int boundSkin = -1, boundBlend = -1;
+    for (size_t i = lodBegin[lod]; i < lodBegin[lod + 1]; ++i) {
+      const uint32_t id = order[i];
+      const int sk = c.skin[id];
+      if (overlay) {
+        const int blend = (keys[i] >> 17) & 1;
+        if (blend != boundBlend) {
+          boundBlend = blend;
+          d.ctx->PSSetShader(blend ? d.ps.Get() : d.psCutout.Get(), nullptr, 0);
+          d.ctx->OMSetBlendState(blend ? d.blendAlpha.Get() : nullptr, blendFactor, 0xFFFFFFFF);
+          d.ctx->OMSetDepthStencilState(blend ? d.dsNoWrite.Get() : d.dsDefault.Get(), 0);
+        }
+      }
+      bindSkin(boundSkin, sk, SkinSrv(*a.crowdSkins[sk]));
+      setMvp(scale * XMMatrixRotationY(c.yaw[id]) * XMMatrixTranslation(c.x[id], c.y[id], c.z[id]) * viewProj);
+
+      const D3DState::GridMeshRange& mesh = d.gridMesh[c.variant[id]];
+      if (lod == CrowdLod_Merged) d.ctx->DrawIndexed(mesh.lod1Count, mesh.lod1Start, mesh.lod1VertexBase);
+      else if (!overlay)          d.ctx->DrawIndexed(mesh.baseCount, mesh.baseStart, mesh.vertexBase);
+      else                        d.ctx->DrawIndexed(mesh.overlayCount, mesh.overlayStart, mesh.vertexBase);
+    }
+    if (overlay) {
+      d.ctx->PSSetShader(d.ps.Get(), nullptr, 0);
+      d.ctx->OMSetBlendState(nullptr, blendFactor, 0xFFFFFFFF);
+      d.ctx->OMSetDepthStencilState(d.dsDefault.Get(), 0);
+    }
+  }
+
+  // LOD2: camera-facing quads, yaw-selected atlas cell, alpha-tested
+  const size_t impostors = lodBegin[CrowdLod_Count] - lodBegin[CrowdLod_Impostor];
+  if (impostors == 0) return;
+
+  static const ImpostorFrame frame = ComputeImpostorFrame();
+  const XMFLOAT3 eye = CameraEye(a.cam);
+  const float du = (float)kImpostorCellW / (float)kImpostorAtlasW;
+  const float dv = (float)kImpostorCellH / (float)kImpostorAtlasH;
+  a.impostorVerts.resize(impostors * 6);
+  Vertex* out = a.impostorVerts.data();
+  for (size_t i = lodBegin[CrowdLod_Impostor]; i < lodBegin[CrowdLod_Count]; ++i) {
+    const uint32_t id = order[i];
+    float fx = c.x[id] - eye.x, fz = c.z[id] - eye.z;
+    const float len = std::sqrt(fx * fx + fz * fz);
+    if (len > 0.0f) { fx /= len; fz /= len; } else { fz = 1.0f; }
+    const float rx = fz * frame.width * 0.5f, rz = -fx * frame.width * 0.5f;   // cross(up, forward)
+
+    const int viewIdx = ImpostorViewIndex(std::atan2(-fx, -fz) - c.yaw[id]);
+    const float u0 = (float)viewIdx * du, u1 = u0 + du;
+    const float v0 = (float)c.variant[id] * dv, v1 = v0 + dv;
+    const float y0 = c.y[id] + frame.centerY - frame.height * 0.5f, y1 = y0 + frame.height;
+    const XMFLOAT3 n(-fx, 0.0f, -fz);
+    const Vertex bl{ XMFLOAT3(c.x[id] - rx, y0, c.z[id] - rz), n, XMFLOAT2(u0, v1) };
+    const Vertex br{ XMFLOAT3(c.x[id] + rx, y0, c.z[id] + rz), n, XMFLOAT2(u1, v1) };
+    const Vertex tr{ XMFLOAT3(c.x[id] + rx, y1, c.z[id] + rz), n, XMFLOAT2(u1, v0) };
+    const Vertex tl{ XMFLOAT3(c.x[id] - rx, y1, c.z[id] - rz), n, XMFLOAT2(u0, v0) };
+    *out++ = bl; *out++ = br; *out++ = tr;   // CCW like EmitPart
+    *out++ = bl; *out++ = tr; *out++ = tl;
+  }
+
+  const UINT vertCount = (UINT)a.impostorVerts.size();
+  if (d.impostorVbCapacity < vertCount) {
+    d.impostorVbCapacity = std::max(vertCount, d.impostorVbCapacity * 2);
+    D3D11_BUFFER_DESC bd{};
+    bd.ByteWidth = d.impostorVbCapacity * (UINT)sizeof(Vertex);
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    d.impostorVb.Reset();
+    ThrowIfFailed(d.device->CreateBuffer(&bd, nullptr, &d.impostorVb), "CreateVB(impostor)");
+  }
+  D3D11_MAPPED_SUBRESOURCE map{};
+  ThrowIfFailed(d.ctx->Map(d.impostorVb.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &map), "Map(VB impostor)");
+  memcpy(map.pData, a.impostorVerts.data(), vertCount * sizeof(Vertex));
+  d.ctx->Unmap(d.impostorVb.Get(), 0);
+
+  d.ctx->IASetVertexBuffers(0, 1, d.impostorVb.GetAddressOf(), &stride, &offset);
+  d.ctx->PSSetShader(d.psCutout.Get(), nullptr, 0);
+  setMvp(viewProj);
+  int boundSkin = -1;
+  UINT runStart = 0;
+  for (size_t i = lodBegin[CrowdLod_Impostor]; i <= lodBegin[CrowdLod_Count]; ++i) {
+    const UINT vi = (UINT)(i - lodBegin[CrowdLod_Impostor]) * 6;
+    const bool end = i == lodBegin[CrowdLod_Count];
+    const int sk = end ? -1 : c.skin[order[i]];
+    if (!end && sk == boundSkin) continue;
+    if (boundSkin >= 0) d.ctx->Draw(vi - runStart, runStart);
+    if (end) break;
+    bindSkin(boundSkin, sk, a.crowdSkins[sk]->impostor->srv.Get());
+    runStart = vi;
+  }
+  d.ctx->PSSetShader(d.ps.Get(), nullptr, 0);
+}
+
+// Only the rows in view are submitted; thumbnails are shown at twice their
+// atlas size. Left click loads a skin, right click adds it to the grid.
+static void DrawGallery(App& a) {
+  SkinGallery& g = *a.gallery;
+  ImGui::SetNextWindowSize(ImVec2(620.0f, 720.0f), ImGuiCond_FirstUseEver);
+  bool open = true;
+  if (ImGui::Begin("Skin gallery", &open)) {
+    const GalleryStats st = g.Stats();
+    ImGui::Text("%zu skins%s; %zu / %zu thumbnails resident, %zu queued", g.Size(), st.listing ? " (listing...)" : "",
+                st.resident, st.cells, st.queued);
+    ImGui::Text("Uploaded %llu, evicted %llu, cancelled %llu, unreadable %llu", (unsigned long long)st.uploaded,
+                (unsigned long long)st.evicted, (unsigned long long)st.cancelled, (unsigned long long)st.failed);
+    if (ImGui::SliderInt("Thumbnail VRAM (MB)", &a.galleryBudgetMB, 4, 128)) g.SetBudget((size_t)a.galleryBudgetMB << 20);
+
+    ImGui::BeginChild("thumbs");
+    const ImVec2 thumb((float)kThumbW * 2.0f, (float)kThumbH * 2.0f);
+    const ImVec2 spacing = ImGui::GetStyle().ItemSpacing;
+    const size_t cols = (size_t)std::max(1.0f, (ImGui::GetContentRegionAvail().x + spacing.x) / (thumb.x + spacing.x));
+    const size_t rows = (g.Size() + cols - 1) / cols;
+    const float rowH = thumb.y + spacing.y;
+
+    // The wanted range comes from the scroll position, not the clipper,
+    // which may also step over a far-away focused row
+    const size_t firstRow = (size_t)(ImGui::GetScrollY() / rowH);
+    const size_t viewRows = (size_t)(ImGui::GetWindowHeight() / rowH) + 2;
+    g.Update(a.d3d.device.Get(), a.d3d.ctx.Get(), firstRow * cols, (firstRow + viewRows) * cols);
+
+    ImGuiListClipper clipper;
+    clipper.Begin((int)rows, rowH);
+    while (clipper.Step()) {
+      for (size_t row = (size_t)clipper.DisplayStart; row < (size_t)clipper.DisplayEnd; ++row) {
+        for (size_t col = 0; col < cols && row * cols + col < g.Size(); ++col) {
+          const size_t i = row * cols + col;
+          if (col) ImGui::SameLine();
+          float uv[4];
+          if (g.Thumb(i, uv)) ImGui::Image((ImTextureID)(intptr_t)g.Srv(), thumb, ImVec2(uv[0], uv[1]), ImVec2(uv[2], uv[3]));
+          else ImGui::Dummy(thumb);
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("%s%s", NarrowFromWide(g.Path(i).filename().wstring()).c_str(), g.Failed(i) ? " (not a skin)" : "");
+          }
+          if (ImGui::IsItemClicked(ImGuiMouseButton_Left)) LoadSkinIntoApp(a, g.Path(i).wstring());
+          if (ImGui::IsItemClicked(ImGuiMouseButton_Right)) AddSkinToGrid(a, g.Path(i).wstring());
+        }
+      }
+    }
+    clipper.End();
+    ImGui::EndChild();
+  }
+  ImGui::End();
+  if (!open) CloseGallery(a);
+}
+
 static void Render(App& a) {
   auto& d = a.d3d;
 
@@ -1187,10 +2211,17 @@ static void Render(App& a) {
   }
 
   XMMATRIX view = MakeView(a.cam);
-  XMMATRIX proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(55.0f), (float)d.fbW / (float)d.fbH, 0.1f, 500.0f);
-  XMMATRIX world = XMMatrixScaling(0.9f, 0.9f, 0.9f) * XMMatrixTranslation(0, 0, 0);
+  XMMATRIX proj = MakeProj(d.fbW, d.fbH);
+  XMMATRIX world = MakeWorld();
   XMMATRIX mvp = world * view * proj;
 
+  // Eye in model space, for sorting translucent faces
+  XMFLOAT3 eyeModel;
+  {
+    const XMFLOAT3 e = CameraEye(a.cam);
+    XMStoreFloat3(&eyeModel, XMVector3TransformCoord(XMVectorSet(e.x, e.y, e.z, 1.0f), XMMatrixInverse(nullptr, world)));
+  }
+
   CB0 cb{};
   XMStoreFloat4x4(&cb.mvp, XMMatrixTranspose(mvp));
 
@@ -1202,21 +2233,42 @@ static void Render(App& a) {
   d.ctx->VSSetConstantBuffers(0, 1, d.cb.GetAddressOf());
 
   ID3D11ShaderResourceView* srv = nullptr;
-  if (a.skin) srv = a.skin->srv.Get();
+  if (a.skin) srv = SkinSrv(*a.skin);
   d.ctx->PSSetShaderResources(0, 1, &srv);
 
+  if (a.crowdMode) RenderCrowd(a);
+  else if (a.gridMode) RenderGridCells(a);
+  const bool single = !a.gridMode && !a.crowdMode;
+
   // Draw base
-  if (d.vb && d.ib && a.skin && d.ibCountBase > 0) {
+  if (single && d.vb && d.ib && a.skin && d.ibCountBase > 0) {
     float blendFactor[4]{};
     d.ctx->OMSetBlendState(nullptr, blendFactor, 0xFFFFFFFF);
     d.ctx->DrawIndexed(d.ibCountBase, 0, 0);
   }
 
-  // Draw overlay
-  if (a.showOverlay && d.vb && d.ib && a.skin && d.ibCountOverlay > 0) {
+  // Draw overlay: binary-alpha faces are alpha-tested (no blending, depth writes on)
+  if (single && a.showOverlay && d.vb && d.ib && a.skin && d.ibCountOverlay > 0) {
+    d.ctx->PSSetShader(d.psCutout.Get(), nullptr, 0);
+    d.ctx->DrawIndexed(d.ibCountOverlay, d.ibOffsetOverlay, 0);
+    d.ctx->PSSetShader(d.ps.Get(), nullptr, 0);
+  }
+
+  // Truly translucent faces: blended back to front, no depth writes
+  if (single && a.showOverlay && d.vb && !d.translucentIdx.empty() && a.skin) {
+    SortFacesBackToFront(d.translucentCentroids, d.translucentIdx, eyeModel, d.translucentOrder, d.translucentSorted);
+
+    D3D11_MAPPED_SUBRESOURCE tmap{};
+    ThrowIfFailed(d.ctx->Map(d.ibTranslucent.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &tmap), "Map(IB translucent)");
+    memcpy(tmap.pData, d.translucentSorted.data(), d.translucentSorted.size() * sizeof(uint32_t));
+    d.ctx->Unmap(d.ibTranslucent.Get(), 0);
+
     float blendFactor[4]{};
+    d.ctx->IASetIndexBuffer(d.ibTranslucent.Get(), DXGI_FORMAT_R32_UINT, 0);
     d.ctx->OMSetBlendState(d.blendAlpha.Get(), blendFactor, 0xFFFFFFFF);
-    d.ctx->DrawIndexed(d.ibCountOverlay, d.ibOffsetOverlay, 0);
+    d.ctx->OMSetDepthStencilState(d.dsNoWrite.Get(), 0);
+    d.ctx->DrawIndexed((UINT)d.translucentSorted.size(), 0, 0);
+    d.ctx->OMSetDepthStencilState(d.dsDefault.Get(), 0);
     d.ctx->OMSetBlendState(nullptr, blendFactor, 0xFFFFFFFF);
   }
 
@@ -1233,43 +2285,224 @@ static void Render(App& a) {
     ImGui::Text("File: %s", NarrowFromWide(a.skin->path).c_str());
     ImGui::Text("Size: %ux%u", a.skin->width, a.skin->height);
     ImGui::Text("Scale: %u (64px reference)", a.skin->scale);
-    ImGui::Text("Format: %s", a.skin->legacy64x32 ? "Legacy 64x32" : "Modern (64x64+) / Scaled");
+    ImGui::Text("Format: %s", a.skin->legacy64x32 ? "Legacy 64x32 (normalized to 64x64)" : "Modern (64x64+) / Scaled");
     ImGui::Text("Alpha: %s", a.skin->hasAlpha ? "present" : "opaque/none detected");
+    ImGui::Text("Perceptual hash: %016llx", (unsigned long long)a.skin->phash);
+    std::string colors;
+    for (int r = 0; r < HistRegion_Count; ++r) {
+      const uint8_t* bins = a.skin->colorHist.bins[r];
+      const uint8_t* top = std::max_element(bins, bins + kHistBins);
+      if (!*top) continue;
+      colors += std::string(colors.empty() ? "" : ", ") + kHistRegionNames[r] + " " + kHistBinNames[top - bins];
+    }
+    ImGui::TextWrapped("Colours: %s", colors.empty() ? "-" : colors.c_str());
     ImGui::Separator();
   } else {
     ImGui::Text("No skin loaded.");
   }
 
-  ImGui::Checkbox("Show overlay (hat/jacket/sleeves/pants)", &a.showOverlay);
+  if (ImGui::Checkbox("Show overlay (hat/jacket/sleeves/pants)", &a.showOverlay)) {
+    OnToggle(a, SessionEv::ShowOverlay);
+  }
 
   if (ImGui::Checkbox("Point filtering (pixel-crisp)", &a.pointFilter)) {
-    ApplySampler(a);
+    OnToggle(a, SessionEv::PointFilter);
   }
 
   if (ImGui::Checkbox("Slim arms (Alex)", &a.slimArms)) {
-    RebuildMeshIfSkinLoaded(a);
+    OnToggle(a, SessionEv::SlimArms);
+  }
+
+  ImGui::Separator();
+  if (ImGui::Checkbox("Grid mode (compare skins)", &a.gridMode)) {
+    OnToggle(a, SessionEv::GridMode);
+  }
+  if (a.gridMode) {
+    ImGui::Text("Grid: %zu / %zu skins", a.gridSkins.size(), App::kMaxGridSkins);
+    const GridLayout g = ComputeGridLayout((int)a.gridSkins.size(), a.d3d.fbW, a.d3d.fbH, kGridMinCell, kGridGap);
+    const int maxScroll = GridMaxScroll(g, a.d3d.fbH);
+    if (maxScroll > 0) ImGui::SliderInt("Grid scroll", &a.gridScroll, 0, maxScroll);
+    if (ImGui::Button("Clear grid")) ClearGrid(a);
+    if (ImGui::Checkbox("Palette storage for grid skins", &a.paletteGridSkins)) {
+      OnToggle(a, SessionEv::PaletteGridSkins);
+    }
+    size_t bytes = 0, rgbaBytes = 0;
+    for (const SkinInfo& s : a.gridSkins) {
+      bytes += SkinPixelBytes(s);
+      rgbaBytes += (size_t)s.width * s.height * 4;
+    }
+    ImGui::Text("Grid pixels: %zu KB (RGBA: %zu KB)", bytes / 1024, rgbaBytes / 1024);
+    const ImpostorBaker::Stats is = a.impostorBaker.GetStats();
+    ImGui::Text("Impostors: %llu of %llu shared by identical skins", (unsigned long long)is.shared,
+                (unsigned long long)is.requested);
+  }
+
+  if (ImGui::Checkbox("Crowd mode (grid skins, or the loaded skin)", &a.crowdMode)) {
+    OnToggle(a, SessionEv::CrowdMode);
   }
+  if (a.crowdMode) {
+    if (ImGui::SliderInt("Crowd size", &a.crowdCount, 1, 20000)) a.recorder.Value(SessionEv::CrowdSize, (uint64_t)a.crowdCount);
+    const CrowdStats& cs = a.crowdStats;
+    ImGui::Text("Instances %u: drawn %u, culled %u, state changes %u", cs.instances, cs.drawn, cs.culled, cs.stateChanges);
+    ImGui::Text("LOD full %u, merged %u, impostor %u; %u draw calls",
+                cs.drawnLod[CrowdLod_Full], cs.drawnLod[CrowdLod_Merged], cs.drawnLod[CrowdLod_Impostor], cs.drawCalls);
+  }
+
+  ImGui::Separator();
+  if (ImGui::Checkbox("Paint mode", &a.paintMode)) OnToggle(a, SessionEv::PaintMode);
+  if (a.paintMode) {
+    if (ImGui::Checkbox("Paint overlay layer", &a.paintOverlay)) OnToggle(a, SessionEv::PaintOverlay);
+    bool brushChanged = ImGui::SliderInt("Brush size", &a.brushSize, 1, 32);
+    brushChanged |= ImGui::ColorEdit4("Brush color", a.brushColor);
+    if (brushChanged) a.recorder.Brush(a.brushSize, a.brushColor);
+  }
+  ImGui::Separator();
+
+  ImGui::Text("Model: %s", ActiveModel(a).name.c_str());
+  if (a.customModel && ImGui::Button("Use player model")) UsePlayerModel(a);
 
   ImGui::Separator();
   ImGui::Text("Controls:");
   ImGui::BulletText("Drag & drop a .png skin onto the window");
-  ImGui::BulletText("Hold Left Mouse + drag: orbit");
+  ImGui::BulletText("Drag & drop a geometry .json to use a custom model");
+  ImGui::BulletText("Drop several skins at once to compare them in a grid");
+  ImGui::BulletText("Drop a folder (or a .txt list of paths) to browse it in the gallery");
+  ImGui::BulletText("Hold Left Mouse + drag: orbit (Right Mouse in paint mode)");
+  ImGui::BulletText("Paint mode: Left Mouse paints texels");
   ImGui::BulletText("Mouse wheel: zoom");
   ImGui::End();
 
+  if (a.gallery) DrawGallery(a);
+
   ImGui::Render();
   ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 
-  d.swap->Present(1, 0);
+  d.swap->Present(a.presentInterval, 0);
+}
+
+// ------------------------------
+// Session replay (--replay)
+// ------------------------------
+// MinecraftSkinViewer.exe --record session.skrec
+// MinecraftSkinViewer.exe --replay session.skrec [--max-speed] [--timings out.csv]
+// Replay feeds the recorded events through the same handlers as live input,
+// in a window that is never shown. Each frame waits for the GPU (event query)
+// so the timings cover the whole frame, not just command submission.
+struct SessionArgs {
+  std::wstring recordPath;
+  std::wstring replayPath;
+  std::wstring timingsPath;   // default: <replay>.csv
+  bool maxSpeed = false;
+};
+
+static SessionArgs ParseSessionArgs(int argc, wchar_t** argv) {
+  SessionArgs s;
+  for (int k = 1; k < argc; ++k) {
+    const bool hasValue = k + 1 < argc;
+    if      (!wcscmp(argv[k], L"--record") && hasValue)  s.recordPath = argv[++k];
+    else if (!wcscmp(argv[k], L"--replay") && hasValue)  s.replayPath = argv[++k];
+    else if (!wcscmp(argv[k], L"--timings") && hasValue) s.timingsPath = argv[++k];
+    else if (!wcscmp(argv[k], L"--max-speed"))           s.maxSpeed = true;
+  }
+  if (!s.replayPath.empty() && s.timingsPath.empty()) {
+    s.timingsPath = std::filesystem::path(s.replayPath).replace_extension(L".csv").wstring();
+  }
+  return s;
+}
+
+static void RunReplay(App& app, const Session& session, const std::filesystem::path& timingsPath, bool maxSpeed) {
+  using Clock = std::chrono::steady_clock;
+  auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+  app.presentInterval = maxSpeed ? 0 : 1;
+  ComPtr<ID3D11Query> gpuDone;
+  D3D11_QUERY_DESC qd{};
+  qd.Query = D3D11_QUERY_EVENT;
+  ThrowIfFailed(app.d3d.device->CreateQuery(&qd, &gpuDone), "CreateQuery(event)");
+
+  struct FrameTiming { double recordedMs, inputMs, renderMs; };
+  std::vector<FrameTiming> timings;
+  timings.reserve(session.frames.size());
+
+  const Clock::time_point start = Clock::now();
+  MSG msg{};
+  bool quit = false;
+  for (const SessionFrame& f : session.frames) {
+    while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+      if (msg.message == WM_QUIT) quit = true;
+      TranslateMessage(&msg);
+      DispatchMessageW(&msg);
+    }
+    if (quit) break;
+    if (!maxSpeed) std::this_thread::sleep_until(start + std::chrono::microseconds(f.timeUs));
+
+    const Clock::time_point t0 = Clock::now();
+    for (const SessionEvent& e : f.events) ApplySessionEvent(app, e);
+    ProcessPaintSamples(app);
+    const Clock::time_point t1 = Clock::now();
+    Render(app);
+    app.d3d.ctx->End(gpuDone.Get());
+    while (app.d3d.ctx->GetData(gpuDone.Get(), nullptr, 0, 0) == S_FALSE) std::this_thread::yield();
+    const Clock::time_point t2 = Clock::now();
+
+    timings.push_back(FrameTiming{ (double)f.timeUs / 1000.0, ms(t1 - t0), ms(t2 - t1) });
+  }
+
+  std::ofstream out(timingsPath, std::ios::trunc);
+  if (!out) throw std::runtime_error("Replay: cannot open " + timingsPath.string() + " for writing");
+  out << "frame,recorded_ms,input_ms,render_ms,total_ms\n";
+  std::vector<double> totals;
+  totals.reserve(timings.size());
+  for (size_t i = 0; i < timings.size(); ++i) {
+    const FrameTiming& t = timings[i];
+    totals.push_back(t.inputMs + t.renderMs);
+    out << i << ',' << t.recordedMs << ',' << t.inputMs << ',' << t.renderMs << ',' << totals.back() << '\n';
+  }
+  if (!totals.empty()) {
+    std::sort(totals.begin(), totals.end());
+    auto pct = [&](double q) { return totals[std::min(totals.size() - 1, (size_t)(q * (double)totals.size()))]; };
+    double sum = 0.0;
+    for (double t : totals) sum += t;
+    out << "# frames " << totals.size() << ", mean " << sum / (double)totals.size()
+        << " ms, p50 " << pct(0.50) << " ms, p95 " << pct(0.95) << " ms, p99 " << pct(0.99)
+        << " ms, max " << totals.back() << " ms\n";
+  }
+  if (!out) throw std::runtime_error("Replay: write failed for " + timingsPath.string());
 }
 
 // ------------------------------
 // Main
 // ------------------------------
+// A WIN32-subsystem program has no console of its own. When started with
+// arguments from a terminal, output and errors go to that terminal; the
+// headless tools live in MinecraftSkinViewerCli (skin_cli.cpp).
+static bool AttachParentConsole() {
+  if (!AttachConsole(ATTACH_PARENT_PROCESS)) return false;
+  FILE* f = nullptr;
+  freopen_s(&f, "CONOUT$", "w", stdout);
+  freopen_s(&f, "CONOUT$", "w", stderr);
+  return true;
+}
+
 int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int nCmdShow) {
+  bool console = false;
   try {
     ThrowIfFailed(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED), "CoInitializeEx");
 
+    SessionArgs sessionArgs;
+    {
+      int argc = 0;
+      wchar_t** argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+      try {
+        if (argv && argc > 1) console = AttachParentConsole();
+        if (argv) sessionArgs = ParseSessionArgs(argc, argv);
+      } catch (...) {
+        LocalFree(argv);
+        throw;
+      }
+      LocalFree(argv);
+    }
+
     WNDCLASSW wc{};
     wc.lpfnWndProc = WndProc;
     wc.hInstance = hInst;
@@ -1277,7 +2510,11 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int nCmdShow) {
     wc.hCursor = LoadCursor(nullptr, IDC_ARROW);
     RegisterClassW(&wc);
 
-    RECT r{0, 0, 1280, 720};
+    std::optional<Session> replay;
+    if (!sessionArgs.replayPath.empty()) replay = LoadSession(sessionArgs.replayPath);
+
+    // Replays use the recorded framebuffer size so timings compare like for like
+    RECT r{0, 0, replay ? std::max(1, replay->fbW) : 1280, replay ? std::max(1, replay->fbH) : 720};
     AdjustWindowRect(&r, WS_OVERLAPPEDWINDOW, FALSE);
 
     HWND hwnd = CreateWindowW(
@@ -1290,8 +2527,10 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int nCmdShow) {
     );
     if (!hwnd) throw std::runtime_error("CreateWindowW failed");
 
-    ShowWindow(hwnd, nCmdShow);
-    UpdateWindow(hwnd);
+    if (!replay) {
+      ShowWindow(hwnd, nCmdShow);
+      UpdateWindow(hwnd);
+    }
 
     App app;
     g_app = &app;
@@ -1300,6 +2539,7 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int nCmdShow) {
     DragAcceptFiles(hwnd, TRUE);
 
     InitD3D(app.d3d);
+    ReserveMeshBuffers(app.d3d, PlayerModel(false));
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -1311,9 +2551,13 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int nCmdShow) {
     ImGui_ImplDX11_Init(app.d3d.device.Get(), app.d3d.ctx.Get());
 
     ApplySampler(app);
+    UploadGridMeshes(app.d3d);
+
+    if (replay) RunReplay(app, *replay, sessionArgs.timingsPath, sessionArgs.maxSpeed);
+    else if (!sessionArgs.recordPath.empty()) app.recorder.Start(sessionArgs.recordPath, app.d3d.fbW, app.d3d.fbH);
 
     MSG msg{};
-    bool running = true;
+    bool running = !replay;
 
     while (running) {
       DWORD timeoutMs = app.minimized ? INFINITE : 16;
@@ -1323,6 +2567,7 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int nCmdShow) {
         QS_ALLINPUT,
         MWMO_INPUTAVAILABLE
       );
+      app.recorder.BeginFrame();
 
       while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
         if (msg.message == WM_QUIT) { running = false; break; }
@@ -1338,35 +2583,38 @@ ImGuiIO& iio = ImGui::GetIO();
 
 // ✅ Zoom: use our own wheel accumulator (reliable even when ImGui wheel is flaky)
 if (app.wheelAccum != 0.0f) {
-  app.cam.dist = Clamp(app.cam.dist - app.wheelAccum * 4.0f, 20.0f, 200.0f);
+  ApplyZoom(app, app.wheelAccum);
   app.wheelAccum = 0.0f;
 }
 
 // Orbit only when ImGui isn't using the mouse
 if (!iio.WantCaptureMouse) {
-  if (ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+  const ImGuiMouseButton orbitButton = app.paintMode ? ImGuiMouseButton_Right : ImGuiMouseButton_Left;
+  if (ImGui::IsMouseDown(orbitButton)) {
     if (!app.rotating) {
       app.rotating = true;
       GetCursorPos(&app.lastMouse);
     } else {
       POINT p{};
       GetCursorPos(&p);
-      const float dx = (float)(p.x - app.lastMouse.x);
-      const float dy = (float)(p.y - app.lastMouse.y);
+      const int dx = p.x - app.lastMouse.x;
+      const int dy = p.y - app.lastMouse.y;
       app.lastMouse = p;
 
-      app.cam.yaw += dx * 0.01f;
-      app.cam.pitch = Clamp(app.cam.pitch + dy * 0.01f, -1.2f, 1.2f);
+      ApplyOrbit(app, dx, dy);
     }
   } else {
     app.rotating = false;
   }
 }
 
+ProcessPaintSamples(app);
+
 Render(app);
 
     }
 
+    app.recorder.Stop();
     DragAcceptFiles(hwnd, FALSE);
 
     ImGui_ImplDX11_Shutdown();
@@ -1376,7 +2624,8 @@ Render(app);
     CoUninitialize();
     return 0;
   } catch (const std::exception& e) {
-    MessageBoxA(nullptr, e.what(), "Fatal error", MB_ICONERROR | MB_OK);
+    if (console) fprintf(stderr, "error: %s\n", e.what());
+    else MessageBoxA(nullptr, e.what(), "Fatal error", MB_ICONERROR | MB_OK);
     return 1;
   }
 }
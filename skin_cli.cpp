@@ -0,0 +1,1486 @@
+// ==============================
+// File: src/skin_cli.cpp
+// ==============================
+// MinecraftSkinViewerCli: the headless commands (render, batch render,
+// benchmarks, indexes, export) as a console program. Builds without Windows
+// headers, so it runs on any host with a C++20 compiler and DirectXMath.
+#include "skin_core.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <unordered_set>
+#include <optional>
+#include <emmintrin.h>
+
+#ifdef SKIN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// ------------------------------
+// Staged pipeline (bounded lock-free queues)
+// ------------------------------
+// A source stage on its own thread feeds a chain of stages. Each stage has its
+// own workers and a bounded input queue. A worker waits when the next queue is
+// full, so a slow stage holds back everything upstream of it and at most
+// sum(capacity + workers) items exist at once. Per stage, the workers' time is
+// split into busy (in the stage function), starved (waiting for input) and
+// blocked (waiting for room downstream), and the input depth is sampled on
+// every pop.
+
+// Bounded multi-producer/multi-consumer ring (D. Vyukov's design). Every cell
+// carries a sequence number, so pushing or popping claims a cell with one CAS
+// and takes no lock.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : cells_(std::max<size_t>(1, capacity)) {
+    for (size_t i = 0; i < cells_.size(); ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Moves from `v` only on success.
+  bool TryPush(T& v) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& c = cells_[pos % cells_.size()];
+      const intptr_t dif = (intptr_t)c.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (dif == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          c.value = std::move(v);
+          c.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;                  // full
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPop(T& v) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& c = cells_[pos % cells_.size()];
+      const intptr_t dif = (intptr_t)c.seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          v = std::move(c.value);
+          c.seq.store(pos + cells_.size(), std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;                  // empty
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t Capacity() const { return cells_.size(); }
+
+  // Approximate while other threads push or pop
+  size_t Depth() const {
+    const size_t t = tail_.load(std::memory_order_relaxed), h = head_.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq{ 0 };
+    T value{};
+  };
+  std::vector<Cell> cells_;
+  alignas(64) std::atomic<size_t> tail_{ 0 };
+  alignas(64) std::atomic<size_t> head_{ 0 };
+};
+
+// Spins briefly, then yields, then sleeps: cheap when the other side is
+// about to catch up, idle when it is not.
+class Backoff {
+public:
+  void Wait() {
+    if (n_ < 64) _mm_pause();
+    else if (n_ < 96) std::this_thread::yield();
+    else std::this_thread::sleep_for(std::chrono::microseconds(200));
+    ++n_;
+  }
+  void Reset() { n_ = 0; }
+
+private:
+  int n_ = 0;
+};
+
+struct StageMetrics {
+  std::string name;
+  unsigned workers = 0;
+  uint64_t items = 0, dropped = 0;     // processed; dropped by the stage or by an exception
+  double busySec = 0.0, starvedSec = 0.0, blockedSec = 0.0; // summed over workers
+  size_t capacity = 0, maxDepth = 0;   // input queue
+  double meanDepth = 0.0;
+  std::string lastError;
+};
+
+template <typename Item>
+class StagedPipeline {
+public:
+  using Emit = std::function<bool(Item&&)>;        // false: stop producing
+  using Source = std::function<void(const Emit&)>;
+  using Process = std::function<bool(Item&)>;      // false: drop the item
+
+  StagedPipeline(std::string sourceName, Source source) : source_(std::move(source)) {
+    stages_.push_back(std::make_unique<Stage>());
+    stages_[0]->m.name = std::move(sourceName);
+    stages_[0]->m.workers = 1;
+  }
+
+  void AddStage(std::string name, unsigned workers, size_t capacity, Process fn) {
+    auto s = std::make_unique<Stage>();
+    s->m.name = std::move(name);
+    s->m.workers = std::max(1u, workers);
+    s->fn = std::move(fn);
+    s->in = std::make_unique<BoundedQueue<Item>>(capacity);
+    s->m.capacity = s->in->Capacity();
+    stages_.push_back(std::move(s));
+  }
+
+  // Blocks until the source is exhausted and every stage has drained. An
+  // exception from the source is rethrown after all threads have stopped.
+  void Run() {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point t0 = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t k = 1; k < stages_.size(); ++k) {
+      stages_[k]->live.store(stages_[k]->m.workers, std::memory_order_relaxed);
+      for (unsigned w = 0; w < stages_[k]->m.workers; ++w) threads.emplace_back([this, k] { Work(k); });
+    }
+
+    std::exception_ptr error;
+    threads.emplace_back([&] {
+      Stage& s = *stages_[0];
+      Counters c;
+      try {
+        Clock::time_point t = Clock::now();
+        source_([&](Item&& item) {
+          const Clock::time_point made = Clock::now();
+          c.busy += made - t;
+          ++c.items;
+          Forward(0, item, c);
+          t = Clock::now();
+          return true;
+        });
+      } catch (...) {
+        error = std::current_exception();
+      }
+      s.Add(c);
+      Finish(0);
+    });
+    for (std::thread& t : threads) t.join();
+    wallSec_ = std::chrono::duration<double>(Clock::now() - t0).count();
+    if (error) std::rethrow_exception(error);
+  }
+
+  double WallSeconds() const { return wallSec_; }
+
+  std::vector<StageMetrics> Metrics() const {
+    std::vector<StageMetrics> out;
+    for (const auto& s : stages_) {
+      StageMetrics m = s->m;
+      m.items = s->items.load();
+      m.dropped = s->dropped.load();
+      m.busySec = (double)s->busyNs.load() * 1e-9;
+      m.starvedSec = (double)s->starvedNs.load() * 1e-9;
+      m.blockedSec = (double)s->blockedNs.load() * 1e-9;
+      m.maxDepth = s->maxDepth.load();
+      m.meanDepth = m.items + m.dropped ? (double)s->depthSum.load() / (double)(m.items + m.dropped) : 0.0;
+      std::lock_guard<std::mutex> lock(s->errorMutex);
+      m.lastError = s->lastError;
+      out.push_back(std::move(m));
+    }
+    return out;
+  }
+
+private:
+  // Per worker, added to the stage when the worker exits
+  struct Counters {
+    std::chrono::steady_clock::duration busy{}, starved{}, blocked{};
+    uint64_t items = 0, dropped = 0, depthSum = 0;
+    size_t maxDepth = 0;
+  };
+
+  struct Stage {
+    StageMetrics m;
+    Process fn;
+    std::unique_ptr<BoundedQueue<Item>> in;
+    std::atomic<unsigned> live{ 0 };
+    std::atomic<bool> inputDone{ false };
+    std::atomic<uint64_t> items{ 0 }, dropped{ 0 }, busyNs{ 0 }, starvedNs{ 0 }, blockedNs{ 0 }, depthSum{ 0 };
+    std::atomic<size_t> maxDepth{ 0 };
+    mutable std::mutex errorMutex;
+    std::string lastError;
+
+    void Add(const Counters& c) {
+      auto ns = [](std::chrono::steady_clock::duration d) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+      };
+      items += c.items;
+      dropped += c.dropped;
+      busyNs += ns(c.busy);
+      starvedNs += ns(c.starved);
+      blockedNs += ns(c.blocked);
+      depthSum += c.depthSum;
+      size_t prev = maxDepth.load();
+      while (prev < c.maxDepth && !maxDepth.compare_exchange_weak(prev, c.maxDepth)) {}
+    }
+  };
+
+  // Hands `item` to stage k + 1, waiting while its queue is full.
+  void Forward(size_t k, Item& item, Counters& c) {
+    if (k + 1 >= stages_.size()) return; // the last stage is the sink
+    BoundedQueue<Item>& q = *stages_[k + 1]->in;
+    if (q.TryPush(item)) return;
+    const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    Backoff backoff;
+    while (!q.TryPush(item)) backoff.Wait();
+    c.blocked += std::chrono::steady_clock::now() - t;
+  }
+
+  // The last worker of stage k closes the input of stage k + 1.
+  void Finish(size_t k) {
+    if (k + 1 < stages_.size()) stages_[k + 1]->inputDone.store(true, std::memory_order_release);
+  }
+
+  void Work(size_t k) {
+    using Clock = std::chrono::steady_clock;
+    Stage& s = *stages_[k];
+    Counters c;
+    Item item{};
+    for (;;) {
+      if (!s.in->TryPop(item)) {
+        const Clock::time_point t = Clock::now();
+        Backoff backoff;
+        bool got = false;
+        for (;;) {
+          // Everything upstream pushed before closing, so one more pop settles it
+          const bool done = s.inputDone.load(std::memory_order_acquire);
+          if ((got = s.in->TryPop(item)) || done) break;
+          backoff.Wait();
+        }
+        c.starved += Clock::now() - t;
+        if (!got) break;
+      }
+      const size_t depth = s.in->Depth();
+      c.depthSum += depth;
+      c.maxDepth = std::max(c.maxDepth, depth);
+
+      const Clock::time_point t = Clock::now();
+      bool keep = false;
+      try {
+        keep = s.fn(item);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(s.errorMutex);
+        s.lastError = e.what();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(s.errorMutex);
+        s.lastError = "unknown exception";
+      }
+      c.busy += Clock::now() - t;
+      if (keep) {
+        ++c.items;
+        Forward(k, item, c);
+      } else {
+        ++c.dropped;
+      }
+      item = Item{};                   // release what the item holds before waiting again
+    }
+    s.Add(c);
+    if (s.live.fetch_sub(1, std::memory_order_acq_rel) == 1) Finish(k);
+  }
+
+  Source source_;
+  std::vector<std::unique_ptr<Stage>> stages_;
+  double wallSec_ = 0.0;
+};
+
+// Table of StagedPipeline::Metrics. Utilization is busy time over the
+// stage's worker-seconds; the stage with the highest one bounds throughput.
+static void PrintStageMetrics(const std::vector<StageMetrics>& stages, double wallSec) {
+  printf("  %-8s %7s %8s %8s %7s %8s %8s %11s\n", "stage", "workers", "items", "dropped", "util", "starved", "blocked", "queue");
+  for (const StageMetrics& m : stages) {
+    const double workerSec = wallSec * m.workers;
+    auto pct = [&](double s) { return workerSec > 0.0 ? 100.0 * s / workerSec : 0.0; };
+    char queue[32] = "-";
+    if (m.capacity) snprintf(queue, sizeof(queue), "%.1f/%zu/%zu", m.meanDepth, m.maxDepth, m.capacity);
+    printf("  %-8s %7u %8llu %8llu %6.1f%% %7.1f%% %7.1f%% %11s\n", m.name.c_str(), m.workers, (unsigned long long)m.items,
+           (unsigned long long)m.dropped, pct(m.busySec), pct(m.starvedSec), pct(m.blockedSec), queue);
+    if (!m.lastError.empty()) printf("           last error: %s\n", m.lastError.c_str());
+  }
+}
+
+// ------------------------------
+// Headless layer compositing (--composite)
+// ------------------------------
+// MinecraftSkinViewerCli --composite out.png base.png [layer.png ...]
+// Stacks the layers bottom first with SkinCompositor and writes the skin.
+// Also reports the cost of a full composite and of re-editing the top layer.
+static bool RunCompositeFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--composite") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--composite needs <out.png> <layer.png>...");
+  const std::wstring outPath = argv[i + 1];
+
+  std::vector<std::vector<uint8_t>> layers;
+  uint32_t size = 0;
+  for (int k = i + 2; k < argc && wcsncmp(argv[k], L"--", 2) != 0; ++k) {
+    uint32_t w = 0, h = 0;
+    layers.push_back(DecodePngRgba(std::filesystem::path(argv[k]), w, h));
+    if (w != h || (w % 64) != 0 || (size && w != size))
+      throw std::runtime_error("--composite: " + NarrowFromWide(argv[k]) + " is " + std::to_string(w) + "x" +
+                               std::to_string(h) + ", layers must all be the same 64k x 64k size");
+    size = w;
+  }
+  if (layers.empty()) throw std::runtime_error("--composite needs at least one layer");
+
+  SkinCompositor comp(size / 64);
+  std::vector<uint64_t> ids;
+  for (size_t l = 0; l < layers.size(); ++l) {
+    comp.SetLayer(l, layers[l].data());
+    ids.push_back(l);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point t0 = Clock::now();
+  const SkinInfo& skin = comp.Composite(ids);
+  const double fullUs = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+  WritePngRgba(outPath, skin.rgba, (int)skin.width, (int)skin.height);
+
+  const int kEdits = 1000;
+  const uint64_t tiles0 = comp.GetStats().tiles;
+  const Clock::time_point t1 = Clock::now();
+  for (int e = 0; e < kEdits; ++e) comp.SetLayer(ids.back(), layers.back().data());
+  const double editUs = std::chrono::duration<double, std::micro>(Clock::now() - t1).count() / kEdits;
+
+  printf("composite: %ux%u from %zu layers, full %.1f us, top-layer edit %.1f us (%llu of %u tiles)\n",
+         size, size, layers.size(), fullUs, editUs,
+         (unsigned long long)((comp.GetStats().tiles - tiles0) / kEdits), kCompositeTiles * kCompositeTiles);
+  return true;
+}
+
+// ------------------------------
+// Palette storage report (--palette-report)
+// ------------------------------
+// MinecraftSkinViewerCli --palette-report <dir|archive>
+// Ingests every skin of the source, palettizes it and reports how many
+// fit in 4-bit / 8-bit palettes and the resulting pixel memory. Every
+// palettized skin is expanded again and compared with its original pixels.
+static bool RunPaletteReportFromArgs(int argc, wchar_t** argv, int& exitCode) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--palette-report") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 1 >= argc) throw std::runtime_error("--palette-report needs <dir|archive>");
+
+  size_t skins = 0, bits4 = 0, bits8 = 0, failed = 0, mismatched = 0;
+  size_t rgbaBytes = 0, storedBytes = 0;
+  std::vector<uint8_t> scratch;
+  IngestSkins(argv[i + 1], [&](IngestedSkin&& r) {
+    if (!r.error.empty()) {
+      ++failed;
+      return true;
+    }
+    SkinInfo& s = r.skin;
+    const std::vector<uint8_t> original = s.rgba;
+    ++skins;
+    rgbaBytes += original.size();
+    if (PalettizeSkin(s)) {
+      ++(s.palette.bits == 4 ? bits4 : bits8);
+      if (SkinRgba(s, scratch) != original) ++mismatched;
+    }
+    storedBytes += SkinPixelBytes(s);
+    return true;
+  });
+
+  const double pct = rgbaBytes ? 100.0 * (1.0 - (double)storedBytes / (double)rgbaBytes) : 0.0;
+  printf("palette-report: %zu skins (%zu unreadable): %zu 4-bit, %zu 8-bit, %zu kept RGBA\n",
+         skins, failed, bits4, bits8, skins - bits4 - bits8);
+  printf("pixel memory: %zu KB RGBA -> %zu KB stored (%.1f%% smaller)%s\n",
+         rgbaBytes / 1024, storedBytes / 1024, pct, mismatched ? "" : ", round trip exact");
+  if (mismatched) printf("ERROR: %zu skins did not expand back to their original pixels\n", mismatched);
+  exitCode = mismatched ? 1 : 0;
+  return true;
+}
+
+// ------------------------------
+// PNG header triage (--probe)
+// ------------------------------
+// MinecraftSkinViewerCli --probe <dir|list.txt>
+// Probes every .png under a directory (or every path listed one per line)
+// with ProbePngFiles and summarizes sizes and formats. No pixel data is read.
+static bool RunProbeFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--probe") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 1 >= argc) throw std::runtime_error("--probe needs <dir|list.txt>");
+  const std::filesystem::path source = argv[i + 1];
+
+  std::vector<std::filesystem::path> paths;
+  if (std::filesystem::is_directory(source)) {
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(source)) {
+      if (entry.is_regular_file() && LowerExtension(entry.path()) == L".png") paths.push_back(entry.path());
+    }
+  } else {
+    std::ifstream f(source);
+    if (!f) throw std::runtime_error("--probe: cannot open " + source.string());
+    for (std::string line; std::getline(f, line);) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (!line.empty()) paths.push_back(std::filesystem::u8path(line));
+    }
+  }
+
+  const auto t0 = std::chrono::steady_clock::now();
+  std::vector<PngProbe> probes;
+  ProbePngFiles(paths, probes);
+  const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  size_t skins = 0, legacy = 0, hd = 0, palette = 0, trns = 0;
+  std::map<std::string, size_t> rejected;
+  for (const PngProbe& p : probes) {
+    if (p.error) { ++rejected[p.error]; continue; }
+    if (!p.skinSized) { ++rejected["not a skin size"]; continue; }
+    ++skins;
+    legacy += p.legacy64x32;
+    hd += p.scale > 1;
+    palette += p.colorType == 3;
+    trns += p.hasTrns;
+  }
+  printf("probe: %zu files in %.2f s (%.0f files/s)\n", paths.size(), secs, secs > 0.0 ? (double)paths.size() / secs : 0.0);
+  printf("  %zu skins: %zu legacy 64x32, %zu HD, %zu palette, %zu with tRNS\n", skins, legacy, hd, palette, trns);
+  for (const auto& [reason, n] : rejected) printf("  %zu rejected: %s\n", n, reason.c_str());
+  return true;
+}
+
+// ------------------------------
+// Colour search (--hist-index, --hist-query)
+// ------------------------------
+// MinecraftSkinViewerCli --hist-index <dir|archive> <index.bin> [--dedupe]
+// Ingests every skin of the source into a ColorHistIndex and writes it plus
+// <index.bin>.txt, the skin names by id. --dedupe indexes only the first of
+// the skins with the same canonical form (CanonicalSkinHash).
+static bool RunHistIndexFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--hist-index") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--hist-index needs <dir|archive> <index.bin>");
+  const std::filesystem::path indexPath = argv[i + 2];
+  bool dedupe = false;
+  for (int a = i + 3; a < argc; ++a) dedupe |= !wcscmp(argv[a], L"--dedupe");
+
+  ColorHistIndex index;
+  std::unordered_set<uint64_t> seen;
+  std::ofstream names(std::filesystem::path(indexPath.wstring() + L".txt"), std::ios::trunc);
+  if (!names) throw std::runtime_error("--hist-index: cannot write the names file");
+  size_t failed = 0, duplicates = 0;
+  const auto t0 = std::chrono::steady_clock::now();
+  IngestSkins(argv[i + 1], [&](IngestedSkin&& r) {
+    if (!r.error.empty()) {
+      ++failed;
+      return true;
+    }
+    if (dedupe && !seen.insert(r.skin.canonHash).second) {
+      ++duplicates;
+      return true;
+    }
+    index.Insert(r.skin.colorHist);
+    names << NarrowFromWide(r.name) << '\n';
+    return true;
+  });
+  index.Save(indexPath);
+  const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  printf("hist-index: %zu skins (%zu unreadable, %zu duplicates skipped) in %.2f s -> %s\n", index.Size(), failed,
+         duplicates, secs, NarrowFromWide(indexPath.wstring()).c_str());
+  return true;
+}
+
+// <index.bin>.txt as written by --hist-index and --phash-index: one name per id.
+static std::vector<std::string> ReadIndexNames(const std::filesystem::path& indexPath) {
+  std::vector<std::string> names;
+  std::ifstream f(std::filesystem::path(indexPath.wstring() + L".txt"));
+  for (std::string line; std::getline(f, line);) names.push_back(line);
+  return names;
+}
+
+// "torso=red,hat=none,limbs=blue": each named region should be mostly that
+// colour ("none": empty). "body" is torso + limbs, "all" adds the head.
+static HistQuery ParseHistQuery(const std::string& spec) {
+  HistQuery q;
+  size_t pos = 0;
+  while (pos < spec.size()) {
+    size_t end = spec.find(',', pos);
+    if (end == std::string::npos) end = spec.size();
+    const std::string term = spec.substr(pos, end - pos);
+    pos = end + 1;
+    const size_t eq = term.find('=');
+    if (eq == std::string::npos) throw std::runtime_error("colour query term needs region=colour: " + term);
+    const std::string region = term.substr(0, eq), color = term.substr(eq + 1);
+
+    int bin = -1;
+    for (int b = 0; b < kHistBins; ++b) {
+      if (color == kHistBinNames[b]) bin = b;
+    }
+    if (bin < 0 && color != "none") throw std::runtime_error("unknown colour in query: " + color);
+
+    std::vector<HistRegion> regions;
+    if (region == "body") regions = { HistRegion_Torso, HistRegion_Limbs };
+    else if (region == "all") regions = { HistRegion_Head, HistRegion_Torso, HistRegion_Limbs };
+    for (int r = 0; r < HistRegion_Count; ++r) {
+      if (region == kHistRegionNames[r]) regions.push_back((HistRegion)r);
+    }
+    if (regions.empty()) throw std::runtime_error("unknown region in query: " + region);
+    for (HistRegion r : regions) {
+      std::fill(q.target.bins[r], q.target.bins[r] + kHistBins, (uint8_t)0);
+      if (bin >= 0) q.target.bins[r][bin] = 255;
+      q.weight[r] = 1;
+    }
+  }
+  return q;
+}
+
+// MinecraftSkinViewerCli --hist-query <index.bin> <query|skin.png> [--k N] [--radius R] [--probe B]
+// Prints the k nearest skins (default 20) or, with --radius, every skin within
+// that distance. A skin path queries by example over all regions. --probe
+// caps the buckets scanned (approximate); the default is exact.
+static bool RunHistQueryFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--hist-query") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--hist-query needs <index.bin> <query|skin.png>");
+  const std::filesystem::path indexPath = argv[i + 1];
+  const std::wstring spec = argv[i + 2];
+
+  size_t k = 20, probe = 0;
+  int64_t radius = -1;
+  for (int a = i + 3; a + 1 < argc; ++a) {
+    if      (!wcscmp(argv[a], L"--k"))      k = (size_t)wcstoull(argv[++a], nullptr, 10);
+    else if (!wcscmp(argv[a], L"--radius")) radius = (int64_t)wcstoull(argv[++a], nullptr, 10);
+    else if (!wcscmp(argv[a], L"--probe"))  probe = (size_t)wcstoull(argv[++a], nullptr, 10);
+  }
+
+  HistQuery q;
+  if (IsPngName(NarrowFromWide(spec))) {
+    q.target = DecodeSkinPng(std::filesystem::path(spec)).colorHist;
+    std::fill(q.weight, q.weight + HistRegion_Count, 1u);
+  } else {
+    q = ParseHistQuery(NarrowFromWide(spec));
+  }
+
+  const ColorHistIndex index = ColorHistIndex::Load(indexPath);
+  const std::vector<std::string> names = ReadIndexNames(indexPath);
+
+  const auto t0 = std::chrono::steady_clock::now();
+  const std::vector<HistMatch> hits = radius >= 0 ? index.Within(q, (uint32_t)radius) : index.Nearest(q, k, probe);
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  for (const HistMatch& m : hits) {
+    printf("%6u  %s\n", m.distance, m.id < names.size() ? names[m.id].c_str() : "?");
+  }
+  printf("hist-query: %zu matches of %zu skins in %.2f ms\n", hits.size(), index.Size(), ms);
+  return true;
+}
+
+// ------------------------------
+// Near-duplicate search (--phash-index, --phash-query)
+// ------------------------------
+static constexpr int kDefaultPHashRadius = 8;   // bits of 64; recolours and small edits stay within it
+
+static int ParsePHashRadius(int argc, wchar_t** argv, int first) {
+  int k = kDefaultPHashRadius;
+  for (int a = first; a + 1 < argc; ++a) {
+    if (!wcscmp(argv[a], L"--k")) k = std::clamp((int)wcstol(argv[++a], nullptr, 10), 0, 64);
+  }
+  return k;
+}
+
+// MinecraftSkinViewerCli --phash-index <dir|archive> <index.bin> [--dedupe] [--k N]
+// Ingests every skin of the source into a PHashIndex (ComputeSkinPHash) and
+// writes it plus <index.bin>.txt, the skin names by id. --dedupe leaves out
+// every skin within k bits of one already indexed and prints the pair.
+static bool RunPHashIndexFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--phash-index") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--phash-index needs <dir|archive> <index.bin>");
+  const std::filesystem::path indexPath = argv[i + 2];
+  bool dedupe = false;
+  for (int a = i + 3; a < argc; ++a) dedupe |= !wcscmp(argv[a], L"--dedupe");
+  const int k = ParsePHashRadius(argc, argv, i + 3);
+
+  PHashIndex index;
+  std::vector<std::string> names;
+  size_t failed = 0, duplicates = 0;
+  const auto t0 = std::chrono::steady_clock::now();
+  IngestSkins(argv[i + 1], [&](IngestedSkin&& r) {
+    if (!r.error.empty()) {
+      ++failed;
+      return true;
+    }
+    const std::string name = NarrowFromWide(r.name);
+    if (dedupe) {
+      const std::vector<uint32_t> near = index.Query(r.skin.phash, k);
+      if (!near.empty()) {
+        printf("%2d  %s ~ %s\n", HammingDistance(r.skin.phash, index.HashOf(near[0])), name.c_str(), names[near[0]].c_str());
+        ++duplicates;
+        return true;
+      }
+    }
+    index.Insert(r.skin.phash);
+    names.push_back(name);
+    return true;
+  });
+
+  index.Save(indexPath);
+  std::ofstream f(std::filesystem::path(indexPath.wstring() + L".txt"), std::ios::trunc);
+  for (const std::string& n : names) f << n << '\n';
+  if (!f) throw std::runtime_error("--phash-index: cannot write the names file");
+  const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  printf("phash-index: %zu skins (%zu unreadable, %zu near-duplicates skipped) in %.2f s -> %s\n", index.Size(), failed,
+         duplicates, secs, NarrowFromWide(indexPath.wstring()).c_str());
+  return true;
+}
+
+// MinecraftSkinViewerCli --phash-query <index.bin> <skin.png> [--k N]
+// Prints every indexed skin within k bits of the given one, nearest first.
+static bool RunPHashQueryFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--phash-query") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--phash-query needs <index.bin> <skin.png>");
+  const int k = ParsePHashRadius(argc, argv, i + 3);
+
+  const PHashIndex index = PHashIndex::Load(argv[i + 1]);
+  const std::vector<std::string> names = ReadIndexNames(argv[i + 1]);
+  const uint64_t h = DecodeSkinPng(std::filesystem::path(argv[i + 2])).phash;
+
+  const auto t0 = std::chrono::steady_clock::now();
+  std::vector<uint32_t> hits = index.Query(h, k);
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  std::stable_sort(hits.begin(), hits.end(), [&](uint32_t a, uint32_t b) {
+    return HammingDistance(h, index.HashOf(a)) < HammingDistance(h, index.HashOf(b));
+  });
+  for (uint32_t id : hits) {
+    printf("%2d  %s\n", HammingDistance(h, index.HashOf(id)), id < names.size() ? names[id].c_str() : "?");
+  }
+  printf("phash-query: %zu matches of %zu skins in %.2f ms\n", hits.size(), index.Size(), ms);
+  return true;
+}
+
+// ------------------------------
+// Batch mesh export (--export)
+// ------------------------------
+// MinecraftSkinViewerCli --export <src> <outdir> [--format glb|obj] [--slim] [--parts] [--scale s]
+// Exports the player mesh of every skin in a file, directory or archive as
+// <outdir>/<name>.glb, or as <name>.obj + .mtl + .png. Reports the export
+// cost apart from decoding and writing.
+static bool RunExportFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--export") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--export needs <src> <outdir>");
+  const std::filesystem::path source = argv[i + 1];
+  const std::filesystem::path outDir = argv[i + 2];
+
+  MeshExportOptions opt;
+  bool obj = false, slim = false;
+  for (int k = i + 3; k < argc; ++k) {
+    if (!wcscmp(argv[k], L"--format") && k + 1 < argc) {
+      ++k;
+      if (!wcscmp(argv[k], L"obj")) obj = true;
+      else if (wcscmp(argv[k], L"glb")) throw std::runtime_error("--format is glb or obj");
+    }
+    else if (!wcscmp(argv[k], L"--slim")) slim = true;
+    else if (!wcscmp(argv[k], L"--parts")) opt.partNodes = true;
+    else if (!wcscmp(argv[k], L"--scale") && k + 1 < argc) opt.scale = (float)wcstod(argv[++k], nullptr);
+  }
+  std::filesystem::create_directories(outDir);
+
+  const ModelDesc& model = PlayerModel(slim);
+  MeshExporter exporter;
+  BuiltMesh mesh;
+  std::vector<uint8_t> present;
+  size_t exported = 0, failed = 0, bytes = 0;
+  double exportUs = 0.0;
+  IngestSkins(source, [&](IngestedSkin&& r) {
+    if (!r.error.empty()) {
+      ++failed;
+      return true;
+    }
+    ComputePartPresence(r.skin, model, present);
+    BuildModelMeshInto(r.skin, model, present, mesh);
+    const std::filesystem::path stem = outDir / std::filesystem::path(r.name).stem();
+    const std::string name = NarrowFromWide(stem.filename().wstring());
+    const std::string mtlName = name + ".mtl", pngName = name + ".png";
+
+    const auto t0 = std::chrono::steady_clock::now();
+    const std::vector<uint8_t>& out = obj ? exporter.Obj(model, present, mesh, opt, mtlName, pngName)
+                                          : exporter.Glb(r.skin, model, present, mesh, opt);
+    const std::vector<uint8_t>* png = obj ? &exporter.Png(r.skin) : nullptr;
+    exportUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    WriteFileBytes(stem.wstring() + (obj ? L".obj" : L".glb"), out);
+    bytes += out.size();
+    if (obj) {
+      WriteFileBytes(stem.wstring() + L".mtl", exporter.Mtl());
+      WriteFileBytes(stem.wstring() + L".png", *png);
+      bytes += exporter.Mtl().size() + png->size();
+    }
+    ++exported;
+    return true;
+  });
+
+  const double perUs = exported ? exportUs / (double)exported : 0.0;
+  printf("export: %zu skins as %s%s (%zu unreadable), %zu KB written\n", exported, obj ? "OBJ" : "glTF",
+         opt.partNodes ? " with part nodes" : "", failed, bytes / 1024);
+  printf("  %.1f us per export (%.0f/s)\n", perUs, perUs > 0.0 ? 1e6 / perUs : 0.0);
+  return true;
+}
+
+// --cache <dir> [--cache-mb N] [--cache-mem-mb N]: nullptr without --cache.
+// The disk budget defaults to 1 GB, the in-memory one to 64 MB.
+static std::unique_ptr<RenderCache> OpenRenderCacheFromArgs(int argc, wchar_t** argv) {
+  std::filesystem::path dir;
+  uint64_t diskMb = 1024, memoryMb = 64;
+  for (int k = 1; k + 1 < argc; ++k) {
+    if      (!wcscmp(argv[k], L"--cache"))        dir = argv[++k];
+    else if (!wcscmp(argv[k], L"--cache-mb"))     diskMb = wcstoull(argv[++k], nullptr, 10);
+    else if (!wcscmp(argv[k], L"--cache-mem-mb")) memoryMb = wcstoull(argv[++k], nullptr, 10);
+  }
+  if (dir.empty()) return nullptr;
+  return std::make_unique<RenderCache>(dir, diskMb << 20, (size_t)(memoryMb << 20));
+}
+
+static void PrintRenderCacheStats(RenderCache& cache) {
+  const RenderCache::Stats s = cache.GetStats();
+  printf("render cache: %llu memory hits, %llu disk hits, %llu misses, %llu file aliases found; %llu written, %llu evicted, %llu KB on disk\n",
+         (unsigned long long)s.memoryHits, (unsigned long long)s.diskHits, (unsigned long long)s.misses, (unsigned long long)s.aliasHits,
+         (unsigned long long)s.writes, (unsigned long long)s.evicted, (unsigned long long)(s.diskBytes / 1024));
+}
+
+// ------------------------------
+// Headless offline render (--render)
+// ------------------------------
+// The render options shared by --render and --render-batch.
+static void ParseCpuRenderArgs(int argc, wchar_t** argv, CpuRenderParams& p, bool& slim) {
+  for (int k = 1; k < argc; ++k) {
+    const wchar_t* a = argv[k];
+    const wchar_t* v = (k + 1 < argc) ? argv[k + 1] : L"";
+    if      (!wcscmp(a, L"--size"))        { swscanf(v, L"%dx%d", &p.width, &p.height); ++k; }
+    else if (!wcscmp(a, L"--ss"))          { p.samplesPerAxis = (int)wcstol(v, nullptr, 10); ++k; }
+    else if (!wcscmp(a, L"--tile"))        { p.tileSize = (int)wcstol(v, nullptr, 10); ++k; }
+    else if (!wcscmp(a, L"--threads"))     { p.threads = (int)wcstol(v, nullptr, 10); ++k; }
+    else if (!wcscmp(a, L"--yaw"))         { p.cam.yaw = wcstof(v, nullptr); ++k; }
+    else if (!wcscmp(a, L"--pitch"))       { p.cam.pitch = Clamp(wcstof(v, nullptr), -1.2f, 1.2f); ++k; }
+    else if (!wcscmp(a, L"--dist"))        { p.cam.dist = Clamp(wcstof(v, nullptr), 20.0f, 250.0f); ++k; }
+    else if (!wcscmp(a, L"--slim"))        slim = true;
+    else if (!wcscmp(a, L"--no-overlay"))  p.showOverlay = false;
+    else if (!wcscmp(a, L"--linear"))      p.pointFilter = false;
+    else if (!wcscmp(a, L"--transparent")) p.background[3] = 0.0f;
+  }
+  if (p.width <= 0 || p.height <= 0 || p.width > 16384 || p.height > 16384)
+    throw std::runtime_error("--size must be between 1x1 and 16384x16384");
+  p.samplesPerAxis = std::clamp(p.samplesPerAxis, 1, 8);
+  p.tileSize = std::clamp(p.tileSize, 16, 512);
+}
+
+// --png fastest|fast|small and --png-threads N, for the commands that write renders.
+static void ParsePngArgs(int argc, wchar_t** argv, PngEncodeOptions& o) {
+  for (int k = 1; k + 1 < argc; ++k) {
+    if (!wcscmp(argv[k], L"--png")) {
+      const std::wstring_view v = argv[++k];
+      if      (v == L"fastest") o.level = PngLevel_Fastest;
+      else if (v == L"fast")    o.level = PngLevel_Fast;
+      else if (v == L"small")   o.level = PngLevel_Small;
+      else throw std::runtime_error("--png is fastest, fast or small");
+    }
+    else if (!wcscmp(argv[k], L"--png-threads")) o.threads = (unsigned)wcstoul(argv[++k], nullptr, 10);
+  }
+}
+
+// MinecraftSkinViewerCli --render in.png out.png [--size WxH] [--ss N]
+//   [--tile N] [--threads N] [--yaw R] [--pitch R] [--dist D] [--slim]
+//   [--no-overlay] [--linear] [--transparent] [--png LEVEL] [--png-threads N]
+//   [--cache DIR [--cache-mb N] [--cache-mem-mb N]]
+// With a cache (see RenderCache), a hit copies the stored PNG without rendering.
+static bool RunOfflineRenderFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--render") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--render needs <in.png> <out.png>");
+  const std::wstring inPath = argv[i + 1];
+  const std::wstring outPath = argv[i + 2];
+
+  CpuRenderParams p;
+  p.width = 1920;
+  p.height = 1080;
+  p.samplesPerAxis = 4;
+  bool slim = false;
+  ParseCpuRenderArgs(argc, argv, p, slim);
+
+  PngEncodeOptions png;
+  ParsePngArgs(argc, argv, png);
+
+  const std::unique_ptr<RenderCache> cache = OpenRenderCacheFromArgs(argc, argv);
+
+  SkinInfo skin = DecodeSkinPng(std::filesystem::path(inPath));
+  const uint64_t key = cache ? RenderCacheKey(skin, slim, p, png) : 0;
+  if (cache) {
+    if (const RenderCache::File hit = cache->Get(key)) {
+      WriteFileBytes(outPath, *hit);
+      PrintRenderCacheStats(*cache);
+      return true;
+    }
+  }
+  BuiltMesh mesh = BuildPlayerMesh(skin, slim);
+
+  const std::vector<uint8_t> image = RenderOfflineCPU(skin, mesh, p);
+  std::vector<uint8_t> file;
+  PngEncoder().Encode(image.data(), (uint32_t)p.width, (uint32_t)p.height, png, file);
+  WriteFileBytes(outPath, file);
+  if (cache) {
+    cache->Put(key, std::make_shared<const std::vector<uint8_t>>(std::move(file)));
+    PrintRenderCacheStats(*cache);
+  }
+  return true;
+}
+
+// ------------------------------
+// Batch render (--render-batch)
+// ------------------------------
+// MinecraftSkinViewerCli --render-batch <src> <outdir> [render and cache options as --render]
+//   [--workers stage=N,...] [--queue N]
+// Renders every skin of a file, directory or archive to <outdir>/<path>.png,
+// <path> being the entry's path below <src>, through a StagedPipeline: read -> decode -> analyze -> mesh -> render ->
+// encode -> write. Each stage renders or encodes whole images on one thread;
+// throughput comes from the stages' workers. A skin with the same canonical
+// form (CanonicalSkinHash) as an earlier one is not rendered again; its file is
+// copied from the first's. With --cache, a cached render skips mesh, render
+// and encode, and a file whose exact bytes were rendered before with the same
+// options is found through a RenderCache alias straight after the read,
+// without being decoded. Prints per-stage metrics and the duplicate rate.
+struct BatchRenderOutput {
+  std::mutex m;                                // the write stage's items for this output
+  std::filesystem::path file;                  // the first copy on disk
+  std::vector<std::filesystem::path> waiting;  // duplicates that reached write before the rendered item
+  std::vector<uint8_t> image;                  // PNG kept for later duplicates while no copy is on disk
+  bool done = false;                           // the rendered item has been through write
+};
+
+struct BatchRenderItem {
+  SkinSourceEntry entry;
+  SkinInfo skin;
+  BuiltMesh mesh;
+  std::vector<uint8_t> image;          // rendered RGBA, then PNG bytes
+  std::shared_ptr<BatchRenderOutput> output;
+  bool duplicate = false;              // output is rendered by an earlier item
+  bool cached = false;                 // image is the PNG from the render cache
+  bool aliased = false;                // found by fileKey, never decoded
+  uint64_t cacheKey = 0;
+  uint64_t fileKey = 0;                // RenderCacheFileKey, with --cache
+  uint64_t fileHash = 0;               // the file's bytes, for the report
+};
+
+// <outdir>/<entry path below source>.png. Only plain components are kept, so
+// an archive entry cannot name a file outside <outdir>.
+static std::filesystem::path BatchOutputPath(const std::filesystem::path& source, const std::filesystem::path& outDir,
+                                             const std::wstring& name) {
+  const std::wstring root = source.wstring();
+  const std::filesystem::path rel = name.size() > root.size() && !name.compare(0, root.size(), root)
+                                      ? std::filesystem::path(name.substr(root.size()))
+                                      : std::filesystem::path(name).filename();
+  std::filesystem::path out = outDir;
+  for (const std::filesystem::path& part : rel.relative_path()) {
+    if (part.empty() || part.has_root_path() || part == L"." || part == L"..") continue;
+    out /= part;
+  }
+  if (out == outDir) out /= L"skin";
+  return out.replace_extension(L".png");
+}
+
+// `file`, or `file` with -2, -3, ... before the extension when an earlier
+// entry took it (archives may repeat a name, and names may differ only in case).
+static std::filesystem::path ClaimBatchOutput(std::unordered_set<std::wstring>& taken, const std::filesystem::path& file) {
+  for (unsigned n = 1;; ++n) {
+    std::filesystem::path candidate = file;
+    if (n > 1) candidate.replace_filename(file.stem().wstring() + L"-" + std::to_wstring(n) + file.extension().wstring());
+    std::wstring key = candidate.wstring();
+    for (wchar_t& c : key) c = (wchar_t)towlower(c);
+    if (taken.insert(std::move(key)).second) return candidate;
+  }
+}
+
+static bool RunBatchRenderFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--render-batch") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 2 >= argc) throw std::runtime_error("--render-batch needs <src> <outdir>");
+  const std::filesystem::path source = argv[i + 1];
+  const std::filesystem::path outDir = argv[i + 2];
+
+  CpuRenderParams p;
+  p.width = 512;
+  p.height = 512;
+  p.samplesPerAxis = 2;
+  bool slim = false;
+  ParseCpuRenderArgs(argc, argv, p, slim);
+  p.threads = 1;
+  PngEncodeOptions png;
+  png.threads = 1;
+  ParsePngArgs(argc, argv, png);
+  const std::unique_ptr<RenderCache> cache = OpenRenderCacheFromArgs(argc, argv);
+
+  const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+  std::map<std::wstring, unsigned> workers = {
+    { L"decode", std::max(1u, hw / 4) }, { L"analyze", 1 }, { L"mesh", 1 },
+    { L"render", std::max(1u, hw / 2) }, { L"encode", std::max(1u, hw / 4) }, { L"write", 1 },
+  };
+  size_t queue = 8;
+  for (int k = 1; k + 1 < argc; ++k) {
+    if (!wcscmp(argv[k], L"--queue")) queue = std::max<size_t>(1, wcstoull(argv[++k], nullptr, 10));
+    else if (!wcscmp(argv[k], L"--workers")) {
+      // stage=N[,stage=N...]
+      std::wstring list = argv[++k];
+      for (size_t at = 0; at < list.size();) {
+        const size_t comma = std::min(list.find(L',', at), list.size());
+        const std::wstring kv = list.substr(at, comma - at);
+        const size_t eq = kv.find(L'=');
+        if (eq == std::wstring::npos || !workers.count(kv.substr(0, eq)))
+          throw std::runtime_error("--workers: unknown stage in " + NarrowFromWide(kv));
+        workers[kv.substr(0, eq)] = std::max(1u, (unsigned)wcstoul(kv.c_str() + eq + 1, nullptr, 10));
+        at = comma + 1;
+      }
+    }
+  }
+  std::filesystem::create_directories(outDir);
+
+  StagedPipeline<BatchRenderItem> pipe("read", [&](const StagedPipeline<BatchRenderItem>::Emit& emit) {
+    ReadSkinSource(source, [&](SkinSourceEntry&& e) {
+      BatchRenderItem item;
+      item.entry = std::move(e);
+      return emit(std::move(item));
+    });
+  });
+  pipe.AddStage("decode", workers[L"decode"], queue, [&](BatchRenderItem& it) {
+    const std::vector<uint8_t> file = ExtractSkinSourceEntry(it.entry);
+    it.entry.data = {};
+    it.fileHash = (uint64_t)Crc32(file.data(), file.size()) << 32 | Adler32(file.data(), file.size());
+    if (cache) {
+      it.fileKey = RenderCacheFileKey(file.data(), file.size(), slim, p, png);
+      if (cache->GetAlias(it.fileKey, it.cacheKey)) {
+        if (const RenderCache::File hit = cache->Get(it.cacheKey)) {
+          it.image = *hit;
+          it.cached = it.aliased = true;
+          return true;
+        }
+      }
+    }
+    const PngProbe probe = ProbePng(file.data(), file.size());
+    if (probe.error) throw std::runtime_error(probe.error);
+    if (!probe.skinSized) return false;
+    it.skin.rgba = DecodePngRgba(file.data(), file.size(), it.skin.width, it.skin.height);
+    it.skin.path = it.entry.name;
+    return true;
+  });
+  // Outputs are keyed by the canonical hash, or with --cache by the cache key,
+  // which within one run maps one to one to it and is all an alias hit has.
+  // File hashes are for the report only.
+  std::mutex outputsMutex;
+  std::unordered_map<uint64_t, std::shared_ptr<BatchRenderOutput>> outputs;
+  std::unordered_set<uint64_t> fileHashes;
+  uint64_t fileDuplicates = 0, duplicates = 0;
+  pipe.AddStage("analyze", workers[L"analyze"], queue, [&](BatchRenderItem& it) {
+    uint64_t key = it.cacheKey;
+    if (!it.aliased) {
+      PrepareDecodedSkin(it.skin);
+      key = cache ? (it.cacheKey = RenderCacheKey(it.skin, slim, p, png)) : CanonicalSkinHash(it.skin, slim, !p.pointFilter);
+    }
+    {
+      std::lock_guard<std::mutex> lock(outputsMutex);
+      fileDuplicates += !fileHashes.insert(it.fileHash).second;
+      std::shared_ptr<BatchRenderOutput>& out = outputs[key];
+      it.duplicate = out != nullptr;
+      if (!out) out = std::make_shared<BatchRenderOutput>();
+      it.output = out;
+      duplicates += it.duplicate;
+    }
+    if (!it.duplicate && !it.cached && cache) {
+      if (const RenderCache::File hit = cache->Get(it.cacheKey)) {
+        it.image = *hit;
+        it.cached = true;
+      }
+    }
+    if (it.duplicate) it.image = {};
+    if (it.duplicate || it.cached) it.skin = SkinInfo{};
+    return true;
+  });
+  pipe.AddStage("mesh", workers[L"mesh"], queue, [slim](BatchRenderItem& it) {
+    if (!it.duplicate && !it.cached) it.mesh = BuildPlayerMesh(it.skin, slim);
+    return true;
+  });
+  pipe.AddStage("render", workers[L"render"], queue, [&p](BatchRenderItem& it) {
+    if (it.duplicate || it.cached) return true;
+    it.image = RenderOfflineCPU(it.skin, it.mesh, p);
+    it.skin = SkinInfo{};
+    it.mesh = BuiltMesh{};
+    return true;
+  });
+  pipe.AddStage("encode", workers[L"encode"], queue, [&](BatchRenderItem& it) {
+    if (it.duplicate || it.cached) return true;
+    std::vector<uint8_t> file;
+    PngEncoder().Encode(it.image.data(), (uint32_t)p.width, (uint32_t)p.height, png, file);
+    it.image = std::move(file);
+    return true;
+  });
+  // Files count once they are on disk. When the rendered file cannot be
+  // written, its bytes go to the duplicates instead (those waiting, then
+  // later ones), and the first of those that succeeds becomes the copy source.
+  std::atomic<uint64_t> bytes{ 0 }, filesWritten{ 0 }, filesFailed{ 0 };
+  std::string writeError;                  // the last one, under outputsMutex
+  std::unordered_set<std::wstring> taken;  // under outputsMutex
+  auto fail = [&](const std::filesystem::path& f, const std::string& why) {
+    ++filesFailed;
+    std::lock_guard<std::mutex> lock(outputsMutex);
+    writeError = f.string() + ": " + why;
+  };
+  pipe.AddStage("write", workers[L"write"], queue, [&](BatchRenderItem& it) {
+    if (cache && !it.aliased) cache->PutAlias(it.fileKey, it.cacheKey);
+    std::filesystem::path file;
+    {
+      std::lock_guard<std::mutex> lock(outputsMutex);
+      file = ClaimBatchOutput(taken, BatchOutputPath(source, outDir, it.entry.name));
+    }
+    BatchRenderOutput& out = *it.output;
+    std::lock_guard<std::mutex> lock(out.m);
+    if (it.duplicate && !out.done) {
+      out.waiting.push_back(file);
+      return true;
+    }
+    std::vector<std::filesystem::path> targets{ file };
+    if (!it.duplicate) {
+      out.done = true;
+      out.image = std::move(it.image);
+      targets.insert(targets.end(), out.waiting.begin(), out.waiting.end());
+      out.waiting.clear();
+    }
+    bool wrote = false;
+    for (const std::filesystem::path& t : targets) {
+      try {
+        std::filesystem::create_directories(t.parent_path());
+        if (out.file.empty()) {
+          WriteFileBytes(t, out.image);
+          bytes += out.image.size();
+          out.file = t;
+        } else {
+          std::filesystem::copy_file(out.file, t, std::filesystem::copy_options::overwrite_existing);
+        }
+        ++filesWritten;
+        wrote |= t == file;
+      } catch (const std::exception& e) {
+        fail(t, e.what());
+      }
+    }
+    if (!out.file.empty() && !out.image.empty()) {
+      if (cache && !it.cached) cache->Put(it.cacheKey, std::make_shared<const std::vector<uint8_t>>(std::move(out.image)));
+      out.image = {};
+    }
+    return wrote;
+  });
+  pipe.Run();
+  // Duplicates still waiting lost their rendered item before write (analyze,
+  // mesh, render or encode failed), so nothing was ever written for them.
+  for (const auto& [key, out] : outputs) {
+    if (out->done) continue;
+    for (const std::filesystem::path& f : out->waiting) fail(f, "the skin it duplicates failed before write");
+  }
+
+  const std::vector<StageMetrics> stages = pipe.Metrics();
+  const uint64_t written = filesWritten.load();
+  const double secs = pipe.WallSeconds();
+  printf("render-batch: %llu of %llu skins written at %dx%d in %.2f s (%.1f/s), %llu KB written\n",
+         (unsigned long long)written, (unsigned long long)stages.front().items, p.width, p.height, secs,
+         secs > 0.0 ? (double)written / secs : 0.0, (unsigned long long)(bytes.load() / 1024));
+  const double analyzed = (double)std::max<uint64_t>(1, stages[2].items);
+  printf("render-batch: %llu duplicates reused by canonical hash (%.1f%%), %llu of them identical files (%.1f%%)\n",
+         (unsigned long long)duplicates, 100.0 * (double)duplicates / analyzed,
+         (unsigned long long)fileDuplicates, 100.0 * (double)fileDuplicates / analyzed);
+  if (filesFailed) {
+    printf("render-batch: %llu files not written, last: %s\n", (unsigned long long)filesFailed.load(), writeError.c_str());
+  }
+  if (cache) PrintRenderCacheStats(*cache);
+  PrintStageMetrics(stages, secs);
+  return true;
+}
+
+// ------------------------------
+// PNG encoder benchmark (--png-bench)
+// ------------------------------
+// MinecraftSkinViewerCli --png-bench <src> [render options as --render] [--count N]
+// Renders up to N skins of a file, directory or archive (default 4) and
+// encodes the frames with zlib at level 6 as the baseline, then with every
+// PngEncoder level on one thread and on all of them. Sizes are relative to
+// the baseline (to the first PngEncoder run when built without zlib). Every
+// output is decoded again and compared with its frame.
+#ifdef SKIN_HAVE_ZLIB
+static void PutPngChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t n) {
+  for (int b = 0; b < 4; ++b) out.push_back((uint8_t)(n >> (24 - 8 * b)));
+  const size_t at = out.size();
+  out.insert(out.end(), type, type + 4);
+  if (n) out.insert(out.end(), data, data + n);
+  const uint32_t crc = Crc32(&out[at], n + 4);
+  for (int b = 0; b < 4; ++b) out.push_back((uint8_t)(crc >> (24 - 8 * b)));
+}
+
+// The reference a general-purpose encoder gives: RGBA8, each row's filter
+// chosen by the smallest sum of absolute filtered bytes (libpng's default
+// heuristic), one IDAT from zlib's compress2. `filtered` is scratch.
+static void EncodePngZlib(const uint8_t* rgba, uint32_t w, uint32_t h, int level,
+                          std::vector<uint8_t>& filtered, std::vector<uint8_t>& out) {
+  const size_t n = (size_t)w * 4, stride = 1 + n;
+  filtered.resize(stride * h);
+  std::vector<uint8_t> cand[5];
+  for (std::vector<uint8_t>& c : cand) c.resize(n);
+  for (uint32_t y = 0; y < h; ++y) {
+    const uint8_t* row = rgba + y * n;
+    const uint8_t* up = y ? row - n : nullptr;
+    uint64_t best = UINT64_MAX;
+    int bestF = 0;
+    for (int f = 0; f < 5; ++f) {
+      uint64_t cost = 0;
+      for (size_t i = 0; i < n; ++i) {
+        const int a = i >= 4 ? row[i - 4] : 0, b = up ? up[i] : 0, c = i >= 4 && up ? up[i - 4] : 0;
+        int pred = 0;
+        switch (f) {
+          case 1: pred = a; break;
+          case 2: pred = b; break;
+          case 3: pred = (a + b) / 2; break;
+          case 4: {
+            const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+            pred = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            break;
+          }
+        }
+        const uint8_t v = (uint8_t)(row[i] - pred);
+        cand[f][i] = v;
+        cost += v < 128 ? v : 256 - v;
+      }
+      if (cost < best) { best = cost; bestF = f; }
+    }
+    filtered[y * stride] = (uint8_t)bestF;
+    memcpy(&filtered[y * stride + 1], cand[bestF].data(), n);
+  }
+
+  uLongf zlen = compressBound((uLong)filtered.size());
+  std::vector<uint8_t> z(zlen);
+  if (compress2(z.data(), &zlen, filtered.data(), (uLong)filtered.size(), level) != Z_OK)
+    throw std::runtime_error("--png-bench: zlib compress2 failed");
+
+  out.clear();
+  static const uint8_t kSig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  out.insert(out.end(), kSig, kSig + 8);
+  uint8_t ihdr[13]{};
+  for (int b = 0; b < 4; ++b) {
+    ihdr[b] = (uint8_t)(w >> (24 - 8 * b));
+    ihdr[4 + b] = (uint8_t)(h >> (24 - 8 * b));
+  }
+  ihdr[8] = 8;
+  ihdr[9] = 6;
+  PutPngChunk(out, "IHDR", ihdr, 13);
+  PutPngChunk(out, "IDAT", z.data(), zlen);
+  PutPngChunk(out, "IEND", nullptr, 0);
+}
+#endif
+
+static bool RunPngBenchFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--png-bench") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 1 >= argc) throw std::runtime_error("--png-bench needs <src>");
+  const std::filesystem::path source = argv[i + 1];
+
+  CpuRenderParams p;
+  p.width = 1920;
+  p.height = 1080;
+  p.samplesPerAxis = 4;
+  bool slim = false;
+  ParseCpuRenderArgs(argc, argv, p, slim);
+  size_t count = 4;
+  for (int k = 1; k + 1 < argc; ++k) {
+    if (!wcscmp(argv[k], L"--count")) count = std::max<size_t>(1, wcstoull(argv[++k], nullptr, 10));
+  }
+
+  std::vector<std::vector<uint8_t>> frames;
+  ReadSkinSource(source, [&](SkinSourceEntry&& e) {
+    try {
+      const std::vector<uint8_t> png = ExtractSkinSourceEntry(e);
+      const PngProbe probe = ProbePng(png.data(), png.size());
+      if (!probe.error && probe.skinSized) {
+        const SkinInfo skin = DecodeSkinPng(e.name, png.data(), png.size());
+        frames.push_back(RenderOfflineCPU(skin, BuildPlayerMesh(skin, slim), p));
+      }
+    } catch (const std::exception&) {
+      // not a skin; try the next entry
+    }
+    return frames.size() < count;
+  });
+  if (frames.empty()) throw std::runtime_error("--png-bench: no readable skins");
+
+  const double mb = (double)frames.size() * p.width * p.height * 4 / 1e6;
+  printf("png-bench: %zu frames of %dx%d, %.1f MB of RGBA\n", frames.size(), p.width, p.height, mb);
+  printf("  %-8s %7s %9s %12s %7s  %s\n", "encoder", "threads", "MB/s", "bytes/frame", "size", "round trip");
+  using Encode = std::function<void(const std::vector<uint8_t>&, std::vector<uint8_t>&)>;
+  double baseBytes = 0.0;
+  auto run = [&](const char* name, unsigned threads, const Encode& encode) {
+    std::vector<uint8_t> out;
+    encode(frames[0], out);              // warm-up
+    size_t bytes = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (const std::vector<uint8_t>& f : frames) {
+      encode(f, out);
+      bytes += out.size();
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    bool exact = true;
+    for (const std::vector<uint8_t>& f : frames) {
+      encode(f, out);
+      uint32_t w = 0, h = 0;
+      exact = exact && DecodePngRgba(out.data(), out.size(), w, h) == f;
+    }
+    const double perFrame = (double)bytes / frames.size();
+    if (!baseBytes) baseBytes = perFrame;
+    printf("  %-8s %7u %9.1f %12.0f %6.0f%%  %s\n", name, threads, mb / sec, perFrame, 100.0 * perFrame / baseBytes,
+           exact ? "exact" : "MISMATCH");
+  };
+
+  std::vector<unsigned> threadCounts = { 1 };
+  if (std::thread::hardware_concurrency() > 1) threadCounts.push_back(std::thread::hardware_concurrency());
+#ifdef SKIN_HAVE_ZLIB
+  std::vector<uint8_t> zlibScratch;
+  run("zlib-6", 1, [&](const std::vector<uint8_t>& f, std::vector<uint8_t>& out) {
+    EncodePngZlib(f.data(), (uint32_t)p.width, (uint32_t)p.height, 6, zlibScratch, out);
+  });
+#else
+  printf("  (no zlib baseline: built without zlib)\n");
+#endif
+  static const char* const kLevels[3] = { "fastest", "fast", "small" };
+  PngEncoder encoder;
+  for (int level = PngLevel_Fastest; level <= PngLevel_Small; ++level) {
+    for (const unsigned threads : threadCounts) {
+      PngEncodeOptions o;
+      o.level = (PngLevel)level;
+      o.threads = threads;
+      run(kLevels[level], threads, [&](const std::vector<uint8_t>& f, std::vector<uint8_t>& out) {
+        encoder.Encode(f.data(), (uint32_t)p.width, (uint32_t)p.height, o, out);
+      });
+    }
+  }
+  return true;
+}
+
+// ------------------------------
+// Crowd cull/sort benchmark (--crowd-bench)
+// ------------------------------
+// MinecraftSkinViewerCli --crowd-bench [N] [--frames F]
+// Times PrepareCrowdFrame for N instances (default 100000) while the camera
+// orbits; no window, device or skins, so it runs on any host.
+static bool RunCrowdBenchFromArgs(int argc, wchar_t** argv) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--crowd-bench") != 0) ++i;
+  if (i >= argc) return false;
+  size_t count = 100000;
+  int frames = 200;
+  if (i + 1 < argc && iswdigit(argv[i + 1][0])) count = (size_t)wcstoull(argv[i + 1], nullptr, 10);
+  for (int k = 1; k + 1 < argc; ++k) {
+    if (!wcscmp(argv[k], L"--frames")) frames = std::max(1, (int)wcstol(argv[k + 1], nullptr, 10));
+  }
+
+  const size_t kSkins = 64;
+  std::vector<uint8_t> skinFlags(kSkins, CrowdSkin_Impostor);
+  for (size_t s = 0; s < kSkins; s += 8) skinFlags[s] |= CrowdSkin_Blended;
+  CrowdInstances crowd;
+  PopulateCrowd(crowd, count, kSkins, kCrowdSpacing, 1234u);
+  const CrowdBounds bounds = ComputeCrowdBounds(kWorldScale);
+  CrowdScratch scratch;
+
+  using Clock = std::chrono::steady_clock;
+  double total = 0.0, worst = 0.0;
+  uint64_t drawn = 0, changes = 0, calls = 0;
+  Camera cam;
+  cam.dist = 800.0f;
+  for (int f = 0; f < frames; ++f) {
+    cam.yaw = (float)f * (XM_2PI / (float)frames);
+    const XMMATRIX view = MakeView(cam);
+    const XMMATRIX proj = MakeProj(1920, 1080, kCrowdFarZ);
+    const Clock::time_point t0 = Clock::now();
+    const CrowdStats st = PrepareCrowdFrame(crowd, view, proj, 1080, bounds, skinFlags, true, scratch);
+    const double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    total += ms;
+    worst = std::max(worst, ms);
+    drawn += st.drawn;
+    changes += st.stateChanges;
+    calls += st.drawCalls;
+  }
+  printf("crowd-bench: %zu instances, %d frames: cull+sort mean %.3f ms, max %.3f ms, "
+         "drawn %.0f, draw calls %.0f, state changes %.0f per frame\n",
+         count, frames, total / frames, worst, (double)drawn / frames, (double)calls / frames, (double)changes / frames);
+  return true;
+}
+
+// ------------------------------
+// CPU crowd render (--crowd-render)
+// ------------------------------
+// MinecraftSkinViewerCli --crowd-render out.png [N] [--skins <dir|archive>] [--size WxH]
+//     [--yaw Y] [--pitch P] [--dist D] [--occluders K] [--no-occlusion] [--compare] [--png LEVEL]
+// Renders N crowd players (default 20000) with RenderCrowdCPU using the
+// golden corpus skins or the given source. Prints the cull counts and time.
+// --compare renders once more without occlusion and reports differing pixels.
+static bool RunCrowdRenderFromArgs(int argc, wchar_t** argv, int& exitCode) {
+  int i = 1;
+  while (i < argc && wcscmp(argv[i], L"--crowd-render") != 0) ++i;
+  if (i >= argc) return false;
+  if (i + 1 >= argc) throw std::runtime_error("--crowd-render needs <out.png>");
+  const std::wstring outPath = argv[i + 1];
+  size_t count = 20000;
+  if (i + 2 < argc && iswdigit(argv[i + 2][0])) count = (size_t)wcstoull(argv[i + 2], nullptr, 10);
+
+  CpuRenderParams p;
+  p.width = 1920;
+  p.height = 1080;
+  p.cam.dist = 300.0f;
+  p.cam.pitch = 0.0f;
+  CpuCrowdParams cp;
+  bool compare = false;
+  std::wstring source;
+  for (int k = 1; k < argc; ++k) {
+    const wchar_t* a = argv[k];
+    const wchar_t* v = (k + 1 < argc) ? argv[k + 1] : L"";
+    if      (!wcscmp(a, L"--size"))         { swscanf(v, L"%dx%d", &p.width, &p.height); ++k; }
+    else if (!wcscmp(a, L"--skins"))        { source = v; ++k; }
+    else if (!wcscmp(a, L"--yaw"))          { p.cam.yaw = wcstof(v, nullptr); ++k; }
+    else if (!wcscmp(a, L"--pitch"))        { p.cam.pitch = Clamp(wcstof(v, nullptr), -1.2f, 1.2f); ++k; }
+    else if (!wcscmp(a, L"--dist"))         { p.cam.dist = Clamp(wcstof(v, nullptr), 20.0f, kCrowdMaxDist); ++k; }
+    else if (!wcscmp(a, L"--occluders"))    { cp.occluders = (int)wcstol(v, nullptr, 10); ++k; }
+    else if (!wcscmp(a, L"--no-occlusion")) cp.occlusion = false;
+    else if (!wcscmp(a, L"--compare"))      compare = true;
+  }
+  if (p.width <= 0 || p.height <= 0 || p.width > 16384 || p.height > 16384)
+    throw std::runtime_error("--size must be between 1x1 and 16384x16384");
+
+  std::vector<SkinInfo> store;
+  if (source.empty()) {
+    for (const GoldenCase& c : kGoldenCases) store.push_back(MakeGoldenSkin(c));
+  } else {
+    IngestSkins(source, [&](IngestedSkin&& r) {
+      if (r.error.empty()) store.push_back(std::move(r.skin));
+      return store.size() < 65536;
+    });
+  }
+  if (store.empty()) throw std::runtime_error("--crowd-render: no readable skins");
+  std::vector<const SkinInfo*> skins;
+  for (const SkinInfo& s : store) skins.push_back(&s);
+
+  const BuiltMesh meshes[2] = { BuildCrowdMesh(false), BuildCrowdMesh(true) };
+  CrowdInstances crowd;
+  PopulateCrowd(crowd, count, skins.size(), kCrowdSpacing, 1234u);
+
+  std::vector<uint8_t> image((size_t)p.width * p.height * 4);
+  auto render = [&](const CpuCrowdParams& params, CpuCrowdStats& st) {
+    const auto t0 = std::chrono::steady_clock::now();
+    RenderCrowdCPU(crowd, skins, meshes, p, params, st, [&](int y0, int rows, const uint8_t* rgba, size_t stride) {
+      memcpy(&image[(size_t)y0 * stride], rgba, stride * rows);
+    });
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  };
+
+  CpuCrowdStats st;
+  const double ms = render(cp, st);
+  printf("crowd-render: %u players, %u outside the frustum, %u occluded (%u occluders), %u drawn, %u triangles, %.1f ms\n",
+         st.instances, st.frustumCulled, st.occlusionCulled, st.occluders, st.drawn, st.triangles, ms);
+
+  PngEncodeOptions png;
+  ParsePngArgs(argc, argv, png);
+  std::vector<uint8_t> file;
+  PngEncoder().Encode(image.data(), (uint32_t)p.width, (uint32_t)p.height, png, file);
+  WriteFileBytes(outPath, file);
+
+  if (compare) {
+    const std::vector<uint8_t> culled = image;
+    CpuCrowdParams all = cp;
+    all.occlusion = !cp.occlusion;
+    CpuCrowdStats st2;
+    const double ms2 = render(all, st2);
+    size_t diff = 0;
+    for (size_t px = 0; px < culled.size(); px += 4) diff += memcmp(&culled[px], &image[px], 4) != 0;
+    printf("occlusion %s: %u drawn, %.1f ms; %zu pixels differ\n", all.occlusion ? "on" : "off", st2.drawn, ms2, diff);
+    exitCode = diff ? 1 : 0;
+  }
+  return true;
+}
+
+
+// ------------------------------
+// Main
+// ------------------------------
+static int PrintUsage() {
+  fputs("usage: MinecraftSkinViewerCli <command> ...\n"
+        "  --render in.png out.png [options]      --render-batch <src> <outdir> [options]\n"
+        "  --png-bench <src> [options]            --crowd-render out.png [N] [options]\n"
+        "  --crowd-bench [N] [--frames F]\n"
+        "  --composite out.png base.png [layer.png ...]\n"
+        "  --palette-report <dir|archive>         --probe <dir|list.txt>\n"
+        "  --hist-index <src> <index.bin>         --hist-query <index.bin> <query|skin.png>\n"
+        "  --phash-index <src> <index.bin> [--dedupe] [--k N]\n"
+        "  --phash-query <index.bin> <skin.png> [--k N]\n"
+        "  --export <src> <outdir> [--format glb|obj]\n"
+        "Options are described above each Run*FromArgs in skin_cli.cpp.\n", stderr);
+  return 2;
+}
+
+static int RunCommand(int argc, wchar_t** argv) {
+  int exitCode = 0;
+  const bool handled =
+    RunOfflineRenderFromArgs(argc, argv) || RunBatchRenderFromArgs(argc, argv) || RunPngBenchFromArgs(argc, argv) ||
+    RunCompositeFromArgs(argc, argv) || RunPaletteReportFromArgs(argc, argv, exitCode) || RunProbeFromArgs(argc, argv) ||
+    RunHistIndexFromArgs(argc, argv) || RunHistQueryFromArgs(argc, argv) || RunPHashIndexFromArgs(argc, argv) ||
+    RunPHashQueryFromArgs(argc, argv) || RunExportFromArgs(argc, argv) ||
+    RunCrowdRenderFromArgs(argc, argv, exitCode) || RunCrowdBenchFromArgs(argc, argv);
+  return handled ? exitCode : PrintUsage();
+}
+
+// Errors go to stderr with exit code 1; 2 is a usage error.
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv) {
+  try {
+    return RunCommand(argc, argv);
+#else
+int main(int argc, char** argv) {
+  try {
+    std::vector<std::wstring> args;
+    std::vector<wchar_t*> wargv;
+    for (int k = 0; k < argc; ++k) args.push_back(WideFromUtf8(argv[k]));
+    for (std::wstring& a : args) wargv.push_back(a.data());
+    wargv.push_back(nullptr);
+    return RunCommand(argc, wargv.data());
+#endif
+  } catch (const std::exception& e) {
+    fprintf(stderr, "error: %s\n", e.what());
+    return 1;
+  } catch (...) {
+    fputs("error: unknown exception\n", stderr);
+    return 1;
+  }
+}
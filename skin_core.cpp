@@ -0,0 +1,4920 @@
+// ==============================
+// File: src/skin_core.cpp
+// ==============================
+#include "skin_core.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <fstream>
+#include <cwctype>
+#include <stdexcept>
+#include <thread>
+#include <barrier>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
+#include <map>
+#include <numeric>
+#include <chrono>
+#include <charconv>
+#include <optional>
+#include <random>
+#include <emmintrin.h>
+
+// ------------------------------
+// Small helpers
+// ------------------------------
+// UTF-8 <-> wchar_t (UTF-16 on Windows, UTF-32 elsewhere). Unpaired
+// surrogates and invalid UTF-8 become U+FFFD, as the Windows converters do.
+std::string NarrowFromWide(std::wstring_view w) {
+  std::string out;
+  out.reserve(w.size());
+  for (size_t i = 0; i < w.size(); ++i) {
+    uint32_t c = (uint32_t)w[i];
+    if (sizeof(wchar_t) == 2 && c >= 0xD800 && c < 0xDC00 && i + 1 < w.size() &&
+        (uint32_t)w[i + 1] >= 0xDC00 && (uint32_t)w[i + 1] < 0xE000) {
+      c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)w[++i] - 0xDC00);
+    }
+    if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF) c = 0xFFFD;
+    if (c < 0x80) {
+      out += (char)c;
+    } else if (c < 0x800) {
+      out += (char)(0xC0 | c >> 6);
+      out += (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      out += (char)(0xE0 | c >> 12);
+      out += (char)(0x80 | ((c >> 6) & 0x3F));
+      out += (char)(0x80 | (c & 0x3F));
+    } else {
+      out += (char)(0xF0 | c >> 18);
+      out += (char)(0x80 | ((c >> 12) & 0x3F));
+      out += (char)(0x80 | ((c >> 6) & 0x3F));
+      out += (char)(0x80 | (c & 0x3F));
+    }
+  }
+  return out;
+}
+
+std::wstring WideFromUtf8(std::string_view s) {
+  std::wstring out;
+  out.reserve(s.size());
+  for (size_t i = 0; i < s.size();) {
+    const uint8_t b = (uint8_t)s[i];
+    const int n = b < 0x80 ? 0 : (b >> 5) == 6 ? 1 : (b >> 4) == 14 ? 2 : (b >> 3) == 30 ? 3 : -1;
+    uint32_t c = n < 0 ? 0xFFFD : n == 0 ? b : b & (0x3F >> n);
+    size_t k = 1;
+    for (; n > 0 && k <= (size_t)n; ++k) {
+      if (i + k >= s.size() || ((uint8_t)s[i + k] >> 6) != 2) break;
+      c = c << 6 | ((uint8_t)s[i + k] & 0x3F);
+    }
+    static constexpr uint32_t kMin[4] = { 0, 0x80, 0x800, 0x10000 };
+    if (n > 0 && (k <= (size_t)n || c < kMin[n] || c > 0x10FFFF || (c >= 0xD800 && c < 0xE000))) c = 0xFFFD;
+    i += k;
+    if (sizeof(wchar_t) == 2 && c >= 0x10000) {
+      out += (wchar_t)(0xD800 + ((c - 0x10000) >> 10));
+      out += (wchar_t)(0xDC00 + ((c - 0x10000) & 0x3FF));
+    } else {
+      out += (wchar_t)c;
+    }
+  }
+  return out;
+}
+
+void WriteFileBytes(const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write((const char*)data.data(), (std::streamsize)data.size());
+  if (!f) throw std::runtime_error("cannot write " + path.string());
+}
+
+// Whole file in one read; false when it cannot be opened or read.
+bool ReadFileBytes(const std::filesystem::path& path, std::vector<uint8_t>& out) {
+  std::ifstream f(path, std::ios::binary | std::ios::ate);
+  if (!f) return false;
+  out.resize((size_t)f.tellg());
+  f.seekg(0);
+  f.read((char*)out.data(), (std::streamsize)out.size());
+  return (bool)f;
+}
+
+// ------------------------------
+// Skin + analysis
+// ------------------------------
+
+static bool AnyNonTransparent(const SkinInfo& s, const UvRectPx& r) {
+  if (s.rgba.empty() || s.width == 0 || s.height == 0) return false;
+  int x0 = std::max(0, r.x), y0 = std::max(0, r.y);
+  int x1 = std::min((int)s.width, r.x + r.w);
+  int y1 = std::min((int)s.height, r.y + r.h);
+  if (x1 <= x0 || y1 <= y0) return false;
+
+  for (int y = y0; y < y1; ++y) {
+    for (int x = x0; x < x1; ++x) {
+      const size_t idx = (size_t)(y * s.width + x) * 4;
+      if (idx + 3 < s.rgba.size() && s.rgba[idx + 3] != 0) return true;
+    }
+  }
+  return false;
+}
+
+enum class AlphaClass : uint8_t { Empty, Binary, Translucent };
+
+// Empty: all alpha 0. Binary: only 0/255. Translucent: some alpha in between.
+static AlphaClass ClassifyRectAlpha(const SkinInfo& s, const UvRectPx& r) {
+  const int x0 = std::max(0, r.x), y0 = std::max(0, r.y);
+  const int x1 = std::min((int)s.width, r.x + r.w);
+  const int y1 = std::min((int)s.height, r.y + r.h);
+
+  AlphaClass c = AlphaClass::Empty;
+  for (int y = y0; y < y1; ++y) {
+    for (int x = x0; x < x1; ++x) {
+      const uint8_t a = s.rgba[((size_t)y * s.width + x) * 4 + 3];
+      if (a != 0 && a != 255) return AlphaClass::Translucent;
+      if (a == 255) c = AlphaClass::Binary;
+    }
+  }
+  return c;
+}
+
+bool HasPartialAlpha(const SkinInfo& s) {
+  for (size_t i = 3; i < s.rgba.size(); i += 4) {
+    if (s.rgba[i] != 0 && s.rgba[i] != 255) return true;
+  }
+  return false;
+}
+
+static UvRectPx ScaleRect(const UvRectPx& r, uint32_t scale) {
+  return UvRectPx{ (int)(r.x * (int)scale), (int)(r.y * (int)scale), (int)(r.w * (int)scale), (int)(r.h * (int)scale) };
+}
+
+BoxUv ScaleBoxUv(const BoxUv& b, uint32_t scale) {
+  return BoxUv{
+    ScaleRect(b.top, scale),
+    ScaleRect(b.bottom, scale),
+    ScaleRect(b.right, scale),
+    ScaleRect(b.front, scale),
+    ScaleRect(b.left, scale),
+    ScaleRect(b.back, scale),
+  };
+}
+
+// Minecraft box-UV layout: a w*h*d box at UV origin (u, v) unwraps to
+//   [ d ][ w ][ w ]          top, bottom
+//   [ d ][ w ][ d ][ w ]     right, front, left, back
+static BoxUv BoxUvFromOrigin(int u, int v, int w, int h, int d) {
+  return BoxUv{
+    /*top*/    {u + d,         v,     w, d},
+    /*bottom*/ {u + d + w,     v,     w, d},
+    /*right*/  {u,             v + d, d, h},
+    /*front*/  {u + d,         v + d, w, h},
+    /*left*/   {u + d + w,     v + d, d, h},
+    /*back*/   {u + d + w + d, v + d, w, h},
+  };
+}
+
+// ------------------------------
+// Model descriptors
+// ------------------------------
+// A model is a flat array of boxes. Each box carries its own UV origin and the
+// per-face UV fix-ups the player model needs, so one emitter handles all parts.
+
+BoxUv PartUv(const PartDesc& p) {
+  return BoxUvFromOrigin(p.u, p.v, (int)p.size.x, (int)p.size.y, (int)p.size.z);
+}
+
+static PartDesc MakePart(const char* name, XMFLOAT3 center, XMFLOAT3 size, int u, int v,
+                         PartLayer layer = Layer_Base, float inflate = 0.0f) {
+  PartDesc p;
+  p.name = name;
+  p.center = center;
+  p.size = size;
+  p.inflate = inflate;
+  p.u = u;
+  p.v = v;
+  p.layer = layer;
+  p.skipIfTransparent = (layer == Layer_Overlay);
+  return p;
+}
+
+// The per-face UV fix-ups of the player's parts, by part (bone) name. Shared
+// with ParseBedrockGeometry, so a geometry file with the vanilla bone names
+// maps the skin exactly like the built-in model.
+static void ApplyPlayerFaceMapping(PartDesc& p) {
+  const std::string_view n = p.name;
+  if (n == "head" || n == "hat") {
+    // Head / hat: bottom and both sides rotated 180°.
+    p.faceFlags[Face_Bottom] ^= FaceFlipU | FaceFlipV;
+    p.faceFlags[Face_PosX]   ^= FaceFlipU | FaceFlipV;
+    p.faceFlags[Face_NegX]   ^= FaceFlipU | FaceFlipV;
+  } else if (n == "rightArm" || n == "leftArm" || n == "rightLeg" || n == "leftLeg") {
+    // Base limbs: inner/outer side rects swapped.
+    p.swapSides = !p.swapSides;
+  } else if (n == "rightSleeve" || n == "leftSleeve") {
+    // Sleeves: only the outer side is mirrored (-X for the right arm, +X for the left).
+    p.faceFlags[n == "rightSleeve" ? Face_NegX : Face_PosX] ^= FaceFlipU;
+  }
+}
+
+static ModelDesc MakePlayerModel(bool slimArms) {
+  const float armW = slimArms ? 3.0f : 4.0f;
+  const float armX = 4.0f + armW * 0.5f;   // body half-width + arm half-width
+  const float ov = 0.25f;                  // overlay boxes are 0.5 larger per axis
+
+  const XMFLOAT3 headSize{8, 8, 8};
+  const XMFLOAT3 bodySize{8, 12, 4};
+  const XMFLOAT3 legSize{4, 12, 4};
+  const XMFLOAT3 armSize{armW, 12, 4};
+
+  const XMFLOAT3 headC{0, 12 + 12 + 4, 0}; // 28
+  const XMFLOAT3 bodyC{0, 12 + 6, 0};      // 18
+  const XMFLOAT3 rArmC{-armX, 12 + 6, 0};
+  const XMFLOAT3 lArmC{ armX, 12 + 6, 0};
+  const XMFLOAT3 rLegC{-2, 6, 0};
+  const XMFLOAT3 lLegC{ 2, 6, 0};
+
+  ModelDesc m;
+  m.name = slimArms ? "Player (slim)" : "Player (classic)";
+  m.parts = {
+    MakePart("head",        headC, headSize,  0,  0),
+    MakePart("body",        bodyC, bodySize, 16, 16),
+    MakePart("rightArm",    rArmC, armSize,  40, 16),
+    MakePart("rightLeg",    rLegC, legSize,   0, 16),
+    MakePart("leftArm",     lArmC, armSize,  32, 48),
+    MakePart("leftLeg",     lLegC, legSize,  16, 48),
+
+    MakePart("hat",         headC, headSize, 32,  0, Layer_Overlay, ov),
+    MakePart("jacket",      bodyC, bodySize, 16, 32, Layer_Overlay, ov),
+    MakePart("rightSleeve", rArmC, armSize,  40, 32, Layer_Overlay, ov),
+    MakePart("rightPants",  rLegC, legSize,   0, 32, Layer_Overlay, ov),
+    MakePart("leftSleeve",  lArmC, armSize,  48, 48, Layer_Overlay, ov),
+    MakePart("leftPants",   lLegC, legSize,   0, 48, Layer_Overlay, ov),
+  };
+  for (PartDesc& p : m.parts) ApplyPlayerFaceMapping(p);
+  return m;
+}
+
+const ModelDesc& PlayerModel(bool slimArms) {
+  static const ModelDesc classic = MakePlayerModel(false);
+  static const ModelDesc slim = MakePlayerModel(true);
+  return slimArms ? slim : classic;
+}
+
+// ------------------------------
+// Geometry
+// ------------------------------
+
+// Minecraft-style directional shading: top brightest, bottom darkest.
+static constexpr float kFaceShade[Face_Count] = { 1.0f, 0.5f, 0.8f, 0.8f, 0.6f, 0.6f };
+
+static constexpr float kAoReach = 1.5f;      // model units sampled above a vertex
+static constexpr float kAoStrength = 0.6f;   // darkening when every sample is blocked
+
+// Face shade times ambient occlusion for a vertex of a `self` face. AO is the
+// share of a 3x3 grid of points, kAoReach out along the normal and tilted
+// around it, that falls inside another base box (base boxes are opaque).
+// This darkens e.g. the torso under the head and the arm tops next to it.
+float BakedShade(const ModelDesc* model, const PartDesc& self, const XMFLOAT3& pos, int face) {
+  if (!model) return kFaceShade[face];
+  const int axis = kFaceNormals[face][0] != 0 ? 0 : (kFaceNormals[face][1] != 0 ? 1 : 2);
+  const int t1 = (axis + 1) % 3, t2 = (axis + 2) % 3;
+  const float base[3] = { pos.x, pos.y, pos.z };
+  float lo[3], hi[3];   // bounds of the sample grid
+  for (int k = 0; k < 3; ++k) {
+    lo[k] = base[k] - (k == axis ? 0.0f : kAoReach);
+    hi[k] = base[k] + (k == axis ? 0.0f : kAoReach);
+  }
+  lo[axis] = hi[axis] = base[axis] + kFaceNormals[face][axis] * kAoReach;
+
+  // Boxes that can hold a sample at all; usually one or two
+  const PartDesc* near[16];
+  int nearCount = 0;
+  for (const PartDesc& o : model->parts) {
+    if (&o == &self || o.layer != Layer_Base || nearCount == 16) continue;
+    bool overlap = true;
+    for (int k = 0; k < 3 && overlap; ++k) {
+      const float h = (&o.size.x)[k] * 0.5f + o.inflate, c = (&o.center.x)[k];
+      overlap = lo[k] <= c + h && hi[k] >= c - h;
+    }
+    if (overlap) near[nearCount++] = &o;
+  }
+  if (!nearCount) return kFaceShade[face];
+
+  int blocked = 0;
+  for (int a = -1; a <= 1; ++a) {
+    for (int b = -1; b <= 1; ++b) {
+      float q[3] = { base[0], base[1], base[2] };
+      q[axis] = lo[axis];
+      q[t1] += (float)a * kAoReach;
+      q[t2] += (float)b * kAoReach;
+      for (int n = 0; n < nearCount; ++n) {
+        const PartDesc& o = *near[n];
+        bool inside = true;
+        for (int k = 0; k < 3 && inside; ++k) inside = std::abs(q[k] - (&o.center.x)[k]) <= (&o.size.x)[k] * 0.5f + o.inflate;
+        if (inside) { ++blocked; break; }
+      }
+    }
+  }
+  return kFaceShade[face] * (1.0f - kAoStrength * (float)blocked / 9.0f);
+}
+
+static bool PartHasVisibleTexels(const SkinInfo& skin, const BoxUv& uv) {
+  return AnyNonTransparent(skin, uv.top) || AnyNonTransparent(skin, uv.bottom) ||
+         AnyNonTransparent(skin, uv.left) || AnyNonTransparent(skin, uv.right) ||
+         AnyNonTransparent(skin, uv.front) || AnyNonTransparent(skin, uv.back);
+}
+
+// Emits one box: 24 vertices, 36 indices. No per-face branches; all variation
+// comes from the descriptor through the tables above. Vertex shades are baked
+// against the base boxes of `aoModel` (nullptr: face shading only).
+// Each face goes to its own index list (dst[face]), see BuildModelMesh.
+void EmitPart(std::vector<Vertex>& v, std::vector<uint32_t>* const dst[Face_Count],
+              const PartDesc& p, const BoxUv& uv, uint32_t texW, uint32_t texH, const ModelDesc* aoModel) {
+  const float hx = p.size.x * 0.5f + p.inflate;
+  const float hy = p.size.y * 0.5f + p.inflate;
+  const float hz = p.size.z * 0.5f + p.inflate;
+
+  XMFLOAT3 corners[8];
+  for (int c = 0; c < 8; ++c) {
+    corners[c] = XMFLOAT3(p.center.x + hx * (float)(((c >> 0) & 1) * 2 - 1),
+                          p.center.y + hy * (float)(((c >> 1) & 1) * 2 - 1),
+                          p.center.z + hz * (float)(((c >> 2) & 1) * 2 - 1));
+  }
+
+  const UvRectPx* rects = &uv.top;
+  const float invW = 1.0f / (float)texW;
+  const float invH = 1.0f / (float)texH;
+
+  for (int f = 0; f < Face_Count; ++f) {
+    if (!dst[f]) continue; // face omitted by the caller
+    const UvRectPx& r = rects[kFaceRect[p.swapSides][f]];
+    const XMFLOAT2 rc[4] = {
+      {(float)r.x * invW,         (float)r.y * invH},
+      {(float)(r.x + r.w) * invW, (float)r.y * invH},
+      {(float)(r.x + r.w) * invW, (float)(r.y + r.h) * invH},
+      {(float)r.x * invW,         (float)(r.y + r.h) * invH},
+    };
+    const uint8_t* perm = kUvCornerPerm[p.faceFlags[f] & 3];
+    const XMFLOAT3 n(kFaceNormals[f][0], kFaceNormals[f][1], kFaceNormals[f][2]);
+
+    const uint32_t base = (uint32_t)v.size();
+    for (int k = 0; k < 4; ++k) {
+      const XMFLOAT3& c = corners[kFaceCorners[f][k]];
+      v.push_back(Vertex{ c, n, rc[perm[k]], BakedShade(aoModel, p, c, f) });
+    }
+
+    // keep your working winding
+    dst[f]->insert(dst[f]->end(), { base + 0, base + 1, base + 2, base + 0, base + 2, base + 3 });
+  }
+}
+
+uint32_t ModelTexScale(const SkinInfo& skin, const ModelDesc& model) {
+  return std::max(1u, skin.width / model.texW);
+}
+
+// One flag per part: 0 if the part is skipped because all of its texels are transparent.
+void ComputePartPresence(const SkinInfo& skin, const ModelDesc& model, std::vector<uint8_t>& present) {
+  present.assign(model.parts.size(), 1);
+  const uint32_t s = ModelTexScale(skin, model);
+  for (size_t i = 0; i < model.parts.size(); ++i) {
+    const PartDesc& p = model.parts[i];
+    // Overlay: only add if any non-transparent pixels exist
+    if (p.skipIfTransparent) present[i] = PartHasVisibleTexels(skin, ScaleBoxUv(PartUv(p), s)) ? 1 : 0;
+  }
+}
+
+std::vector<uint8_t> ComputePartPresence(const SkinInfo& skin, const ModelDesc& model) {
+  std::vector<uint8_t> present;
+  ComputePartPresence(skin, model, present);
+  return present;
+}
+
+// Builds from a known presence mask (no texel scans), e.g. after a paint stroke.
+// Writes into `m` as an arena: clear() keeps its storage and the reserves are
+// exact for the model's box and face counts, so rebuilding a model no larger
+// than the previous one performs no heap allocation.
+void BuildModelMeshInto(const SkinInfo& skin, const ModelDesc& model, const std::vector<uint8_t>& present, BuiltMesh& m) {
+  m.vertices.clear();
+  m.indicesBase.clear();
+  m.indicesOverlay.clear();
+  m.indicesTranslucent.clear();
+  if (!skin.width || !skin.height) return;
+
+  const uint32_t texW = skin.width;
+  const uint32_t texH = skin.height;
+  const uint32_t s = ModelTexScale(skin, model);
+
+  size_t boxes[2]{};
+  for (size_t i = 0; i < model.parts.size(); ++i) {
+    if (present[i]) ++boxes[model.parts[i].layer];
+  }
+  m.vertices.reserve((boxes[Layer_Base] + boxes[Layer_Overlay]) * Face_Count * 4);
+  m.indicesBase.reserve(boxes[Layer_Base] * Face_Count * 6);
+  m.indicesOverlay.reserve(boxes[Layer_Overlay] * Face_Count * 6);
+  m.indicesTranslucent.reserve(boxes[Layer_Overlay] * Face_Count * 6); // any overlay face may be translucent
+  std::vector<uint32_t>* const layerDst[2] = { &m.indicesBase, &m.indicesOverlay };
+
+  for (size_t i = 0; i < model.parts.size(); ++i) {
+    if (!present[i]) continue;
+    const PartDesc& p = model.parts[i];
+    const BoxUv uv = ScaleBoxUv(PartUv(p), s);
+
+    std::vector<uint32_t>* dst[Face_Count];
+    for (int f = 0; f < Face_Count; ++f) dst[f] = layerDst[p.layer];
+
+    // Only faces that really contain partial alpha pay for blending and sorting.
+    if (p.layer == Layer_Overlay && skin.overlayTranslucent) {
+      for (int f = 0; f < Face_Count; ++f) {
+        if (ClassifyRectAlpha(skin, (&uv.top)[kFaceRect[p.swapSides][f]]) == AlphaClass::Translucent) {
+          dst[f] = &m.indicesTranslucent;
+        }
+      }
+    }
+    EmitPart(m.vertices, dst, p, uv, texW, texH, &model);
+  }
+}
+
+BuiltMesh BuildModelMesh(const SkinInfo& skin, const ModelDesc& model, const std::vector<uint8_t>& present) {
+  BuiltMesh m;
+  BuildModelMeshInto(skin, model, present, m);
+  return m;
+}
+
+MeshBufferSizes MeshBufferNeeds(const BuiltMesh& m) {
+  MeshBufferSizes s;
+  s.vertices = (uint32_t)m.vertices.size();
+  s.indices = (uint32_t)(m.indicesBase.size() + m.indicesOverlay.size());
+  s.translucentIndices = (uint32_t)m.indicesTranslucent.size();
+  return s;
+}
+
+MeshBufferSizes MeshBufferReserve(const ModelDesc& model) {
+  uint32_t overlayParts = 0;
+  for (const PartDesc& p : model.parts) overlayParts += p.layer == Layer_Overlay ? 1 : 0;
+  const uint32_t parts = (uint32_t)model.parts.size();
+  MeshBufferSizes s;
+  s.vertices = parts * Face_Count * 4;
+  s.indices = parts * Face_Count * 6;
+  s.translucentIndices = std::max(1u, overlayParts * Face_Count * 6);
+  return s;
+}
+
+bool GrowMeshBufferCapacity(uint32_t& capacity, uint32_t needed, bool exists) {
+  if (exists && needed <= capacity) return false;
+  capacity = std::max({ needed, capacity * 2, 1u });
+  return true;
+}
+
+// Face centroids for a list of quads (6 indices per face, as emitted by EmitPart).
+void ComputeFaceCentroids(const BuiltMesh& m, const std::vector<uint32_t>& idx, std::vector<XMFLOAT3>& out) {
+  out.resize(idx.size() / 6);
+  for (size_t f = 0; f < out.size(); ++f) {
+    const uint32_t* q = &idx[f * 6];
+    const XMFLOAT3& a = m.vertices[q[0]].pos;
+    const XMFLOAT3& c = m.vertices[q[2]].pos;
+    out[f] = XMFLOAT3((a.x + c.x) * 0.5f, (a.y + c.y) * 0.5f, (a.z + c.z) * 0.5f); // diagonal midpoint
+  }
+}
+
+// Writes faceIdx reordered back to front as seen from `eye` (model space).
+// Used by both the GPU and CPU paths so translucent faces composite identically.
+void SortFacesBackToFront(const std::vector<XMFLOAT3>& centroids, const std::vector<uint32_t>& faceIdx,
+                          const XMFLOAT3& eye, std::vector<uint32_t>& order, std::vector<uint32_t>& out) {
+  order.resize(centroids.size());
+  for (uint32_t f = 0; f < (uint32_t)order.size(); ++f) order[f] = f;
+
+  auto dist2 = [&](uint32_t f) {
+    const float dx = centroids[f].x - eye.x, dy = centroids[f].y - eye.y, dz = centroids[f].z - eye.z;
+    return dx * dx + dy * dy + dz * dz;
+  };
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    const float da = dist2(a), db = dist2(b);
+    return da != db ? da > db : a < b; // stable tie-break keeps results deterministic
+  });
+
+  out.resize(faceIdx.size());
+  for (size_t k = 0; k < order.size(); ++k) {
+    memcpy(&out[k * 6], &faceIdx[(size_t)order[k] * 6], 6 * sizeof(uint32_t));
+  }
+}
+
+BuiltMesh BuildModelMesh(const SkinInfo& skin, const ModelDesc& model) {
+  return BuildModelMesh(skin, model, ComputePartPresence(skin, model));
+}
+
+BuiltMesh BuildPlayerMesh(const SkinInfo& skin, bool slimArms) {
+  return BuildModelMesh(skin, PlayerModel(slimArms));
+}
+
+// Per base part, a bit per face that lies flush against another base box and
+// is covered by it (base boxes are opaque, see SanitizeMinecraftBaseAlpha).
+static std::vector<uint8_t> ComputeHiddenBaseFaces(const ModelDesc& model) {
+  constexpr float kEps = 1e-4f;
+  std::vector<uint8_t> hidden(model.parts.size(), 0);
+  auto lo = [](const PartDesc& p, int axis) { return (&p.center.x)[axis] - (&p.size.x)[axis] * 0.5f - p.inflate; };
+  auto hi = [](const PartDesc& p, int axis) { return (&p.center.x)[axis] + (&p.size.x)[axis] * 0.5f + p.inflate; };
+
+  for (size_t i = 0; i < model.parts.size(); ++i) {
+    const PartDesc& a = model.parts[i];
+    if (a.layer != Layer_Base) continue;
+    for (int f = 0; f < Face_Count; ++f) {
+      const int axis = kFaceNormals[f][0] != 0 ? 0 : (kFaceNormals[f][1] != 0 ? 1 : 2);
+      const bool positive = (kFaceNormals[f][axis] > 0);
+      const float plane = positive ? hi(a, axis) : lo(a, axis);
+      for (size_t j = 0; j < model.parts.size() && !(hidden[i] & (1u << f)); ++j) {
+        const PartDesc& b = model.parts[j];
+        if (j == i || b.layer != Layer_Base) continue;
+        // b must start at the plane and extend outward...
+        const bool flush = positive ? (std::abs(lo(b, axis) - plane) < kEps) : (std::abs(hi(b, axis) - plane) < kEps);
+        if (!flush) continue;
+        // ...and contain the whole face rect.
+        bool covers = true;
+        for (int k = 0; k < 3 && covers; ++k) {
+          if (k == axis) continue;
+          covers = lo(b, k) <= lo(a, k) + kEps && hi(b, k) >= hi(a, k) - kEps;
+        }
+        if (covers) hidden[i] |= (uint8_t)(1u << f);
+      }
+    }
+  }
+  return hidden;
+}
+
+// LOD1: base boxes only, merged into a single index range without the faces
+// they hide from each other. UVs are normalized, so any skin scale fits.
+BuiltMesh BuildLod1Mesh(const SkinInfo& skin, const ModelDesc& model) {
+  BuiltMesh m;
+  if (!skin.width || !skin.height) return m;
+  const std::vector<uint8_t> hidden = ComputeHiddenBaseFaces(model);
+  const uint32_t s = ModelTexScale(skin, model);
+  for (size_t i = 0; i < model.parts.size(); ++i) {
+    const PartDesc& p = model.parts[i];
+    if (p.layer != Layer_Base) continue;
+    std::vector<uint32_t>* dst[Face_Count];
+    for (int f = 0; f < Face_Count; ++f) dst[f] = (hidden[i] & (1u << f)) ? nullptr : &m.indicesBase;
+    EmitPart(m.vertices, dst, p, ScaleBoxUv(PartUv(p), s), skin.width, skin.height, &model);
+  }
+  return m;
+}
+
+// ------------------------------
+// Model loading (Bedrock geometry.json)
+// ------------------------------
+// Minimal JSON DOM: enough for geometry files, throws std::runtime_error on bad input.
+struct JsonValue {
+  enum class Type { Null, Bool, Number, String, Array, Object };
+  Type type = Type::Null;
+  bool boolean = false;
+  double number = 0.0;
+  std::string str;
+  std::vector<JsonValue> arr;
+  std::vector<std::pair<std::string, JsonValue>> obj;
+
+  const JsonValue* Find(std::string_view key) const {
+    for (const auto& kv : obj) if (kv.first == key) return &kv.second;
+    return nullptr;
+  }
+  double NumberOr(std::string_view key, double def) const {
+    const JsonValue* v = Find(key);
+    return (v && v->type == Type::Number) ? v->number : def;
+  }
+};
+
+class JsonParser {
+public:
+  static constexpr int kMaxDepth = 64;   // geometry files nest about 6 deep
+
+  explicit JsonParser(std::string_view text) : s_(text) {}
+
+  JsonValue Parse() {
+    JsonValue v = ParseValue();
+    SkipWs();
+    if (pos_ != s_.size()) Fail("trailing characters");
+    return v;
+  }
+
+private:
+  [[noreturn]] void Fail(const char* what) const {
+    throw std::runtime_error(std::string("JSON: ") + what + " at offset " + std::to_string(pos_));
+  }
+
+  void SkipWs() {
+    while (pos_ < s_.size()) {
+      const char c = s_[pos_];
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r') { ++pos_; continue; }
+      // Bedrock files in the wild sometimes carry // comments
+      if (c == '/' && pos_ + 1 < s_.size() && s_[pos_ + 1] == '/') {
+        while (pos_ < s_.size() && s_[pos_] != '\n') ++pos_;
+        continue;
+      }
+      break;
+    }
+  }
+
+  bool Consume(char c) {
+    SkipWs();
+    if (pos_ < s_.size() && s_[pos_] == c) { ++pos_; return true; }
+    return false;
+  }
+
+  void Expect(char c) {
+    if (!Consume(c)) Fail("unexpected character");
+  }
+
+  JsonValue ParseValue() {
+    SkipWs();
+    if (pos_ >= s_.size()) Fail("unexpected end");
+    JsonValue v;
+    const char c = s_[pos_];
+    if ((c == '{' || c == '[') && depth_ == kMaxDepth) Fail("nested too deeply");
+    if (c == '{') {
+      v.type = JsonValue::Type::Object;
+      ++pos_;
+      ++depth_;
+      if (!Consume('}')) {
+        do {
+          SkipWs();
+          std::string key = ParseString();
+          Expect(':');
+          v.obj.emplace_back(std::move(key), ParseValue());
+        } while (Consume(','));
+        Expect('}');
+      }
+      --depth_;
+    } else if (c == '[') {
+      v.type = JsonValue::Type::Array;
+      ++pos_;
+      ++depth_;
+      if (!Consume(']')) {
+        do { v.arr.push_back(ParseValue()); } while (Consume(','));
+        Expect(']');
+      }
+      --depth_;
+    } else if (c == '"') {
+      v.type = JsonValue::Type::String;
+      v.str = ParseString();
+    } else if (s_.substr(pos_, 4) == "true") {
+      v.type = JsonValue::Type::Bool; v.boolean = true; pos_ += 4;
+    } else if (s_.substr(pos_, 5) == "false") {
+      v.type = JsonValue::Type::Bool; pos_ += 5;
+    } else if (s_.substr(pos_, 4) == "null") {
+      pos_ += 4;
+    } else {
+      v.type = JsonValue::Type::Number;
+      const std::string num(s_.substr(pos_, std::min<size_t>(64, s_.size() - pos_)));
+      char* end = nullptr;
+      v.number = strtod(num.c_str(), &end);
+      if (end == num.c_str()) Fail("invalid value");
+      pos_ += (size_t)(end - num.c_str());
+    }
+    return v;
+  }
+
+  std::string ParseString() {
+    if (pos_ >= s_.size() || s_[pos_] != '"') Fail("expected string");
+    ++pos_;
+    std::string out;
+    while (pos_ < s_.size() && s_[pos_] != '"') {
+      char c = s_[pos_++];
+      if (c == '\\' && pos_ < s_.size()) {
+        c = s_[pos_++];
+        switch (c) {
+          case 'n': out += '\n'; break;
+          case 't': out += '\t'; break;
+          case 'r': out += '\r'; break;
+          case 'b': out += '\b'; break;
+          case 'f': out += '\f'; break;
+          case 'u': pos_ += 4; out += '?'; break; // identifiers are ASCII in practice
+          default:  out += c; break;
+        }
+      } else {
+        out += c;
+      }
+    }
+    if (pos_ >= s_.size()) Fail("unterminated string");
+    ++pos_;
+    return out;
+  }
+
+  std::string_view s_;
+  size_t pos_ = 0;
+  int depth_ = 0;   // open objects and arrays; capped so hostile input cannot exhaust the stack
+};
+
+static XMFLOAT3 JsonVec3(const JsonValue* v, XMFLOAT3 def) {
+  if (!v || v->type != JsonValue::Type::Array || v->arr.size() < 3) return def;
+  return XMFLOAT3((float)v->arr[0].number, (float)v->arr[1].number, (float)v->arr[2].number);
+}
+
+// Accepts both the 1.12+ layout ("minecraft:geometry": [ {description, bones} ])
+// and the older 1.8 layout ("geometry.name": {texturewidth, bones}). Cubes use
+// box UV only; bone pivots/rotations are ignored (the viewer does not pose).
+// Cubes with a positive inflate are treated as overlay parts. Bedrock models
+// face north (-Z) and the viewer's face +Z, so Z is negated. Cubes of the
+// vanilla player bones get the built-in model's face fix-ups
+// (ApplyPlayerFaceMapping); "mirror" flips every face on top of them.
+ModelDesc ParseBedrockGeometry(std::string_view text) {
+  const JsonValue root = JsonParser(text).Parse();
+  if (root.type != JsonValue::Type::Object) throw std::runtime_error("geometry: root is not an object");
+
+  const JsonValue* geo = nullptr;
+  ModelDesc m;
+
+  if (const JsonValue* list = root.Find("minecraft:geometry"); list && list->type == JsonValue::Type::Array && !list->arr.empty()) {
+    geo = &list->arr[0];
+    if (const JsonValue* desc = geo->Find("description")) {
+      if (const JsonValue* id = desc->Find("identifier")) m.name = id->str;
+      m.texW = (uint32_t)desc->NumberOr("texture_width", 64);
+      m.texH = (uint32_t)desc->NumberOr("texture_height", 64);
+    }
+  } else {
+    for (const auto& kv : root.obj) {
+      if (kv.first.rfind("geometry.", 0) == 0 && kv.second.type == JsonValue::Type::Object) {
+        geo = &kv.second;
+        m.name = kv.first;
+        m.texW = (uint32_t)geo->NumberOr("texturewidth", 64);
+        m.texH = (uint32_t)geo->NumberOr("textureheight", 64);
+        break;
+      }
+    }
+  }
+  if (!geo) throw std::runtime_error("geometry: no model found");
+  if (m.texW == 0 || m.texH == 0) throw std::runtime_error("geometry: invalid texture size");
+
+  const JsonValue* bones = geo->Find("bones");
+  if (!bones || bones->type != JsonValue::Type::Array) throw std::runtime_error("geometry: missing bones");
+
+  for (const JsonValue& bone : bones->arr) {
+    const JsonValue* cubes = bone.Find("cubes");
+    if (!cubes) continue;
+    const JsonValue* boneName = bone.Find("name");
+    const JsonValue* boneMirror = bone.Find("mirror");
+    const float boneInflate = (float)bone.NumberOr("inflate", 0.0);
+
+    for (const JsonValue& cube : cubes->arr) {
+      const XMFLOAT3 origin = JsonVec3(cube.Find("origin"), XMFLOAT3(0, 0, 0));
+      const XMFLOAT3 size = JsonVec3(cube.Find("size"), XMFLOAT3(0, 0, 0));
+      const JsonValue* uv = cube.Find("uv");
+      if (!uv || uv->type != JsonValue::Type::Array || uv->arr.size() < 2) {
+        throw std::runtime_error("geometry: only box UV ([u, v]) cubes are supported");
+      }
+
+      PartDesc p;
+      p.name = boneName ? boneName->str : std::string();
+      p.size = size;
+      p.center = XMFLOAT3(origin.x + size.x * 0.5f, origin.y + size.y * 0.5f, -(origin.z + size.z * 0.5f));
+      p.inflate = (float)cube.NumberOr("inflate", boneInflate);
+      p.u = (int)uv->arr[0].number;
+      p.v = (int)uv->arr[1].number;
+      p.layer = p.inflate > 0.0f ? Layer_Overlay : Layer_Base;
+      p.skipIfTransparent = (p.layer == Layer_Overlay);
+      ApplyPlayerFaceMapping(p);
+
+      const JsonValue* mirror = cube.Find("mirror");
+      if (!mirror) mirror = boneMirror;
+      if (mirror && mirror->boolean) {
+        p.swapSides = !p.swapSides;
+        for (uint8_t& f : p.faceFlags) f ^= FaceFlipU;
+      }
+      m.parts.push_back(std::move(p));
+    }
+  }
+  if (m.parts.empty()) throw std::runtime_error("geometry: model has no cubes");
+  return m;
+}
+
+ModelDesc LoadBedrockGeometry(const std::filesystem::path& path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("cannot open " + path.string());
+  const std::string text((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  return ParseBedrockGeometry(text);
+}
+
+static void ForceRectOpaque(SkinInfo& s, int x, int y, int w, int h) {
+  const int x0 = std::max(0, x);
+  const int y0 = std::max(0, y);
+  const int x1 = std::min((int)s.width, x + w);
+  const int y1 = std::min((int)s.height, y + h);
+  if (x1 <= x0 || y1 <= y0) return;
+
+  for (int yy = y0; yy < y1; ++yy) {
+    for (int xx = x0; xx < x1; ++xx) {
+      const size_t idx = (size_t)(yy * s.width + xx) * 4;
+      s.rgba[idx + 3] = 255;
+    }
+  }
+}
+
+// Base-layer regions in 64px reference units.
+static constexpr UvRectPx kBaseOpaqueRects[] = {
+  { 0,  0,  32, 16 }, // head base
+  { 16, 16, 24, 16 }, // torso base
+  { 40, 16, 16, 16 }, // right arm base
+  { 0,  16, 16, 16 }, // right leg base
+  { 32, 48, 16, 16 }, // left arm base
+  { 16, 48, 16, 16 }, // left leg base
+};
+
+// Only texels inside `clip` (pixel space) are touched.
+void SanitizeMinecraftBaseAlpha(SkinInfo& s, const UvRectPx& clip) {
+  for (const UvRectPx& ref : kBaseOpaqueRects) {
+    const UvRectPx r = ScaleRect(ref, s.scale);
+    const int x0 = std::max(r.x, clip.x), y0 = std::max(r.y, clip.y);
+    const int x1 = std::min(r.x + r.w, clip.x + clip.w), y1 = std::min(r.y + r.h, clip.y + clip.h);
+    ForceRectOpaque(s, x0, y0, x1 - x0, y1 - y0);
+  }
+}
+
+void SanitizeMinecraftBaseAlpha(SkinInfo& s) {
+  SanitizeMinecraftBaseAlpha(s, UvRectPx{ 0, 0, (int)s.width, (int)s.height });
+}
+
+// ------------------------------
+// Legacy 64x32 -> 64x64 normalization
+// ------------------------------
+// A legacy skin has no left limbs and no second layer except the hat. The game
+// converts them once at load: the right limbs are mirrored into the left-limb
+// regions (each face flipped horizontally, inner/outer side faces swapped) and
+// everything below y=32 that is not a left limb stays transparent.
+// Coordinates are in 64px reference units; every rect is a multiple of 4 wide.
+struct SkinBlitOp {
+  int sx, sy;   // source top-left
+  int dx, dy;   // destination top-left
+  int w, h;
+  bool flipX;
+};
+
+static constexpr SkinBlitOp kLegacyToModernBlits[] = {
+  // Left leg <- right leg
+  { 4, 16, 20, 48, 4,  4, true},  // top
+  { 8, 16, 24, 48, 4,  4, true},  // bottom
+  { 0, 20, 24, 52, 4, 12, true},  // outer side -> inner side slot
+  { 4, 20, 20, 52, 4, 12, true},  // front
+  { 8, 20, 16, 52, 4, 12, true},  // inner side -> outer side slot
+  {12, 20, 28, 52, 4, 12, true},  // back
+  // Left arm <- right arm
+  {44, 16, 36, 48, 4,  4, true},
+  {48, 16, 40, 48, 4,  4, true},
+  {40, 20, 40, 52, 4, 12, true},
+  {44, 20, 36, 52, 4, 12, true},
+  {48, 20, 32, 52, 4, 12, true},
+  {52, 20, 44, 52, 4, 12, true},
+};
+
+// Copies one row of n texels (n % 4 == 0), optionally reversed.
+static void BlitRow(uint32_t* dst, const uint32_t* src, int n, bool flipX) {
+  if (!flipX) {
+    memcpy(dst, src, (size_t)n * 4);
+    return;
+  }
+  // Reverse 4 texels per step: read the mirrored block and swap its lanes.
+  for (int x = 0; x < n; x += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + (n - 4 - x)));
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_si128((__m128i*)(dst + x), v);
+  }
+}
+
+// Applies a blit table to one image. src and dst may not overlap per-op, but
+// may be the same image (the legacy ops read y<32 and write y>=48).
+static void ApplySkinBlits(const SkinBlitOp* ops, size_t count,
+                           const uint32_t* src, uint32_t* dst, uint32_t pitchTexels, uint32_t scale) {
+  const int k = (int)scale;
+  for (size_t o = 0; o < count; ++o) {
+    const SkinBlitOp& op = ops[o];
+    const int w = op.w * k;
+    for (int y = 0; y < op.h * k; ++y) {
+      const uint32_t* s = src + (size_t)(op.sy * k + y) * pitchTexels + op.sx * k;
+      uint32_t*       d = dst + (size_t)(op.dy * k + y) * pitchTexels + op.dx * k;
+      BlitRow(d, s, w, op.flipX);
+    }
+  }
+}
+
+// The game's doNotchTransparencyHack(32, 0, 64, 32): when the whole right
+// half of the top 32 rows (hat plus arm and unused texels) is opaque, the hat
+// was painted by an editor that did not know about the second layer, and the
+// game treats it as absent. Any transparent texel in that rect, typically the
+// unused 56..64 x 16..32 block, keeps the hat. Of the cleared rect only the
+// hat rows stay transparent; the game makes rows 16..32 opaque again.
+static void NotchTransparencyHack(SkinInfo& s) {
+  const uint32_t k = s.scale;
+  const uint32_t x0 = 32 * k, x1 = 64 * k;
+  for (uint32_t y = 0; y < 32 * k; ++y) {
+    for (uint32_t x = x0; x < x1; ++x) {
+      if (s.rgba[((size_t)y * s.width + x) * 4 + 3] < 128) return;
+    }
+  }
+  for (uint32_t y = 0; y < 16 * k; ++y) {
+    memset(&s.rgba[((size_t)y * s.width + x0) * 4], 0, (size_t)(x1 - x0) * 4);
+  }
+}
+
+// Expands a legacy (64k x 32k) skin in place to 64k x 64k. No-op for modern skins.
+static void NormalizeLegacySkin(SkinInfo& s) {
+  if (!s.legacy64x32 || s.height * 2 != s.width) return;
+
+  const size_t halfBytes = (size_t)s.width * s.height * 4;
+  s.rgba.resize(halfBytes * 2);                         // lower half: second layer + left limbs
+  memset(s.rgba.data() + halfBytes, 0, halfBytes);      // cleared (transparent)
+  s.height = s.width;
+
+  NotchTransparencyHack(s);
+
+  uint32_t* px = reinterpret_cast<uint32_t*>(s.rgba.data());
+  ApplySkinBlits(kLegacyToModernBlits, std::size(kLegacyToModernBlits), px, px, s.width, s.scale);
+}
+
+// ------------------------------
+// Canonical skin form
+// ------------------------------
+// Many skins differ only in texels no face samples: the unused corners of the
+// layout, base-region alpha that SanitizeMinecraftBaseAlpha overwrites anyway,
+// and the fourth arm column a slim model leaves out. The canonical form zeroes
+// unmapped texels and makes base texels opaque; skins with the same canonical
+// form render identically, so caches and dedupe key on its hash.
+enum SkinTexelUse : uint8_t { Texel_Unused, Texel_Mapped, Texel_MappedBase };
+
+// SkinTexelUse per texel of the 64x64 reference layout.
+static std::vector<uint8_t> BuildSkinCoverageMask(bool slim, bool bilinear) {
+  std::vector<uint8_t> m(64 * 64, Texel_Unused);
+  const int grow = bilinear ? 1 : 0;
+  for (const PartDesc& p : PlayerModel(slim).parts) {
+    const BoxUv uv = PartUv(p);
+    for (const UvRectPx& r : { uv.top, uv.bottom, uv.right, uv.front, uv.left, uv.back }) {
+      for (int y = std::max(0, r.y - grow); y < std::min(64, r.y + r.h + grow); ++y)
+        for (int x = std::max(0, r.x - grow); x < std::min(64, r.x + r.w + grow); ++x) m[(size_t)y * 64 + x] = Texel_Mapped;
+    }
+  }
+  for (const UvRectPx& r : kBaseOpaqueRects) {
+    for (int y = r.y; y < r.y + r.h; ++y)
+      for (int x = r.x; x < r.x + r.w; ++x) {
+        if (m[(size_t)y * 64 + x]) m[(size_t)y * 64 + x] = Texel_MappedBase;
+      }
+  }
+  return m;
+}
+
+// With bilinear filtering a face edge also blends the texel beyond it, so
+// those count as mapped too.
+static const std::vector<uint8_t>& SkinCoverageMask(bool slim, bool bilinear) {
+  static const std::vector<uint8_t> masks[2][2] = {
+    { BuildSkinCoverageMask(false, false), BuildSkinCoverageMask(false, true) },
+    { BuildSkinCoverageMask(true, false),  BuildSkinCoverageMask(true, true) },
+  };
+  return masks[slim][bilinear];
+}
+
+// 64-bit hash of the canonical form for the given model variant and filter;
+// the pixels themselves are left alone. The default (classic, bilinear) covers
+// every texel any player-model render samples, as slim arms map a subset of
+// the classic arm rects. Sizes that are not a 64x64 layout hash every texel;
+// 0 while the skin is palettized.
+uint64_t CanonicalSkinHash(const SkinInfo& s, bool slim, bool bilinear) {
+  if (s.rgba.empty() || s.rgba.size() != (size_t)s.width * s.height * 4) return 0;
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ ((uint64_t)s.width << 32 | s.height);
+  const uint32_t* px = reinterpret_cast<const uint32_t*>(s.rgba.data());
+  const bool layout = s.width == 64 * s.scale && s.height == 64 * s.scale;
+  const std::vector<uint8_t>& mask = SkinCoverageMask(slim, bilinear);
+  for (uint32_t y = 0; y < s.height; ++y) {
+    const uint8_t* maskRow = &mask[(size_t)(layout ? y / s.scale : 0) * 64];
+    for (uint32_t x = 0; x < s.width; ++x) {
+      uint32_t c = px[(size_t)y * s.width + x];
+      if (layout) {
+        const uint8_t use = maskRow[x / s.scale];
+        if (use == Texel_Unused) c = 0;
+        else if (use == Texel_MappedBase) c |= 0xFF000000u; // alpha is the high byte of RGBA8
+      }
+      h = (h ^ c) * 0xBF58476D1CE4E5B9ull;
+      h ^= h >> 29;
+    }
+  }
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;   // splitmix64 finalizer
+  h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+  return h ^ (h >> 31);
+}
+
+// ------------------------------
+// Perceptual hash + near-duplicate index
+// ------------------------------
+// DCT-based perceptual hash over mapped texels only. The layout is reduced to a
+// 16x16 grid of 4x4-texel cells (alpha-weighted luminance), the 8x8 lowest DCT
+// coefficients minus DC are compared to their median -> 64 bits. Robust to
+// recolours of similar brightness, one-pixel edits and re-saves.
+uint64_t ComputeSkinPHash(const SkinInfo& s) {
+  if (s.rgba.empty() || s.width != 64 * s.scale || s.height != 64 * s.scale) return 0;
+
+  const std::vector<uint8_t>& mask = SkinCoverageMask(false, false);
+  const uint32_t k = s.scale;
+
+  float sum[16 * 16]{};
+  uint32_t cnt[16 * 16]{};
+  for (uint32_t y = 0; y < s.height; ++y) {
+    const uint32_t ry = y / k;
+    for (uint32_t x = 0; x < s.width; ++x) {
+      const uint32_t rx = x / k;
+      if (!mask[ry * 64 + rx]) continue;
+      const uint8_t* p = &s.rgba[((size_t)y * s.width + x) * 4];
+      const float lum = (0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]) * (p[3] / 255.0f);
+      const uint32_t c = (ry / 4) * 16 + (rx / 4);
+      sum[c] += lum;
+      cnt[c] += 1;
+    }
+  }
+
+  float grid[16 * 16];
+  for (int c = 0; c < 16 * 16; ++c) grid[c] = cnt[c] ? sum[c] / (float)cnt[c] : 0.0f;
+
+  // Separable DCT-II, only the 8 lowest frequencies per axis are needed.
+  static const std::vector<float> basis = [] {
+    std::vector<float> b(8 * 16);
+    for (int u = 0; u < 8; ++u)
+      for (int x = 0; x < 16; ++x)
+        b[u * 16 + x] = cosf((float)((2 * x + 1) * u) * XM_PI / 32.0f);
+    return b;
+  }();
+
+  float rows[16 * 8];
+  for (int y = 0; y < 16; ++y)
+    for (int u = 0; u < 8; ++u) {
+      float acc = 0.0f;
+      for (int x = 0; x < 16; ++x) acc += grid[y * 16 + x] * basis[u * 16 + x];
+      rows[y * 8 + u] = acc;
+    }
+
+  float coef[64];
+  for (int v = 0; v < 8; ++v)
+    for (int u = 0; u < 8; ++u) {
+      float acc = 0.0f;
+      for (int y = 0; y < 16; ++y) acc += rows[y * 8 + u] * basis[v * 16 + y];
+      coef[v * 8 + u] = acc;
+    }
+
+  coef[0] = 0.0f; // DC carries overall brightness only
+  float sorted[64];
+  std::copy(std::begin(coef), std::end(coef), sorted);
+  std::nth_element(sorted, sorted + 32, sorted + 64);
+  const float median = sorted[32];
+
+  uint64_t h = 0;
+  for (int i = 0; i < 64; ++i) {
+    if (coef[i] > median) h |= (uint64_t)1 << i;
+  }
+  return h;
+}
+
+
+uint32_t PHashIndex::Insert(uint64_t h) {
+  const uint32_t id = (uint32_t)hashes_.size();
+  hashes_.push_back(h);
+  for (int c = 0; c < kChunks; ++c) tables_[c][Chunk(h, c)].push_back(id);
+  return id;
+}
+
+std::vector<uint32_t> PHashIndex::Query(uint64_t h, int k) const {
+  std::vector<uint32_t> cand;
+  const int r = std::max(0, k) / kChunks;
+  for (int c = 0; c < kChunks; ++c) {
+    const uint32_t q = Chunk(h, c);
+    ForEachWithinRadius(q, r, [&](uint32_t key) {
+      const std::vector<uint32_t>& b = tables_[c][key];
+      cand.insert(cand.end(), b.begin(), b.end());
+    });
+  }
+  std::sort(cand.begin(), cand.end());
+  cand.erase(std::unique(cand.begin(), cand.end()), cand.end());
+
+  std::vector<uint32_t> out;
+  for (uint32_t id : cand) {
+    if (HammingDistance(h, hashes_[id]) <= k) out.push_back(id);
+  }
+  return out;
+}
+
+void PHashIndex::Save(const std::filesystem::path& path) const {
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  if (!f) throw std::runtime_error("PHashIndex: cannot open " + path.string() + " for writing");
+  const uint32_t hdr[2] = { kMagic, kVersion };
+  const uint64_t n = hashes_.size();
+  f.write((const char*)hdr, sizeof(hdr));
+  f.write((const char*)&n, sizeof(n));
+  f.write((const char*)hashes_.data(), (std::streamsize)(n * sizeof(uint64_t)));
+  if (!f) throw std::runtime_error("PHashIndex: write failed for " + path.string());
+}
+
+PHashIndex PHashIndex::Load(const std::filesystem::path& path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("PHashIndex: cannot open " + path.string());
+  uint32_t hdr[2]{};
+  uint64_t n = 0;
+  f.read((char*)hdr, sizeof(hdr));
+  f.read((char*)&n, sizeof(n));
+  if (!f || hdr[0] != kMagic || hdr[1] != kVersion) throw std::runtime_error("PHashIndex: bad header in " + path.string());
+  // The count must match the file before it sizes anything.
+  std::error_code ec;
+  const uint64_t fileSize = std::filesystem::file_size(path, ec);
+  const uint64_t headerSize = sizeof(hdr) + sizeof(n);
+  if (ec || fileSize < headerSize || n != (fileSize - headerSize) / sizeof(uint64_t) ||
+      (fileSize - headerSize) % sizeof(uint64_t)) {
+    throw std::runtime_error("PHashIndex: count does not match the size of " + path.string());
+  }
+
+  std::vector<uint64_t> hashes(n);
+  f.read((char*)hashes.data(), (std::streamsize)(n * sizeof(uint64_t)));
+  if (!f) throw std::runtime_error("PHashIndex: truncated file " + path.string());
+
+  PHashIndex idx;
+  idx.hashes_.reserve(n);
+  for (uint64_t h : hashes) idx.Insert(h);
+  return idx;
+}
+
+template <class Fn>
+void PHashIndex::ForEachWithinRadius(uint32_t q, int r, Fn&& fn, int firstBit) {
+  fn(q);
+  if (r == 0) return;
+  for (int b = firstBit; b < kChunkBits; ++b) {
+    ForEachWithinRadius(q ^ (1u << b), r - 1, fn, b + 1);
+  }
+}
+
+// ------------------------------
+// Colour histograms + search index
+// ------------------------------
+
+static int HistColorBin(uint8_t r, uint8_t g, uint8_t b) {
+  const int mx = std::max({ r, g, b }), mn = std::min({ r, g, b });
+  const int chroma = mx - mn;
+  if (mx < 40) return 0;
+  if (chroma < 32) {
+    const int l = (mx + mn) / 2;
+    return l < 64 ? 0 : l < 128 ? 1 : l < 208 ? 2 : 3;
+  }
+  int h6;   // hue in 1/6 degrees, [0, 2160)
+  if (mx == r)      h6 = ((g - b) * 360 / chroma + 2160) % 2160;
+  else if (mx == g) h6 = (b - r) * 360 / chroma + 720;
+  else              h6 = (r - g) * 360 / chroma + 1440;
+  return 4 + ((h6 + 90) / 180) % 12;   // sectors centred on red, orange, ...
+}
+
+static HistRegion HistRegionOfPart(const std::string& name) {
+  if (name == "head") return HistRegion_Head;
+  if (name == "hat") return HistRegion_Hat;
+  if (name == "body") return HistRegion_Torso;
+  if (name == "jacket") return HistRegion_Jacket;
+  if (name.find("Sleeve") != std::string::npos || name.find("Pants") != std::string::npos) return HistRegion_LimbOverlay;
+  return HistRegion_Limbs;
+}
+
+// Uses the classic player rects (as SkinCoverageMask does). HD skins are sampled
+// on a grid of at most 256x256 texels.
+static ColorHistogram ComputeColorHistogram(const SkinInfo& s) {
+  ColorHistogram h;
+  if (s.rgba.empty() || s.width != 64 * s.scale || s.height != 64 * s.scale) return h;
+
+  const uint32_t step = std::max(1u, s.scale / 4);
+  uint64_t counts[HistRegion_Count][kHistBins]{};
+  uint64_t total[HistRegion_Count]{};
+  for (const PartDesc& p : PlayerModel(false).parts) {
+    const HistRegion region = HistRegionOfPart(p.name);
+    const BoxUv uv = ScaleBoxUv(PartUv(p), s.scale);
+    for (const UvRectPx& r : { uv.top, uv.bottom, uv.right, uv.front, uv.left, uv.back }) {
+      for (int y = r.y; y < r.y + r.h; y += (int)step) {
+        for (int x = r.x; x < r.x + r.w; x += (int)step) {
+          const uint8_t* px = &s.rgba[((size_t)y * s.width + x) * 4];
+          counts[region][HistColorBin(px[0], px[1], px[2])] += px[3];
+          total[region] += 255;
+        }
+      }
+    }
+  }
+  for (int r = 0; r < HistRegion_Count; ++r) {
+    if (!total[r]) continue;
+    for (int b = 0; b < kHistBins; ++b) h.bins[r][b] = (uint8_t)((counts[r][b] * 255 + total[r] / 2) / total[r]);
+  }
+  return h;
+}
+
+// Weighted L1: one SAD per 16-bin region.
+static uint32_t HistDistance(const uint8_t* a, const uint8_t* b, const uint32_t* weight) {
+  uint32_t d = 0;
+  for (int r = 0; r < HistRegion_Count; ++r) {
+    const __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + r * kHistBins)),
+                                   _mm_loadu_si128((const __m128i*)(b + r * kHistBins)));
+    d += weight[r] * (uint32_t)(_mm_cvtsi128_si32(s) + _mm_extract_epi16(s, 4));
+  }
+  return d;
+}
+
+// Weighted L1 from q to the nearest point of the per-bin box [lo, hi]: a lower
+// bound for every descriptor inside the box.
+static uint32_t HistBoxDistance(const uint8_t* q, const uint8_t* lo, const uint8_t* hi, const uint32_t* weight) {
+  uint32_t d = 0;
+  for (int r = 0; r < HistRegion_Count; ++r) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(q + r * kHistBins));
+    const __m128i c = _mm_min_epu8(_mm_max_epu8(v, _mm_loadu_si128((const __m128i*)(lo + r * kHistBins))),
+                                   _mm_loadu_si128((const __m128i*)(hi + r * kHistBins)));
+    const __m128i s = _mm_sad_epu8(v, c);
+    d += weight[r] * (uint32_t)(_mm_cvtsi128_si32(s) + _mm_extract_epi16(s, 4));
+  }
+  return d;
+}
+
+uint32_t ColorHistIndex::Insert(const ColorHistogram& h) {
+  const uint32_t id = (uint32_t)count_++;
+  const uint8_t* d = &h.bins[0][0];
+  Bucket& b = buckets_[BucketOf(h)];
+  if (b.ids.empty()) {
+    memcpy(b.lo, d, kDescBytes);
+    memcpy(b.hi, d, kDescBytes);
+  } else {
+    for (size_t i = 0; i < kDescBytes; i += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i*)(d + i));
+      _mm_storeu_si128((__m128i*)(b.lo + i), _mm_min_epu8(v, _mm_loadu_si128((const __m128i*)(b.lo + i))));
+      _mm_storeu_si128((__m128i*)(b.hi + i), _mm_max_epu8(v, _mm_loadu_si128((const __m128i*)(b.hi + i))));
+    }
+  }
+  b.ids.push_back(id);
+  b.desc.insert(b.desc.end(), d, d + kDescBytes);
+  return id;
+}
+
+std::vector<HistMatch> ColorHistIndex::Nearest(const HistQuery& q, size_t k, size_t maxBuckets) const {
+  std::vector<HistMatch> best;   // max-heap on distance
+  if (!k) return best;
+  auto worse = [](const HistMatch& a, const HistMatch& b) { return a.distance < b.distance; };
+  size_t probed = 0;
+  for (const auto& [bound, bi] : RankBuckets(q)) {
+    if (best.size() == k && bound >= best.front().distance) break;
+    if (maxBuckets && probed++ == maxBuckets) break;
+    const Bucket& b = buckets_[bi];
+    for (size_t i = 0; i < b.ids.size(); ++i) {
+      const uint32_t d = HistDistance(&q.target.bins[0][0], &b.desc[i * kDescBytes], q.weight);
+      if (best.size() < k) {
+        best.push_back({ b.ids[i], d });
+        std::push_heap(best.begin(), best.end(), worse);
+      } else if (d < best.front().distance) {
+        std::pop_heap(best.begin(), best.end(), worse);
+        best.back() = { b.ids[i], d };
+        std::push_heap(best.begin(), best.end(), worse);
+      }
+    }
+  }
+  std::sort_heap(best.begin(), best.end(), worse);
+  return best;
+}
+
+std::vector<HistMatch> ColorHistIndex::Within(const HistQuery& q, uint32_t radius) const {
+  std::vector<HistMatch> out;
+  for (const auto& [bound, bi] : RankBuckets(q)) {
+    if (bound > radius) break;
+    const Bucket& b = buckets_[bi];
+    for (size_t i = 0; i < b.ids.size(); ++i) {
+      const uint32_t d = HistDistance(&q.target.bins[0][0], &b.desc[i * kDescBytes], q.weight);
+      if (d <= radius) out.push_back({ b.ids[i], d });
+    }
+  }
+  std::sort(out.begin(), out.end(), [](const HistMatch& a, const HistMatch& b) {
+    return a.distance != b.distance ? a.distance < b.distance : a.id < b.id;
+  });
+  return out;
+}
+
+void ColorHistIndex::Save(const std::filesystem::path& path) const {
+  std::vector<uint8_t> all(count_ * kDescBytes);
+  for (const Bucket& b : buckets_) {
+    for (size_t i = 0; i < b.ids.size(); ++i) memcpy(&all[(size_t)b.ids[i] * kDescBytes], &b.desc[i * kDescBytes], kDescBytes);
+  }
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  if (!f) throw std::runtime_error("ColorHistIndex: cannot open " + path.string() + " for writing");
+  const uint32_t hdr[2] = { kMagic, kVersion };
+  const uint64_t n = count_;
+  f.write((const char*)hdr, sizeof(hdr));
+  f.write((const char*)&n, sizeof(n));
+  f.write((const char*)all.data(), (std::streamsize)all.size());
+  if (!f) throw std::runtime_error("ColorHistIndex: write failed for " + path.string());
+}
+
+ColorHistIndex ColorHistIndex::Load(const std::filesystem::path& path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("ColorHistIndex: cannot open " + path.string());
+  uint32_t hdr[2]{};
+  uint64_t n = 0;
+  f.read((char*)hdr, sizeof(hdr));
+  f.read((char*)&n, sizeof(n));
+  if (!f || hdr[0] != kMagic || hdr[1] != kVersion) throw std::runtime_error("ColorHistIndex: bad header in " + path.string());
+
+  ColorHistIndex idx;
+  ColorHistogram h;
+  for (uint64_t i = 0; i < n; ++i) {
+    if (!f.read((char*)&h, sizeof(h))) throw std::runtime_error("ColorHistIndex: truncated file " + path.string());
+    idx.Insert(h);
+  }
+  return idx;
+}
+
+size_t ColorHistIndex::BucketOf(const ColorHistogram& h) {
+  auto dominant = [&](HistRegion r) {
+    return (size_t)(std::max_element(h.bins[r], h.bins[r] + kHistBins) - h.bins[r]);
+  };
+  const uint32_t hat = std::accumulate(h.bins[HistRegion_Hat], h.bins[HistRegion_Hat] + kHistBins, 0u);
+  return ((dominant(HistRegion_Head) * kHistBins + dominant(HistRegion_Torso)) * kHistBins +
+          dominant(HistRegion_Limbs)) * 2 + (hat >= 128 ? 1 : 0);
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> ColorHistIndex::RankBuckets(const HistQuery& q) const {
+  std::vector<std::pair<uint32_t, uint32_t>> order;
+  for (uint32_t i = 0; i < kBuckets; ++i) {
+    const Bucket& b = buckets_[i];
+    if (!b.ids.empty()) order.emplace_back(HistBoxDistance(&q.target.bins[0][0], b.lo, b.hi, q.weight), i);
+  }
+  std::sort(order.begin(), order.end());
+  return order;
+}
+
+// ------------------------------
+// Layer compositing
+// ------------------------------
+
+static void PremultiplyRgba(uint8_t* px, size_t texels) {
+  for (size_t i = 0; i < texels; ++i, px += 4) {
+    const uint32_t a = px[3];
+    if (a == 255) continue;
+    for (int c = 0; c < 3; ++c) px[c] = (uint8_t)((px[c] * a + 127) / 255);
+  }
+}
+
+static void UnpremultiplyRow(uint8_t* dst, const uint8_t* src, uint32_t n) {
+  for (uint32_t i = 0; i < n; ++i, dst += 4, src += 4) {
+    const uint32_t a = src[3];
+    if (a == 255 || a == 0) {
+      memcpy(dst, src, 4);
+      continue;
+    }
+    for (int c = 0; c < 3; ++c) dst[c] = (uint8_t)std::min<uint32_t>(255, (src[c] * 255 + a / 2) / a);
+    dst[3] = (uint8_t)a;
+  }
+}
+
+// s + d * (255 - s.a) / 255 for two premultiplied texels widened to 16 bits.
+static __m128i BlendOver2(__m128i s, __m128i d) {
+  const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  const __m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(d, ia), _mm_set1_epi16(128));
+  t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);  // exact /255 with rounding
+  return _mm_add_epi16(s, t);
+}
+
+// dst = src over dst, premultiplied RGBA8, n % 4 == 0. Groups of four fully
+// transparent or fully opaque source texels skip the arithmetic.
+static void BlendOverRow(uint32_t* dst, const uint32_t* src, uint32_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+  for (uint32_t x = 0; x < n; x += 4) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)(src + x));
+    const __m128i sa = _mm_and_si128(s, alpha);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, zero)) == 0xFFFF) continue;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, alpha)) == 0xFFFF) {
+      _mm_storeu_si128((__m128i*)(dst + x), s);
+      continue;
+    }
+    const __m128i d = _mm_loadu_si128((const __m128i*)(dst + x));
+    const __m128i lo = BlendOver2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+    const __m128i hi = BlendOver2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+  }
+}
+
+// Bit ty * kCompositeTiles + tx is set if the tile holds any texel with alpha > 0.
+static uint64_t CompositeTileMask(const uint8_t* rgba, uint32_t size) {
+  const uint32_t t = size / kCompositeTiles;
+  uint64_t mask = 0;
+  for (uint32_t y = 0; y < size; ++y) {
+    const uint8_t* row = rgba + (size_t)y * size * 4;
+    for (uint32_t x = 0; x < size; ++x) {
+      if (row[x * 4 + 3]) mask |= (uint64_t)1 << ((y / t) * kCompositeTiles + x / t);
+    }
+  }
+  return mask;
+}
+
+static uint64_t HashLayerIds(const uint64_t* ids, size_t count) {
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ count;
+  for (size_t i = 0; i < count; ++i) {
+    h ^= ids[i];
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;   // splitmix64 finalizer, order-sensitive
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    h ^= h >> 31;
+  }
+  return h;
+}
+
+SkinCompositor::SkinCompositor(uint32_t scale, size_t capacity) : scale_(std::max(1u, scale)), size_(64 * scale_), capacity_(std::max<size_t>(2, capacity)) {
+  entries_.reserve(capacity_);
+}
+
+void SkinCompositor::SetLayer(uint64_t id, const uint8_t* rgba) {
+  Layer& l = layers_[id];
+  const uint64_t before = l.tiles;
+  l.premul.assign(rgba, rgba + (size_t)size_ * size_ * 4);
+  PremultiplyRgba(l.premul.data(), (size_t)size_ * size_);
+  l.tiles = CompositeTileMask(l.premul.data(), size_);
+
+  for (Entry& e : entries_) {
+    if (std::find(e.ids.begin(), e.ids.end(), id) == e.ids.end()) continue;
+    ResolveLayers(e.ids.data(), e.ids.size());
+    Recomposite(e, before | l.tiles);
+  }
+}
+
+void SkinCompositor::RemoveLayer(uint64_t id) {
+  layers_.erase(id);
+  for (Entry& e : entries_) {
+    if (std::find(e.ids.begin(), e.ids.end(), id) == e.ids.end()) continue;
+    Unindex(e);
+    e.key = 0;
+    e.ids.clear();
+    e.lastUse = 0;
+  }
+}
+
+const SkinInfo& SkinCompositor::Composite(const uint64_t* ids, size_t count) {
+  const uint64_t key = HashLayerIds(ids, count);
+  auto it = index_.find(key);
+  if (it != index_.end() && SameIds(entries_[it->second], ids, count)) {
+    ++stats_.hits;
+    Entry& e = entries_[it->second];
+    e.lastUse = ++clock_;
+    return e.skin;
+  }
+  ResolveLayers(ids, count);
+
+  // Most recently used stack that differs in exactly one layer
+  const Entry* base = nullptr;
+  uint64_t dirty = ~0ull;
+  for (const Entry& e : entries_) {
+    if (e.ids.size() != count || (base && e.lastUse < base->lastUse)) continue;
+    size_t diff = count, nDiff = 0;
+    for (size_t i = 0; i < count && nDiff < 2; ++i) {
+      if (e.ids[i] != ids[i]) { diff = i; ++nDiff; }
+    }
+    if (nDiff != 1) continue;
+    const auto old = layers_.find(e.ids[diff]);
+    if (old == layers_.end()) continue;
+    base = &e;
+    dirty = old->second.tiles | scratch_[diff]->tiles;
+  }
+
+  Entry& slot = AcquireSlot(it != index_.end() ? &entries_[it->second] : nullptr, base, key);
+  slot.ids.assign(ids, ids + count);
+  if (base) {
+    slot.premul = base->premul;
+    slot.skin.rgba = base->skin.rgba;
+    ++stats_.partial;
+  } else {
+    slot.premul.assign((size_t)size_ * size_ * 4, 0);
+    slot.skin.rgba.resize(slot.premul.size());
+    dirty = ~0ull;
+    ++stats_.full;
+  }
+  Recomposite(slot, dirty);
+  return slot.skin;
+}
+
+bool SkinCompositor::SameIds(const Entry& e, const uint64_t* ids, size_t count) {
+  return e.ids.size() == count && std::equal(e.ids.begin(), e.ids.end(), ids);
+}
+
+void SkinCompositor::ResolveLayers(const uint64_t* ids, size_t count) {
+  scratch_.clear();
+  for (size_t i = 0; i < count; ++i) {
+    const auto l = layers_.find(ids[i]);
+    if (l == layers_.end()) throw std::runtime_error("SkinCompositor: unknown layer id " + std::to_string(ids[i]));
+    scratch_.push_back(&l->second);
+  }
+}
+
+SkinCompositor::Entry& SkinCompositor::AcquireSlot(Entry* collided, const Entry* keep, uint64_t key) {
+  Entry* e = collided;
+  if (!e && entries_.size() < capacity_) e = &entries_.emplace_back();
+  if (!e) {
+    for (Entry& c : entries_) {
+      if (&c != keep && (!e || c.lastUse < e->lastUse)) e = &c;
+    }
+    Unindex(*e);
+  }
+  e->key = key;
+  e->lastUse = ++clock_;
+  index_[key] = (size_t)(e - entries_.data());
+  return *e;
+}
+
+void SkinCompositor::Unindex(const Entry& e) {
+  const auto it = index_.find(e.key);
+  if (it != index_.end() && it->second == (size_t)(&e - entries_.data())) index_.erase(it);
+}
+
+void SkinCompositor::Recomposite(Entry& e, uint64_t tiles) {
+  const uint32_t t = kCompositeTileRef * scale_;
+  for (uint64_t m = tiles; m; m &= m - 1) {
+    const int bit = std::countr_zero(m);
+    const uint32_t x0 = (uint32_t)(bit % kCompositeTiles) * t;
+    const uint32_t y0 = (uint32_t)(bit / kCompositeTiles) * t;
+    for (uint32_t y = y0; y < y0 + t; ++y) {
+      const size_t off = ((size_t)y * size_ + x0) * 4;
+      uint8_t* row = e.premul.data() + off;
+      memset(row, 0, (size_t)t * 4);
+      for (const Layer* l : scratch_) {
+        if (l->tiles >> bit & 1) BlendOverRow((uint32_t*)row, (const uint32_t*)(l->premul.data() + off), t);
+      }
+      UnpremultiplyRow(e.skin.rgba.data() + off, row, t);
+    }
+    SanitizeMinecraftBaseAlpha(e.skin, UvRectPx{ (int)x0, (int)y0, (int)t, (int)t });
+    ++stats_.tiles;
+  }
+
+  // phash and colorHist stay empty: hashing costs more than the composite
+  // itself and previews do not need them. Compute both before indexing.
+  SkinInfo& s = e.skin;
+  s.width = s.height = size_;
+  s.scale = scale_;
+  s.hasAlpha = std::any_of(s.rgba.begin() + 3, s.rgba.end(), [](uint8_t a) { return a != 255; });
+  s.overlayTranslucent = HasPartialAlpha(s);
+}
+
+// ------------------------------
+// Palette storage
+// ------------------------------
+// Most skins use far fewer than 256 distinct RGBA values. A skin that fits is
+// stored as an exact palette (no quantization; transparent texels keep their
+// RGB) plus 8-bit indices, or 4-bit indices when 16 colours suffice, and its
+// rgba is released. Everything that needs plain pixels expands on demand;
+// SampleSkin reads palettes directly. Skins with more colours stay RGBA.
+static constexpr size_t kMaxPaletteColors = 256;
+
+static uint32_t PaletteIndexAt(const SkinPalette& p, size_t texel) {
+  if (p.bits == 8) return p.indices[texel];
+  const uint8_t b = p.indices[texel >> 1];
+  return (texel & 1) ? (uint32_t)(b >> 4) : (uint32_t)(b & 15);
+}
+
+// Pixel bytes held by the skin in either form (capacity, not size).
+size_t SkinPixelBytes(const SkinInfo& s) {
+  return s.rgba.capacity() + s.palette.colors.capacity() * sizeof(uint32_t) + s.palette.indices.capacity();
+}
+
+// Exact colour table of the texels, or false as soon as it exceeds kMaxPaletteColors.
+// Open addressing over 1024 slots keeps the probe chains short at 256 entries.
+static bool ExtractPalette(const uint32_t* px, size_t count, std::vector<uint32_t>& colors, std::vector<uint8_t>& index) {
+  constexpr uint32_t kSlots = 1024;
+  uint32_t keys[kSlots];
+  uint16_t slotColor[kSlots];
+  bool used[kSlots]{};
+  colors.clear();
+  index.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const uint32_t c = px[i];
+    if (i && c == px[i - 1]) {           // runs skip the hash
+      index[i] = index[i - 1];
+      continue;
+    }
+    uint32_t h = (c * 0x9E3779B1u) >> 22;
+    while (used[h] && keys[h] != c) h = (h + 1) & (kSlots - 1);
+    if (!used[h]) {
+      if (colors.size() == kMaxPaletteColors) return false;
+      used[h] = true;
+      keys[h] = c;
+      slotColor[h] = (uint16_t)colors.size();
+      colors.push_back(c);
+    }
+    index[i] = (uint8_t)slotColor[h];
+  }
+  return true;
+}
+
+// Converts s to palette storage if it fits; returns whether it did.
+bool PalettizeSkin(SkinInfo& s) {
+  if (s.palette.bits || s.rgba.empty()) return s.palette.bits != 0;
+  const size_t count = (size_t)s.width * s.height;
+  std::vector<uint32_t> colors;
+  std::vector<uint8_t> index;
+  if (!ExtractPalette((const uint32_t*)s.rgba.data(), count, colors, index)) return false;
+
+  SkinPalette& p = s.palette;
+  p.colors = std::move(colors);
+  p.colors.shrink_to_fit();
+  if (p.colors.size() <= 16) {
+    p.bits = 4;
+    p.indices.assign((count + 1) / 2, 0);
+    for (size_t i = 0; i < count; ++i) p.indices[i >> 1] |= (uint8_t)(index[i] << ((i & 1) * 4));
+  } else {
+    p.bits = 8;
+    p.indices = std::move(index);
+  }
+  std::vector<uint8_t>().swap(s.rgba);
+  return true;
+}
+
+// Writes `count` texels starting at texel 0 as RGBA8. SSE2 has no gather, so
+// 8-bit indices are four table lookups per 128-bit store; for 4-bit indices a
+// 256-entry table maps each index byte to both of its texels in one load.
+static void ExpandSkinPalette(const SkinPalette& p, uint32_t* dst, size_t count) {
+  const uint32_t* pal = p.colors.data();
+  size_t i = 0;
+  if (p.bits == 8) {
+    const uint8_t* idx = p.indices.data();
+    for (; i + 4 <= count; i += 4) {
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_setr_epi32((int)pal[idx[i]], (int)pal[idx[i + 1]],
+                                                           (int)pal[idx[i + 2]], (int)pal[idx[i + 3]]));
+    }
+  } else {
+    uint32_t full[16]{};
+    std::copy(p.colors.begin(), p.colors.end(), full);
+    alignas(16) uint64_t pairs[256];
+    for (uint32_t b = 0; b < 256; ++b) pairs[b] = full[b & 15] | (uint64_t)full[b >> 4] << 32;
+    for (; i + 4 <= count; i += 4) {
+      const uint8_t* idx = &p.indices[i >> 1];
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_set_epi64x((long long)pairs[idx[1]], (long long)pairs[idx[0]]));
+    }
+  }
+  for (; i < count; ++i) dst[i] = pal[PaletteIndexAt(p, i)];
+}
+
+void UnpalettizeSkin(SkinInfo& s) {
+  if (!s.palette.bits) return;
+  s.rgba.resize((size_t)s.width * s.height * 4);
+  ExpandSkinPalette(s.palette, (uint32_t*)s.rgba.data(), (size_t)s.width * s.height);
+  s.palette = SkinPalette{};
+}
+
+// RGBA8 pixels of s in either storage; `scratch` backs palette skins.
+const std::vector<uint8_t>& SkinRgba(const SkinInfo& s, std::vector<uint8_t>& scratch) {
+  if (!s.palette.bits) return s.rgba;
+  scratch.resize((size_t)s.width * s.height * 4);
+  ExpandSkinPalette(s.palette, (uint32_t*)scratch.data(), (size_t)s.width * s.height);
+  return scratch;
+}
+
+// ------------------------------
+// Decoded skins
+// ------------------------------
+static constexpr uint32_t kMaxSkinSide = 8192;
+
+// Sizes laid out as a skin: 64x64 or legacy 64x32, or a multiple of either.
+bool IsSkinSize(uint32_t w, uint32_t h) {
+  return w && (w % 64) == 0 && w <= kMaxSkinSide && (w == h || w == h * 2);
+}
+
+// Legacy layout, including scaled variants (128x64, ...).
+static void SkinLayoutForSize(uint32_t w, uint32_t h, uint32_t& scale, bool& legacy64x32) {
+  legacy64x32 = (w == h * 2 && (w % 64) == 0);
+  scale = ((w == h || legacy64x32) && (w % 64) == 0) ? w / 64 : 1;
+}
+
+// Load-time analysis of raw RGBA8 skin pixels (width/height/rgba already set).
+void PrepareDecodedSkin(SkinInfo& out) {
+  SkinLayoutForSize(out.width, out.height, out.scale, out.legacy64x32);
+
+  // Legacy skins become a regular 64x64 (scaled) layout from here on
+  NormalizeLegacySkin(out);
+
+  // Make Minecraft base layer opaque (prevents see-through skins)
+  SanitizeMinecraftBaseAlpha(out);
+
+  // Alpha detection
+  out.hasAlpha = std::any_of(out.rgba.begin() + 3, out.rgba.end(),
+                             [](uint8_t a) { return a != 255; });
+
+  out.canonHash = CanonicalSkinHash(out);
+  out.phash = ComputeSkinPHash(out);
+  out.colorHist = ComputeColorHistogram(out);
+  out.overlayTranslucent = HasPartialAlpha(out);
+}
+
+// ------------------------------
+// Skin ingest (files, directories, tar, zip)
+// ------------------------------
+// One entry point for every skin source: a PNG file, a .tar or .zip archive
+// (stored and deflate entries), or a directory holding any of those. Archives
+// are read sequentially by one thread and never extracted; PNG payloads go
+// from memory through inflate (if needed) and DecodeSkinPng on worker threads. Results
+// come back in source order on the calling thread, and the bytes held between
+// reading and delivery are bounded, so a huge dump needs no scratch space and
+// only a fixed amount of memory.
+
+// Raw DEFLATE (RFC 1951) for zip entries and PNG. Whole-buffer, throws on bad
+// data, and stops as soon as the output would pass maxOut (the size the
+// container declared), so a small bomb never grows a large buffer.
+class Inflater {
+public:
+  static void Run(const uint8_t* src, size_t size, std::vector<uint8_t>& out, size_t maxOut) {
+    Inflater z(src, size, out, maxOut);
+    out.clear();
+    out.reserve(maxOut);
+    bool last = false;
+    while (!last) {
+      last = z.Bits(1) != 0;
+      switch (z.Bits(2)) {
+        case 0: z.Stored(); break;
+        case 1: z.Codes(FixedTables().lit, FixedTables().dist); break;
+        case 2: z.Dynamic(); break;
+        default: throw std::runtime_error("inflate: invalid block type");
+      }
+    }
+  }
+
+private:
+  static constexpr int kFastBits = 9;
+
+  // Canonical Huffman code: count/symbol as in zlib's puff, plus a lookup of
+  // the next kFastBits input bits for the (common) short codes.
+  struct Huffman {
+    uint16_t count[16]{};
+    uint16_t symbol[288]{};
+    uint16_t fast[1 << kFastBits]{}; // len << 9 | symbol; 0 = longer than kFastBits
+
+    void Build(const uint8_t* lengths, int n) {
+      std::fill(std::begin(count), std::end(count), (uint16_t)0);
+      std::fill(std::begin(fast), std::end(fast), (uint16_t)0);
+      for (int s = 0; s < n; ++s) ++count[lengths[s]];
+      count[0] = 0;
+      int left = 1;
+      for (int len = 1; len < 16; ++len) {
+        left = (left << 1) - count[len];
+        if (left < 0) throw std::runtime_error("inflate: over-subscribed code");
+      }
+      uint16_t offs[16]{};
+      for (int len = 1; len < 15; ++len) offs[len + 1] = offs[len] + count[len];
+      for (int s = 0; s < n; ++s) {
+        if (lengths[s]) symbol[offs[lengths[s]]++] = (uint16_t)s;
+      }
+      // Codes are assigned in symbol order per length; the stream holds them
+      // bit-reversed, which is what the fast table is indexed by.
+      uint32_t code = 0;
+      int k = 0;
+      for (int len = 1; len <= kFastBits; ++len) {
+        for (int c = 0; c < count[len]; ++c, ++code, ++k) {
+          uint32_t rev = 0;
+          for (int b = 0; b < len; ++b) rev |= ((code >> b) & 1) << (len - 1 - b);
+          for (uint32_t fill = rev; fill < (1u << kFastBits); fill += 1u << len) {
+            fast[fill] = (uint16_t)(len << 9 | symbol[k]);
+          }
+        }
+        code <<= 1;
+      }
+    }
+  };
+
+  struct Tables {
+    Huffman lit, dist;
+  };
+
+  static const Tables& FixedTables() {
+    static const Tables t = [] {
+      Tables f;
+      uint8_t len[288];
+      for (int s = 0; s < 288; ++s) len[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+      f.lit.Build(len, 288);
+      std::fill(len, len + 30, (uint8_t)5);
+      f.dist.Build(len, 30);
+      return f;
+    }();
+    return t;
+  }
+
+  Inflater(const uint8_t* src, size_t size, std::vector<uint8_t>& out, size_t maxOut)
+    : src_(src), end_(src + size), out_(out), maxOut_(maxOut) {}
+
+  // Throws unless n more output bytes stay within maxOut_.
+  void Room(size_t n) const {
+    if (n > maxOut_ - out_.size()) throw std::runtime_error("inflate: more data than declared");
+  }
+
+  void Need(int n) {
+    while (count_ < n) {
+      if (src_ == end_) throw std::runtime_error("inflate: unexpected end of data");
+      bits_ |= (uint64_t)*src_++ << count_;
+      count_ += 8;
+    }
+  }
+
+  uint32_t Bits(int n) {
+    if (n == 0) return 0;
+    Need(n);
+    const uint32_t v = (uint32_t)(bits_ & ((1ull << n) - 1));
+    bits_ >>= n;
+    count_ -= n;
+    return v;
+  }
+
+  int Decode(const Huffman& h) {
+    // Near the end of the input there may be fewer than kFastBits bits left.
+    while (count_ < kFastBits && src_ != end_) {
+      bits_ |= (uint64_t)*src_++ << count_;
+      count_ += 8;
+    }
+    if (count_ >= kFastBits) {
+      const uint16_t f = h.fast[bits_ & ((1u << kFastBits) - 1)];
+      if (f) {
+        bits_ >>= f >> 9;
+        count_ -= f >> 9;
+        return f & 511;
+      }
+    }
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; ++len) {
+      code |= (int)Bits(1);
+      const int n = h.count[len];
+      if (code - n < first) return h.symbol[index + (code - first)];
+      index += n;
+      first = (first + n) << 1;
+      code <<= 1;
+    }
+    throw std::runtime_error("inflate: bad code");
+  }
+
+  void Stored() {
+    bits_ >>= count_ & 7;   // to a byte boundary; whole bytes still buffered are rewound
+    count_ -= count_ & 7;
+    src_ -= count_ / 8;
+    bits_ = 0;
+    count_ = 0;
+    if (end_ - src_ < 4) throw std::runtime_error("inflate: truncated stored block");
+    const uint32_t len = src_[0] | src_[1] << 8;
+    const uint32_t nlen = src_[2] | src_[3] << 8;
+    src_ += 4;
+    if ((len ^ 0xFFFF) != nlen || (size_t)(end_ - src_) < len) throw std::runtime_error("inflate: bad stored block");
+    Room(len);
+    out_.insert(out_.end(), src_, src_ + len);
+    src_ += len;
+  }
+
+  void Codes(const Huffman& lit, const Huffman& dist) {
+    static constexpr uint16_t kLenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                               35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr uint8_t kLenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr uint16_t kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                                8193, 12289, 16385, 24577 };
+    static constexpr uint8_t kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    for (;;) {
+      int sym = Decode(lit);
+      if (sym < 256) {
+        Room(1);
+        out_.push_back((uint8_t)sym);
+        continue;
+      }
+      if (sym == 256) return;
+      sym -= 257;
+      if (sym >= 29) throw std::runtime_error("inflate: bad length symbol");
+      const size_t len = kLenBase[sym] + Bits(kLenExtra[sym]);
+      const int ds = Decode(dist);
+      if (ds >= 30) throw std::runtime_error("inflate: bad distance symbol");
+      const size_t d = kDistBase[ds] + Bits(kDistExtra[ds]);
+      if (d > out_.size()) throw std::runtime_error("inflate: distance too far back");
+      Room(len);
+      const size_t from = out_.size() - d;
+      for (size_t i = 0; i < len; ++i) out_.push_back(out_[from + i]);   // may overlap
+    }
+  }
+
+  void Dynamic() {
+    static constexpr uint8_t kOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    const int nlen = (int)Bits(5) + 257, ndist = (int)Bits(5) + 1, ncode = (int)Bits(4) + 4;
+    if (nlen > 286 || ndist > 30) throw std::runtime_error("inflate: bad code counts");
+
+    uint8_t lengths[288 + 32]{};
+    for (int i = 0; i < ncode; ++i) lengths[kOrder[i]] = (uint8_t)Bits(3);
+    Huffman lencode;
+    lencode.Build(lengths, 19);
+
+    std::fill(std::begin(lengths), std::end(lengths), (uint8_t)0);
+    for (int i = 0; i < nlen + ndist;) {
+      const int sym = Decode(lencode);
+      if (sym < 16) {
+        lengths[i++] = (uint8_t)sym;
+        continue;
+      }
+      uint8_t v = 0;
+      int rep;
+      if (sym == 16) {
+        if (i == 0) throw std::runtime_error("inflate: repeat with no previous length");
+        v = lengths[i - 1];
+        rep = 3 + (int)Bits(2);
+      } else {
+        rep = sym == 17 ? 3 + (int)Bits(3) : 11 + (int)Bits(7);
+      }
+      if (i + rep > nlen + ndist) throw std::runtime_error("inflate: too many lengths");
+      while (rep--) lengths[i++] = v;
+    }
+    if (!lengths[256]) throw std::runtime_error("inflate: no end-of-block code");
+
+    Tables t;
+    t.lit.Build(lengths, nlen);
+    t.dist.Build(lengths + nlen, ndist);
+    Codes(t.lit, t.dist);
+  }
+
+  const uint8_t* src_;
+  const uint8_t* end_;
+  std::vector<uint8_t>& out_;
+  const size_t maxOut_;
+  uint64_t bits_ = 0;
+  int count_ = 0;
+};
+
+// zlib's crc32(): pass the previous result as `crc` to continue a sum.
+// Slicing-by-8, so eight table lookups cover eight bytes.
+uint32_t Crc32(const uint8_t* p, size_t n, uint32_t crc) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(8 * 256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+      for (int s = 1; s < 8; ++s) t[s * 256 + i] = (t[(s - 1) * 256 + i] >> 8) ^ t[t[(s - 1) * 256 + i] & 0xFF];
+    return t;
+  }();
+  const uint32_t* const t = table.data();
+  uint32_t c = ~crc;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= c;
+    c = t[7 * 256 + (lo & 0xFF)] ^ t[6 * 256 + ((lo >> 8) & 0xFF)] ^ t[5 * 256 + ((lo >> 16) & 0xFF)] ^ t[4 * 256 + (lo >> 24)] ^
+        t[3 * 256 + (hi & 0xFF)] ^ t[2 * 256 + ((hi >> 8) & 0xFF)] ^ t[1 * 256 + ((hi >> 16) & 0xFF)] ^ t[hi >> 24];
+  }
+  for (; n; --n) c = t[(c ^ *p++) & 0xFF] ^ (c >> 8);
+  return ~c;
+}
+
+static constexpr size_t kPngProbeBytes = 4096;  // covers IHDR, PLTE and tRNS in practice
+
+static uint32_t ReadBe32(const uint8_t* p) { return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]; }
+
+PngProbe ProbePng(const uint8_t* data, size_t size) {
+  static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  PngProbe r;
+  if (size < 8 || memcmp(data, kSignature, 8)) { r.error = "not a PNG file"; return r; }
+  if (size < 33) { r.error = "truncated PNG header"; return r; }
+  if (ReadBe32(data + 8) != 13 || memcmp(data + 12, "IHDR", 4)) { r.error = "PNG does not start with IHDR"; return r; }
+  if (Crc32(data + 12, 17) != ReadBe32(data + 29)) { r.error = "bad IHDR checksum"; return r; }
+
+  r.width = ReadBe32(data + 16);
+  r.height = ReadBe32(data + 20);
+  r.bitDepth = data[24];
+  r.colorType = data[25];
+  r.interlaced = data[28] == 1;
+  const uint8_t d = r.bitDepth;
+  const bool depthOk =
+    (r.colorType == 0 && (d == 1 || d == 2 || d == 4 || d == 8 || d == 16)) ||
+    (r.colorType == 3 && (d == 1 || d == 2 || d == 4 || d == 8)) ||
+    ((r.colorType == 2 || r.colorType == 4 || r.colorType == 6) && (d == 8 || d == 16));
+  if (!r.width || !r.height || r.width > 0x7FFFFFFFu || r.height > 0x7FFFFFFFu) { r.error = "bad PNG dimensions"; return r; }
+  if (!depthOk || data[26] != 0 || data[27] != 0 || data[28] > 1) { r.error = "bad PNG IHDR fields"; return r; }
+
+  for (size_t pos = 33; pos + 8 <= size;) {
+    const uint32_t len = ReadBe32(data + pos);
+    const uint8_t* type = data + pos + 4;
+    if (len > 0x7FFFFFFFu) { r.error = "bad PNG chunk length"; return r; }
+    if (!memcmp(type, "IDAT", 4) || !memcmp(type, "IEND", 4)) { r.chunksKnown = true; break; }
+    if (!memcmp(type, "PLTE", 4)) r.hasPalette = true;
+    if (!memcmp(type, "tRNS", 4)) r.hasTrns = true;
+    pos += 12 + (size_t)len;
+  }
+  if (r.colorType == 3 && r.chunksKnown && !r.hasPalette) { r.error = "palette PNG without PLTE"; return r; }
+
+  SkinLayoutForSize(r.width, r.height, r.scale, r.legacy64x32);
+  r.skinSized = IsSkinSize(r.width, r.height);
+  return r;
+}
+
+// Probes many files from the first kPngProbeBytes of each. On Windows every
+// worker keeps kProbeWindow overlapped reads in flight on its own completion
+// port, so the latency of one file overlaps with the others; elsewhere each
+// worker reads its files in turn. out[i] belongs to paths[i].
+void ProbePngFiles(const std::vector<std::filesystem::path>& paths, std::vector<PngProbe>& out, unsigned threads) {
+  constexpr size_t kProbeWindow = 32;
+  out.assign(paths.size(), PngProbe{});
+  std::atomic<size_t> next{ 0 };
+
+#ifdef _WIN32
+  auto worker = [&] {
+    struct Read {
+      OVERLAPPED ov;    // first member: completions hand back &ov
+      HANDLE file;
+      size_t index;
+      uint8_t buf[kPngProbeBytes];
+    };
+    HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    auto fail = [&](size_t i, DWORD err) {
+      out[i].error = err == ERROR_HANDLE_EOF ? "not a PNG file" : "cannot read file";
+    };
+    // Starts the next unclaimed file in r; false when none is left.
+    auto issue = [&](Read& r) {
+      for (size_t i; (i = next.fetch_add(1)) < paths.size();) {
+        const HANDLE f = CreateFileW(paths[i].wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                     FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (f == INVALID_HANDLE_VALUE) { out[i].error = "cannot open file"; continue; }
+        if (!port || !CreateIoCompletionPort(f, port, 0, 0)) { CloseHandle(f); fail(i, 0); continue; }
+        r.ov = OVERLAPPED{};
+        r.file = f;
+        r.index = i;
+        if (!ReadFile(f, r.buf, (DWORD)kPngProbeBytes, nullptr, &r.ov)) {
+          const DWORD err = GetLastError();
+          if (err != ERROR_IO_PENDING) { CloseHandle(f); fail(i, err); continue; }
+        }
+        return true;   // completes through the port, even if ReadFile finished at once
+      }
+      return false;
+    };
+
+    std::vector<Read> reads(kProbeWindow);
+    size_t inFlight = 0;
+    for (Read& r : reads) {
+      if (!issue(r)) break;
+      ++inFlight;
+    }
+    while (inFlight) {
+      DWORD bytes = 0;
+      ULONG_PTR key = 0;
+      OVERLAPPED* ov = nullptr;
+      const BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &ov, INFINITE);
+      if (!ov) break;
+      Read& r = *reinterpret_cast<Read*>(ov);
+      CloseHandle(r.file);
+      if (ok) out[r.index] = ProbePng(r.buf, bytes);
+      else fail(r.index, GetLastError());
+      if (!issue(r)) --inFlight;
+    }
+    if (port) CloseHandle(port);
+  };
+#else
+  auto worker = [&] {
+    uint8_t buf[kPngProbeBytes];
+    for (size_t i; (i = next.fetch_add(1)) < paths.size();) {
+      std::ifstream f(paths[i], std::ios::binary);
+      if (!f) { out[i].error = "cannot open file"; continue; }
+      f.read((char*)buf, (std::streamsize)kPngProbeBytes);
+      if (f.bad()) { out[i].error = "cannot read file"; continue; }
+      out[i] = ProbePng(buf, (size_t)f.gcount());
+    }
+  };
+#endif
+
+  const unsigned n = std::max(1u, std::min<unsigned>(threads ? threads : std::thread::hardware_concurrency(),
+                                                      (unsigned)(paths.size() / kProbeWindow + 1)));
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < n; ++t) pool.emplace_back(worker);
+  worker();
+  for (std::thread& t : pool) t.join();
+}
+
+std::wstring LowerExtension(const std::filesystem::path& p) {
+  std::wstring ext = p.extension().wstring();
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::towlower);
+  return ext;
+}
+
+bool IsPngName(std::string_view name) {
+  if (name.size() < 4) return false;
+  char ext[4];
+  for (int i = 0; i < 4; ++i) ext[i] = (char)tolower((unsigned char)name[name.size() - 4 + i]);
+  return !memcmp(ext, ".png", 4);
+}
+
+bool IsSkinArchive(const std::filesystem::path& p) {
+  const std::wstring ext = LowerExtension(p);
+  return ext == L".zip" || ext == L".tar";
+}
+
+static uint16_t ReadLe16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t ReadLe32(const uint8_t* p) { return (uint32_t)ReadLe16(p) | (uint32_t)ReadLe16(p + 2) << 16; }
+static uint64_t ReadLe64(const uint8_t* p) { return (uint64_t)ReadLe32(p) | (uint64_t)ReadLe32(p + 4) << 32; }
+
+// GNU long names and pax headers hold a path or a few records, never more.
+static constexpr uint64_t kMaxTarMetaBytes = 64u << 10;
+
+// Entry over maxEntryBytes: passed on without its data, see SkinSourceEntry::error.
+static SkinSourceEntry OversizedEntry(std::wstring name, uint64_t size, uint64_t maxEntryBytes) {
+  SkinSourceEntry e;
+  e.name = std::move(name);
+  e.size = size;
+  e.error = std::to_string(size) + " bytes is over the " + std::to_string(maxEntryBytes) + " byte entry limit";
+  return e;
+}
+
+// ustar / GNU / pax tar. Only regular files ending in .png are read; the rest
+// is skipped with a seek.
+static bool ReadTarSkins(const std::filesystem::path& path, const SkinSourceEmit& emit, uint64_t maxEntryBytes) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("cannot open " + path.string());
+
+  auto field = [](const char* p, size_t n) { return std::string(p, strnlen(p, n)); };
+  auto octal = [](const char* p, size_t n) -> uint64_t {
+    if ((uint8_t)p[0] & 0x80) {            // GNU base-256 for sizes >= 8 GB
+      uint64_t v = 0;
+      for (size_t i = 1; i < n; ++i) v = v << 8 | (uint8_t)p[i];
+      return v;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < n && p[i]; ++i) {
+      if (p[i] >= '0' && p[i] <= '7') v = v * 8 + (uint64_t)(p[i] - '0');
+    }
+    return v;
+  };
+
+  std::string longName, paxPath;
+  char hdr[512];
+  while (f.read(hdr, sizeof(hdr))) {
+    if (std::all_of(hdr, hdr + 512, [](char c) { return c == 0; })) break;  // end of archive
+    uint64_t size = octal(hdr + 124, 12);
+    const char type = hdr[156];
+    std::string name = field(hdr, 100);
+    if (!memcmp(hdr + 257, "ustar\0", 6) && hdr[345]) name = field(hdr + 345, 155) + "/" + name;  // POSIX prefix
+    if (!longName.empty()) name = std::move(longName);
+    if (!paxPath.empty()) name = std::move(paxPath);
+    longName.clear();
+    paxPath.clear();
+
+    const uint64_t padded = (size + 511) & ~(uint64_t)511;
+    if (type == 'L' || type == 'x') {
+      // GNU long name / pax extended header: applies to the next entry
+      if (size > kMaxTarMetaBytes) throw std::runtime_error("tar: " + std::to_string(size) + " byte extended header in " + path.string());
+      std::string meta((size_t)size, '\0');
+      if (!f.read(meta.data(), (std::streamsize)size)) break;
+      f.seekg((std::streamoff)(padded - size), std::ios::cur);
+      if (type == 'L') {
+        longName = meta.c_str();
+        continue;
+      }
+      for (size_t at = 0; at < meta.size();) {       // records: "<len> <key>=<value>\n"
+        const size_t len = (size_t)strtoull(meta.c_str() + at, nullptr, 10);
+        const size_t sp = meta.find(' ', at), eq = meta.find('=', at);
+        if (!len || sp == std::string::npos || eq == std::string::npos || at + len > meta.size()) break;
+        const std::string key = meta.substr(sp + 1, eq - sp - 1);
+        const std::string value = meta.substr(eq + 1, at + len - eq - 2);
+        if (key == "path") paxPath = value;
+        at += len;
+      }
+      continue;
+    }
+
+    if ((type == '0' || type == 0) && IsPngName(name) && size > maxEntryBytes) {
+      f.seekg((std::streamoff)padded, std::ios::cur);
+      if (!emit(OversizedEntry(path.wstring() + L"/" + WideFromUtf8(name), size, maxEntryBytes))) return false;
+    } else if ((type == '0' || type == 0) && IsPngName(name)) {
+      SkinSourceEntry e;
+      e.name = path.wstring() + L"/" + WideFromUtf8(name);
+      e.size = size;
+      e.data.resize((size_t)size);
+      if (!f.read((char*)e.data.data(), (std::streamsize)size)) throw std::runtime_error("truncated tar entry " + name);
+      f.seekg((std::streamoff)(padded - size), std::ios::cur);
+      if (!emit(std::move(e))) return false;
+    } else {
+      f.seekg((std::streamoff)padded, std::ios::cur);
+    }
+  }
+  return true;
+}
+
+// Zip via the central directory (local headers may defer sizes to a data
+// descriptor). Zip64 sizes and offsets are supported; encrypted entries and
+// methods other than stored/deflate are skipped.
+static bool ReadZipSkins(const std::filesystem::path& path, const SkinSourceEmit& emit, uint64_t maxEntryBytes) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("cannot open " + path.string());
+  f.seekg(0, std::ios::end);
+  const uint64_t fileSize = (uint64_t)f.tellg();
+
+  auto readAt = [&](uint64_t off, void* dst, size_t n) {
+    f.clear();
+    f.seekg((std::streamoff)off);
+    if (!f.read((char*)dst, (std::streamsize)n)) throw std::runtime_error("zip: read past end of " + path.string());
+  };
+
+  // End of central directory: last 22 bytes plus a comment of up to 64 KB
+  const size_t tailSize = (size_t)std::min<uint64_t>(fileSize, 22 + 65535);
+  std::vector<uint8_t> tail(tailSize);
+  readAt(fileSize - tailSize, tail.data(), tailSize);
+  size_t eocd = SIZE_MAX;
+  for (size_t i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0;) {
+    if (ReadLe32(&tail[i]) == 0x06054b50) { eocd = i; break; }
+  }
+  if (eocd == SIZE_MAX) throw std::runtime_error("zip: no end of central directory in " + path.string());
+
+  uint64_t entries = ReadLe16(&tail[eocd + 10]);
+  uint64_t cdSize = ReadLe32(&tail[eocd + 12]);
+  uint64_t cdOffset = ReadLe32(&tail[eocd + 16]);
+  if (eocd >= 20 && ReadLe32(&tail[eocd - 20]) == 0x07064b50) {
+    uint8_t z64[56];
+    readAt(ReadLe64(&tail[eocd - 20 + 8]), z64, sizeof(z64));
+    if (ReadLe32(z64) != 0x06064b50) throw std::runtime_error("zip: bad zip64 end record");
+    entries = ReadLe64(z64 + 32);
+    cdSize = ReadLe64(z64 + 40);
+    cdOffset = ReadLe64(z64 + 48);
+  }
+  if (cdSize > fileSize || cdOffset > fileSize - cdSize) throw std::runtime_error("zip: central directory out of range");
+
+  std::vector<uint8_t> cd((size_t)cdSize);
+  readAt(cdOffset, cd.data(), cd.size());
+
+  for (size_t at = 0; entries-- > 0;) {
+    if (at + 46 > cd.size() || ReadLe32(&cd[at]) != 0x02014b50) throw std::runtime_error("zip: bad central directory");
+    const uint8_t* h = &cd[at];
+    const uint16_t flags = ReadLe16(h + 8), method = ReadLe16(h + 10);
+    const uint32_t crc = ReadLe32(h + 16);
+    uint64_t csize = ReadLe32(h + 20), usize = ReadLe32(h + 24);
+    const uint16_t nameLen = ReadLe16(h + 28), extraLen = ReadLe16(h + 30), commentLen = ReadLe16(h + 32);
+    uint64_t local = ReadLe32(h + 42);
+    if (at + 46 + nameLen + extraLen > cd.size()) throw std::runtime_error("zip: bad central directory");
+    const std::string name((const char*)h + 46, nameLen);
+
+    // Zip64 extra field: only the fields saturated in the fixed header, in this order
+    for (const uint8_t* x = h + 46 + nameLen; x + 4 <= h + 46 + nameLen + extraLen;) {
+      const uint16_t id = ReadLe16(x), len = ReadLe16(x + 2);
+      if (id == 0x0001) {
+        const uint8_t* v = x + 4;
+        const uint8_t* const vEnd = x + 4 + len;
+        if (usize == 0xFFFFFFFFu && v + 8 <= vEnd) { usize = ReadLe64(v); v += 8; }
+        if (csize == 0xFFFFFFFFu && v + 8 <= vEnd) { csize = ReadLe64(v); v += 8; }
+        if (local == 0xFFFFFFFFu && v + 8 <= vEnd) local = ReadLe64(v);
+      }
+      x += 4 + len;
+    }
+    at += 46 + (size_t)nameLen + extraLen + commentLen;
+
+    if (!IsPngName(name) || (flags & 1) || (method != 0 && method != 8)) continue;
+    if (csize > maxEntryBytes || usize > maxEntryBytes) {
+      if (!emit(OversizedEntry(path.wstring() + L"/" + WideFromUtf8(name), std::max(csize, usize), maxEntryBytes))) return false;
+      continue;
+    }
+
+    uint8_t lh[30];
+    readAt(local, lh, sizeof(lh));
+    if (ReadLe32(lh) != 0x04034b50) throw std::runtime_error("zip: bad local header for " + name);
+    const uint64_t dataAt = local + 30 + ReadLe16(lh + 26) + ReadLe16(lh + 28);
+    if (csize > fileSize || dataAt > fileSize - csize) throw std::runtime_error("zip: entry out of range: " + name);
+
+    SkinSourceEntry e;
+    e.name = path.wstring() + L"/" + WideFromUtf8(name);
+    e.method = method;
+    e.size = usize;
+    e.crc = crc;
+    e.checkCrc = true;
+    e.data.resize((size_t)csize);
+    readAt(dataAt, e.data.data(), e.data.size());
+    if (!emit(std::move(e))) return false;
+  }
+  return true;
+}
+
+// Emits every PNG of a source in order. Directories are walked in path order.
+bool ReadSkinSource(const std::filesystem::path& path, const SkinSourceEmit& emit, uint64_t maxEntryBytes) {
+  if (std::filesystem::is_directory(path)) {
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+      if (entry.is_regular_file()) files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+    for (const std::filesystem::path& p : files) {
+      const std::wstring ext = LowerExtension(p);
+      if ((ext == L".png" || IsSkinArchive(p)) && !ReadSkinSource(p, emit, maxEntryBytes)) return false;
+    }
+    return true;
+  }
+  const std::wstring ext = LowerExtension(path);
+  if (ext == L".zip") return ReadZipSkins(path, emit, maxEntryBytes);
+  if (ext == L".tar") return ReadTarSkins(path, emit, maxEntryBytes);
+
+  std::ifstream f(path, std::ios::binary);
+  if (!f) throw std::runtime_error("cannot open " + path.string());
+  std::error_code ec;
+  const uint64_t fileSize = std::filesystem::file_size(path, ec);
+  if (!ec && fileSize > maxEntryBytes) return emit(OversizedEntry(path.wstring(), fileSize, maxEntryBytes));
+  SkinSourceEntry e;
+  e.name = path.wstring();
+  e.data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  e.size = e.data.size();
+  return emit(std::move(e));
+}
+
+// Uncompressed payload of an entry (moved out when stored).
+std::vector<uint8_t> ExtractSkinSourceEntry(SkinSourceEntry& e) {
+  if (!e.error.empty()) throw std::runtime_error(e.error);
+  std::vector<uint8_t> out;
+  if (e.method == 8) Inflater::Run(e.data.data(), e.data.size(), out, (size_t)e.size);
+  else out = std::move(e.data);
+  if (out.size() != e.size) throw std::runtime_error("size mismatch after extraction");
+  if (e.checkCrc && Crc32(out.data(), out.size()) != e.crc) throw std::runtime_error("CRC mismatch");
+  return out;
+}
+
+// Entries over this come through as errors, see SkinSourceEntry::error.
+static uint64_t EntryLimit(const IngestOptions& opt) {
+  return std::min<uint64_t>(opt.maxEntryBytes, opt.maxInFlightBytes);
+}
+
+// Reserves n more in-flight bytes for the entry being processed, waiting for
+// the budget; throws when the pipeline stops meanwhile.
+using IngestReserve = std::function<void(size_t n)>;
+
+// Reader thread -> workers (process) -> in-order delivery on the calling
+// thread. An entry is charged its compressed size when read and its decoded
+// pixels, reserved from the PNG header, before decoding; all of it is released
+// when delivered. The reader and the workers wait until the charge fits the
+// budget, except for the next entry to deliver, so that one always proceeds.
+// A failed archive read is rethrown here after all threads have stopped.
+static void RunIngestPipeline(const std::filesystem::path& source, const IngestOptions& opt,
+                              const std::function<void(SkinSourceEntry&, IngestedSkin&, const IngestReserve&)>& process,
+                              const IngestSink& sink) {
+  struct Slot {
+    bool ready = false;
+    size_t bytes = 0;
+    IngestedSkin result;
+  };
+  const size_t ring = std::max<size_t>(1, opt.maxInFlightEntries);
+  std::vector<Slot> slots(ring);
+  std::deque<std::pair<uint64_t, SkinSourceEntry>> work;
+  std::mutex m;
+  std::condition_variable cvRead, cvWork, cvDone, cvBudget;
+  uint64_t readSeq = 0, deliverSeq = 0;
+  size_t inFlightBytes = 0;
+  bool readerDone = false, stop = false;
+  std::exception_ptr readError;
+
+  std::thread reader([&] {
+    try {
+      ReadSkinSource(source, [&](SkinSourceEntry&& e) {
+        std::unique_lock<std::mutex> lock(m);
+        cvRead.wait(lock, [&] {
+          return stop || (readSeq - deliverSeq < ring && inFlightBytes + e.data.size() <= opt.maxInFlightBytes);
+        });
+        if (stop) return false;
+        slots[readSeq % ring].bytes = e.data.size();
+        inFlightBytes += e.data.size();
+        work.emplace_back(readSeq++, std::move(e));
+        cvWork.notify_one();
+        return true;
+      }, EntryLimit(opt));
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(m);
+      readError = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(m);
+    readerDone = true;
+    cvWork.notify_all();
+    cvDone.notify_all();
+  });
+
+  const unsigned nThreads = opt.threads ? opt.threads : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < nThreads; ++t) {
+    workers.emplace_back([&] {
+      for (;;) {
+        std::pair<uint64_t, SkinSourceEntry> job;
+        {
+          std::unique_lock<std::mutex> lock(m);
+          cvWork.wait(lock, [&] { return stop || !work.empty() || readerDone; });
+          if (stop || work.empty()) break;
+          job = std::move(work.front());
+          work.pop_front();
+        }
+        IngestedSkin r;
+        r.name = job.second.name;
+        size_t reserved = 0;
+        const IngestReserve reserve = [&](size_t n) {
+          std::unique_lock<std::mutex> lock(m);
+          cvBudget.wait(lock, [&] {
+            return stop || job.first == deliverSeq || inFlightBytes + n <= opt.maxInFlightBytes;
+          });
+          if (stop) throw std::runtime_error("ingest stopped");
+          inFlightBytes += n;
+          reserved += n;
+        };
+        try {
+          process(job.second, r, reserve);
+        } catch (const std::exception& e) {
+          r.error = e.what();
+        } catch (...) {
+          r.error = "unknown exception";
+        }
+        std::lock_guard<std::mutex> lock(m);
+        Slot& s = slots[job.first % ring];
+        s.bytes += r.skin.rgba.size();
+        inFlightBytes = inFlightBytes - reserved + r.skin.rgba.size();
+        s.result = std::move(r);
+        s.ready = true;
+        cvDone.notify_all();
+        cvRead.notify_one();
+        cvBudget.notify_all();
+      }
+    });
+  }
+
+  auto shutdown = [&] {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stop = true;
+    }
+    cvRead.notify_all();
+    cvWork.notify_all();
+    cvBudget.notify_all();
+    reader.join();
+    for (std::thread& w : workers) w.join();
+  };
+
+  try {
+    for (;;) {
+      IngestedSkin r;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        Slot& s = slots[deliverSeq % ring];
+        cvDone.wait(lock, [&] { return s.ready || (readerDone && deliverSeq == readSeq); });
+        if (!s.ready) break;
+        r = std::move(s.result);
+        s.ready = false;
+        inFlightBytes -= s.bytes;
+        ++deliverSeq;
+      }
+      cvRead.notify_one();
+      cvBudget.notify_all();
+      if (!sink(std::move(r))) break;
+    }
+  } catch (...) {
+    shutdown();
+    throw;
+  }
+  shutdown();
+  if (readError) std::rethrow_exception(readError);
+}
+
+// Decodes every skin of a file, directory or archive, see ReadSkinSource.
+// A plain PNG file is decoded on the calling thread without the pipeline.
+void IngestSkins(const std::filesystem::path& source, const IngestSink& sink, const IngestOptions& opt) {
+  auto process = [&opt](SkinSourceEntry& e, IngestedSkin& r, const IngestReserve& reserve) {
+    const std::vector<uint8_t> png = ExtractSkinSourceEntry(e);
+    const PngProbe probe = ProbePng(png.data(), png.size());
+    if (opt.skinSizesOnly) {
+      if (probe.error) throw std::runtime_error(probe.error);
+      if (!probe.skinSized) {
+        throw std::runtime_error(std::to_string(probe.width) + "x" + std::to_string(probe.height) + " is not a skin size");
+      }
+    }
+    // Legacy 2:1 skins come out square. Anything over the budget waits to be
+    // next for delivery either way, and decoding rejects absurd headers.
+    if (!probe.error) {
+      const uint64_t pixels = (uint64_t)probe.width * std::max(probe.width, probe.height);
+      reserve((size_t)std::min<uint64_t>(pixels, opt.maxInFlightBytes / 4) * 4);
+    }
+    r.skin = DecodeSkinPng(e.name, png.data(), png.size());
+  };
+  if (std::filesystem::is_directory(source) || IsSkinArchive(source)) {
+    RunIngestPipeline(source, opt, process, sink);
+    return;
+  }
+  ReadSkinSource(source, [&](SkinSourceEntry&& e) {
+    IngestedSkin r;
+    r.name = e.name;
+    try {
+      process(e, r, [](size_t) {});
+    } catch (const std::exception& ex) {
+      r.error = ex.what();
+    }
+    return sink(std::move(r));
+  }, EntryLimit(opt));
+}
+
+// ------------------------------
+// PNG decoder
+// ------------------------------
+// Every colour type and bit depth, PLTE/tRNS and Adam7, to tightly packed
+// RGBA8; 16-bit samples keep their high byte. Gamma, colour profiles and the
+// other ancillary chunks are ignored, so texels come out exactly as stored,
+// which is what the game samples too.
+static constexpr uint32_t kMaxDecodeSide = 16384;
+static constexpr uint64_t kMaxDecodePixels = 1ull << 26;   // 256 MB of RGBA
+
+struct PngImageInfo {
+  uint32_t w = 0, h = 0;
+  uint8_t depth = 8, colorType = 6;
+  int channels = 4;
+  uint32_t palette[256]{};         // RGBA8 as stored in memory, tRNS applied
+  uint32_t paletteSize = 0;
+  bool hasKey = false;             // tRNS on grey / RGB: one 16-bit colour is transparent
+  uint16_t key[3]{};
+};
+
+// Sample i of a row of `depth`-bit samples (depth < 8: packed, MSB first).
+static uint32_t PngSample(const uint8_t* row, size_t i, uint8_t depth) {
+  switch (depth) {
+    case 16: return (uint32_t)row[i * 2] << 8 | row[i * 2 + 1];
+    case 8: return row[i];
+    default: {
+      const size_t bit = i * depth;
+      return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+    }
+  }
+}
+
+// One unfiltered row of `n` pixels to RGBA8, every dx-th output pixel.
+static void PngExpandRow(const PngImageInfo& im, const uint8_t* row, uint32_t n, uint8_t* dst, size_t dx) {
+  const uint8_t d = im.depth;
+  auto to8 = [d](uint32_t v) -> uint8_t {
+    return d == 16 ? (uint8_t)(v >> 8) : d == 8 ? (uint8_t)v : (uint8_t)(v * 255 / ((1u << d) - 1));
+  };
+  if (im.colorType == 6 && d == 8 && dx == 1) {
+    memcpy(dst, row, (size_t)n * 4);
+    return;
+  }
+  for (uint32_t x = 0; x < n; ++x, dst += dx * 4) {
+    const size_t s = (size_t)x * im.channels;
+    switch (im.colorType) {
+      case 0: {
+        const uint32_t g = PngSample(row, s, d);
+        dst[0] = dst[1] = dst[2] = to8(g);
+        dst[3] = im.hasKey && g == im.key[0] ? 0 : 255;
+        break;
+      }
+      case 2: {
+        const uint32_t r = PngSample(row, s, d), g = PngSample(row, s + 1, d), b = PngSample(row, s + 2, d);
+        dst[0] = to8(r); dst[1] = to8(g); dst[2] = to8(b);
+        dst[3] = im.hasKey && r == im.key[0] && g == im.key[1] && b == im.key[2] ? 0 : 255;
+        break;
+      }
+      case 3: {
+        const uint32_t i = PngSample(row, s, d);
+        if (i >= im.paletteSize) throw std::runtime_error("PNG palette index out of range");
+        memcpy(dst, &im.palette[i], 4);
+        break;
+      }
+      case 4:
+        dst[0] = dst[1] = dst[2] = to8(PngSample(row, s, d));
+        dst[3] = to8(PngSample(row, s + 1, d));
+        break;
+      default:
+        for (int ch = 0; ch < 4; ++ch) dst[ch] = to8(PngSample(row, s + ch, d));
+        break;
+    }
+  }
+}
+
+// Reverses the row filter in place; `up` is the unfiltered row above (zeros for the first).
+static void PngUnfilterRow(uint8_t filter, uint8_t* row, const uint8_t* up, size_t n, size_t bpp) {
+  switch (filter) {
+    case 0: break;
+    case 1: for (size_t i = bpp; i < n; ++i) row[i] += row[i - bpp]; break;
+    case 2: for (size_t i = 0; i < n; ++i) row[i] += up[i]; break;
+    case 3:
+      for (size_t i = 0; i < n; ++i) row[i] += (uint8_t)(((i >= bpp ? row[i - bpp] : 0) + up[i]) >> 1);
+      break;
+    case 4:
+      for (size_t i = 0; i < n; ++i) {
+        const int a = i >= bpp ? row[i - bpp] : 0, b = up[i], c = i >= bpp ? up[i - bpp] : 0;
+        const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        row[i] += (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+      }
+      break;
+    default: throw std::runtime_error("bad PNG row filter");
+  }
+}
+
+std::vector<uint8_t> DecodePngRgba(const uint8_t* data, size_t size, uint32_t& w, uint32_t& h) {
+  const PngProbe probe = ProbePng(data, size);
+  if (probe.error) throw std::runtime_error(probe.error);
+  if (probe.width > kMaxDecodeSide || probe.height > kMaxDecodeSide ||
+      (uint64_t)probe.width * probe.height > kMaxDecodePixels) {
+    throw std::runtime_error("PNG too large (" + std::to_string(probe.width) + "x" + std::to_string(probe.height) + ")");
+  }
+  PngImageInfo im;
+  im.w = probe.width;
+  im.h = probe.height;
+  im.depth = probe.bitDepth;
+  im.colorType = probe.colorType;
+  im.channels = im.colorType == 0 || im.colorType == 3 ? 1 : im.colorType == 2 ? 3 : im.colorType == 4 ? 2 : 4;
+
+  std::vector<uint8_t> idat;
+  bool ended = false;
+  for (size_t pos = 8; !ended;) {
+    if (size - pos < 12) throw std::runtime_error("truncated PNG");
+    const uint32_t len = ReadBe32(data + pos);
+    const uint8_t* type = data + pos + 4;
+    const uint8_t* body = data + pos + 8;
+    if (len > size - pos - 12) throw std::runtime_error("truncated PNG chunk");
+    if (Crc32(type, 4 + (size_t)len) != ReadBe32(body + len)) throw std::runtime_error("bad PNG chunk checksum");
+    if (!memcmp(type, "PLTE", 4)) {
+      if (len % 3 || len > 768) throw std::runtime_error("bad PNG palette");
+      im.paletteSize = len / 3;
+      for (uint32_t i = 0; i < im.paletteSize; ++i) {
+        const uint8_t px[4] = { body[i * 3], body[i * 3 + 1], body[i * 3 + 2], 255 };
+        memcpy(&im.palette[i], px, 4);
+      }
+    } else if (!memcmp(type, "tRNS", 4)) {
+      if (im.colorType == 3) {
+        for (uint32_t i = 0; i < std::min<uint32_t>(len, im.paletteSize); ++i) reinterpret_cast<uint8_t*>(&im.palette[i])[3] = body[i];
+      } else if ((im.colorType == 0 && len >= 2) || (im.colorType == 2 && len >= 6)) {
+        im.hasKey = true;
+        for (int ch = 0; ch < (im.colorType == 0 ? 1 : 3); ++ch) im.key[ch] = (uint16_t)(body[ch * 2] << 8 | body[ch * 2 + 1]);
+      }
+    } else if (!memcmp(type, "IDAT", 4)) {
+      idat.insert(idat.end(), body, body + len);
+    } else if (!memcmp(type, "IEND", 4)) {
+      ended = true;
+    }
+    pos += 12 + (size_t)len;
+  }
+  if (im.colorType == 3 && !im.paletteSize) throw std::runtime_error("palette PNG without PLTE");
+  if (idat.size() < 2 || (idat[0] & 0x0F) != 8 || (idat[0] << 8 | idat[1]) % 31 || (idat[1] & 0x20)) {
+    throw std::runtime_error("bad PNG zlib header");
+  }
+
+  // Adam7 passes: x0, y0, dx, dy; a plain image is one pass over everything.
+  static constexpr uint8_t kAdam7[7][4] = {
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 },
+  };
+  static constexpr uint8_t kPlain[1][4] = { { 0, 0, 1, 1 } };
+  const auto& passes = probe.interlaced ? kAdam7 : kPlain;
+  const int passCount = probe.interlaced ? 7 : 1;
+  const size_t bitsPerPixel = (size_t)im.channels * im.depth;
+  const size_t bpp = std::max<size_t>(1, bitsPerPixel / 8);
+  size_t rawSize = 0;
+  for (int pi = 0; pi < passCount; ++pi) {
+    const uint8_t* ps = passes[pi];
+    const size_t pw = (im.w + ps[2] - 1 - ps[0]) / ps[2], ph = (im.h + ps[3] - 1 - ps[1]) / ps[3];
+    if (pw && ph) rawSize += ph * (1 + (pw * bitsPerPixel + 7) / 8);
+  }
+
+  std::vector<uint8_t> raw;
+  Inflater::Run(idat.data() + 2, idat.size() - 2, raw, rawSize);
+  if (raw.size() < rawSize) throw std::runtime_error("truncated PNG image data");
+
+  std::vector<uint8_t> rgba((size_t)im.w * im.h * 4);
+  std::vector<uint8_t> zeros;
+  uint8_t* src = raw.data();
+  for (int pi = 0; pi < passCount; ++pi) {
+    const uint8_t* ps = passes[pi];
+    const uint32_t pw = (im.w + ps[2] - 1 - ps[0]) / ps[2], ph = (im.h + ps[3] - 1 - ps[1]) / ps[3];
+    if (!pw || !ph) continue;
+    const size_t rowBytes = ((size_t)pw * bitsPerPixel + 7) / 8;
+    zeros.assign(rowBytes, 0);
+    const uint8_t* up = zeros.data();
+    for (uint32_t y = 0; y < ph; ++y, src += 1 + rowBytes) {
+      PngUnfilterRow(src[0], src + 1, up, rowBytes, bpp);
+      uint8_t* dst = &rgba[(((size_t)(ps[1] + y * ps[3])) * im.w + ps[0]) * 4];
+      PngExpandRow(im, src + 1, pw, dst, ps[2]);
+      up = src + 1;
+    }
+  }
+  w = im.w;
+  h = im.h;
+  return rgba;
+}
+
+std::vector<uint8_t> DecodePngRgba(const std::filesystem::path& path, uint32_t& w, uint32_t& h) {
+  std::vector<uint8_t> file;
+  if (!ReadFileBytes(path, file)) throw std::runtime_error("cannot read " + path.string());
+  return DecodePngRgba(file.data(), file.size(), w, h);
+}
+
+SkinInfo DecodeSkinPng(const std::wstring& name, const uint8_t* data, size_t size) {
+  SkinInfo out;
+  out.path = name;
+  out.rgba = DecodePngRgba(data, size, out.width, out.height);
+  PrepareDecodedSkin(out);
+  return out;
+}
+
+SkinInfo DecodeSkinPng(const std::filesystem::path& path) {
+  std::vector<uint8_t> file;
+  if (!ReadFileBytes(path, file)) throw std::runtime_error("cannot read " + path.string());
+  return DecodeSkinPng(path.wstring(), file.data(), file.size());
+}
+
+// ------------------------------
+// PNG encoder (renders and textures)
+// ------------------------------
+
+uint32_t Adler32(const uint8_t* p, size_t n, uint32_t adler) {
+  uint32_t a = adler & 0xFFFF, b = adler >> 16;
+  while (n) {
+    const size_t k = std::min<size_t>(n, 5552); // largest run before b can overflow
+    for (size_t i = 0; i < k; ++i) b += a += p[i];
+    a %= 65521;
+    b %= 65521;
+    p += k;
+    n -= k;
+  }
+  return b << 16 | a;
+}
+
+// Adler-32 of A followed by B, from adler(A), adler(B) and len(B) (as zlib's adler32_combine).
+static uint32_t Adler32Combine(uint32_t a1, uint32_t a2, size_t len2) {
+  constexpr uint32_t kBase = 65521;
+  const uint32_t rem = (uint32_t)(len2 % kBase);
+  uint32_t s1 = a1 & 0xFFFF;
+  uint32_t s2 = (uint32_t)((uint64_t)rem * s1 % kBase);
+  s1 += (a2 & 0xFFFF) + kBase - 1;
+  s2 += (a1 >> 16) + (a2 >> 16) + kBase - rem;
+  if (s1 >= kBase) s1 -= kBase;
+  if (s1 >= kBase) s1 -= kBase;
+  if (s2 >= 2 * kBase) s2 -= 2 * kBase;
+  if (s2 >= kBase) s2 -= kBase;
+  return s2 << 16 | s1;
+}
+
+// Raw deflate (RFC 1951) of one chunk of a larger stream: hash-chain matching
+// (lazy above the fastest level), and per block the smallest of dynamic Huffman,
+// fixed Huffman or stored. Tables are kept between calls.
+class DeflateEncoder {
+public:
+  // Appends the deflate of data[begin, end) to `out`. Up to 32 KB before
+  // `begin` serve only as dictionary. Sets BFINAL when `last`; otherwise ends
+  // with an empty stored block so the next chunk starts on a byte boundary.
+  void Compress(const uint8_t* data, size_t size, size_t begin, size_t end, bool last, PngLevel level,
+                std::vector<uint8_t>& out) {
+    static constexpr int kChain[3] = { 1, 4, 16 };       // candidates tried per position
+    static constexpr int kLazyBelow[3] = { 0, 16, 32 };  // shorter matches wait to see if the next position does better
+    static constexpr int kHashAll[3] = { 8, 32, 32 };    // matches up to this long hash every position they cover,
+    static constexpr int kHashTail[3] = { 4, 32, 64 };   // longer ones (background runs) only their last positions
+    data_ = data;
+    size_ = size;
+    end_ = end;
+    chain_ = kChain[level];
+    auto hashCovered = [&](size_t from, size_t at, int len) {
+      if (len > kHashAll[level]) from = std::max(from, at + len - kHashTail[level]);
+      for (size_t p = from; p < at + len; ++p) Insert(p);
+    };
+
+    head_.assign(kHashSize, 0);
+    prev_.resize(kWindow);
+    const size_t outStart = out.size();
+    out.resize(outStart + (end - begin) + (end - begin) / 8192 * 8 + 1024); // never more than stored blocks, plus headers
+    dst_ = out.data() + outStart;
+    bits_ = 0;
+    nbits_ = 0;
+
+    for (size_t p = begin - std::min<size_t>(begin, kWindow - 1); p < begin; ++p) Insert(p);
+
+    tokens_.clear();
+    std::fill(std::begin(litFreq_), std::end(litFreq_), 0u);
+    std::fill(std::begin(distFreq_), std::end(distFreq_), 0u);
+    size_t blockStart = begin;
+    size_t pos = begin;
+    int len = 0, dist = 0;
+    bool found = false;                  // len/dist already hold the match at pos
+    while (pos < end) {
+      if (!found) len = FindMatch(pos, dist);
+      found = false;
+      if (len >= kMinMatch && len < kLazyBelow[level] && pos + 1 < end) {
+        int dist1 = 0;
+        const int len1 = FindMatch(pos + 1, dist1);
+        if (len1 > len) {
+          Literal(data[pos++]);
+          len = len1;
+          dist = dist1;
+          found = true;
+          continue;
+        }
+        Match(len, dist);
+        hashCovered(pos + 2, pos, len);
+        pos += len;
+      } else if (len >= kMinMatch) {
+        Match(len, dist);
+        hashCovered(pos + 1, pos, len);
+        pos += len;
+      } else {
+        Literal(data[pos++]);
+      }
+      if (tokens_.size() >= kBlockTokens) {
+        FlushBlock(blockStart, pos, false);
+        blockStart = pos;
+      }
+    }
+    if (!tokens_.empty() || last) FlushBlock(blockStart, end, last);
+    if (!last) {
+      Put(0, 3);                         // empty stored block: aligns and flushes
+      AlignToByte();
+      Put(0, 16);
+      Put(0xFFFF, 16);
+    }
+    AlignToByte();
+    out.resize((size_t)(dst_ - out.data()));
+  }
+
+private:
+  static constexpr int kMinMatch = 4;    // the hash covers 4 bytes
+  static constexpr int kMaxMatch = 258;
+  static constexpr size_t kWindow = 32768;
+  static constexpr int kHashBits = 15;
+  static constexpr uint32_t kHashSize = 1u << kHashBits;
+  static constexpr size_t kBlockTokens = 16384;
+
+  // Length and distance symbol tables (RFC 1951 3.2.5) and the fixed codes.
+  struct Tables {
+    uint8_t lenSym[256];                 // by length - 3
+    uint8_t distSmall[256], distLarge[256]; // by distance - 1: < 256, else by (d - 1) >> 7
+    uint16_t lenBase[29], distBase[30];  // length - 3, distance - 1
+    uint8_t lenExtra[29], distExtra[30];
+    uint16_t fixedLitCode[288], fixedDistCode[30];
+    uint8_t fixedLitLen[288], fixedDistLen[30];
+
+    Tables() {
+      static const uint16_t kLen[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                         67, 83, 99, 115, 131, 163, 195, 227, 258 };
+      static const uint16_t kDist[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+                                          769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+      for (int s = 0; s < 29; ++s) {
+        lenBase[s] = (uint16_t)(kLen[s] - 3);
+        lenExtra[s] = (uint8_t)(s < 8 || s == 28 ? 0 : (s - 4) / 4);
+        for (int l = kLen[s]; l < (s < 28 ? kLen[s + 1] : 259); ++l) lenSym[l - 3] = (uint8_t)s;
+      }
+      lenSym[255] = 28;                  // 258 has its own code, not 284 + 31
+      for (int s = 0; s < 30; ++s) {
+        distBase[s] = (uint16_t)(kDist[s] - 1);
+        distExtra[s] = (uint8_t)(s < 2 ? 0 : (s - 2) / 2);
+        const int hi = s < 29 ? kDist[s + 1] : 32769;
+        for (int d = kDist[s] - 1; d < hi - 1; ++d) {
+          if (d < 256) distSmall[d] = (uint8_t)s;
+          else distLarge[d >> 7] = (uint8_t)s;
+        }
+      }
+      for (int i = 0; i < 288; ++i) fixedLitLen[i] = (uint8_t)(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+      std::fill(std::begin(fixedDistLen), std::end(fixedDistLen), (uint8_t)5);
+      CanonicalCodes(fixedLitLen, 288, fixedLitCode);
+      CanonicalCodes(fixedDistLen, 30, fixedDistCode);
+    }
+
+    int DistSym(int d1) const { return d1 < 256 ? distSmall[d1] : distLarge[d1 >> 7]; }
+  };
+
+  static const Tables& T() {
+    static const Tables t;
+    return t;
+  }
+
+  // Bit-reversed canonical codes for the given lengths (deflate sends codes MSB first).
+  static void CanonicalCodes(const uint8_t* lengths, int n, uint16_t* codes) {
+    uint16_t count[16]{}, next[16]{};
+    for (int i = 0; i < n; ++i) ++count[lengths[i]];
+    count[0] = 0;
+    for (int l = 1, code = 0; l < 16; ++l) {
+      code = (code + count[l - 1]) << 1;
+      next[l] = (uint16_t)code;
+    }
+    for (int i = 0; i < n; ++i) {
+      const int l = lengths[i];
+      uint32_t c = l ? next[l]++ : 0, r = 0;
+      for (int k = 0; k < l; ++k, c >>= 1) r = r << 1 | (c & 1);
+      codes[i] = (uint16_t)r;
+    }
+  }
+
+  // Huffman code lengths of at most maxBits: Moffat-Katajainen in place over
+  // the used symbols sorted by frequency, then lengths over the limit are
+  // folded back as in zlib/miniz. A lone symbol gets a partner so every code
+  // is complete.
+  static void HuffmanLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lengths) {
+    std::pair<uint32_t, uint16_t> sym[288];
+    int used = 0;
+    for (int i = 0; i < n; ++i) {
+      lengths[i] = 0;
+      if (freq[i]) sym[used++] = { freq[i], (uint16_t)i };
+    }
+    if (used == 0) return;
+    if (used == 1) {
+      lengths[sym[0].second] = 1;
+      lengths[sym[0].second ? 0 : 1] = 1;
+      return;
+    }
+    std::sort(sym, sym + used);
+
+    uint32_t a[288];
+    for (int i = 0; i < used; ++i) a[i] = sym[i].first;
+    a[0] += a[1];
+    int root = 0, leaf = 2;
+    for (int next = 1; next < used - 1; ++next) {
+      if (leaf >= used || a[root] < a[leaf]) { a[next] = a[root]; a[root++] = (uint32_t)next; }
+      else a[next] = a[leaf++];
+      if (leaf >= used || (root < next && a[root] < a[leaf])) { a[next] += a[root]; a[root++] = (uint32_t)next; }
+      else a[next] += a[leaf++];
+    }
+    a[used - 2] = 0;
+    for (int next = used - 3; next >= 0; --next) a[next] = a[a[next]] + 1;
+    int avail = 1, taken = 0, depth = 0;
+    for (int r = used - 2, next = used - 1; avail > 0; avail = 2 * taken, ++depth, taken = 0) {
+      while (r >= 0 && (int)a[r] == depth) { ++taken; --r; }
+      while (avail > taken) { a[next--] = (uint32_t)depth; --avail; }
+    }
+
+    int count[33]{};
+    for (int i = 0; i < used; ++i) ++count[std::min<uint32_t>(a[i], 32)];
+    for (int l = maxBits + 1; l <= 32; ++l) { count[maxBits] += count[l]; count[l] = 0; }
+    uint32_t total = 0;
+    for (int l = maxBits; l > 0; --l) total += (uint32_t)count[l] << (maxBits - l);
+    for (; total != 1u << maxBits; --total) {
+      --count[maxBits];
+      for (int l = maxBits - 1; l > 0; --l) {
+        if (count[l]) { --count[l]; count[l + 1] += 2; break; }
+      }
+    }
+    for (int l = 1, j = used; l <= maxBits; ++l)
+      for (int c = count[l]; c > 0; --c) lengths[sym[--j].second] = (uint8_t)l;
+  }
+
+  uint32_t Hash(size_t p) const {
+    uint32_t v;
+    memcpy(&v, data_ + p, 4);
+    return (v * 2654435761u) >> (32 - kHashBits);
+  }
+
+  void Insert(size_t p) {
+    if (p + 4 > size_) return;
+    uint32_t& h = head_[Hash(p)];
+    prev_[p & (kWindow - 1)] = h;
+    h = (uint32_t)p + 1;
+  }
+
+  // Common prefix of a and b, up to limit bytes; 8 at a time.
+  static size_t MatchLength(const uint8_t* a, const uint8_t* b, size_t limit) {
+    size_t n = 0;
+    for (uint64_t x, y; n + 8 <= limit; n += 8) {
+      memcpy(&x, a + n, 8);
+      memcpy(&y, b + n, 8);
+      if (x != y) return n + (std::countr_zero(x ^ y) >> 3);
+    }
+    while (n < limit && a[n] == b[n]) ++n;
+    return n;
+  }
+
+  // Hashes `pos` and returns the longest match found within the chain budget.
+  int FindMatch(size_t pos, int& dist) {
+    if (pos + 4 > size_) return 0;
+    uint32_t& h = head_[Hash(pos)];
+    uint32_t cand = h;
+    prev_[pos & (kWindow - 1)] = cand;
+    h = (uint32_t)pos + 1;
+
+    const uint8_t* const cur = data_ + pos;
+    const size_t limit = std::min<size_t>(end_ - pos, kMaxMatch);
+    int best = 0;
+    for (int chain = chain_; cand && chain > 0; --chain) {
+      const size_t c = cand - 1;
+      if (c >= pos || pos - c >= kWindow) break; // stale: overwritten or out of the window
+      const uint8_t* const m = data_ + c;
+      if (best < (int)limit && m[best] == cur[best]) {
+        const size_t n = MatchLength(cur, m, limit);
+        if ((int)n > best) {
+          best = (int)n;
+          dist = (int)(pos - c);
+          if (n == limit) break;
+        }
+      }
+      cand = prev_[c & (kWindow - 1)];
+    }
+    return best;
+  }
+
+  void Literal(uint8_t b) {
+    tokens_.push_back(b);
+    ++litFreq_[b];
+  }
+
+  void Match(int len, int dist) {
+    tokens_.push_back(0x80000000u | (uint32_t)(dist - 1) << 8 | (uint32_t)(len - 3));
+    ++litFreq_[257 + T().lenSym[len - 3]];
+    ++distFreq_[T().DistSym(dist - 1)];
+  }
+
+  void Put(uint32_t v, int n) {
+    bits_ |= (uint64_t)v << nbits_;
+    nbits_ += n;
+    if (nbits_ >= 32) {
+      const uint32_t w = (uint32_t)bits_;
+      memcpy(dst_, &w, 4);              // little-endian, as deflate's bit order
+      dst_ += 4;
+      bits_ >>= 32;
+      nbits_ -= 32;
+    }
+  }
+
+  void AlignToByte() {
+    for (; nbits_ > 0; nbits_ -= 8, bits_ >>= 8) *dst_++ = (uint8_t)bits_;
+    nbits_ = 0;
+    bits_ = 0;
+  }
+
+  // Writes the tokens of data[from, to) as one block of whichever type is smallest.
+  void FlushBlock(size_t from, size_t to, bool final) {
+    const Tables& t = T();
+    ++litFreq_[256];
+    uint8_t litLen[286], distLen[30];
+    HuffmanLengths(litFreq_, 286, 15, litLen);
+    HuffmanLengths(distFreq_, 30, 15, distLen);
+    if (!std::any_of(distLen, distLen + 30, [](uint8_t l) { return l != 0; })) distLen[0] = distLen[1] = 1;
+
+    // Code-length alphabet: runs of the lengths as 16 (repeat), 17/18 (zeros)
+    int nlit = 286, ndist = 30;
+    while (nlit > 257 && !litLen[nlit - 1]) --nlit;
+    while (ndist > 1 && !distLen[ndist - 1]) --ndist;
+    uint8_t all[316];
+    memcpy(all, litLen, nlit);
+    memcpy(all + nlit, distLen, ndist);
+    const int nall = nlit + ndist;
+    uint16_t rle[316];                   // symbol | extra value << 5
+    int nrle = 0;
+    uint32_t clFreq[19]{};
+    for (int i = 0; i < nall;) {
+      const uint8_t l = all[i];
+      int run = 1;
+      while (i + run < nall && all[i + run] == l) ++run;
+      i += run;
+      if (l == 0) {
+        for (; run >= 11; run -= std::min(run, 138)) rle[nrle++] = (uint16_t)(18 | (std::min(run, 138) - 11) << 5), ++clFreq[18];
+        if (run >= 3) { rle[nrle++] = (uint16_t)(17 | (run - 3) << 5); ++clFreq[17]; run = 0; }
+      } else {
+        rle[nrle++] = l;
+        ++clFreq[l];
+        --run;
+        for (; run >= 3; run -= std::min(run, 6)) rle[nrle++] = (uint16_t)(16 | (std::min(run, 6) - 3) << 5), ++clFreq[16];
+      }
+      for (; run > 0; --run) rle[nrle++] = l, ++clFreq[l];
+    }
+    uint8_t clLen[19];
+    HuffmanLengths(clFreq, 19, 7, clLen);
+    static const uint8_t kClOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int nclen = 19;
+    while (nclen > 4 && !clLen[kClOrder[nclen - 1]]) --nclen;
+
+    // Sizes in bits of each block type
+    uint64_t extra = 0, dyn = 17 + 3 * (uint64_t)nclen, fixed = 3;
+    for (int s = 0; s < 29; ++s) extra += (uint64_t)litFreq_[257 + s] * t.lenExtra[s];
+    for (int s = 0; s < 30; ++s) {
+      extra += (uint64_t)distFreq_[s] * t.distExtra[s];
+      dyn += (uint64_t)distFreq_[s] * distLen[s];
+      fixed += (uint64_t)distFreq_[s] * t.fixedDistLen[s];
+    }
+    for (int s = 0; s < 286; ++s) {
+      dyn += (uint64_t)litFreq_[s] * litLen[s];
+      fixed += (uint64_t)litFreq_[s] * t.fixedLitLen[s];
+    }
+    for (int s = 0; s < 19; ++s) dyn += (uint64_t)clFreq[s] * clLen[s];
+    dyn += 2 * (uint64_t)clFreq[16] + 3 * (uint64_t)clFreq[17] + 7 * (uint64_t)clFreq[18] + extra;
+    fixed += extra;
+    const size_t raw = to - from;
+    const uint64_t stored = (raw / 65535 + 1) * 40 + 8 * (uint64_t)raw + 7;
+
+    if (stored <= std::min(dyn, fixed)) {
+      for (size_t at = from;;) {
+        const size_t n = std::min<size_t>(to - at, 65535);
+        Put(final && at + n == to ? 1 : 0, 3);
+        AlignToByte();
+        Put((uint32_t)n, 16);
+        Put((uint32_t)n ^ 0xFFFF, 16);
+        memcpy(dst_, data_ + at, n);
+        dst_ += n;
+        at += n;
+        if (at == to) break;
+      }
+    } else if (fixed <= dyn) {
+      Put(final ? 3 : 2, 3);
+      Symbols(t.fixedLitCode, t.fixedLitLen, t.fixedDistCode, t.fixedDistLen);
+    } else {
+      Put(final ? 5 : 4, 3);
+      Put((uint32_t)(nlit - 257), 5);
+      Put((uint32_t)(ndist - 1), 5);
+      Put((uint32_t)(nclen - 4), 4);
+      for (int i = 0; i < nclen; ++i) Put(clLen[kClOrder[i]], 3);
+      uint16_t clCode[19], litCode[286], distCode[30];
+      CanonicalCodes(clLen, 19, clCode);
+      CanonicalCodes(litLen, 286, litCode);
+      CanonicalCodes(distLen, 30, distCode);
+      static const uint8_t kRepeatBits[3] = { 2, 3, 7 };
+      for (int i = 0; i < nrle; ++i) {
+        const int s = rle[i] & 31;
+        Put(clCode[s], clLen[s]);
+        if (s >= 16) Put(rle[i] >> 5, kRepeatBits[s - 16]);
+      }
+      Symbols(litCode, litLen, distCode, distLen);
+    }
+
+    tokens_.clear();
+    std::fill(std::begin(litFreq_), std::end(litFreq_), 0u);
+    std::fill(std::begin(distFreq_), std::end(distFreq_), 0u);
+  }
+
+  void Symbols(const uint16_t* litCode, const uint8_t* litLen, const uint16_t* distCode, const uint8_t* distLen) {
+    const Tables& t = T();
+    for (const uint32_t tok : tokens_) {
+      if (!(tok & 0x80000000u)) {
+        Put(litCode[tok], litLen[tok]);
+        continue;
+      }
+      const int l3 = tok & 255, d1 = (tok >> 8) & 0x7FFF;
+      const int ls = t.lenSym[l3], ds = t.DistSym(d1);
+      Put(litCode[257 + ls], litLen[257 + ls]);
+      Put((uint32_t)(l3 - t.lenBase[ls]), t.lenExtra[ls]);
+      Put(distCode[ds], distLen[ds]);
+      Put((uint32_t)(d1 - t.distBase[ds]), t.distExtra[ds]);
+    }
+    Put(litCode[256], litLen[256]);
+  }
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0, end_ = 0;
+  int chain_ = 1;
+  std::vector<uint32_t> head_, prev_;    // position + 1; 0: none
+  std::vector<uint32_t> tokens_;         // literal byte, or 1 << 31 | (distance - 1) << 8 | (length - 3)
+  uint32_t litFreq_[286]{}, distFreq_[30]{};
+  uint8_t* dst_ = nullptr;
+  uint64_t bits_ = 0;
+  int nbits_ = 0;
+};
+
+static void PutBe32(std::vector<uint8_t>& v, uint32_t x) {
+  const uint8_t b[4] = { (uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x };
+  v.insert(v.end(), b, b + 4);
+}
+
+// Sum of the bytes read as signed magnitudes: the usual estimate of how well
+// a filtered row will compress (smaller is better).
+static uint64_t FilterCost(const uint8_t* p, size_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  uint64_t sum = lanes[0] + lanes[1];
+  for (; i < n; ++i) sum += std::min<uint32_t>(p[i], 256 - p[i]);
+  return sum;
+}
+
+// PNG row filters 1 (Sub), 2 (Up) and 4 (Paeth); `up` is the previous row,
+// zeros for the first. Average (3) and None rarely win on renders.
+static void FilterRowSub(const uint8_t* row, size_t n, size_t bpp, uint8_t* out) {
+  size_t i = 0;
+  for (; i < bpp; ++i) out[i] = row[i];
+  for (; i + 16 <= n; i += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+    const __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, a));
+  }
+  for (; i < n; ++i) out[i] = (uint8_t)(row[i] - row[i - bpp]);
+}
+
+static void FilterRowUp(const uint8_t* row, const uint8_t* up, size_t n, uint8_t* out) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(up + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, b));
+  }
+  for (; i < n; ++i) out[i] = (uint8_t)(row[i] - up[i]);
+}
+
+static void FilterRowPaeth(const uint8_t* row, const uint8_t* up, size_t n, size_t bpp, uint8_t* out) {
+  for (size_t i = 0; i < n; ++i) {
+    const int a = i >= bpp ? row[i - bpp] : 0, b = up[i], c = i >= bpp ? up[i - bpp] : 0;
+    const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+    out[i] = (uint8_t)(row[i] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+  }
+}
+
+struct PngEncoder::Worker {
+  DeflateEncoder deflate;
+  std::vector<uint8_t> row, zeros;     // a filter candidate; the row above the first
+};
+
+// Threads 1..n-1 of a ForChunks call; thread 0 is the caller. Each call bumps
+// seq, and the threads below `active` run the job once for it.
+struct PngEncoder::Pool {
+  std::vector<std::thread> threads;
+  std::mutex m;
+  std::condition_variable wake, done;
+  std::function<void(unsigned)> job;
+  uint64_t seq = 0;
+  unsigned active = 0, pending = 0;
+  std::exception_ptr error;
+  bool stop = false;
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stop = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : threads) t.join();
+  }
+
+  void Loop(unsigned wi) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(m);
+    for (;;) {
+      wake.wait(lock, [&] { return stop || seq != seen; });
+      if (stop) return;
+      seen = seq;
+      if (wi >= active) continue;
+      lock.unlock();
+      std::exception_ptr e;
+      try {
+        job(wi);
+      } catch (...) {
+        e = std::current_exception();
+      }
+      lock.lock();
+      if (e && !error) error = e;
+      if (--pending == 0) done.notify_one();
+    }
+  }
+
+  void Run(unsigned n, std::function<void(unsigned)> fn) {
+    while (threads.size() + 1 < n) {
+      const unsigned wi = (unsigned)threads.size() + 1;
+      threads.emplace_back([this, wi] { Loop(wi); });
+    }
+    {
+      std::lock_guard<std::mutex> lock(m);
+      job = std::move(fn);
+      active = n;
+      pending = n - 1;
+      error = nullptr;
+      ++seq;
+    }
+    wake.notify_all();
+    std::exception_ptr e;
+    try {
+      job(0);
+    } catch (...) {
+      e = std::current_exception();
+    }
+    std::unique_lock<std::mutex> lock(m);
+    done.wait(lock, [&] { return pending == 0; });
+    job = nullptr;
+    if (!e) e = error;
+    if (e) std::rethrow_exception(e);
+  }
+};
+
+PngEncoder::PngEncoder() = default;
+PngEncoder::~PngEncoder() = default;
+
+void PngEncoder::Encode(const uint8_t* rgba, uint32_t w, uint32_t h, const PngEncodeOptions& opt, std::vector<uint8_t>& out) {
+  if (!w || !h || w > 0x7FFFFFFF || h > 0x7FFFFFFF) throw std::runtime_error("PngEncoder: bad image size");
+  rgba_ = rgba;
+  w_ = w;
+  level_ = opt.level;
+  indexed_ = opt.palette && ExtractPalette((const uint32_t*)rgba, (size_t)w * h, colors_, index_);
+  depth_ = 8;
+  trns_ = 0;
+  rowBytes_ = (size_t)w * 4;
+  if (indexed_) {
+    const size_t n = colors_.size();
+    depth_ = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+    rowBytes_ = ((size_t)w * depth_ + 7) / 8;
+    // Translucent entries first, so tRNS ends at the last of them
+    size_t k = 0;
+    for (int opaque = 0; opaque < 2; ++opaque) {
+      for (size_t i = 0; i < n; ++i) {
+        if ((colors_[i] >> 24 == 255) != (opaque == 1)) continue;
+        remap_[i] = (uint8_t)k;
+        sorted_[k++] = colors_[i];
+      }
+      if (!opaque) trns_ = k;
+    }
+  }
+  const size_t stride = 1 + rowBytes_;
+  filtered_.resize(stride * h);
+
+  const uint32_t rowsPerChunk = (uint32_t)std::clamp<size_t>(std::max<size_t>(opt.chunkBytes, 64u << 10) / stride, 1, h);
+  chunks_.resize((h + rowsPerChunk - 1) / rowsPerChunk);
+  for (size_t c = 0; c < chunks_.size(); ++c) {
+    chunks_[c].y0 = (uint32_t)(c * rowsPerChunk);
+    chunks_[c].y1 = std::min(h, chunks_[c].y0 + rowsPerChunk);
+  }
+  const unsigned threads = (unsigned)std::min<size_t>(chunks_.size(),
+    std::max(1u, opt.threads ? opt.threads : std::thread::hardware_concurrency()));
+  while (workers_.size() < threads) workers_.push_back(std::make_unique<Worker>());
+  for (auto& wk : workers_) {
+    wk->row.resize(rowBytes_);
+    wk->zeros.assign(rowBytes_, 0);
+  }
+
+  // Filtering first: every chunk matches against the filtered bytes before it
+  ForChunks(threads, [&](Chunk& k, Worker& wk) {
+    for (uint32_t y = k.y0; y < k.y1; ++y) FilterRow(y, wk);
+    k.adler = Adler32(&filtered_[k.y0 * stride], (size_t)(k.y1 - k.y0) * stride);
+  });
+  uint32_t adler = chunks_[0].adler;
+  for (size_t c = 1; c < chunks_.size(); ++c)
+    adler = Adler32Combine(adler, chunks_[c].adler, (size_t)(chunks_[c].y1 - chunks_[c].y0) * stride);
+
+  // One IDAT per chunk, the zlib header in the first and the Adler-32 in the last
+  ForChunks(threads, [&](Chunk& k, Worker& wk) {
+    const bool first = &k == &chunks_.front(), last = &k == &chunks_.back();
+    k.idat.assign({ 0, 0, 0, 0, 'I', 'D', 'A', 'T' });
+    static const uint8_t kFlags[3] = { 0x01, 0x5E, 0x9C }; // FLEVEL fastest, fast, default; check bits for CMF 0x78
+    if (first) k.idat.insert(k.idat.end(), { 0x78, kFlags[level_] });
+    wk.deflate.Compress(filtered_.data(), filtered_.size(), k.y0 * stride, k.y1 * stride, last, level_, k.idat);
+    if (last) PutBe32(k.idat, adler);
+    const uint32_t len = (uint32_t)(k.idat.size() - 8);
+    for (int b = 0; b < 4; ++b) k.idat[b] = (uint8_t)(len >> (24 - 8 * b));
+    PutBe32(k.idat, Crc32(&k.idat[4], k.idat.size() - 4));
+  });
+
+  size_t total = 8 + 25 + 12 + 3 * colors_.size() + 12 + trns_ + 12 + 12;
+  for (const Chunk& k : chunks_) total += k.idat.size();
+  out.clear();
+  out.reserve(total);
+  static const uint8_t kSig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  out.insert(out.end(), kSig, kSig + 8);
+  uint8_t ihdr[13];
+  for (int b = 0; b < 4; ++b) {
+    ihdr[b] = (uint8_t)(w >> (24 - 8 * b));
+    ihdr[4 + b] = (uint8_t)(h >> (24 - 8 * b));
+  }
+  ihdr[8] = (uint8_t)depth_;
+  ihdr[9] = indexed_ ? 3 : 6;
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  WriteChunk("IHDR", ihdr, 13, out);
+  if (indexed_) {
+    uint8_t plte[768], trns[256];
+    for (size_t i = 0; i < colors_.size(); ++i) {
+      for (int ch = 0; ch < 3; ++ch) plte[3 * i + ch] = (uint8_t)(sorted_[i] >> (8 * ch));
+      trns[i] = (uint8_t)(sorted_[i] >> 24);
+    }
+    WriteChunk("PLTE", plte, 3 * colors_.size(), out);
+    if (trns_) WriteChunk("tRNS", trns, trns_, out);
+  }
+  for (const Chunk& k : chunks_) out.insert(out.end(), k.idat.begin(), k.idat.end());
+  WriteChunk("IEND", nullptr, 0, out);
+}
+
+void PngEncoder::WriteChunk(const char* type, const uint8_t* data, size_t n, std::vector<uint8_t>& out) {
+  PutBe32(out, (uint32_t)n);
+  const size_t at = out.size();
+  out.insert(out.end(), type, type + 4);
+  if (n) out.insert(out.end(), data, data + n);
+  PutBe32(out, Crc32(&out[at], n + 4));
+}
+
+template <typename Fn>
+void PngEncoder::ForChunks(unsigned threads, const Fn& fn) {
+  std::atomic<size_t> next{ 0 };
+  auto worker = [&](unsigned wi) {
+    for (size_t c; (c = next.fetch_add(1)) < chunks_.size();) fn(chunks_[c], *workers_[wi]);
+  };
+  if (threads <= 1) {
+    worker(0);
+    return;
+  }
+  if (!pool_) pool_ = std::make_unique<Pool>();
+  pool_->Run(threads, worker);
+}
+
+void PngEncoder::FilterRow(uint32_t y, Worker& wk) {
+  uint8_t* const dst = &filtered_[(size_t)y * (1 + rowBytes_)];
+  const size_t n = rowBytes_;
+  if (indexed_) {
+    dst[0] = 0;
+    const uint8_t* idx = &index_[(size_t)y * w_];
+    if (depth_ == 8) {
+      for (uint32_t x = 0; x < w_; ++x) dst[1 + x] = remap_[idx[x]];
+    } else {
+      std::fill(dst + 1, dst + 1 + n, (uint8_t)0);
+      const int perByte = 8 / depth_;
+      for (uint32_t x = 0; x < w_; ++x)
+        dst[1 + x / perByte] |= (uint8_t)(remap_[idx[x]] << (8 - depth_ * (x % perByte + 1)));
+    }
+    return;
+  }
+  const uint8_t* const row = rgba_ + (size_t)y * n;
+  const uint8_t* const up = y ? row - n : wk.zeros.data();
+  if (y && !memcmp(row, up, n)) {
+    dst[0] = 2;
+    std::fill(dst + 1, dst + 1 + n, (uint8_t)0);
+    return;
+  }
+  dst[0] = 1;
+  FilterRowSub(row, n, 4, dst + 1);
+  if (level_ == PngLevel_Fastest) return;
+
+  uint64_t best = FilterCost(dst + 1, n);
+  uint8_t* const cand = wk.row.data();
+  auto consider = [&](uint8_t filter) {
+    const uint64_t cost = FilterCost(cand, n);
+    if (cost < best) {
+      best = cost;
+      dst[0] = filter;
+      memcpy(dst + 1, cand, n);
+    }
+  };
+  if (y) {
+    FilterRowUp(row, up, n, cand);
+    consider(2);
+  }
+  if (level_ == PngLevel_Small) {
+    FilterRowPaeth(row, up, n, 4, cand);
+    consider(4);
+  }
+}
+
+// PngEncoder with default options, for tools that write a one-off image.
+void WritePngRgba(const std::filesystem::path& path, const std::vector<uint8_t>& rgba, int w, int h) {
+  std::vector<uint8_t> file;
+  PngEncoder().Encode(rgba.data(), (uint32_t)w, (uint32_t)h, PngEncodeOptions{}, file);
+  WriteFileBytes(path, file);
+}
+
+// ------------------------------
+// Mesh export (glTF 2.0 .glb, OBJ/MTL)
+// ------------------------------
+
+// Appends to a byte vector; reserve it up front to keep writes allocation-free.
+class ExportWriter {
+public:
+  explicit ExportWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+  size_t Size() const { return out_.size(); }
+  void Bytes(const void* p, size_t n) { out_.insert(out_.end(), (const uint8_t*)p, (const uint8_t*)p + n); }
+  void Str(std::string_view s) { Bytes(s.data(), s.size()); }
+  void U8(uint8_t v) { out_.push_back(v); }
+  void U32(uint32_t v) { Bytes(&v, 4); }
+  void F32(float v) { Bytes(&v, 4); }
+  void PatchU32(size_t at, uint32_t v) { memcpy(&out_[at], &v, 4); }
+  void Pad(size_t align, uint8_t fill) { while (out_.size() % align) out_.push_back(fill); }
+
+  void Int(uint64_t v) {
+    char b[24];
+    Bytes(b, std::to_chars(b, b + sizeof(b), v).ptr - b);
+  }
+  // Shortest text that reads back as the same float
+  void Num(float v) {
+    char b[32];
+    Bytes(b, std::to_chars(b, b + sizeof(b), v).ptr - b);
+  }
+  void JsonStr(std::string_view s) {
+    U8('"');
+    for (const char c : s) {
+      if (c == '"' || c == '\\') { U8('\\'); U8((uint8_t)c); }
+      else if ((uint8_t)c < 0x20) { Str("\\u00"); U8("0123456789abcdef"[c >> 4]); U8("0123456789abcdef"[c & 15]); }
+      else U8((uint8_t)c);
+    }
+    U8('"');
+  }
+
+private:
+  std::vector<uint8_t>& out_;
+};
+
+const std::vector<uint8_t>& MeshExporter::Glb(const SkinInfo& skin, const ModelDesc& model, const std::vector<uint8_t>& present, const BuiltMesh& mesh, const MeshExportOptions& opt) {
+  Segment(model, present, mesh, opt.partNodes);
+  const std::vector<uint8_t>& png = Png(skin);
+  const uint32_t nv = (uint32_t)mesh.vertices.size();
+  const size_t ni = mesh.indicesBase.size() + mesh.indicesOverlay.size() + mesh.indicesTranslucent.size();
+  const size_t pngSize = png.size();
+  const size_t binSize = (size_t)nv * 32 + ni * 4 + pngSize;
+
+  out_.clear();
+  out_.reserve(2048 + segs_.size() * 768 + binSize + 8);
+  ExportWriter w(out_);
+  w.Str("glTF");
+  w.U32(2);
+  w.U32(0);                            // total length, patched below
+  w.U32(0);                            // JSON length, patched below
+  w.Str("JSON");
+
+  w.Str(R"({"asset":{"version":"2.0","generator":"MinecraftSkinViewer"},"scene":0,"scenes":[{"nodes":[0]}],"nodes":[)");
+  w.Str(R"({"name":)");
+  w.JsonStr(model.name);
+  w.Str(R"(,"scale":[)");
+  for (int k = 0; k < 3; ++k) { if (k) w.U8(','); w.Num(opt.scale); }
+  w.U8(']');
+  if (opt.partNodes) {
+    Children(w, -1);
+    for (size_t s = 0; s < segs_.size(); ++s) {
+      const PartDesc& p = model.parts[segs_[s].part];
+      const XMFLOAT3 parent = segs_[s].parent < 0 ? XMFLOAT3(0, 0, 0) : model.parts[segs_[segs_[s].parent].part].center;
+      w.Str(R"(},{"name":)");
+      w.JsonStr(p.name);
+      w.Str(R"(,"translation":[)");
+      w.Num(p.center.x - parent.x); w.U8(','); w.Num(p.center.y - parent.y); w.U8(','); w.Num(p.center.z - parent.z);
+      w.Str(R"(],"mesh":)");
+      w.Int(s);
+      Children(w, (int)s);
+    }
+  } else {
+    w.Str(R"(,"mesh":0)");
+  }
+  w.Str("}],");
+
+  // Accessors per segment: POSITION, NORMAL, TEXCOORD_0, then one per non-empty index list
+  w.Str(R"("meshes":[)");
+  uint32_t acc = 0;
+  for (size_t s = 0; s < segs_.size(); ++s) {
+    const ExportSegment& g = segs_[s];
+    if (s) w.U8(',');
+    w.Str(R"({"name":)");
+    w.JsonStr(opt.partNodes ? model.parts[g.part].name : model.name);
+    w.Str(R"(,"primitives":[)");
+    const uint32_t attr = acc;
+    acc += 3;
+    bool first = true;
+    for (int l = 0; l < 3; ++l) {
+      if (g.i0[l] == g.i1[l]) continue;
+      if (!first) w.U8(',');
+      first = false;
+      w.Str(R"({"attributes":{"POSITION":)"); w.Int(attr);
+      w.Str(R"(,"NORMAL":)"); w.Int(attr + 1);
+      w.Str(R"(,"TEXCOORD_0":)"); w.Int(attr + 2);
+      w.Str(R"(},"indices":)"); w.Int(acc++);
+      w.Str(R"(,"material":)"); w.Int(l);
+      w.U8('}');
+    }
+    w.Str("]}");
+  }
+  w.Str("],");
+
+  w.Str(R"("accessors":[)");
+  size_t idxOffset = 0;
+  for (size_t s = 0; s < segs_.size(); ++s) {
+    const ExportSegment& g = segs_[s];
+    const XMFLOAT3 pivot = Pivot(model, g, opt);
+    float lo[3]{ FLT_MAX, FLT_MAX, FLT_MAX }, hi[3]{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32_t v = g.v0; v < g.v1; ++v) {
+      const XMFLOAT3& p = mesh.vertices[v].pos;
+      const float q[3]{ p.x - pivot.x, p.y - pivot.y, p.z - pivot.z };
+      for (int k = 0; k < 3; ++k) { lo[k] = std::min(lo[k], q[k]); hi[k] = std::max(hi[k], q[k]); }
+    }
+    if (s) w.U8(',');
+    w.Str(R"({"bufferView":0,"byteOffset":)"); w.Int((size_t)g.v0 * 12);
+    w.Str(R"(,"componentType":5126,"count":)"); w.Int(g.v1 - g.v0);
+    w.Str(R"(,"type":"VEC3","min":[)");
+    for (int k = 0; k < 3; ++k) { if (k) w.U8(','); w.Num(lo[k]); }
+    w.Str(R"(],"max":[)");
+    for (int k = 0; k < 3; ++k) { if (k) w.U8(','); w.Num(hi[k]); }
+    w.Str(R"(]},{"bufferView":1,"byteOffset":)"); w.Int((size_t)g.v0 * 12);
+    w.Str(R"(,"componentType":5126,"count":)"); w.Int(g.v1 - g.v0);
+    w.Str(R"(,"type":"VEC3"},{"bufferView":2,"byteOffset":)"); w.Int((size_t)g.v0 * 8);
+    w.Str(R"(,"componentType":5126,"count":)"); w.Int(g.v1 - g.v0);
+    w.Str(R"(,"type":"VEC2"})");
+    for (int l = 0; l < 3; ++l) {
+      if (g.i0[l] == g.i1[l]) continue;
+      w.Str(R"(,{"bufferView":3,"byteOffset":)"); w.Int(idxOffset * 4);
+      w.Str(R"(,"componentType":5125,"count":)"); w.Int(g.i1[l] - g.i0[l]);
+      w.Str(R"(,"type":"SCALAR"})");
+      idxOffset += g.i1[l] - g.i0[l];
+    }
+  }
+  w.Str("],");
+
+  w.Str(R"("bufferViews":[{"buffer":0,"byteOffset":0,"byteLength":)"); w.Int((size_t)nv * 12);
+  w.Str(R"(,"target":34962},{"buffer":0,"byteOffset":)"); w.Int((size_t)nv * 12);
+  w.Str(R"(,"byteLength":)"); w.Int((size_t)nv * 12);
+  w.Str(R"(,"target":34962},{"buffer":0,"byteOffset":)"); w.Int((size_t)nv * 24);
+  w.Str(R"(,"byteLength":)"); w.Int((size_t)nv * 8);
+  w.Str(R"(,"target":34962},{"buffer":0,"byteOffset":)"); w.Int((size_t)nv * 32);
+  w.Str(R"(,"byteLength":)"); w.Int(ni * 4);
+  w.Str(R"(,"target":34963},{"buffer":0,"byteOffset":)"); w.Int((size_t)nv * 32 + ni * 4);
+  w.Str(R"(,"byteLength":)"); w.Int(pngSize);
+  w.Str(R"(}],"buffers":[{"byteLength":)"); w.Int(binSize);
+  w.Str(R"(}],"images":[{"bufferView":4,"mimeType":"image/png"}],"samplers":[{"magFilter":)");
+  w.Int(opt.pointFilter ? 9728 : 9729);
+  w.Str(R"(,"minFilter":)");
+  w.Int(opt.pointFilter ? 9728 : 9729);
+  w.Str(R"(,"wrapS":33071,"wrapT":33071}],"textures":[{"sampler":0,"source":0}],"materials":[)");
+  static const char* const kMaterials[3] = {
+    R"("name":"base","alphaMode":"OPAQUE")",
+    R"("name":"overlay","alphaMode":"MASK","alphaCutoff":0.5)",
+    R"("name":"overlay_translucent","alphaMode":"BLEND")",
+  };
+  for (int l = 0; l < 3; ++l) {
+    w.Str(l ? ",{" : "{");
+    w.Str(kMaterials[l]);
+    w.Str(R"(,"pbrMetallicRoughness":{"baseColorTexture":{"index":0},"metallicFactor":0,"roughnessFactor":1}})");
+  }
+  w.Str("]}");
+  w.Pad(4, ' ');
+  w.PatchU32(12, (uint32_t)(w.Size() - 20));
+
+  w.U32((uint32_t)((binSize + 3) & ~size_t(3)));
+  w.Str(std::string_view("BIN\0", 4));
+  for (const ExportSegment& g : segs_) {
+    const XMFLOAT3 pivot = Pivot(model, g, opt);
+    for (uint32_t v = g.v0; v < g.v1; ++v) {
+      const XMFLOAT3& p = mesh.vertices[v].pos;
+      w.F32(p.x - pivot.x); w.F32(p.y - pivot.y); w.F32(p.z - pivot.z);
+    }
+  }
+  for (const Vertex& v : mesh.vertices) { w.F32(v.nrm.x); w.F32(v.nrm.y); w.F32(v.nrm.z); }
+  for (const Vertex& v : mesh.vertices) { w.F32(v.uv.x); w.F32(v.uv.y); }
+  const std::vector<uint32_t>* lists[3] = { &mesh.indicesBase, &mesh.indicesOverlay, &mesh.indicesTranslucent };
+  for (const ExportSegment& g : segs_) {
+    for (int l = 0; l < 3; ++l) {
+      for (uint32_t i = g.i0[l]; i < g.i1[l]; i += 3) {
+        const uint32_t* t = &(*lists[l])[i];
+        w.U32(t[0] - g.v0); w.U32(t[2] - g.v0); w.U32(t[1] - g.v0);
+      }
+    }
+  }
+  w.Bytes(png.data(), png.size());
+  w.Pad(4, 0);
+  w.PatchU32(8, (uint32_t)w.Size());
+  return out_;
+}
+
+const std::vector<uint8_t>& MeshExporter::Obj(const ModelDesc& model, const std::vector<uint8_t>& present, const BuiltMesh& mesh, const MeshExportOptions& opt, std::string_view mtlName, std::string_view textureName) {
+  Segment(model, present, mesh, opt.partNodes);
+  const size_t ni = mesh.indicesBase.size() + mesh.indicesOverlay.size() + mesh.indicesTranslucent.size();
+  out_.clear();
+  out_.reserve(256 + segs_.size() * 64 + mesh.vertices.size() * 112 + ni / 3 * 72);
+  ExportWriter w(out_);
+  w.Str("# ");
+  w.Str(model.name);
+  w.Str("\nmtllib ");
+  w.Str(mtlName);
+  w.U8('\n');
+  if (!opt.partNodes) { w.Str("o "); w.Str(model.name); w.U8('\n'); }
+
+  static const char* const kMaterials[3] = { "base", "overlay", "overlay_translucent" };
+  const std::vector<uint32_t>* lists[3] = { &mesh.indicesBase, &mesh.indicesOverlay, &mesh.indicesTranslucent };
+  for (const ExportSegment& g : segs_) {
+    if (opt.partNodes) { w.Str("o "); w.Str(model.parts[g.part].name); w.U8('\n'); }
+    for (uint32_t v = g.v0; v < g.v1; ++v) {
+      const Vertex& x = mesh.vertices[v];
+      w.Str("v "); w.Num(x.pos.x * opt.scale); w.U8(' '); w.Num(x.pos.y * opt.scale); w.U8(' '); w.Num(x.pos.z * opt.scale);
+      w.Str("\nvt "); w.Num(x.uv.x); w.U8(' '); w.Num(1.0f - x.uv.y);
+      w.Str("\nvn "); w.Num(x.nrm.x); w.U8(' '); w.Num(x.nrm.y); w.U8(' '); w.Num(x.nrm.z); w.U8('\n');
+    }
+    for (int l = 0; l < 3; ++l) {
+      if (g.i0[l] == g.i1[l]) continue;
+      w.Str("usemtl ");
+      w.Str(kMaterials[l]);
+      w.U8('\n');
+      for (uint32_t i = g.i0[l]; i < g.i1[l]; i += 3) {
+        const uint32_t* t = &(*lists[l])[i];
+        w.U8('f');
+        for (const uint32_t c : { t[0], t[2], t[1] }) {
+          w.U8(' '); w.Int(c + 1); w.U8('/'); w.Int(c + 1); w.U8('/'); w.Int(c + 1);
+        }
+        w.U8('\n');
+      }
+    }
+  }
+
+  mtl_.clear();
+  ExportWriter m(mtl_);
+  for (int l = 0; l < 3; ++l) {
+    m.Str("newmtl ");
+    m.Str(kMaterials[l]);
+    m.Str("\nKd 1 1 1\nmap_Kd ");
+    m.Str(textureName);
+    if (l) { m.Str("\nmap_d "); m.Str(textureName); }
+    m.Str("\n\n");
+  }
+  return out_;
+}
+
+const std::vector<uint8_t>& MeshExporter::Png(const SkinInfo& skin) {
+  const std::vector<uint8_t>& rgba = SkinRgba(skin, rgba_);
+  PngEncodeOptions opt;
+  opt.threads = 1;
+  pngEncoder_.Encode(rgba.data(), skin.width, skin.height, opt, png_);
+  return png_;
+}
+
+void MeshExporter::Segment(const ModelDesc& model, const std::vector<uint8_t>& present, const BuiltMesh& m, bool perPart) {
+  const std::vector<uint32_t>* lists[3] = { &m.indicesBase, &m.indicesOverlay, &m.indicesTranslucent };
+  segs_.clear();
+  if (!perPart) {
+    ExportSegment g;
+    g.v1 = (uint32_t)m.vertices.size();
+    for (int l = 0; l < 3; ++l) g.i1[l] = (uint32_t)lists[l]->size();
+    segs_.push_back(g);
+    return;
+  }
+  if (present.size() != model.parts.size()) throw std::runtime_error("export: part mask does not match the model");
+  uint32_t v = 0, pos[3]{};
+  for (uint32_t i = 0; i < (uint32_t)model.parts.size(); ++i) {
+    if (!present[i]) continue;
+    ExportSegment g;
+    g.part = i;
+    g.v0 = v;
+    g.v1 = v += Face_Count * 4;
+    for (int l = 0; l < 3; ++l) {
+      g.i0[l] = pos[l];
+      while (pos[l] < lists[l]->size() && (*lists[l])[pos[l]] < g.v1) ++pos[l];
+      g.i1[l] = pos[l];
+    }
+    const XMFLOAT3& c = model.parts[i].center;
+    if (model.parts[i].layer == Layer_Overlay) {
+      for (size_t s = 0; s < segs_.size() && g.parent < 0; ++s) {
+        const PartDesc& b = model.parts[segs_[s].part];
+        if (b.layer == Layer_Base && b.center.x == c.x && b.center.y == c.y && b.center.z == c.z) g.parent = (int)s;
+      }
+    }
+    segs_.push_back(g);
+  }
+  if (v != m.vertices.size()) throw std::runtime_error("export: mesh was not built from this model and part mask");
+}
+
+XMFLOAT3 MeshExporter::Pivot(const ModelDesc& model, const ExportSegment& g, const MeshExportOptions& opt) {
+  return opt.partNodes ? model.parts[g.part].center : XMFLOAT3(0, 0, 0);
+}
+
+void MeshExporter::Children(ExportWriter& w, int parent) const {
+  bool first = true;
+  for (size_t s = 0; s < segs_.size(); ++s) {
+    if (segs_[s].parent != parent) continue;
+    w.Str(first ? R"(,"children":[)" : ",");
+    w.Int(s + 1);
+    first = false;
+  }
+  if (!first) w.U8(']');
+}
+
+// ------------------------------
+// Camera controls
+// ------------------------------
+
+XMFLOAT3 CameraEye(const Camera& c) {
+  const float cp = cosf(c.pitch), sp = sinf(c.pitch);
+  const float cy = cosf(c.yaw),   sy = sinf(c.yaw);
+  return XMFLOAT3(
+    c.target.x + c.dist * cp * sy,
+    c.target.y + c.dist * sp,
+    c.target.z + c.dist * cp * cy
+  );
+}
+
+XMMATRIX MakeView(const Camera& c) {
+  const XMFLOAT3 e = CameraEye(c);
+  XMVECTOR eye = XMVectorSet(e.x, e.y, e.z, 1.0f);
+
+  XMVECTOR at = XMVectorSet(c.target.x, c.target.y, c.target.z, 1.0f);
+  XMVECTOR up = XMVectorSet(0, 1, 0, 0);
+  return XMMatrixLookAtLH(eye, at, up);
+}
+
+XMMATRIX MakeProj(int fbW, int fbH, float farZ) {
+  return XMMatrixPerspectiveFovLH(XMConvertToRadians(55.0f), (float)fbW / (float)fbH, 0.1f, farZ);
+}
+
+XMMATRIX MakeWorld() {
+  return XMMatrixScaling(kWorldScale, kWorldScale, kWorldScale) * XMMatrixTranslation(0, 0, 0);
+}
+
+// ------------------------------
+// Grid layout (no D3D; pure functions of counts and pixel sizes)
+// ------------------------------
+
+// Picks the column count that gives the largest cells for `count` entries in
+// areaW x areaH. Cells never shrink below minCell; the grid scrolls instead.
+GridLayout ComputeGridLayout(int count, int areaW, int areaH, int minCell, int gap) {
+  GridLayout g;
+  g.gap = gap;
+  if (count <= 0 || areaW <= 0 || areaH <= 0) return g;
+
+  int bestSide = -1;
+  for (int cols = 1; cols <= count; ++cols) {
+    const int rows = (count + cols - 1) / cols;
+    const int cw = (areaW - gap * (cols + 1)) / cols;
+    const int ch = (areaH - gap * (rows + 1)) / rows;
+    const int side = std::min(cw, ch);
+    if (side > bestSide) {
+      bestSide = side;
+      g.cols = cols; g.rows = rows; g.cellW = cw; g.cellH = ch;
+    }
+  }
+
+  if (std::min(g.cellW, g.cellH) < minCell) {
+    g.cols = std::clamp((areaW - gap) / (minCell + gap), 1, count);
+    g.rows = (count + g.cols - 1) / g.cols;
+    g.cellW = std::max(minCell, (areaW - gap * (g.cols + 1)) / g.cols);
+    g.cellH = minCell;
+  }
+  g.contentH = g.rows * g.cellH + (g.rows + 1) * gap;
+  return g;
+}
+
+CellRect GridCellRect(const GridLayout& g, int index, int scrollY) {
+  const int c = index % g.cols;
+  const int r = index / g.cols;
+  return CellRect{ g.gap + c * (g.cellW + g.gap), g.gap + r * (g.cellH + g.gap) - scrollY, g.cellW, g.cellH };
+}
+
+int GridMaxScroll(const GridLayout& g, int areaH) {
+  return std::max(0, g.contentH - areaH);
+}
+
+static bool CellIntersects(const CellRect& c, int areaW, int areaH) {
+  return c.w > 0 && c.h > 0 && c.x < areaW && c.y < areaH && c.x + c.w > 0 && c.y + c.h > 0;
+}
+
+// Indices of the cells that are at least partly on screen, in row order.
+void VisibleGridCells(const GridLayout& g, int count, int scrollY, int areaW, int areaH, std::vector<int>& out) {
+  out.clear();
+  if (count <= 0 || g.cellH <= 0) return;
+  const int firstRow = std::max(0, (scrollY - g.gap) / (g.cellH + g.gap));
+  for (int i = firstRow * g.cols; i < count; ++i) {
+    const CellRect r = GridCellRect(g, i, scrollY);
+    if (r.y >= areaH) break;
+    if (CellIntersects(r, areaW, areaH)) out.push_back(i);
+  }
+}
+
+// ------------------------------
+// Crowd scene (no D3D; SoA instances, frustum culling, state sort)
+// ------------------------------
+
+// Deterministic population: jittered square grid on the XZ plane centered on
+// the origin, random yaw, skin and variant.
+void PopulateCrowd(CrowdInstances& c, size_t count, size_t skinCount, float spacing, uint32_t seed) {
+  c.Clear();
+  if (skinCount == 0) return;
+  uint32_t state = seed ? seed : 1u;
+  auto rnd = [&]() { state = state * 1664525u + 1013904223u; return (float)(state >> 8) / 16777216.0f; };
+
+  const size_t side = (size_t)std::ceil(std::sqrt((double)count));
+  const float half = 0.5f * spacing * (float)(side - 1);
+  for (size_t i = 0; i < count; ++i) {
+    const float px = (float)(i % side) * spacing - half + (rnd() - 0.5f) * spacing * 0.5f;
+    const float pz = (float)(i / side) * spacing - half + (rnd() - 0.5f) * spacing * 0.5f;
+    const float ryaw = rnd() * XM_2PI;
+    const uint16_t sk = (uint16_t)std::min(skinCount - 1, (size_t)(rnd() * (float)skinCount));
+    const uint8_t slim = rnd() < 0.5f ? 1 : 0;
+    c.Add(px, 0.0f, pz, ryaw, sk, slim);
+  }
+}
+
+CrowdBounds ComputeCrowdBounds(float worldScale) {
+  float r2 = 0.0f, yMin = FLT_MAX, yMax = -FLT_MAX;
+  for (int slim = 0; slim < 2; ++slim) {
+    for (const PartDesc& p : PlayerModel(slim == 1).parts) {
+      const float hx = std::abs(p.center.x) + 0.5f * p.size.x + p.inflate;
+      const float hz = std::abs(p.center.z) + 0.5f * p.size.z + p.inflate;
+      r2 = std::max(r2, hx * hx + hz * hz);
+      yMin = std::min(yMin, p.center.y - 0.5f * p.size.y - p.inflate);
+      yMax = std::max(yMax, p.center.y + 0.5f * p.size.y + p.inflate);
+    }
+  }
+  CrowdBounds b;
+  b.centerY = 0.5f * (yMin + yMax) * worldScale;
+  b.halfY = 0.5f * (yMax - yMin) * worldScale;
+  b.halfXZ = std::sqrt(r2) * worldScale;
+  return b;
+}
+
+static Frustum ExtractFrustum(const XMFLOAT4X4& m) {
+  auto col = [&](int c) { return XMFLOAT4(m.m[0][c], m.m[1][c], m.m[2][c], m.m[3][c]); };
+  const XMFLOAT4 c0 = col(0), c1 = col(1), c2 = col(2), c3 = col(3);
+  const XMFLOAT4 raw[6] = {
+    { c3.x + c0.x, c3.y + c0.y, c3.z + c0.z, c3.w + c0.w },   // left
+    { c3.x - c0.x, c3.y - c0.y, c3.z - c0.z, c3.w - c0.w },   // right
+    { c3.x + c1.x, c3.y + c1.y, c3.z + c1.z, c3.w + c1.w },   // bottom
+    { c3.x - c1.x, c3.y - c1.y, c3.z - c1.z, c3.w - c1.w },   // top
+    { c2.x, c2.y, c2.z, c2.w },                               // near
+    { c3.x - c2.x, c3.y - c2.y, c3.z - c2.z, c3.w - c2.w },   // far
+  };
+  Frustum f;
+  for (int i = 0; i < 6; ++i) {
+    const float len = std::sqrt(raw[i].x * raw[i].x + raw[i].y * raw[i].y + raw[i].z * raw[i].z);
+    const float inv = len > 0.0f ? 1.0f / len : 0.0f;
+    f.planes[i] = XMFLOAT4(raw[i].x * inv, raw[i].y * inv, raw[i].z * inv, raw[i].w * inv);
+  }
+  return f;
+}
+
+// Appends the indices of instances whose box touches the frustum.
+static void CullCrowd(const CrowdInstances& c, const Frustum& f, const CrowdBounds& b, std::vector<uint32_t>& visible) {
+  visible.clear();
+  const size_t n = c.Size();
+
+  // Per plane: box center offset and projected extent folded into the constant
+  float nx[6], ny[6], nz[6], dw[6];
+  for (int i = 0; i < 6; ++i) {
+    const XMFLOAT4& p = f.planes[i];
+    nx[i] = p.x; ny[i] = p.y; nz[i] = p.z;
+    dw[i] = p.w + p.y * b.centerY + (std::abs(p.x) + std::abs(p.z)) * b.halfXZ + std::abs(p.y) * b.halfY;
+  }
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 px = _mm_loadu_ps(&c.x[i]);
+    const __m128 py = _mm_loadu_ps(&c.y[i]);
+    const __m128 pz = _mm_loadu_ps(&c.z[i]);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int k = 0; k < 6; ++k) {
+      __m128 d = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(nx[k])), _mm_set1_ps(dw[k]));
+      d = _mm_add_ps(d, _mm_mul_ps(py, _mm_set1_ps(ny[k])));
+      d = _mm_add_ps(d, _mm_mul_ps(pz, _mm_set1_ps(nz[k])));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+    }
+    for (int m = _mm_movemask_ps(inside); m; m &= m - 1) {
+      visible.push_back((uint32_t)(i + std::countr_zero((unsigned)m)));
+    }
+  }
+  for (; i < n; ++i) {
+    bool in = true;
+    for (int k = 0; k < 6 && in; ++k) in = c.x[i] * nx[k] + c.y[i] * ny[k] + c.z[i] * nz[k] + dw[k] >= 0.0f;
+    if (in) visible.push_back((uint32_t)i);
+  }
+}
+
+// Draw key: LOD | blend (cutout < blended) | mesh variant | texture. Blending
+// is a property of the skin, so within a LOD this is the (variant, texture)
+// order with the few blended skins moved last, where the overlay pass needs
+// them anyway. Only LOD0 draws overlays; impostors only care about texture.
+static uint32_t CrowdDrawKey(CrowdLod lod, uint8_t blend, uint8_t variant, uint16_t skin) {
+  if (lod == CrowdLod_Impostor) return ((uint32_t)lod << 18) | skin;
+  if (lod == CrowdLod_Merged) blend = 0;
+  return ((uint32_t)lod << 18) | ((uint32_t)blend << 17) | ((uint32_t)variant << 16) | skin;
+}
+
+static CrowdLod CrowdKeyLod(uint32_t key) { return (CrowdLod)(key >> 18); }
+
+// Stable LSD radix sort of s.visible by s.keys (two 10-bit passes cover the
+// 20-bit key); no allocations once the scratch vectors have grown.
+static void RadixSortCrowdKeys(CrowdScratch& s) {
+  const size_t n = s.visible.size();
+  s.tmpKeys.resize(n);
+  s.tmpIdx.resize(n);
+  for (int shift = 0; shift < 20; shift += 10) {
+    uint32_t count[1025]{};
+    for (size_t i = 0; i < n; ++i) ++count[((s.keys[i] >> shift) & 1023) + 1];
+    if (n == 0 || count[((s.keys[0] >> shift) & 1023) + 1] == n) continue; // all equal
+    for (int b = 0; b < 1024; ++b) count[b + 1] += count[b];
+    for (size_t i = 0; i < n; ++i) {
+      const uint32_t dst = count[(s.keys[i] >> shift) & 1023]++;
+      s.tmpKeys[dst] = s.keys[i];
+      s.tmpIdx[dst] = s.visible[i];
+    }
+    s.keys.swap(s.tmpKeys);
+    s.visible.swap(s.tmpIdx);
+  }
+}
+
+// Binds and draws RenderCrowd issues for a sorted key list: LOD0 base pass
+// (+ overlay pass), LOD1 base pass, then one impostor draw per texture run.
+static void CountCrowdSubmission(const std::vector<uint32_t>& keys, bool overlayPass, CrowdStats& st) {
+  st.stateChanges = 0;
+  st.drawCalls = 0;
+  size_t begin = 0;
+  for (int lod = 0; lod < CrowdLod_Count; ++lod) {
+    size_t end = begin;
+    while (end < keys.size() && CrowdKeyLod(keys[end]) == lod) ++end;
+    st.drawnLod[lod] = (uint32_t)(end - begin);
+    if (end == begin) continue;
+
+    const int passes = (lod == CrowdLod_Full && overlayPass) ? 2 : 1;
+    for (int pass = 0; pass < passes; ++pass) {
+      st.stateChanges += 1 + (pass == 1 ? 1 : 0); // pipeline/buffers for this pass
+      uint32_t prev = UINT32_MAX;
+      for (size_t i = begin; i < end; ++i) {
+        const uint32_t k = keys[i];
+        const bool texChange = prev == UINT32_MAX || (k & 0xFFFF) != (prev & 0xFFFF);
+        if (texChange) ++st.stateChanges;
+        if (lod == CrowdLod_Impostor) {
+          if (texChange) ++st.drawCalls;
+        } else {
+          ++st.drawCalls;
+          if (prev != UINT32_MAX && ((k >> 16) & 1) != ((prev >> 16) & 1)) ++st.stateChanges;
+          if (pass == 1 && prev != UINT32_MAX && ((k >> 17) & 1) != ((prev >> 17) & 1)) ++st.stateChanges;
+        }
+        prev = k;
+      }
+    }
+    begin = end;
+  }
+}
+
+// Cull, LOD and sort for one frame; s.visible/s.keys end up in submission order.
+CrowdStats PrepareCrowdFrame(const CrowdInstances& c, FXMMATRIX view, CXMMATRIX proj, int fbH,
+                             const CrowdBounds& b, const std::vector<uint8_t>& skinFlags,
+                             bool overlayPass, CrowdScratch& s) {
+  XMFLOAT4X4 vp, v;
+  XMStoreFloat4x4(&vp, view * proj);
+  XMStoreFloat4x4(&v, view);
+  XMFLOAT4X4 pr;
+  XMStoreFloat4x4(&pr, proj);
+  CullCrowd(c, ExtractFrustum(vp), b, s.visible);
+
+  // Projected height = worldHeight * proj._22 * (fbH / 2) / viewDepth
+  const float heightScale = 2.0f * b.halfY * pr.m[1][1] * 0.5f * (float)fbH;
+  const size_t n = s.visible.size();
+  s.keys.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t id = s.visible[i];
+    const float cy = c.y[id] + b.centerY;
+    const float depth = c.x[id] * v.m[0][2] + cy * v.m[1][2] + c.z[id] * v.m[2][2] + v.m[3][2];
+    const float px = depth > 0.0f ? heightScale / depth : FLT_MAX;
+
+    const uint16_t sk = c.skin[id];
+    const uint8_t flags = sk < skinFlags.size() ? skinFlags[sk] : 0;
+    CrowdLod lod = CrowdLod_Full;
+    if (px < kCrowdLod2Px && (flags & CrowdSkin_Impostor)) lod = CrowdLod_Impostor;
+    else if (px < kCrowdLod1Px) lod = CrowdLod_Merged;
+    s.keys[i] = CrowdDrawKey(lod, (flags & CrowdSkin_Blended) ? 1 : 0, c.variant[id], sk);
+  }
+  RadixSortCrowdKeys(s);
+
+  CrowdStats st;
+  st.instances = (uint32_t)c.Size();
+  st.drawn = (uint32_t)n;
+  st.culled = st.instances - st.drawn;
+  CountCrowdSubmission(s.keys, overlayPass, st);
+  return st;
+}
+
+// ------------------------------
+// CPU renderer (software rasterizer)
+// ------------------------------
+
+enum CpuPass : uint8_t { CpuPass_Base, CpuPass_Cutout, CpuPass_Translucent };
+
+// Screen-space triangle, counter-clockwise on screen after setup.
+struct CpuTri {
+  float x[3], y[3], z[3];
+  float invW[3], uw[3], vw[3];     // 1/w, u/w, v/w for perspective-correct UVs
+  float sw[3];                     // shade/w
+  float minX, minY, maxX, maxY;
+  CpuPass pass;
+  uint16_t skin;                   // index into the skin table given to the rasterizer
+};
+
+static void SetupCpuTriangles(const BuiltMesh& m, const std::vector<uint32_t>& idx, const XMFLOAT4X4& mvp,
+                              int W, int H, CpuPass pass, std::vector<CpuTri>& out, uint16_t skin = 0) {
+  for (size_t t = 0; t + 2 < idx.size(); t += 3) {
+    CpuTri tri{};
+    bool behind = false;
+    for (int k = 0; k < 3; ++k) {
+      const Vertex& v = m.vertices[idx[t + k]];
+      const float* r0 = mvp.m[0]; const float* r1 = mvp.m[1]; const float* r2 = mvp.m[2]; const float* r3 = mvp.m[3];
+      const float cx = v.pos.x * r0[0] + v.pos.y * r1[0] + v.pos.z * r2[0] + r3[0];
+      const float cy = v.pos.x * r0[1] + v.pos.y * r1[1] + v.pos.z * r2[1] + r3[1];
+      const float cz = v.pos.x * r0[2] + v.pos.y * r1[2] + v.pos.z * r2[2] + r3[2];
+      const float cw = v.pos.x * r0[3] + v.pos.y * r1[3] + v.pos.z * r2[3] + r3[3];
+      // The orbit camera never gets closer than ~3 units to the model, so
+      // near-plane clipping is not needed; anything crossing the near plane
+      // (only crowd players next to the eye) is dropped.
+      if (cw < 1e-4f || cz < 0.0f) { behind = true; break; }
+      const float iw = 1.0f / cw;
+      tri.x[k] = (cx * iw * 0.5f + 0.5f) * (float)W;
+      tri.y[k] = (0.5f - cy * iw * 0.5f) * (float)H;
+      tri.z[k] = cz * iw;
+      tri.invW[k] = iw;
+      tri.uw[k] = v.uv.x * iw;
+      tri.vw[k] = v.uv.y * iw;
+      tri.sw[k] = v.shade * iw;
+    }
+    if (behind) continue;
+
+    // Back-face culling like the rasterizer state (front = CCW, y down => negative area).
+    const float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+    if (area >= 0.0f) continue;
+    // Reorder to positive area so all edge functions are >= 0 inside.
+    std::swap(tri.x[1], tri.x[2]); std::swap(tri.y[1], tri.y[2]); std::swap(tri.z[1], tri.z[2]);
+    std::swap(tri.invW[1], tri.invW[2]); std::swap(tri.uw[1], tri.uw[2]); std::swap(tri.vw[1], tri.vw[2]);
+    std::swap(tri.sw[1], tri.sw[2]);
+
+    tri.minX = std::min({ tri.x[0], tri.x[1], tri.x[2] });
+    tri.maxX = std::max({ tri.x[0], tri.x[1], tri.x[2] });
+    tri.minY = std::min({ tri.y[0], tri.y[1], tri.y[2] });
+    tri.maxY = std::max({ tri.y[0], tri.y[1], tri.y[2] });
+    if (tri.maxX < 0 || tri.maxY < 0 || tri.minX > (float)W || tri.minY > (float)H) continue;
+    tri.pass = pass;
+    tri.skin = skin;
+    out.push_back(tri);
+  }
+}
+
+// Clamp addressing, point or bilinear, like the D3D sampler.
+static void SampleSkin(const SkinInfo& s, float u, float v, bool point, float out[4]) {
+  const int W = (int)s.width, H = (int)s.height;
+  auto texel = [&](int x, int y) -> const uint8_t* {
+    x = std::clamp(x, 0, W - 1);
+    y = std::clamp(y, 0, H - 1);
+    const size_t i = (size_t)y * W + x;
+    if (s.palette.bits) return (const uint8_t*)&s.palette.colors[PaletteIndexAt(s.palette, i)];
+    return &s.rgba[i * 4];
+  };
+  if (point) {
+    const uint8_t* t = texel((int)floorf(u * W), (int)floorf(v * H));
+    for (int c = 0; c < 4; ++c) out[c] = t[c] * (1.0f / 255.0f);
+    return;
+  }
+  const float fx = u * W - 0.5f, fy = v * H - 0.5f;
+  const int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+  const float ax = fx - x0, ay = fy - y0;
+  const uint8_t* t00 = texel(x0, y0);     const uint8_t* t10 = texel(x0 + 1, y0);
+  const uint8_t* t01 = texel(x0, y0 + 1); const uint8_t* t11 = texel(x0 + 1, y0 + 1);
+  for (int c = 0; c < 4; ++c) {
+    const float top = t00[c] + (t10[c] - t00[c]) * ax;
+    const float bot = t01[c] + (t11[c] - t01[c]) * ax;
+    out[c] = (top + (bot - top) * ay) * (1.0f / 255.0f);
+  }
+}
+
+// Per-thread sample storage for one tile (reused across tiles).
+struct CpuTileBuffers {
+  std::vector<float> color;  // RGBA per sample
+  std::vector<float> depth;
+};
+
+// Top-left fill rule: samples exactly on an edge belong to top or left edges only.
+static bool EdgeOwns(float e, float ex, float ey) {
+  return e > 0.0f || (e == 0.0f && (ey < 0.0f || (ey == 0.0f && ex > 0.0f)));
+}
+
+// Rasterizes all triangles into one tile and resolves it into dst (RGBA8, tw x th).
+static void RenderCpuTile(const SkinInfo* const* skins, const std::vector<CpuTri>& tris, const CpuRenderParams& p,
+                          int tx0, int ty0, int tw, int th, CpuTileBuffers& buf, uint8_t* dst, size_t dstStride) {
+  const int n = std::max(1, p.samplesPerAxis);
+  const int sw = tw * n, sh = th * n;
+  const float inv = 1.0f / (float)n;
+
+  buf.color.resize((size_t)sw * sh * 4);
+  buf.depth.assign((size_t)sw * sh, 1.0f);
+  for (size_t i = 0; i < (size_t)sw * sh; ++i) memcpy(&buf.color[i * 4], p.background, sizeof(p.background));
+
+  for (const CpuTri& t : tris) {
+    // Sample-space bounds of the triangle inside this tile.
+    const int sx0 = std::max(0, (int)floorf((t.minX - tx0) * n));
+    const int sy0 = std::max(0, (int)floorf((t.minY - ty0) * n));
+    const int sx1 = std::min(sw, (int)ceilf((t.maxX - tx0) * n) + 1);
+    const int sy1 = std::min(sh, (int)ceilf((t.maxY - ty0) * n) + 1);
+    if (sx0 >= sx1 || sy0 >= sy1) continue;
+
+    const float e0x = t.x[2] - t.x[1], e0y = t.y[2] - t.y[1];
+    const float e1x = t.x[0] - t.x[2], e1y = t.y[0] - t.y[2];
+    const float e2x = t.x[1] - t.x[0], e2y = t.y[1] - t.y[0];
+    const float area = e2x * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * e2y;
+    const float invArea = 1.0f / area;
+
+    for (int sy = sy0; sy < sy1; ++sy) {
+      const float py = (float)ty0 + ((float)sy + 0.5f) * inv;
+      for (int sx = sx0; sx < sx1; ++sx) {
+        const float px = (float)tx0 + ((float)sx + 0.5f) * inv;
+
+        const float w0 = e0x * (py - t.y[1]) - e0y * (px - t.x[1]);
+        const float w1 = e1x * (py - t.y[2]) - e1y * (px - t.x[2]);
+        const float w2 = e2x * (py - t.y[0]) - e2y * (px - t.x[0]);
+        if (!EdgeOwns(w0, e0x, e0y) || !EdgeOwns(w1, e1x, e1y) || !EdgeOwns(w2, e2x, e2y)) continue;
+
+        const float b0 = w0 * invArea, b1 = w1 * invArea, b2 = w2 * invArea;
+        const size_t si = (size_t)sy * sw + sx;
+        const float z = b0 * t.z[0] + b1 * t.z[1] + b2 * t.z[2];
+        if (z > buf.depth[si]) continue; // LESS_EQUAL
+
+        const float iw = b0 * t.invW[0] + b1 * t.invW[1] + b2 * t.invW[2];
+        const float u = (b0 * t.uw[0] + b1 * t.uw[1] + b2 * t.uw[2]) / iw;
+        const float v = (b0 * t.vw[0] + b1 * t.vw[1] + b2 * t.vw[2]) / iw;
+        const float shade = (b0 * t.sw[0] + b1 * t.sw[1] + b2 * t.sw[2]) / iw;
+        float c[4];
+        SampleSkin(*skins[t.skin], u, v, p.pointFilter, c);
+        c[0] *= shade; c[1] *= shade; c[2] *= shade;
+
+        float* d = &buf.color[si * 4];
+        if (t.pass == CpuPass_Translucent) {
+          const float a = c[3];
+          d[0] = c[0] * a + d[0] * (1.0f - a);
+          d[1] = c[1] * a + d[1] * (1.0f - a);
+          d[2] = c[2] * a + d[2] * (1.0f - a);
+          d[3] = a + d[3] * (1.0f - a);
+        } else {
+          if (t.pass == CpuPass_Cutout) {
+            if (c[3] < 0.5f) continue;
+            c[3] = 1.0f;
+          }
+          memcpy(d, c, sizeof(c));
+          buf.depth[si] = z;
+        }
+      }
+    }
+  }
+
+  // Resolve: box filter over the n*n samples of each pixel.
+  const float norm = 255.0f / (float)(n * n);
+  for (int y = 0; y < th; ++y) {
+    uint8_t* row = dst + (size_t)y * dstStride;
+    for (int x = 0; x < tw; ++x) {
+      float acc[4]{};
+      for (int j = 0; j < n; ++j) {
+        const float* sp = &buf.color[(((size_t)(y * n + j)) * sw + (size_t)x * n) * 4];
+        for (int i = 0; i < n; ++i, sp += 4) {
+          acc[0] += sp[0]; acc[1] += sp[1]; acc[2] += sp[2]; acc[3] += sp[3];
+        }
+      }
+      for (int c = 0; c < 4; ++c) row[x * 4 + c] = (uint8_t)Clamp(acc[c] * norm + 0.5f, 0.0f, 255.0f);
+    }
+  }
+}
+
+// Tiles the image and rasterizes `tris` (in order) into it, one band of tiles
+// at a time; each band only sees the triangles that overlap it. The workers
+// are started once per render and meet at a barrier before and after each band.
+static void RasterizeCpuTris(const SkinInfo* const* skins, const std::vector<CpuTri>& tris, const CpuRenderParams& p,
+                             const CpuRowSink& sink) {
+  const int W = p.width, H = p.height;
+  const int ts = std::max(8, p.tileSize);
+  const int tilesX = (W + ts - 1) / ts;
+  const int threads = std::max(1, std::min(p.threads > 0 ? p.threads : (int)std::thread::hardware_concurrency(), tilesX));
+
+  std::vector<uint8_t> band((size_t)W * ts * 4);
+  std::vector<CpuTileBuffers> buffers(threads);
+  std::vector<CpuTri> bandTris;
+  int ty0 = 0, th = 0;
+  std::atomic<int> next{ 0 };
+  bool done = false;
+  std::barrier sync(threads);
+
+  auto renderBand = [&](int wi) {
+    for (int tx; (tx = next.fetch_add(1)) < tilesX;) {
+      const int tx0 = tx * ts;
+      const int tw = std::min(ts, W - tx0);
+      RenderCpuTile(skins, bandTris, p, tx0, ty0, tw, th, buffers[wi], &band[(size_t)tx0 * 4], (size_t)W * 4);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int wi = 1; wi < threads; ++wi) {
+    pool.emplace_back([&, wi] {
+      for (;;) {
+        sync.arrive_and_wait();   // band set up, or done
+        if (done) return;
+        renderBand(wi);
+        sync.arrive_and_wait();   // band finished
+      }
+    });
+  }
+  auto finish = [&] {
+    done = true;
+    sync.arrive_and_wait();
+    for (std::thread& t : pool) t.join();
+  };
+
+  try {
+    for (ty0 = 0; ty0 < H; ty0 += ts) {
+      th = std::min(ts, H - ty0);
+      bandTris.clear();
+      for (const CpuTri& t : tris) {
+        if (t.maxY >= (float)ty0 && t.minY <= (float)(ty0 + th)) bandTris.push_back(t);
+      }
+      next = 0;
+      sync.arrive_and_wait();
+      renderBand(0);
+      sync.arrive_and_wait();
+      sink(ty0, th, band.data(), (size_t)W * 4);
+    }
+  } catch (...) {
+    finish();
+    throw;
+  }
+  finish();
+}
+
+void RenderOfflineCPU(const SkinInfo& skin, const BuiltMesh& mesh, const CpuRenderParams& p, const CpuRowSink& sink) {
+  const int W = p.width, H = p.height;
+  if (W <= 0 || H <= 0 || (skin.rgba.empty() && !skin.palette.bits)) return;
+
+  const XMMATRIX world = MakeWorld();
+  XMFLOAT4X4 mvp;
+  const XMMATRIX proj = p.orthoHeight > 0.0f
+    ? XMMatrixOrthographicLH(p.orthoHeight * (float)W / (float)H, p.orthoHeight, 0.1f, 500.0f)
+    : MakeProj(W, H);
+  XMStoreFloat4x4(&mvp, world * MakeView(p.cam) * proj);
+
+  std::vector<CpuTri> tris;
+  SetupCpuTriangles(mesh, mesh.indicesBase, mvp, W, H, CpuPass_Base, tris);
+  if (p.showOverlay) {
+    SetupCpuTriangles(mesh, mesh.indicesOverlay, mvp, W, H, CpuPass_Cutout, tris);
+
+    // Same back-to-front order as the GPU path
+    XMFLOAT3 eyeModel;
+    const XMFLOAT3 e = CameraEye(p.cam);
+    XMStoreFloat3(&eyeModel, XMVector3TransformCoord(XMVectorSet(e.x, e.y, e.z, 1.0f), XMMatrixInverse(nullptr, world)));
+    std::vector<XMFLOAT3> centroids;
+    std::vector<uint32_t> order, sorted;
+    ComputeFaceCentroids(mesh, mesh.indicesTranslucent, centroids);
+    SortFacesBackToFront(centroids, mesh.indicesTranslucent, eyeModel, order, sorted);
+    SetupCpuTriangles(mesh, sorted, mvp, W, H, CpuPass_Translucent, tris);
+  }
+
+  const SkinInfo* const skins[1] = { &skin };
+  RasterizeCpuTris(skins, tris, p, sink);
+}
+
+// Convenience for small outputs: collects the whole image.
+std::vector<uint8_t> RenderOfflineCPU(const SkinInfo& skin, const BuiltMesh& mesh, const CpuRenderParams& p) {
+  std::vector<uint8_t> img((size_t)std::max(0, p.width) * std::max(0, p.height) * 4);
+  RenderOfflineCPU(skin, mesh, p, [&](int y0, int rows, const uint8_t* rgba, size_t stride) {
+    memcpy(&img[(size_t)y0 * stride], rgba, stride * rows);
+  });
+  return img;
+}
+
+// ------------------------------
+// CPU crowd renderer (hierarchical-Z occlusion)
+// ------------------------------
+// Renders a CrowdInstances scene with the software rasterizer. Every player is
+// drawn at full detail using the crowd rules of RenderCrowd: base opaque, and
+// overlays either alpha-tested or, for skins with partial alpha, blended
+// without depth writes (drawn back to front here). Before any triangle setup,
+// each player that survives the frustum is tested against a coarse depth
+// pyramid built from the base boxes of the nearest players. In packed crowds
+// the cost then follows the visible rows, not the crowd size.
+static constexpr int kHiZCell = 4;   // pixels per level-0 texel side
+
+// Max-depth pyramid. A level-0 texel holds the farthest depth at which its
+// whole cell is known to be covered, or 1 if it is not covered. Each further
+// level halves the resolution and keeps the max, so any texel bounds the depth
+// of everything visible through it.
+class HiZPyramid {
+public:
+  void Reset(int width, int height) {
+    const int w0 = std::max(1, (width + kHiZCell - 1) / kHiZCell), h0 = std::max(1, (height + kHiZCell - 1) / kHiZCell);
+    levels_.resize(1);
+    sizes_.assign(1, { w0, h0 });
+    levels_[0].assign((size_t)w0 * h0, 1.0f);
+  }
+
+  // Convex polygon in pixels, counter-clockwise on screen (y down), at
+  // constant depth z. Lowers every texel whose cell lies entirely inside.
+  void FillConvex(const float* xs, const float* ys, int n, float z) {
+    if (n < 3) return;
+    const auto [w, h] = sizes_[0];
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (int i = 0; i < n; ++i) {
+      minX = std::min(minX, xs[i]); maxX = std::max(maxX, xs[i]);
+      minY = std::min(minY, ys[i]); maxY = std::max(maxY, ys[i]);
+    }
+    const int cx0 = std::max(0, (int)ceilf(minX / kHiZCell)), cx1 = std::min(w, (int)floorf(maxX / kHiZCell));
+    const int cy0 = std::max(0, (int)ceilf(minY / kHiZCell)), cy1 = std::min(h, (int)floorf(maxY / kHiZCell));
+    if (cx0 >= cx1 || cy0 >= cy1) return;
+
+    // Edge i: a*x + b*y + c >= 0 inside. Its minimum over a cell is the value
+    // at the cell center minus (|a| + |b|) * half the cell size.
+    float ea[16], eb[16], ec[16];
+    for (int i = 0; i < n; ++i) {
+      const int j = (i + 1) % n;
+      ea[i] = ys[i] - ys[j];
+      eb[i] = xs[j] - xs[i];
+      ec[i] = -(ea[i] * xs[i] + eb[i] * ys[i]) - (std::abs(ea[i]) + std::abs(eb[i])) * (0.5f * kHiZCell);
+    }
+    for (int cy = cy0; cy < cy1; ++cy) {
+      const float py = ((float)cy + 0.5f) * kHiZCell;
+      float* row = &levels_[0][(size_t)cy * w];
+      for (int cx = cx0; cx < cx1; ++cx) {
+        const float px = ((float)cx + 0.5f) * kHiZCell;
+        bool inside = true;
+        for (int i = 0; i < n && inside; ++i) inside = ea[i] * px + eb[i] * py + ec[i] >= 0.0f;
+        if (inside && z < row[cx]) row[cx] = z;
+      }
+    }
+  }
+
+  void Build() {
+    levels_.resize(1);
+    sizes_.resize(1);
+    while (sizes_.back().first > 1 || sizes_.back().second > 1) {
+      const auto [pw, ph] = sizes_.back();
+      const int w = (pw + 1) / 2, h = (ph + 1) / 2;
+      std::vector<float> next((size_t)w * h);
+      const std::vector<float>& prev = levels_.back();
+      for (int y = 0; y < h; ++y) {
+        const int y0 = 2 * y, y1 = std::min(ph - 1, 2 * y + 1);
+        for (int x = 0; x < w; ++x) {
+          const int x0 = 2 * x, x1 = std::min(pw - 1, 2 * x + 1);
+          next[(size_t)y * w + x] = std::max({ prev[(size_t)y0 * pw + x0], prev[(size_t)y0 * pw + x1],
+                                               prev[(size_t)y1 * pw + x0], prev[(size_t)y1 * pw + x1] });
+        }
+      }
+      levels_.push_back(std::move(next));
+      sizes_.push_back({ w, h });
+    }
+  }
+
+  // True if everything inside the pixel rect whose nearest depth is zMin lies
+  // behind the pyramid. Reads at most 4x4 texels.
+  bool Occluded(float x0, float y0, float x1, float y1, float zMin) const {
+    const auto [w, h] = sizes_[0];
+    int cx0 = std::clamp((int)floorf(x0 / kHiZCell), 0, w - 1), cx1 = std::clamp((int)floorf(x1 / kHiZCell), 0, w - 1);
+    int cy0 = std::clamp((int)floorf(y0 / kHiZCell), 0, h - 1), cy1 = std::clamp((int)floorf(y1 / kHiZCell), 0, h - 1);
+    size_t level = 0;
+    while (level + 1 < levels_.size() && std::max(cx1 - cx0, cy1 - cy0) > 3) {
+      cx0 >>= 1; cx1 >>= 1; cy0 >>= 1; cy1 >>= 1;
+      ++level;
+    }
+    const std::vector<float>& t = levels_[level];
+    const int lw = sizes_[level].first;
+    float farthest = 0.0f;
+    for (int y = cy0; y <= cy1; ++y) {
+      for (int x = cx0; x <= cx1; ++x) farthest = std::max(farthest, t[(size_t)y * lw + x]);
+    }
+    return zMin > farthest;
+  }
+
+private:
+  std::vector<std::vector<float>> levels_;
+  std::vector<std::pair<int, int>> sizes_;
+};
+
+// Both arm variants with every overlay part, like the GPU grid meshes.
+BuiltMesh BuildCrowdMesh(bool slim) {
+  SkinInfo ref;
+  ref.width = ref.height = 64;
+  const ModelDesc& model = PlayerModel(slim);
+  return BuildModelMesh(ref, model, std::vector<uint8_t>(model.parts.size(), 1));
+}
+
+// Projects the 8 corners of a box given as a transform of the unit cube
+// [-1, 1]^3. Returns false if any corner is not in front of the near plane.
+static bool ProjectBoxCorners(FXMMATRIX boxToClip, int W, int H, float sx[8], float sy[8], float sz[8]) {
+  for (int k = 0; k < 8; ++k) {
+    XMFLOAT4 c;
+    XMStoreFloat4(&c, XMVector4Transform(XMVectorSet(k & 1 ? 1.0f : -1.0f, k & 2 ? 1.0f : -1.0f, k & 4 ? 1.0f : -1.0f, 1.0f), boxToClip));
+    if (c.w < 1e-4f || c.z < 0.0f) return false;
+    sx[k] = (c.x / c.w * 0.5f + 0.5f) * (float)W;
+    sy[k] = (0.5f - c.y / c.w * 0.5f) * (float)H;
+    sz[k] = c.z / c.w;
+  }
+  return true;
+}
+
+// Convex hull (monotone chain) of n <= 8 points, counter-clockwise on a y-down
+// screen; returns the hull size.
+static int ConvexHull2D(const float* xs, const float* ys, int n, float* hx, float* hy) {
+  int idx[8];
+  for (int i = 0; i < n; ++i) idx[i] = i;
+  std::sort(idx, idx + n, [&](int a, int b) { return xs[a] != xs[b] ? xs[a] < xs[b] : ys[a] < ys[b]; });
+  auto cross = [&](int o, int a, int b) {
+    return (xs[a] - xs[o]) * (ys[b] - ys[o]) - (ys[a] - ys[o]) * (xs[b] - xs[o]);
+  };
+  int hull[16], k = 0;
+  for (int i = 0; i < n; ++i) {
+    while (k >= 2 && cross(hull[k - 2], hull[k - 1], idx[i]) <= 0.0f) --k;
+    hull[k++] = idx[i];
+  }
+  for (int i = n - 2, lower = k + 1; i >= 0; --i) {
+    while (k >= lower && cross(hull[k - 2], hull[k - 1], idx[i]) <= 0.0f) --k;
+    hull[k++] = idx[i];
+  }
+  for (int i = 0; i + 1 < k; ++i) { hx[i] = xs[hull[i]]; hy[i] = ys[hull[i]]; }
+  return std::max(0, k - 1);
+}
+
+void RenderCrowdCPU(const CrowdInstances& c, const std::vector<const SkinInfo*>& skins, const BuiltMesh (&meshes)[2],
+                    const CpuRenderParams& p, const CpuCrowdParams& cp, CpuCrowdStats& st, const CpuRowSink& sink) {
+  const int W = p.width, H = p.height;
+  st = CpuCrowdStats{};
+  st.instances = (uint32_t)c.Size();
+  if (W <= 0 || H <= 0 || skins.empty()) return;
+
+  const XMMATRIX view = MakeView(p.cam);
+  const XMMATRIX viewProj = view * MakeProj(W, H, kCrowdFarZ);
+  XMFLOAT4X4 vp, v;
+  XMStoreFloat4x4(&vp, viewProj);
+  XMStoreFloat4x4(&v, view);
+  static const CrowdBounds bounds = ComputeCrowdBounds(kWorldScale);
+
+  std::vector<uint32_t> visible;
+  CullCrowd(c, ExtractFrustum(vp), bounds, visible);
+  st.frustumCulled = st.instances - (uint32_t)visible.size();
+
+  // Front to back by view depth of the bounds center
+  std::vector<std::pair<float, uint32_t>> order(visible.size());
+  for (size_t i = 0; i < visible.size(); ++i) {
+    const uint32_t id = visible[i];
+    const float cy = c.y[id] + bounds.centerY;
+    order[i] = { c.x[id] * v.m[0][2] + cy * v.m[1][2] + c.z[id] * v.m[2][2] + v.m[3][2], id };
+  }
+  std::sort(order.begin(), order.end());
+
+  const XMMATRIX scale = XMMatrixScaling(kWorldScale, kWorldScale, kWorldScale);
+  auto worldOf = [&](uint32_t id) {
+    return scale * XMMatrixRotationY(c.yaw[id]) * XMMatrixTranslation(c.x[id], c.y[id], c.z[id]);
+  };
+
+  if (cp.occlusion && !order.empty()) {
+    HiZPyramid hiz;
+    hiz.Reset(W, H);
+    float sx[8], sy[8], sz[8], hx[8], hy[8];
+    const size_t occluders = std::min(order.size(), (size_t)std::max(0, cp.occluders));
+    for (size_t i = 0; i < occluders; ++i) {
+      const uint32_t id = order[i].second;
+      const XMMATRIX toClip = worldOf(id) * viewProj;
+      for (const PartDesc& part : PlayerModel(c.variant[id] == 1).parts) {
+        if (part.layer != Layer_Base) continue;   // base boxes are opaque (SanitizeMinecraftBaseAlpha)
+        const XMMATRIX box = XMMatrixScaling(0.5f * part.size.x, 0.5f * part.size.y, 0.5f * part.size.z) *
+                             XMMatrixTranslation(part.center.x, part.center.y, part.center.z) * toClip;
+        if (!ProjectBoxCorners(box, W, H, sx, sy, sz)) continue;
+        hiz.FillConvex(hx, hy, ConvexHull2D(sx, sy, 8, hx, hy), *std::max_element(sz, sz + 8));
+      }
+      ++st.occluders;
+    }
+    hiz.Build();
+
+    const XMMATRIX boundsBox = XMMatrixScaling(bounds.halfXZ, bounds.halfY, bounds.halfXZ) *
+                               XMMatrixTranslation(0.0f, bounds.centerY, 0.0f);
+    size_t kept = 0;
+    for (const auto& entry : order) {
+      const uint32_t id = entry.second;
+      const XMMATRIX box = boundsBox * XMMatrixTranslation(c.x[id], c.y[id], c.z[id]) * viewProj;
+      if (ProjectBoxCorners(box, W, H, sx, sy, sz) &&
+          hiz.Occluded(*std::min_element(sx, sx + 8), *std::min_element(sy, sy + 8),
+                       *std::max_element(sx, sx + 8), *std::max_element(sy, sy + 8), *std::min_element(sz, sz + 8))) {
+        ++st.occlusionCulled;
+        continue;
+      }
+      order[kept++] = entry;
+    }
+    order.resize(kept);
+  }
+  st.drawn = (uint32_t)order.size();
+
+  // Opaque and cutout front to back (the depth test then skips most sampling),
+  // blended overlays back to front afterwards.
+  std::vector<CpuTri> tris;
+  XMFLOAT4X4 mvp;
+  for (const auto& [depth, id] : order) {
+    const uint16_t sk = (uint16_t)std::min<size_t>(c.skin[id], skins.size() - 1);
+    const BuiltMesh& mesh = meshes[c.variant[id]];
+    XMStoreFloat4x4(&mvp, worldOf(id) * viewProj);
+    SetupCpuTriangles(mesh, mesh.indicesBase, mvp, W, H, CpuPass_Base, tris, sk);
+    if (p.showOverlay && !skins[sk]->overlayTranslucent) {
+      SetupCpuTriangles(mesh, mesh.indicesOverlay, mvp, W, H, CpuPass_Cutout, tris, sk);
+    }
+  }
+  if (p.showOverlay) {
+    std::vector<XMFLOAT3> centroids[2];
+    for (int variant = 0; variant < 2; ++variant) ComputeFaceCentroids(meshes[variant], meshes[variant].indicesOverlay, centroids[variant]);
+    std::vector<uint32_t> faceOrder, sorted;
+    const XMFLOAT3 e = CameraEye(p.cam);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      const uint32_t id = it->second;
+      const uint16_t sk = (uint16_t)std::min<size_t>(c.skin[id], skins.size() - 1);
+      if (!skins[sk]->overlayTranslucent) continue;
+      const BuiltMesh& mesh = meshes[c.variant[id]];
+      const XMMATRIX world = worldOf(id);
+      XMFLOAT3 eyeModel;
+      XMStoreFloat3(&eyeModel, XMVector3TransformCoord(XMVectorSet(e.x, e.y, e.z, 1.0f), XMMatrixInverse(nullptr, world)));
+      SortFacesBackToFront(centroids[c.variant[id]], mesh.indicesOverlay, eyeModel, faceOrder, sorted);
+      XMStoreFloat4x4(&mvp, world * viewProj);
+      SetupCpuTriangles(mesh, sorted, mvp, W, H, CpuPass_Translucent, tris, sk);
+    }
+  }
+  st.triangles = (uint32_t)tris.size();
+  RasterizeCpuTris(skins.data(), tris, p, sink);
+}
+
+// ------------------------------
+// Golden skins
+// ------------------------------
+// Every face gets its own hue and a pattern that is asymmetric in u and v, with
+// a white texel in its top-left corner, so any flipped or rotated face changes
+// the rendered image. Goes through the same load-time analysis as a file.
+SkinInfo MakeGoldenSkin(const GoldenCase& c) {
+  const uint32_t k = c.scale;
+  const bool legacy = c.kind == GoldenSkinKind::Legacy;
+  SkinInfo s;
+  s.width = 64 * k;
+  s.height = (legacy ? 32 : 64) * k;
+  s.rgba.assign((size_t)s.width * s.height * 4, 0);
+
+  const ModelDesc& model = PlayerModel(c.slim);
+  for (size_t pi = 0; pi < model.parts.size(); ++pi) {
+    const PartDesc& p = model.parts[pi];
+    if (legacy && p.v >= 32) continue;
+    const BoxUv uv = ScaleBoxUv(PartUv(p), k);
+    const UvRectPx* rects = &uv.top;
+    for (int f = 0; f < 6; ++f) {
+      const UvRectPx& r = rects[f];
+      const uint32_t seed = (uint32_t)(pi * 6 + f) * 2654435761u;
+      const uint8_t base[3] = { (uint8_t)(64 + (seed >> 8) % 160), (uint8_t)(64 + (seed >> 16) % 160), (uint8_t)(64 + (seed >> 24) % 160) };
+      for (int y = 0; y < r.h; ++y) {
+        for (int x = 0; x < r.w; ++x) {
+          uint8_t* px = &s.rgba[((size_t)(r.y + y) * s.width + (r.x + x)) * 4];
+          const int tx = x / (int)k, ty = y / (int)k;
+          const int shade = ((tx + 2 * ty) % 4) * 12;
+          for (int ch = 0; ch < 3; ++ch) px[ch] = (uint8_t)std::min(255, base[ch] + shade);
+          if (tx == 0 && ty == 0) px[0] = px[1] = px[2] = 255;
+          px[3] = 255;
+          if (p.layer == Layer_Overlay) {
+            const bool on = ((tx + ty) & 1) == 0;
+            px[3] = on ? (c.kind == GoldenSkinKind::Translucent && (tx % 3) == 0 ? 128 : 255) : 0;
+          }
+        }
+      }
+    }
+  }
+  PrepareDecodedSkin(s);
+  return s;
+}
+
+// ------------------------------
+// Render result cache
+// ------------------------------
+// Encoded renders by canonical skin, render parameters and encoding: an
+// in-memory LRU in front of a directory shared by any number of processes,
+// <dir>/<stamp>/<2 hex>/<16 hex>.png. A hit is one file read and the PNG is
+// served as stored. Entries are written to a temporary name and renamed into
+// place, so readers never see a partial file. The directory is kept under its
+// byte budget by deleting the least recently used entries; a hit touches the
+// file's write time, so the order survives restarts. The directory is only
+// scanned by writes (the first, then before evicting and after every tenth of
+// the budget written), so hits never pay for it.
+//
+// The stamp is kRenderCacheVersion plus a fingerprint of the meshes built from
+// the golden skins, so a change to mesh building invalidates old entries by
+// itself. Bump the version when the renderer or the PNG encoder output
+// changes. On open, sibling directories with another stamp are deleted, but
+// only when the name is exactly v<N>-<8 hex digits> and they hold the marker
+// file a RenderCache writes, so pointing --cache at a shared folder never
+// removes anything else.
+static constexpr uint32_t kRenderCacheVersion = 1;
+static constexpr const wchar_t* kRenderCacheMarker = L"render-cache.stamp";
+
+static bool IsRenderCacheStampDir(const std::filesystem::path& dir) {
+  const std::wstring name = dir.filename().wstring();
+  const size_t dash = name.find(L'-');
+  if (name.size() < 2 || name[0] != L'v' || dash == std::wstring::npos || dash < 2 || name.size() - dash - 1 != 8) return false;
+  for (size_t i = 1; i < dash; ++i) {
+    if (!iswdigit(name[i])) return false;
+  }
+  for (size_t i = dash + 1; i < name.size(); ++i) {
+    if (!iswxdigit(name[i])) return false;
+  }
+  std::error_code ec;
+  return std::filesystem::is_regular_file(dir / kRenderCacheMarker, ec);
+}
+
+static std::string RenderCacheStamp() {
+  uint32_t crc = 0;
+  for (const GoldenCase& c : kGoldenCases) {
+    if (c.scale != 1) continue; // HD meshes differ only in UV scale; keeps opening cheap
+    const SkinInfo skin = MakeGoldenSkin(c);
+    for (bool slim : { false, true }) {
+      const BuiltMesh m = BuildPlayerMesh(skin, slim);
+      crc = Crc32(reinterpret_cast<const uint8_t*>(m.vertices.data()), m.vertices.size() * sizeof(Vertex), crc);
+      for (const std::vector<uint32_t>* idx : { &m.indicesBase, &m.indicesOverlay, &m.indicesTranslucent })
+        crc = Crc32(reinterpret_cast<const uint8_t*>(idx->data()), idx->size() * sizeof(uint32_t), crc);
+    }
+  }
+  char stamp[32];
+  snprintf(stamp, sizeof(stamp), "v%u-%08x", kRenderCacheVersion, crc);
+  return stamp;
+}
+
+// Everything that changes the encoded file (tile size and threads do not);
+// `content` identifies the skin.
+static uint64_t RenderCacheKeyOf(uint64_t content, bool slim, const CpuRenderParams& p, const PngEncodeOptions& png) {
+  auto bits = [](float f) { return (uint64_t)std::bit_cast<uint32_t>(f); };
+  const uint64_t words[] = {
+    content,
+    bits(p.cam.yaw) << 32 | bits(p.cam.pitch),
+    bits(p.cam.dist) << 32 | bits(p.cam.target.x),
+    bits(p.cam.target.y) << 32 | bits(p.cam.target.z),
+    (uint64_t)p.width << 32 | (uint32_t)p.height,
+    (uint64_t)p.samplesPerAxis << 32 | (uint64_t)slim << 2 | (uint64_t)p.showOverlay << 1 | (uint64_t)p.pointFilter,
+    bits(p.background[0]) << 32 | bits(p.background[1]),
+    bits(p.background[2]) << 32 | bits(p.background[3]),
+    bits(p.orthoHeight),
+    1 + ((uint64_t)png.level << 1 | (uint64_t)png.palette),  // 0 was WIC's encoder
+  };
+  return HashLayerIds(words, std::size(words));
+}
+
+uint64_t RenderCacheKey(const SkinInfo& skin, bool slim, const CpuRenderParams& p, const PngEncodeOptions& png) {
+  return RenderCacheKeyOf(CanonicalSkinHash(skin, slim, !p.pointFilter), slim, p, png);
+}
+
+uint64_t RenderCacheFileKey(const uint8_t* data, size_t size, bool slim, const CpuRenderParams& p, const PngEncodeOptions& png) {
+  const uint64_t words[] = { (uint64_t)Crc32(data, size) << 32 | Adler32(data, size), size, 0x46494C45 }; // "FILE"
+  return RenderCacheKeyOf(HashLayerIds(words, std::size(words)), slim, p, png);
+}
+
+RenderCache::RenderCache(const std::filesystem::path& root, uint64_t diskBudget, size_t memoryBudget)
+    : dir_(root / RenderCacheStamp()), diskBudget_(diskBudget), memoryBudget_(memoryBudget),
+      tmpTag_(std::random_device{}()) {
+  std::filesystem::create_directories(dir_);
+  std::error_code ec;
+  if (!std::filesystem::exists(dir_ / kRenderCacheMarker, ec)) {
+    const std::string stamp = dir_.filename().string();
+    WriteFileBytes(dir_ / kRenderCacheMarker, std::vector<uint8_t>(stamp.begin(), stamp.end()));
+  }
+  for (const auto& e : std::filesystem::directory_iterator(root)) {
+    if (e.is_directory() && e.path() != dir_ && IsRenderCacheStampDir(e.path())) std::filesystem::remove_all(e.path(), ec);
+  }
+}
+
+RenderCache::File RenderCache::Get(uint64_t key) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = memory_.find(key);
+    if (it != memory_.end()) {
+      it->second.lastUse = ++clock_;
+      ++stats_.memoryHits;
+      return it->second.file;
+    }
+  }
+  const std::filesystem::path path = EntryPath(key);
+  auto bytes = std::make_shared<std::vector<uint8_t>>();
+  if (!ReadFileBytes(path, *bytes) || bytes->empty()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.misses;
+    return nullptr;
+  }
+  std::error_code ec;
+  std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+  File file = std::move(bytes);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.diskHits;
+  TrackDisk(key, file->size());
+  Remember(key, file);
+  return file;
+}
+
+void RenderCache::Put(uint64_t key, File file) {
+  const bool stored = Store(key, false, *file);
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.writes += stored;
+  Remember(key, std::move(file));
+}
+
+bool RenderCache::GetAlias(uint64_t fileKey, uint64_t& key) {
+  const std::filesystem::path path = EntryPath(fileKey, true);
+  std::vector<uint8_t> bytes;
+  if (!ReadFileBytes(path, bytes) || bytes.size() != 8) return false;
+  key = ReadLe64(bytes.data());
+  std::error_code ec;
+  std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.aliasHits;
+  TrackDisk(fileKey, bytes.size(), true);
+  return true;
+}
+
+void RenderCache::PutAlias(uint64_t fileKey, uint64_t key) {
+  std::vector<uint8_t> bytes(8);
+  for (int b = 0; b < 8; ++b) bytes[b] = (uint8_t)(key >> (8 * b));
+  Store(fileKey, true, bytes);
+}
+
+bool RenderCache::Store(uint64_t key, bool alias, const std::vector<uint8_t>& bytes) {
+  std::call_once(scanned_, [this] { ScanDisk(); });
+  const std::filesystem::path path = EntryPath(key, alias);
+  std::filesystem::path tmp = path;
+  tmp += L"." + std::to_wstring(tmpTag_) + L"-" + std::to_wstring(++tmpSeq_) + L".tmp";
+  std::error_code ec;
+  bool stored = false;
+  try {
+    std::filesystem::create_directories(path.parent_path());
+    WriteFileBytes(tmp, bytes);
+    std::filesystem::rename(tmp, path, ec);   // replaces an older copy atomically
+    stored = !ec;
+  } catch (const std::exception&) {
+  }
+  if (!stored) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  bool over = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TrackDisk(key, bytes.size(), alias);
+    // Other processes' writes show up only when measured, so measure again
+    // after every tenth of the budget written here as well
+    writtenSinceMeasure_ += bytes.size();
+    over = diskBytes_ > diskBudget_ || writtenSinceMeasure_ > diskBudget_ / 10;
+  }
+  if (over) EvictDisk();
+  return true;
+}
+
+RenderCache::Stats RenderCache::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats s = stats_;
+  s.diskBytes = diskBytes_;
+  s.memoryBytes = memoryBytes_;
+  return s;
+}
+
+std::filesystem::path RenderCache::EntryPath(uint64_t key, bool alias) const {
+  wchar_t shard[4], name[32];
+  swprintf(shard, std::size(shard), L"%02x", (unsigned)(key >> 56));
+  swprintf(name, std::size(name), alias ? L"%016llx.alias" : L"%016llx.png", (unsigned long long)key);
+  return dir_ / shard / name;
+}
+
+std::unordered_map<uint64_t, RenderCache::DiskEntry> RenderCache::MeasureDisk() {
+  std::unordered_map<uint64_t, DiskEntry> found;
+  std::error_code ec;
+  const auto now = std::filesystem::file_time_type::clock::now();
+  for (const auto& e : std::filesystem::recursive_directory_iterator(dir_, ec)) {
+    if (!e.is_regular_file() || e.path().filename() == kRenderCacheMarker) continue;
+    uint64_t key = 0;
+    bool alias = false;
+    if (!ParseEntryName(e.path(), key, alias)) {
+      // Temporary file of a writer that did not finish
+      const auto written = e.last_write_time(ec);
+      if (!ec && now - written > std::chrono::hours(1)) std::filesystem::remove(e.path(), ec);
+      continue;
+    }
+    const uint64_t bytes = e.file_size(ec);
+    const auto written = e.last_write_time(ec);
+    if (ec) continue;                  // evicted meanwhile
+    found[key] = DiskEntry{ bytes, written.time_since_epoch().count(), alias };
+  }
+  return found;
+}
+
+void RenderCache::ScanDisk() {
+  const std::unordered_map<uint64_t, DiskEntry> found = MeasureDisk();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& [key, d] : found) {
+    if (disk_.emplace(key, d).second) diskBytes_ += d.bytes;
+  }
+}
+
+bool RenderCache::ParseEntryName(const std::filesystem::path& path, uint64_t& key, bool& alias) {
+  const std::wstring stem = path.stem().wstring();
+  alias = path.extension() == L".alias";
+  if ((!alias && path.extension() != L".png") || stem.size() != 16) return false;
+  wchar_t* end = nullptr;
+  key = wcstoull(stem.c_str(), &end, 16);
+  return end == stem.c_str() + 16;
+}
+
+void RenderCache::TrackDisk(uint64_t key, uint64_t bytes, bool alias) {
+  DiskEntry& d = disk_[key];
+  diskBytes_ = diskBytes_ - d.bytes + bytes;
+  d.bytes = bytes;
+  d.alias = alias;
+  d.lastUse = std::filesystem::file_time_type::clock::now().time_since_epoch().count();
+}
+
+void RenderCache::EvictDisk() {
+  std::unordered_map<uint64_t, DiskEntry> found = MeasureDisk();
+  std::vector<std::pair<uint64_t, bool>> victims;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    disk_ = std::move(found);
+    writtenSinceMeasure_ = 0;
+    diskBytes_ = 0;
+    for (const auto& [key, d] : disk_) diskBytes_ += d.bytes;
+    victims = CollectDiskVictims();
+  }
+  for (const auto& [key, alias] : victims) {
+    std::error_code ec;
+    const bool removed = std::filesystem::remove(EntryPath(key, alias), ec);
+    if (ec) continue;                  // still on disk (in use elsewhere); keeps its bytes
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.evicted += removed;         // false: another process got there first
+    auto it = disk_.find(key);
+    if (it == disk_.end()) continue;
+    diskBytes_ -= it->second.bytes;
+    disk_.erase(it);
+  }
+}
+
+std::vector<std::pair<uint64_t, bool>> RenderCache::CollectDiskVictims() const {
+  std::vector<std::pair<uint64_t, bool>> victims;
+  if (diskBytes_ <= diskBudget_) return victims;
+  std::vector<std::pair<int64_t, uint64_t>> order;
+  order.reserve(disk_.size());
+  for (const auto& [key, d] : disk_) order.emplace_back(d.lastUse, key);
+  std::sort(order.begin(), order.end());
+  uint64_t bytes = diskBytes_;
+  for (const auto& [lastUse, key] : order) {
+    if (bytes <= diskBudget_ / 10 * 9) break;
+    const DiskEntry& d = disk_.at(key);
+    bytes -= d.bytes;
+    victims.emplace_back(key, d.alias);
+  }
+  return victims;
+}
+
+void RenderCache::Remember(uint64_t key, File file) {
+  if (file->size() > memoryBudget_) return;
+  MemoryEntry& e = memory_[key];
+  if (e.file) memoryBytes_ -= e.file->size();
+  memoryBytes_ += file->size();
+  e.file = std::move(file);
+  e.lastUse = ++clock_;
+  while (memoryBytes_ > memoryBudget_) {
+    auto lru = std::min_element(memory_.begin(), memory_.end(),
+                                [](const auto& a, const auto& b) { return a.second.lastUse < b.second.lastUse; });
+    memoryBytes_ -= lru->second.file->size();
+    memory_.erase(lru);
+  }
+}
@@ -0,0 +1,893 @@
+// ==============================
+// File: src/skin_core.h
+// ==============================
+// Everything that works without a window or a GPU: skin decode and analysis,
+// the player model and its meshes, archives and ingest, PNG, the CPU renderer
+// and the render cache. The viewer and the console tool both build on it.
+#pragma once
+
+#include "DirectXMath.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace DirectX;
+
+struct ImpostorAtlas;     // viewer-side GPU resources, see main.cpp
+struct SkinGpuTexture;
+class ExportWriter;
+
+// ------------------------------
+// Small helpers
+// ------------------------------
+std::string NarrowFromWide(std::wstring_view w);
+std::wstring WideFromUtf8(std::string_view s);
+void WriteFileBytes(const std::filesystem::path& path, const std::vector<uint8_t>& data);
+
+// Whole file in one read; false when it cannot be opened or read.
+bool ReadFileBytes(const std::filesystem::path& path, std::vector<uint8_t>& out);
+
+inline float Clamp(float v, float lo, float hi) { return std::max(lo, std::min(hi, v)); }
+
+// ------------------------------
+// Skin + model
+// ------------------------------
+// Indexed pixels (see PalettizeSkin); bits == 0 means the skin is plain RGBA.
+struct SkinPalette {
+  uint8_t bits = 0;              // 0, 4 (two texels per byte, low nibble first) or 8
+  std::vector<uint32_t> colors;  // RGBA8 as stored in memory, <= 256 entries
+  std::vector<uint8_t> indices;
+};
+
+// Alpha-weighted colour histogram per model region (ComputeColorHistogram).
+enum HistRegion : uint8_t {
+  HistRegion_Head, HistRegion_Hat, HistRegion_Torso, HistRegion_Jacket, HistRegion_Limbs, HistRegion_LimbOverlay,
+  HistRegion_Count
+};
+
+static constexpr int kHistBins = 16;
+
+struct ColorHistogram {
+  uint8_t bins[HistRegion_Count][kHistBins]{};
+};
+
+struct SkinInfo {
+  std::wstring path;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t scale = 1;   // 1 for 64x*, 2 for 128x128, etc.
+  bool legacy64x32 = false;
+  bool hasAlpha = true;
+  uint64_t phash = 0;   // perceptual hash over mapped texels (ComputeSkinPHash)
+  uint64_t canonHash = 0; // CanonicalSkinHash: equal for skins every player render shows alike
+  ColorHistogram colorHist; // per-region colours for ColorHistIndex
+  bool overlayTranslucent = false; // some texel alpha is neither 0 nor 255
+  std::shared_ptr<struct ImpostorAtlas> impostor; // crowd LOD2, baked in the background
+
+  std::vector<uint8_t> rgba; // width * height * 4 (RGBA); empty while palettized
+  SkinPalette palette;
+  std::shared_ptr<SkinGpuTexture> gpu; // viewer only: texture + SRV, kept for painting
+};
+
+struct UvRectPx {
+  int x = 0, y = 0, w = 0, h = 0; // pixel-space
+};
+
+struct BoxUv {
+  UvRectPx top, bottom, right, front, left, back;
+};
+
+// Geometric faces of a box, in emission order.
+enum BoxFace : uint8_t { Face_Top, Face_Bottom, Face_Front, Face_Back, Face_PosX, Face_NegX, Face_Count };
+
+enum FaceFlags : uint8_t {
+  FaceFlipU = 1 << 0,
+  FaceFlipV = 1 << 1,
+};
+
+enum PartLayer : uint8_t { Layer_Base, Layer_Overlay };
+
+struct PartDesc {
+  std::string name;
+  XMFLOAT3 center{};          // model units (1 = one 64px-reference texel)
+  XMFLOAT3 size{};            // before inflate; also the box-UV dimensions
+  float inflate = 0.0f;       // grows every face outward by this amount
+  int u = 0, v = 0;           // box-UV origin in reference texels
+  bool swapSides = false;     // +X samples uv.left, -X samples uv.right
+  uint8_t faceFlags[Face_Count]{};
+  PartLayer layer = Layer_Base;
+  bool skipIfTransparent = false; // omit the box when all its texels are alpha 0
+};
+
+struct ModelDesc {
+  std::string name;
+  uint32_t texW = 64;         // reference texture size the UV origins refer to
+  uint32_t texH = 64;
+  std::vector<PartDesc> parts;
+};
+
+struct Vertex {
+  XMFLOAT3 pos;
+  XMFLOAT3 nrm;
+  XMFLOAT2 uv;
+  float shade = 1.0f;   // baked face shading * ambient occlusion (BakedShade)
+};
+
+struct BuiltMesh {
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indicesBase;
+  std::vector<uint32_t> indicesOverlay;      // binary alpha (0/255): alpha-tested, no blending
+  std::vector<uint32_t> indicesTranslucent;  // faces with partial alpha: blended, sorted per frame
+};
+
+// Box corners are numbered by bits: x (1 = +X), y (2 = +Y), z (4 = +Z).
+static constexpr uint8_t kFaceCorners[Face_Count][4] = {
+  {2, 3, 7, 6}, // top    (+Y)
+  {4, 5, 1, 0}, // bottom (-Y)
+  {6, 7, 5, 4}, // front  (+Z)
+  {3, 2, 0, 1}, // back   (-Z)
+  {7, 3, 1, 5}, // +X
+  {2, 6, 4, 0}, // -X
+};
+
+static constexpr float kFaceNormals[Face_Count][3] = {
+  {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {1, 0, 0}, {-1, 0, 0},
+};
+
+// Which BoxUv rect (top, bottom, right, front, left, back) a face samples, by swapSides.
+static constexpr uint8_t kFaceRect[2][Face_Count] = {
+  {0, 1, 3, 5, 2, 4},
+  {0, 1, 3, 5, 4, 2},
+};
+
+// UV corner order (0..3 = TL, TR, BR, BL of the rect) for each FaceFlags value.
+static constexpr uint8_t kUvCornerPerm[4][4] = {
+  {0, 1, 2, 3}, // none
+  {1, 0, 3, 2}, // flipU
+  {3, 2, 1, 0}, // flipV
+  {2, 3, 0, 1}, // flipU | flipV (180°)
+};
+
+bool HasPartialAlpha(const SkinInfo& s);
+BoxUv ScaleBoxUv(const BoxUv& b, uint32_t scale);
+BoxUv PartUv(const PartDesc& p);
+const ModelDesc& PlayerModel(bool slimArms);
+float BakedShade(const ModelDesc* model, const PartDesc& self, const XMFLOAT3& pos, int face);
+void EmitPart(std::vector<Vertex>& v, std::vector<uint32_t>* const dst[Face_Count],
+              const PartDesc& p, const BoxUv& uv, uint32_t texW, uint32_t texH, const ModelDesc* aoModel);
+uint32_t ModelTexScale(const SkinInfo& skin, const ModelDesc& model);
+void ComputePartPresence(const SkinInfo& skin, const ModelDesc& model, std::vector<uint8_t>& present);
+std::vector<uint8_t> ComputePartPresence(const SkinInfo& skin, const ModelDesc& model);
+void BuildModelMeshInto(const SkinInfo& skin, const ModelDesc& model, const std::vector<uint8_t>& present, BuiltMesh& m);
+BuiltMesh BuildModelMesh(const SkinInfo& skin, const ModelDesc& model, const std::vector<uint8_t>& present);
+BuiltMesh BuildModelMesh(const SkinInfo& skin, const ModelDesc& model);
+
+// Element counts of the viewer's dynamic mesh buffers: vertices, base +
+// overlay indices, translucent indices. The D3D side is in main.cpp.
+struct MeshBufferSizes {
+  uint32_t vertices = 0, indices = 0, translucentIndices = 0;
+};
+
+MeshBufferSizes MeshBufferNeeds(const BuiltMesh& m);
+// `model` with every part present; reserved up front so rebuilds never grow.
+MeshBufferSizes MeshBufferReserve(const ModelDesc& model);
+// Grows `capacity` (at least doubling) when the buffer does not exist yet or
+// `needed` does not fit; returns whether the buffer has to be created again.
+bool GrowMeshBufferCapacity(uint32_t& capacity, uint32_t needed, bool exists);
+
+void ComputeFaceCentroids(const BuiltMesh& m, const std::vector<uint32_t>& idx, std::vector<XMFLOAT3>& out);
+void SortFacesBackToFront(const std::vector<XMFLOAT3>& centroids, const std::vector<uint32_t>& faceIdx,
+                          const XMFLOAT3& eye, std::vector<uint32_t>& order, std::vector<uint32_t>& out);
+BuiltMesh BuildPlayerMesh(const SkinInfo& skin, bool slimArms);
+BuiltMesh BuildLod1Mesh(const SkinInfo& skin, const ModelDesc& model);
+
+// Bedrock geometry JSON (format 1.8 to 1.12) as a ModelDesc.
+ModelDesc ParseBedrockGeometry(std::string_view text);
+ModelDesc LoadBedrockGeometry(const std::filesystem::path& path);
+
+// ------------------------------
+// Skin hashes
+// ------------------------------
+void SanitizeMinecraftBaseAlpha(SkinInfo& s, const UvRectPx& clip);
+void SanitizeMinecraftBaseAlpha(SkinInfo& s);
+uint64_t CanonicalSkinHash(const SkinInfo& s, bool slim = false, bool bilinear = true);
+uint64_t ComputeSkinPHash(const SkinInfo& s);
+
+inline int HammingDistance(uint64_t a, uint64_t b) { return std::popcount(a ^ b); }
+
+// Multi-index hashing: the 64-bit hash is split into 4 disjoint 16-bit chunks,
+// each with its own bucket table. Two hashes within distance k agree to within
+// k/4 bits on at least one chunk, so a query only probes chunk values within
+// that radius and verifies the candidates with popcount.
+class PHashIndex {
+public:
+  static constexpr int kChunks = 4;
+  static constexpr int kChunkBits = 16;
+
+  PHashIndex() : tables_(kChunks, std::vector<std::vector<uint32_t>>(1u << kChunkBits)) {}
+
+  uint32_t Insert(uint64_t h);
+
+  size_t Size() const { return hashes_.size(); }
+  uint64_t HashOf(uint32_t id) const { return hashes_[id]; }
+
+  // Ids of all entries with HammingDistance(h, entry) <= k, ascending.
+  std::vector<uint32_t> Query(uint64_t h, int k) const;
+
+  // On-disk form: magic, version, count, raw hashes. Buckets are rebuilt on load.
+  void Save(const std::filesystem::path& path) const;
+
+  static PHashIndex Load(const std::filesystem::path& path);
+
+private:
+  static constexpr uint32_t kMagic = 0x48504B53; // "SKPH"
+  static constexpr uint32_t kVersion = 1;
+
+  static uint32_t Chunk(uint64_t h, int c) { return (uint32_t)(h >> (c * kChunkBits)) & ((1u << kChunkBits) - 1); }
+
+  // Visits every 16-bit value within Hamming radius r of q (r <= 3 in practice).
+  template <class Fn>
+  static void ForEachWithinRadius(uint32_t q, int r, Fn&& fn, int firstBit = 0);
+
+  std::vector<uint64_t> hashes_;
+  std::vector<std::vector<std::vector<uint32_t>>> tables_;
+};
+
+// ------------------------------
+// Colour histograms
+// ------------------------------
+// Per region of the player (head, hat, torso, jacket, limbs, limb overlays), a
+// 16-bin colour histogram: four grey levels and twelve 30-degree hue sectors
+// for saturated colours. Counts are alpha-weighted and scaled so a region
+// fully covered by one colour reads 255; an empty hat reads all zeros. The
+// whole descriptor is 96 bytes and compared with L1 distance.
+static constexpr const char* kHistBinNames[kHistBins] = {
+  "black", "darkgray", "lightgray", "white", "red", "orange", "yellow", "lime",
+  "green", "mint", "cyan", "azure", "blue", "violet", "magenta", "pink",
+};
+
+static constexpr const char* kHistRegionNames[HistRegion_Count] = {
+  "head", "hat", "torso", "jacket", "limbs", "sleeves",
+};
+
+// Target histogram plus a weight per region (0: region ignored).
+struct HistQuery {
+  ColorHistogram target;
+  uint32_t weight[HistRegion_Count]{};
+};
+
+struct HistMatch {
+  uint32_t id;
+  uint32_t distance;
+};
+
+// Descriptors are bucketed by the dominant colour of head, torso and limbs
+// (plus whether a hat is present), which needs no training, so inserts stay
+// O(1) at any size. Each bucket keeps its descriptors contiguously and the
+// per-bin min/max over them. A query ranks buckets by HistBoxDistance and
+// scans them in that order until the bound exceeds the k-th best distance,
+// which makes Nearest exact; maxBuckets trades exactness for a fixed cost.
+class ColorHistIndex {
+public:
+  static constexpr size_t kDescBytes = sizeof(ColorHistogram);
+  static constexpr size_t kBuckets = kHistBins * kHistBins * kHistBins * 2;
+
+  ColorHistIndex() : buckets_(kBuckets) {}
+
+  uint32_t Insert(const ColorHistogram& h);
+
+  size_t Size() const { return count_; }
+
+  // k nearest by weighted L1, closest first. maxBuckets == 0: exact.
+  std::vector<HistMatch> Nearest(const HistQuery& q, size_t k, size_t maxBuckets = 0) const;
+
+  // Every entry within `radius` (inclusive), closest first. Always exact.
+  std::vector<HistMatch> Within(const HistQuery& q, uint32_t radius) const;
+
+  // On-disk form: magic, version, count, descriptors by id. Buckets are rebuilt on load.
+  void Save(const std::filesystem::path& path) const;
+
+  static ColorHistIndex Load(const std::filesystem::path& path);
+
+private:
+  static constexpr uint32_t kMagic = 0x49484B53; // "SKHI"
+  static constexpr uint32_t kVersion = 1;
+
+  struct Bucket {
+    uint8_t lo[kDescBytes]{};
+    uint8_t hi[kDescBytes]{};
+    std::vector<uint32_t> ids;
+    std::vector<uint8_t> desc;
+  };
+
+  static size_t BucketOf(const ColorHistogram& h);
+
+  // Non-empty buckets by ascending lower bound.
+  std::vector<std::pair<uint32_t, uint32_t>> RankBuckets(const HistQuery& q) const;
+
+  std::vector<Bucket> buckets_;
+  size_t count_ = 0;
+};
+
+// ------------------------------
+// Compositing + palettes
+// ------------------------------
+// Character-creator skins are stacks of partial layers (body, face, outfit
+// pieces, accessories), each a full-size RGBA8 image that is mostly transparent.
+// Layers are kept premultiplied so "over" is one multiply-add per channel; the
+// stack is converted back to straight alpha and the base regions are then
+// forced opaque exactly as for a loaded skin, while overlay regions keep the
+// blended alpha.
+//
+// Work is tracked on an 8x8 grid of tiles (8x8 reference texels each), one bit
+// per tile: a layer only touches the tiles its visible texels fall in, and a
+// composite that differs from a cached one in a single layer only redoes the
+// tiles the old and the new layer cover.
+static constexpr uint32_t kCompositeTiles = 8;                       // per axis
+
+static constexpr uint32_t kCompositeTileRef = 64 / kCompositeTiles;  // reference texels per tile side
+
+// Composites are CPU-only SkinInfos (no texture); callers that display one
+// create or update its texture themselves. Not thread-safe.
+class SkinCompositor {
+public:
+  struct Stats {
+    uint64_t hits = 0;        // served from the cache as is
+    uint64_t partial = 0;     // derived from a cached stack differing in one layer
+    uint64_t full = 0;        // composited from scratch
+    uint64_t tiles = 0;       // tiles composited in total
+  };
+
+  explicit SkinCompositor(uint32_t scale = 1, size_t capacity = 256);
+
+  uint32_t Size() const { return size_; }
+  const Stats& GetStats() const { return stats_; }
+
+  // Adds or replaces layer `id` from straight RGBA8 (Size() x Size()). Cached
+  // composites that use it are patched over the tiles it covered before and
+  // covers now, so editing a layer costs the same as swapping one.
+  void SetLayer(uint64_t id, const uint8_t* rgba);
+
+  void RemoveLayer(uint64_t id);
+
+  // Stack of layer ids, bottom first. Throws on unknown ids. The reference is
+  // valid until the next call that changes the compositor.
+  const SkinInfo& Composite(const uint64_t* ids, size_t count);
+
+  const SkinInfo& Composite(const std::vector<uint64_t>& ids) { return Composite(ids.data(), ids.size()); }
+
+private:
+  struct Layer {
+    std::vector<uint8_t> premul;
+    uint64_t tiles = 0;
+  };
+  struct Entry {
+    uint64_t key = 0;
+    uint64_t lastUse = 0;
+    std::vector<uint64_t> ids;
+    std::vector<uint8_t> premul;   // the stack before un-premultiplying and sanitizing
+    SkinInfo skin;
+  };
+
+  static bool SameIds(const Entry& e, const uint64_t* ids, size_t count);
+
+  void ResolveLayers(const uint64_t* ids, size_t count);
+
+  // A hash collision reuses the colliding entry; otherwise a free slot or the
+  // least recently used one that is not `keep`.
+  Entry& AcquireSlot(Entry* collided, const Entry* keep, uint64_t key);
+
+  // Drops e's index entry unless the key has since moved to another slot.
+  void Unindex(const Entry& e);
+
+  // Rebuilds the given tiles of e from scratch_ (the resolved e.ids), then
+  // refreshes the straight-alpha skin and its load-time analysis.
+  void Recomposite(Entry& e, uint64_t tiles);
+
+  uint32_t scale_;
+  uint32_t size_;
+  size_t capacity_;
+  uint64_t clock_ = 0;
+  std::unordered_map<uint64_t, Layer> layers_;
+  std::vector<Entry> entries_;                     // never reallocates (reserved to capacity_)
+  std::unordered_map<uint64_t, size_t> index_;     // HashLayerIds -> entries_ slot
+  std::vector<const Layer*> scratch_;              // resolved ids of the stack being composited
+  Stats stats_;
+};
+
+size_t SkinPixelBytes(const SkinInfo& s);
+bool PalettizeSkin(SkinInfo& s);
+void UnpalettizeSkin(SkinInfo& s);
+const std::vector<uint8_t>& SkinRgba(const SkinInfo& s, std::vector<uint8_t>& scratch);
+
+// ------------------------------
+// Decode + ingest
+// ------------------------------
+bool IsSkinSize(uint32_t w, uint32_t h);
+void PrepareDecodedSkin(SkinInfo& out);
+
+// PNG header probe: the signature, IHDR and the chunk list up to the first
+// IDAT, without inflating anything, so triage can drop non-skins before a decode.
+struct PngProbe {
+  const char* error = nullptr;  // nullptr: well-formed PNG header
+  uint32_t width = 0, height = 0;
+  uint8_t bitDepth = 0, colorType = 0;
+  bool interlaced = false;
+  bool hasPalette = false;      // PLTE before the first IDAT
+  bool hasTrns = false;         // tRNS before the first IDAT
+  bool chunksKnown = false;     // the first IDAT was within the probed bytes, so the flags above are final
+  uint32_t scale = 1;           // as PrepareDecodedSkin derives them
+  bool legacy64x32 = false;
+  bool skinSized = false;       // IsSkinSize(width, height)
+};
+
+// One file as stored in its source; data is still compressed for method 8.
+struct SkinSourceEntry {
+  std::wstring name;      // file path, or "<archive>/<path inside the archive>"
+  uint16_t method = 0;    // 0 stored, 8 deflate
+  uint64_t size = 0;      // uncompressed
+  uint32_t crc = 0;
+  bool checkCrc = false;  // zip entries carry one
+  std::vector<uint8_t> data;
+  std::string error;      // set instead of data when the entry is over the size limit
+};
+
+// Largest PNG ReadSkinSource reads, stored or declared uncompressed; skins are
+// far smaller, and a bigger entry is a broken or hostile archive.
+inline constexpr uint64_t kMaxSkinEntryBytes = 32ull << 20;
+
+using SkinSourceEmit = std::function<bool(SkinSourceEntry&&)>; // false: stop reading
+
+struct IngestedSkin {
+  std::wstring name;
+  SkinInfo skin;          // valid when error is empty
+  std::string error;
+};
+
+struct IngestOptions {
+  unsigned threads = 0;                 // workers; 0: hardware concurrency
+  size_t maxInFlightBytes = 64u << 20;  // read, decoded or waiting for delivery; the next skin to deliver may exceed it
+  size_t maxInFlightEntries = 256;
+  uint64_t maxEntryBytes = kMaxSkinEntryBytes;  // capped at maxInFlightBytes
+  bool skinSizesOnly = true;            // reject PNGs whose IHDR is not a skin size, before decoding
+};
+
+// Return false to stop early.
+using IngestSink = std::function<bool(IngestedSkin&&)>;
+
+uint32_t Crc32(const uint8_t* p, size_t n, uint32_t crc = 0);
+PngProbe ProbePng(const uint8_t* data, size_t size);
+void ProbePngFiles(const std::vector<std::filesystem::path>& paths, std::vector<PngProbe>& out, unsigned threads = 0);
+std::wstring LowerExtension(const std::filesystem::path& p);
+bool IsPngName(std::string_view name);
+bool IsSkinArchive(const std::filesystem::path& p);
+bool ReadSkinSource(const std::filesystem::path& path, const SkinSourceEmit& emit,
+                    uint64_t maxEntryBytes = kMaxSkinEntryBytes);
+std::vector<uint8_t> ExtractSkinSourceEntry(SkinSourceEntry& e);
+void IngestSkins(const std::filesystem::path& source, const IngestSink& sink, const IngestOptions& opt = {});
+
+// Any PNG as tightly packed RGBA8; throws std::runtime_error on bad or oversized files.
+std::vector<uint8_t> DecodePngRgba(const uint8_t* data, size_t size, uint32_t& w, uint32_t& h);
+std::vector<uint8_t> DecodePngRgba(const std::filesystem::path& path, uint32_t& w, uint32_t& h);
+
+// Decode + PrepareDecodedSkin, no GPU. From memory, `name` becomes SkinInfo::path.
+SkinInfo DecodeSkinPng(const std::wstring& name, const uint8_t* data, size_t size);
+SkinInfo DecodeSkinPng(const std::filesystem::path& path);
+
+// ------------------------------
+// PNG encoder + mesh export
+// ------------------------------
+uint32_t Adler32(const uint8_t* p, size_t n, uint32_t adler = 1);
+
+// Renders are mostly flat background and flat-shaded pixel-art colours, and a
+// general-purpose zlib spends most of its time searching for matches. Instead,
+// PngEncoder picks a row filter from a cheap estimate, finds matches through a
+// small hash table (a single probe at the fastest level), and writes indexed
+// colour when the image has at most 256 colours. The filtered rows are cut
+// into chunks that are deflated independently on worker threads. Each chunk
+// still matches against the 32 KB before it and ends byte-aligned, so the
+// chunks concatenate into one zlib stream, as pigz does.
+enum PngLevel : uint8_t { PngLevel_Fastest, PngLevel_Fast, PngLevel_Small };
+
+struct PngEncodeOptions {
+  PngLevel level = PngLevel_Fast;
+  bool palette = true;              // indexed colour when the image has <= 256 colours
+  unsigned threads = 0;             // chunks deflated at once; 0: hardware concurrency
+  size_t chunkBytes = 256u << 10;   // filtered bytes per chunk, in whole rows; at least 64 KB, as each
+                                    // chunk first hashes the 32 KB before it
+};
+
+// Encodes tightly packed RGBA8 images. Buffers, including one DeflateEncoder
+// per thread, are kept between calls; a warm single-chunk encode does not allocate.
+class PngEncoder {
+public:
+  PngEncoder();
+  ~PngEncoder();
+
+  // Replaces `out` with the PNG file.
+  void Encode(const uint8_t* rgba, uint32_t w, uint32_t h, const PngEncodeOptions& opt, std::vector<uint8_t>& out);
+
+  // Whether the last Encode wrote indexed colour, and its bits per pixel.
+  bool Indexed() const { return indexed_; }
+  int BitDepth() const { return indexed_ ? depth_ : 32; }
+
+private:
+  struct Chunk {
+    uint32_t y0 = 0, y1 = 0;
+    uint32_t adler = 1;
+    std::vector<uint8_t> idat;           // the whole PNG chunk: length, type, data, CRC
+  };
+
+  struct Worker;                        // a DeflateEncoder and row scratch per thread
+  struct Pool;                          // threads for ForChunks, kept between Encode calls
+
+  static void WriteChunk(const char* type, const uint8_t* data, size_t n, std::vector<uint8_t>& out);
+
+  // Runs fn over every chunk on `threads` threads, the caller's included. The
+  // other threads are started on first use and park until the next call.
+  template <typename Fn>
+  void ForChunks(unsigned threads, const Fn& fn);
+
+  // Indexed rows are packed and left unfiltered, as the PNG spec recommends.
+  // An RGBA row that repeats the one above is Up (all zeros). Otherwise the
+  // fastest level takes Sub and the others the lowest FilterCost of Sub and
+  // Up, plus Paeth at PngLevel_Small (it pays off on antialiased edges).
+  void FilterRow(uint32_t y, Worker& wk);
+
+  const uint8_t* rgba_ = nullptr;
+  uint32_t w_ = 0;
+  PngLevel level_ = PngLevel_Fast;
+  bool indexed_ = false;
+  int depth_ = 8;
+  size_t trns_ = 0, rowBytes_ = 0;
+  std::vector<uint32_t> colors_;
+  std::vector<uint8_t> index_;
+  uint8_t remap_[256]{};
+  uint32_t sorted_[256]{};
+  std::vector<uint8_t> filtered_;
+  std::vector<Chunk> chunks_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::unique_ptr<Pool> pool_;
+};
+
+void WritePngRgba(const std::filesystem::path& path, const std::vector<uint8_t>& rgba, int w, int h);
+
+// Writes a BuiltMesh exactly as built, with the same face flips and UVs, plus
+// the skin texture. Model space is right-handed with the player facing +Z, as
+// glTF expects. EmitPart winds triangles clockwise seen from outside because
+// the viewer draws through a left-handed view, so each exported triangle has
+// two corners swapped. MeshExporter keeps its output buffers between exports,
+// so a warm batch export does not allocate.
+struct MeshExportOptions {
+  float scale = 1.0f / 16.0f;   // metres per model unit (16 texels to a block)
+  bool partNodes = false;       // glTF: a node per part, overlays under their base part; OBJ: an object per part
+  bool pointFilter = true;      // glTF sampler
+};
+
+class MeshExporter {
+public:
+  // .glb with the texture embedded. `present` is the part mask the mesh was built with.
+  const std::vector<uint8_t>& Glb(const SkinInfo& skin, const ModelDesc& model, const std::vector<uint8_t>& present,
+                                  const BuiltMesh& mesh, const MeshExportOptions& opt);
+
+  // OBJ text and its MTL; both materials refer to `textureName`, see Png.
+  const std::vector<uint8_t>& Obj(const ModelDesc& model, const std::vector<uint8_t>& present, const BuiltMesh& mesh,
+                                  const MeshExportOptions& opt, std::string_view mtlName, std::string_view textureName);
+
+  const std::vector<uint8_t>& Mtl() const { return mtl_; }
+
+  // The texture the mesh samples (legacy skins already normalized), as PNG.
+  const std::vector<uint8_t>& Png(const SkinInfo& skin);
+
+private:
+  // Vertex range and per-list index ranges (base, overlay, translucent) of
+  // the whole mesh or of one part.
+  struct ExportSegment {
+    uint32_t part = 0;
+    int parent = -1;                   // segment of the base part an overlay is posed with
+    uint32_t v0 = 0, v1 = 0;
+    uint32_t i0[3]{}, i1[3]{};
+  };
+
+  // BuildModelMeshInto emits the present parts in order, 24 vertices each,
+  // and appends each part's faces to the index lists in the same order.
+  void Segment(const ModelDesc& model, const std::vector<uint8_t>& present, const BuiltMesh& m, bool perPart);
+
+  static XMFLOAT3 Pivot(const ModelDesc& model, const ExportSegment& g, const MeshExportOptions& opt);
+
+  void Children(ExportWriter& w, int parent) const;
+
+  std::vector<ExportSegment> segs_;
+  std::vector<uint8_t> out_, mtl_, png_, rgba_;
+  PngEncoder pngEncoder_;
+};
+
+// ------------------------------
+// Camera + grid
+// ------------------------------
+struct Camera {
+  float yaw = 0.9f;
+  float pitch = 0.35f;
+  float dist = 70.0f;
+  XMFLOAT3 target{0, 16, 0};
+};
+
+static constexpr float kWorldScale = 0.9f;
+
+struct GridLayout {
+  int cols = 1, rows = 1;
+  int cellW = 0, cellH = 0;
+  int gap = 0;
+  int contentH = 0;          // total height; > area height means the grid scrolls
+};
+
+struct CellRect {
+  int x = 0, y = 0, w = 0, h = 0;
+};
+
+XMFLOAT3 CameraEye(const Camera& c);
+XMMATRIX MakeView(const Camera& c);
+XMMATRIX MakeProj(int fbW, int fbH, float farZ = 500.0f);
+XMMATRIX MakeWorld();
+GridLayout ComputeGridLayout(int count, int areaW, int areaH, int minCell, int gap);
+CellRect GridCellRect(const GridLayout& g, int index, int scrollY);
+// Largest useful scrollY: the last row ends at the bottom of the area.
+int GridMaxScroll(const GridLayout& g, int areaH);
+void VisibleGridCells(const GridLayout& g, int count, int scrollY, int areaW, int areaH, std::vector<int>& out);
+
+// ------------------------------
+// Crowd
+// ------------------------------
+// Instances are stored as parallel arrays so the cull loop reads only the
+// position columns, four instances per SSE iteration.
+struct CrowdInstances {
+  std::vector<float> x, y, z;        // feet position, world units
+  std::vector<float> yaw;            // radians
+  std::vector<uint16_t> skin;        // index into the caller's skin table
+  std::vector<uint8_t> variant;      // 0 classic, 1 slim
+
+  size_t Size() const { return x.size(); }
+
+  void Clear() {
+    x.clear(); y.clear(); z.clear(); yaw.clear(); skin.clear(); variant.clear();
+  }
+
+  void Add(float px, float py, float pz, float ryaw, uint16_t skinIndex, uint8_t slim) {
+    x.push_back(px); y.push_back(py); z.push_back(pz);
+    yaw.push_back(ryaw); skin.push_back(skinIndex); variant.push_back(slim);
+  }
+};
+
+// Yaw-independent box around a player: a cylinder around the Y axis that holds
+// every part (overlay inflate included) of both variants, boxed.
+struct CrowdBounds {
+  float centerY = 0.0f;    // above the feet
+  float halfXZ = 0.0f;
+  float halfY = 0.0f;
+};
+
+// Normalized planes (inside: dot(n, p) + w >= 0) of a row-vector view*proj
+// matrix with D3D depth range [0, w].
+struct Frustum {
+  XMFLOAT4 planes[6];
+};
+
+// Distance LOD by projected player height. LOD0: full mesh with overlays.
+// LOD1: merged base boxes (BuildLod1Mesh). LOD2: impostor quad, drawn in one
+// batch per skin, so far players cost the same however many boxes they have.
+enum CrowdLod : uint8_t { CrowdLod_Full, CrowdLod_Merged, CrowdLod_Impostor, CrowdLod_Count };
+
+static constexpr float kCrowdLod1Px = 96.0f;   // below this height on screen: LOD1
+
+static constexpr float kCrowdLod2Px = 32.0f;   // below this: LOD2 (if the impostor is baked)
+
+// Per skin table entry
+enum : uint8_t { CrowdSkin_Blended = 1, CrowdSkin_Impostor = 2 };
+
+struct CrowdStats {
+  uint32_t instances = 0;
+  uint32_t culled = 0;
+  uint32_t drawn = 0;
+  uint32_t drawnLod[CrowdLod_Count]{};
+  uint32_t drawCalls = 0;
+  uint32_t stateChanges = 0;   // texture, mesh variant/LOD and blend binds
+};
+
+static constexpr float kCrowdSpacing = 24.0f;
+
+static constexpr float kCrowdMaxDist = 2000.0f;
+
+static constexpr float kCrowdFarZ = 5000.0f;
+
+struct CrowdScratch {
+  std::vector<uint32_t> visible;
+  std::vector<uint32_t> keys, tmpKeys, tmpIdx;
+};
+
+void PopulateCrowd(CrowdInstances& c, size_t count, size_t skinCount, float spacing, uint32_t seed);
+CrowdBounds ComputeCrowdBounds(float worldScale);
+CrowdStats PrepareCrowdFrame(const CrowdInstances& c, FXMMATRIX view, CXMMATRIX proj, int fbH,
+                             const CrowdBounds& b, const std::vector<uint8_t>& skinFlags,
+                             bool overlayPass, CrowdScratch& s);
+
+// ------------------------------
+// CPU renderer
+// ------------------------------
+// Follows the same rules as Render(): base opaque, binary-alpha overlay faces
+// alpha-tested at 0.5 with depth writes, translucent faces blended back to
+// front without depth writes. The image is produced in square screen tiles;
+// each tile owns its sample buffers and is resolved before the next, so peak
+// memory depends on the tile size and thread count, not on the output size.
+// Every sample is computed from the same inputs no matter which thread or
+// tile handles it, so the output is identical for any thread count.
+struct CpuRenderParams {
+  Camera cam;
+  int width = 1280;
+  int height = 720;
+  int samplesPerAxis = 1;      // supersampling: n*n ordered-grid samples per pixel
+  int tileSize = 64;           // pixels
+  int threads = 0;             // 0 = hardware concurrency
+  bool showOverlay = true;
+  bool pointFilter = true;
+  float background[4]{ 0.08f, 0.08f, 0.10f, 1.0f };
+  float orthoHeight = 0.0f;    // > 0: orthographic, world units across the image height
+};
+
+// Receives finished rows top to bottom, one tile row (band) at a time.
+using CpuRowSink = std::function<void(int y0, int rows, const uint8_t* rgba, size_t stride)>;
+
+struct CpuCrowdParams {
+  bool occlusion = true;
+  int occluders = 64;        // nearest visible players whose base boxes fill the pyramid
+};
+
+struct CpuCrowdStats {
+  uint32_t instances = 0;
+  uint32_t frustumCulled = 0;
+  uint32_t occlusionCulled = 0;
+  uint32_t drawn = 0;
+  uint32_t occluders = 0;
+  uint32_t triangles = 0;
+};
+
+void RenderOfflineCPU(const SkinInfo& skin, const BuiltMesh& mesh, const CpuRenderParams& p, const CpuRowSink& sink);
+std::vector<uint8_t> RenderOfflineCPU(const SkinInfo& skin, const BuiltMesh& mesh, const CpuRenderParams& p);
+BuiltMesh BuildCrowdMesh(bool slim);
+void RenderCrowdCPU(const CrowdInstances& c, const std::vector<const SkinInfo*>& skins, const BuiltMesh (&meshes)[2],
+                    const CpuRenderParams& p, const CpuCrowdParams& cp, CpuCrowdStats& st, const CpuRowSink& sink);
+
+// ------------------------------
+// Golden skins
+// ------------------------------
+// A built-in corpus for the golden-image tests and the benchmarks: every
+// layout (classic, slim, legacy, translucent overlay, HD) with per-case budgets.
+enum class GoldenSkinKind { Modern, Legacy, Translucent };
+
+struct GoldenCase {
+  const char* name;
+  GoldenSkinKind kind;
+  uint32_t scale;
+  bool slim;
+  double meshBudgetMs;       // BuildPlayerMesh, best of several runs
+  double renderBudgetMs;     // slowest view
+  uint64_t meshAllocBudget;  // heap allocations in one BuildPlayerMesh
+};
+
+inline constexpr GoldenCase kGoldenCases[] = {
+  { "classic",      GoldenSkinKind::Modern,      1,  false, 1.0, 50.0, 24 },
+  { "slim",         GoldenSkinKind::Modern,      1,  true,  1.0, 50.0, 24 },
+  { "legacy",       GoldenSkinKind::Legacy,      1,  false, 1.0, 50.0, 24 },
+  { "translucent",  GoldenSkinKind::Translucent, 1,  false, 1.0, 50.0, 24 },
+  { "hd128",        GoldenSkinKind::Modern,      2,  false, 1.0, 50.0, 24 },
+  { "hd256",        GoldenSkinKind::Modern,      4,  false, 1.0, 50.0, 24 },
+  { "hd512_slim",   GoldenSkinKind::Modern,      8,  true,  1.0, 50.0, 24 },
+  { "hd1024",       GoldenSkinKind::Modern,     16,  false, 1.0, 50.0, 24 },
+};
+
+// Every face gets its own hue and an asymmetric pattern (see skin_core.cpp).
+SkinInfo MakeGoldenSkin(const GoldenCase& c);
+
+// ------------------------------
+// Render cache
+// ------------------------------
+uint64_t RenderCacheKey(const SkinInfo& skin, bool slim, const CpuRenderParams& p, const PngEncodeOptions& png);
+// The same parameters with the exact bytes of a skin file instead of its
+// canonical pixels: the name of a RenderCache alias, see PutAlias.
+uint64_t RenderCacheFileKey(const uint8_t* data, size_t size, bool slim, const CpuRenderParams& p, const PngEncodeOptions& png);
+
+// Thread-safe; file I/O happens outside the lock.
+class RenderCache {
+public:
+  using File = std::shared_ptr<const std::vector<uint8_t>>;
+
+  struct Stats {
+    uint64_t memoryHits = 0, diskHits = 0, misses = 0;
+    uint64_t aliasHits = 0;
+    uint64_t writes = 0, evicted = 0;     // disk entries
+    uint64_t diskBytes = 0;
+    size_t memoryBytes = 0;
+  };
+
+  RenderCache(const std::filesystem::path& root, uint64_t diskBudget, size_t memoryBudget);
+
+  RenderCache(const RenderCache&) = delete;
+  RenderCache& operator=(const RenderCache&) = delete;
+
+  // nullptr on a miss. Entries written by other processes are found too.
+  File Get(uint64_t key);
+
+  // A failed write only loses the entry; the caller has its file either way.
+  void Put(uint64_t key, File file);
+
+  // Aliases map a RenderCacheFileKey to the key its render is stored under,
+  // so a repeat of the same file finds its render without being decoded.
+  // They share the directory, budget and eviction with the renders; an alias
+  // can outlive its render, in which case Get misses.
+  bool GetAlias(uint64_t fileKey, uint64_t& key);
+  void PutAlias(uint64_t fileKey, uint64_t key);
+
+  Stats GetStats();
+
+private:
+  struct DiskEntry {
+    uint64_t bytes = 0;
+    int64_t lastUse = 0;       // file_time_type ticks
+    bool alias = false;        // <key>.alias rather than <key>.png
+  };
+  struct MemoryEntry {
+    File file;
+    uint64_t lastUse = 0;
+  };
+
+  std::filesystem::path EntryPath(uint64_t key, bool alias = false) const;
+
+  // Writes through a temporary file, then tracks the entry and evicts if needed.
+  bool Store(uint64_t key, bool alias, const std::vector<uint8_t>& bytes);
+
+  // Entries on disk now, by key; also removes abandoned temporary files.
+  std::unordered_map<uint64_t, DiskEntry> MeasureDisk();
+
+  // Entries already tracked by Get or Put keep their newer state.
+  void ScanDisk();
+
+  static bool ParseEntryName(const std::filesystem::path& path, uint64_t& key, bool& alias);
+
+  void TrackDisk(uint64_t key, uint64_t bytes, bool alias = false);
+
+  // Measures the directory again (other processes write and evict too), then
+  // deletes the least recently used entries down to 90% of the budget, so
+  // that eviction does not run on every write once the directory is full.
+  void EvictDisk();
+
+  // Keys of the least recently used entries that bring the ledger to 90% of
+  // the budget; the ledger itself changes only as files are removed.
+  std::vector<std::pair<uint64_t, bool>> CollectDiskVictims() const;
+
+  void Remember(uint64_t key, File file);
+
+  std::filesystem::path dir_;
+  uint64_t diskBudget_;
+  size_t memoryBudget_;
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, DiskEntry> disk_;
+  uint64_t diskBytes_ = 0;
+  uint64_t writtenSinceMeasure_ = 0;
+  std::unordered_map<uint64_t, MemoryEntry> memory_;
+  size_t memoryBytes_ = 0;
+  uint64_t clock_ = 0;
+  uint32_t tmpTag_;                    // per instance, so processes sharing the directory never collide
+  std::atomic<uint64_t> tmpSeq_{ 0 };
+  std::once_flag scanned_;
+  Stats stats_;
+};
@@ -0,0 +1,607 @@
+// ==============================
+// File: tests/skin_tests.cpp
+// ==============================
+// MinecraftSkinViewerTests [test ...] [--golden-dir DIR] [--out DIR] [--update] [--budget-scale X]
+// Runs the named tests, or all of them, against the portable core; no window
+// or device. Each test prints PASS or FAIL with its problems, and the exit
+// code is 1 if any test fails. ctest runs every test on its own (see
+// CMakeLists.txt).
+#include "skin_core.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <random>
+#include <stdexcept>
+
+// ------------------------------
+// Allocation counter
+// ------------------------------
+// Counts heap allocations of the whole test program; read around the code
+// under test only. Every replaced new has its matching deletes replaced too.
+static std::atomic<uint64_t> g_allocCount{ 0 };
+
+static void* CountedAlloc(size_t n) {
+  g_allocCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+static void CountedFree(void* p) noexcept { free(p); }
+
+void* operator new(size_t n) { return CountedAlloc(n); }
+void* operator new[](size_t n) { return CountedAlloc(n); }
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+
+static uint64_t AllocCount() { return g_allocCount.load(std::memory_order_relaxed); }
+
+// ------------------------------
+// Test harness
+// ------------------------------
+struct TestOptions {
+  std::filesystem::path goldenDir = "golden";
+  std::filesystem::path outDir = ".";        // reports, .actual.png and .diff.png
+  bool update = false;                       // rewrite the golden images
+  double budgetScale = 1.0;                  // time budgets, for slow or instrumented builds
+};
+
+// A test adds one line per problem; an exception fails it too.
+using TestProblems = std::vector<std::string>;
+using TestFn = void (*)(const TestOptions& opt, TestProblems& problems);
+
+#define EXPECT(cond, what)                                          \
+  do {                                                              \
+    if (!(cond)) problems.push_back(std::string(what) + " (" #cond ")"); \
+  } while (0)
+
+// ------------------------------
+// Golden images
+// ------------------------------
+// Renders the golden corpus (kGoldenCases) on the CPU from fixed camera
+// angles and compares the results with <golden-dir>/<case>_<view>.png.
+// Failures write .actual.png and .diff.png to --out. Each case also has a
+// time budget (scaled by --budget-scale) and an allocation budget for
+// BuildPlayerMesh. --update rewrites the goldens instead of comparing.
+struct GoldenView { const char* name; float yaw, pitch; };
+
+// yaw 0 looks at the model's front (+Z)
+static const GoldenView kGoldenViews[] = {
+  { "front",  0.0f,           0.0f  },
+  { "back",   XM_PI,          0.0f  },
+  { "side",   XM_PI * 0.5f,   0.0f  },
+  { "above",  0.9f,           0.9f  },
+  { "below", -2.3f,          -0.8f  },
+};
+
+static constexpr int kGoldenSize = 256;
+static constexpr float kGoldenCamDist = 45.0f;          // model fills most of the frame
+static constexpr int kGoldenMeshRuns = 5;
+static constexpr int kGoldenPixelTolerance = 12;        // see GoldenPixelDelta
+static constexpr double kGoldenMaxDifferingFraction = 0.001;
+
+// Luma weighted twice as much as chroma; alpha counts fully.
+static int GoldenPixelDelta(const uint8_t* a, const uint8_t* b) {
+  auto luma = [](const uint8_t* p) { return (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8; };
+  const int ya = luma(a), yb = luma(b);
+  const int dY = std::abs(ya - yb);
+  const int dCb = std::abs((a[2] - ya) - (b[2] - yb));
+  const int dCr = std::abs((a[0] - ya) - (b[0] - yb));
+  return 2 * dY + (dCb + dCr) / 2 + std::abs(a[3] - b[3]);
+}
+
+static void TestGolden(const TestOptions& opt, TestProblems& problems) {
+  using Clock = std::chrono::steady_clock;
+  auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+  if (opt.update) std::filesystem::create_directories(opt.goldenDir);
+  PngEncodeOptions png;
+  png.level = PngLevel_Small;
+
+  for (const GoldenCase& c : kGoldenCases) {
+    const SkinInfo skin = MakeGoldenSkin(c);
+    const std::string name = c.name;
+
+    BuiltMesh mesh;
+    double meshMs = 1e30;
+    uint64_t meshAllocs = 0;
+    for (int run = 0; run < kGoldenMeshRuns; ++run) {
+      const uint64_t a0 = AllocCount();
+      const Clock::time_point t0 = Clock::now();
+      mesh = BuildPlayerMesh(skin, c.slim);
+      meshMs = std::min(meshMs, ms(Clock::now() - t0));
+      meshAllocs = AllocCount() - a0;
+    }
+
+    const size_t before = problems.size();
+    if (meshMs > c.meshBudgetMs * opt.budgetScale)
+      problems.push_back(name + ": mesh " + std::to_string(meshMs) + " ms > budget " + std::to_string(c.meshBudgetMs * opt.budgetScale) + " ms");
+    if (meshAllocs > c.meshAllocBudget)
+      problems.push_back(name + ": mesh " + std::to_string(meshAllocs) + " allocations > budget " + std::to_string(c.meshAllocBudget));
+
+    double renderMs = 0.0;
+    for (const GoldenView& v : kGoldenViews) {
+      CpuRenderParams p;
+      p.width = p.height = kGoldenSize;
+      p.samplesPerAxis = 2;
+      p.cam.yaw = v.yaw;
+      p.cam.pitch = v.pitch;
+      p.cam.dist = kGoldenCamDist;
+
+      const Clock::time_point t0 = Clock::now();
+      const std::vector<uint8_t> img = RenderOfflineCPU(skin, mesh, p);
+      renderMs = std::max(renderMs, ms(Clock::now() - t0));
+
+      const std::string stem = name + "_" + v.name;
+      const std::filesystem::path goldenPath = opt.goldenDir / (stem + ".png");
+      if (opt.update) {
+        std::vector<uint8_t> file;
+        PngEncoder().Encode(img.data(), (uint32_t)p.width, (uint32_t)p.height, png, file);
+        WriteFileBytes(goldenPath, file);
+        continue;
+      }
+      if (!std::filesystem::exists(goldenPath)) {
+        problems.push_back(stem + ": missing golden " + goldenPath.string() + " (run with --update)");
+        continue;
+      }
+
+      uint32_t gw = 0, gh = 0;
+      const std::vector<uint8_t> golden = DecodePngRgba(goldenPath, gw, gh);
+      if ((int)gw != p.width || (int)gh != p.height) {
+        problems.push_back(stem + ": golden is " + std::to_string(gw) + "x" + std::to_string(gh));
+        continue;
+      }
+
+      const size_t pixels = (size_t)p.width * p.height;
+      std::vector<uint8_t> diff(pixels * 4);
+      size_t differing = 0;
+      int worst = 0;
+      for (size_t px = 0; px < pixels; ++px) {
+        const int d = GoldenPixelDelta(&img[px * 4], &golden[px * 4]);
+        worst = std::max(worst, d);
+        uint8_t* o = &diff[px * 4];
+        if (d > kGoldenPixelTolerance) {
+          ++differing;
+          o[0] = 255; o[1] = 0; o[2] = 0;
+        } else {
+          const uint8_t* g = &golden[px * 4];
+          o[0] = o[1] = o[2] = (uint8_t)(((77 * g[0] + 150 * g[1] + 29 * g[2]) >> 8) / 3);
+        }
+        o[3] = 255;
+      }
+      if ((double)differing > kGoldenMaxDifferingFraction * (double)pixels) {
+        problems.push_back(stem + ": " + std::to_string(differing) + " pixels differ (max delta " + std::to_string(worst) + ")");
+        WritePngRgba(opt.outDir / (stem + ".actual.png"), img, p.width, p.height);
+        WritePngRgba(opt.outDir / (stem + ".diff.png"), diff, p.width, p.height);
+      }
+    }
+    if (renderMs > c.renderBudgetMs * opt.budgetScale)
+      problems.push_back(name + ": render " + std::to_string(renderMs) + " ms > budget " + std::to_string(c.renderBudgetMs * opt.budgetScale) + " ms");
+
+    printf("  %s %-12s mesh %.3f ms / %llu allocs, render %.1f ms\n",
+           problems.size() == before ? "ok  " : "FAIL", c.name, meshMs, (unsigned long long)meshAllocs, renderMs);
+  }
+  if (opt.update) printf("  goldens written to %s\n", opt.goldenDir.string().c_str());
+}
+
+// ------------------------------
+// Warm mesh rebuilds
+// ------------------------------
+// The viewer's rebuild path (arm toggle / skin swap) reuses App::meshArena
+// and App::partPresent, and its dynamic buffers are reserved for the classic
+// model with every part present (ReserveMeshBuffers). Mirrors that path for
+// each golden skin: once warm it must not touch the heap, and no mesh buffer
+// may need to be created again (GrowMeshBufferCapacity).
+static void TestMeshRebuild(const TestOptions&, TestProblems& problems) {
+  MeshBufferSizes capacity;
+  std::vector<uint32_t> translucentIdx;
+  std::vector<XMFLOAT3> translucentCentroids;
+  auto ensure = [&](const MeshBufferSizes& n, bool exists) {
+    int created = 0;
+    created += GrowMeshBufferCapacity(capacity.vertices, n.vertices, exists);
+    created += GrowMeshBufferCapacity(capacity.indices, n.indices, exists);
+    created += GrowMeshBufferCapacity(capacity.translucentIndices, n.translucentIndices, exists);
+    return created;
+  };
+  ensure(MeshBufferReserve(PlayerModel(false)), false);
+  translucentIdx.reserve(capacity.translucentIndices);
+  translucentCentroids.reserve(capacity.translucentIndices / 6);
+
+  for (const GoldenCase& c : kGoldenCases) {
+    const SkinInfo skin = MakeGoldenSkin(c);
+    BuiltMesh arena;
+    std::vector<uint8_t> present;
+    for (bool slim : { false, true }) {
+      ComputePartPresence(skin, PlayerModel(slim), present);
+      BuildModelMeshInto(skin, PlayerModel(slim), present, arena);
+    }
+
+    int created = 0;
+    const uint64_t a0 = AllocCount();
+    for (bool slim : { !c.slim, c.slim }) {
+      ComputePartPresence(skin, PlayerModel(slim), present);
+      BuildModelMeshInto(skin, PlayerModel(slim), present, arena);
+      created += ensure(MeshBufferNeeds(arena), true);
+      translucentIdx = arena.indicesTranslucent;      // UploadMesh keeps these for the per-frame sort
+      ComputeFaceCentroids(arena, translucentIdx, translucentCentroids);
+    }
+    const uint64_t allocs = AllocCount() - a0;
+
+    const std::string name = c.name;
+    EXPECT(allocs == 0, name + ": warm rebuild made " + std::to_string(allocs) + " allocations");
+    EXPECT(created == 0, name + ": warm rebuild created " + std::to_string(created) + " buffers");
+  }
+}
+
+// ------------------------------
+// Grid layout
+// ------------------------------
+// ComputeGridLayout, GridCellRect, GridMaxScroll and VisibleGridCells on
+// areas that fit, that scroll, and that are degenerate.
+static void TestGridLayout(const TestOptions&, TestProblems& problems) {
+  const GridLayout one = ComputeGridLayout(1, 800, 600, 96, 4);
+  EXPECT(one.cols == 1 && one.rows == 1 && one.cellW == 792 && one.cellH == 592, "one skin fills the area");
+  const GridLayout four = ComputeGridLayout(4, 600, 600, 96, 4);
+  EXPECT(four.cols == 2 && four.rows == 2, "four skins in a square area are 2x2");
+  const GridLayout none = ComputeGridLayout(0, 800, 600, 96, 4);
+  EXPECT(GridMaxScroll(none, 600) == 0, "an empty grid does not scroll");
+
+  std::vector<int> visible;
+  VisibleGridCells(none, 0, 0, 800, 600, visible);
+  EXPECT(visible.empty(), "an empty grid has no visible cells");
+
+  struct Area { int count, w, h; };
+  for (const Area& ar : { Area{ 7, 1280, 720 }, Area{ 64, 1280, 720 }, Area{ 1000, 1280, 720 }, Area{ 500, 300, 200 }, Area{ 3, 90, 90 } }) {
+    const std::string tag = std::to_string(ar.count) + " in " + std::to_string(ar.w) + "x" + std::to_string(ar.h);
+    const GridLayout g = ComputeGridLayout(ar.count, ar.w, ar.h, 96, 4);
+    EXPECT(g.cols * g.rows >= ar.count && (g.rows - 1) * g.cols < ar.count, tag + ": rows follow from the count");
+    EXPECT(g.contentH == g.rows * g.cellH + (g.rows + 1) * g.gap, tag + ": content height covers every row");
+
+    const int maxScroll = GridMaxScroll(g, ar.h);
+    EXPECT(maxScroll == std::max(0, g.contentH - ar.h), tag + ": scroll range");
+    EXPECT((maxScroll > 0) == (std::min(g.cellW, g.cellH) <= 96 && g.contentH > ar.h), tag + ": scrolls only below the minimum cell");
+    const CellRect last = GridCellRect(g, ar.count - 1, maxScroll);
+    EXPECT(last.y + last.h <= ar.h, tag + ": the last row is reachable");
+    if (maxScroll > 0) EXPECT(last.y + last.h + g.gap == ar.h, tag + ": no scrolling past the last row");
+
+    for (int i = 0; i + 1 < ar.count; ++i) {
+      const CellRect a = GridCellRect(g, i, 0), b = GridCellRect(g, i + 1, 0);
+      const bool apart = a.x + a.w <= b.x || b.x + b.w <= a.x || a.y + a.h <= b.y || b.y + b.h <= a.y;
+      if (!apart) { problems.push_back(tag + ": cells " + std::to_string(i) + " and " + std::to_string(i + 1) + " overlap"); break; }
+    }
+
+    for (int scroll : { 0, 1, g.cellH / 2, g.cellH + g.gap, maxScroll / 2, maxScroll }) {
+      std::vector<int> expected;
+      for (int i = 0; i < ar.count; ++i) {
+        const CellRect r = GridCellRect(g, i, scroll);
+        if (r.x < ar.w && r.y < ar.h && r.x + r.w > 0 && r.y + r.h > 0) expected.push_back(i);
+      }
+      VisibleGridCells(g, ar.count, scroll, ar.w, ar.h, visible);
+      EXPECT(visible == expected, tag + ": visible cells at scroll " + std::to_string(scroll));
+    }
+  }
+}
+
+// ------------------------------
+// Perceptual hash index
+// ------------------------------
+// PHashIndex::Query against a linear scan, the Save/Load round trip, and Load
+// rejecting files whose count does not match their size.
+static void TestPHashIndex(const TestOptions& opt, TestProblems& problems) {
+  std::mt19937_64 rng(27);
+  PHashIndex index;
+  std::vector<uint64_t> hashes;
+  for (int n = 0; n < 4000; ++n) {
+    // Clusters of near copies, as re-uploads and recolours of one skin make
+    uint64_t h = n % 8 && !hashes.empty() ? hashes[rng() % hashes.size()] : rng();
+    for (int flips = (int)(rng() % 6); flips > 0; --flips) h ^= 1ull << (rng() % 64);
+    hashes.push_back(h);
+    index.Insert(h);
+  }
+  for (int q = 0; q < 200; ++q) {
+    const uint64_t h = hashes[rng() % hashes.size()] ^ (1ull << (rng() % 64));
+    for (int k : { 0, 3, 8, 12 }) {
+      std::vector<uint32_t> expected;
+      for (uint32_t id = 0; id < (uint32_t)hashes.size(); ++id) {
+        if (HammingDistance(h, hashes[id]) <= k) expected.push_back(id);
+      }
+      if (index.Query(h, k) != expected) {
+        problems.push_back("query " + std::to_string(q) + " at k=" + std::to_string(k) + " differs from a linear scan");
+        break;
+      }
+    }
+  }
+
+  const std::filesystem::path path = opt.outDir / "phash_test.bin";
+  index.Save(path);
+  const PHashIndex loaded = PHashIndex::Load(path);
+  bool same = loaded.Size() == hashes.size();
+  for (uint32_t id = 0; same && id < (uint32_t)hashes.size(); ++id) same = loaded.HashOf(id) == hashes[id];
+  EXPECT(same, "Save/Load round trip");
+
+  std::vector<uint8_t> file;
+  ReadFileBytes(path, file);
+  auto rejects = [&](const std::vector<uint8_t>& bytes) {
+    WriteFileBytes(path, bytes);
+    try {
+      PHashIndex::Load(path);
+    } catch (const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  EXPECT(rejects(std::vector<uint8_t>(file.begin(), file.end() - 8)), "Load rejects a truncated file");
+  EXPECT(rejects([&] { auto f = file; f.push_back(0); return f; }()), "Load rejects trailing bytes");
+  EXPECT(rejects([&] { auto f = file; const uint64_t n = 1ull << 60; memcpy(&f[8], &n, 8); return f; }()),
+         "Load rejects a huge count before allocating");
+  std::filesystem::remove(path);
+
+  // A few edited texels keep a skin within the CLI's default radius.
+  SkinInfo skin = MakeGoldenSkin(kGoldenCases[0]);
+  const uint64_t before = ComputeSkinPHash(skin);
+  for (uint32_t x = 8; x < 12; ++x) skin.rgba[((size_t)10 * skin.width + x) * 4] ^= 0x40;
+  EXPECT(HammingDistance(before, ComputeSkinPHash(skin)) <= 8, "small edits stay near");
+}
+
+// ------------------------------
+// Bedrock geometry
+// ------------------------------
+// The vanilla 64x64 player geometry must load as the built-in model: same
+// boxes, UV origins, layers and face fix-ups. A north-facing (-Z) feature
+// must end up in front (+Z), and deeply nested JSON must fail cleanly.
+static const char kBedrockHumanoid[] = R"({
+  "format_version": "1.12.0",
+  "minecraft:geometry": [ {
+    "description": { "identifier": "geometry.humanoid.custom", "texture_width": 64, "texture_height": 64 },
+    "bones": [
+      { "name": "body",        "pivot": [0, 24, 0], "cubes": [ { "origin": [-4, 12, -2],   "size": [8, 12, 4],  "uv": [16, 16] } ] },
+      { "name": "jacket",      "parent": "body", "cubes": [ { "origin": [-4, 12, -2], "size": [8, 12, 4], "uv": [16, 32], "inflate": 0.25 } ] },
+      { "name": "head",        "pivot": [0, 24, 0], "cubes": [ { "origin": [-4, 24, -4],   "size": [8, 8, 8],   "uv": [0, 0] } ] },
+      { "name": "hat",         "cubes": [ { "origin": [-4, 24, -4], "size": [8, 8, 8], "uv": [32, 0], "inflate": 0.25 } ] },
+      { "name": "rightArm",    "cubes": [ { "origin": [-8, 12, -2],   "size": [4, 12, 4],  "uv": [40, 16] } ] },
+      { "name": "rightSleeve", "cubes": [ { "origin": [-8, 12, -2],   "size": [4, 12, 4],  "uv": [40, 32], "inflate": 0.25 } ] },
+      { "name": "leftArm",     "cubes": [ { "origin": [4, 12, -2],    "size": [4, 12, 4],  "uv": [32, 48] } ] },
+      { "name": "leftSleeve",  "cubes": [ { "origin": [4, 12, -2],    "size": [4, 12, 4],  "uv": [48, 48], "inflate": 0.25 } ] },
+      { "name": "rightLeg",    "cubes": [ { "origin": [-4, 0, -2],    "size": [4, 12, 4],  "uv": [0, 16] } ] },
+      { "name": "rightPants",  "cubes": [ { "origin": [-4, 0, -2],    "size": [4, 12, 4],  "uv": [0, 32], "inflate": 0.25 } ] },
+      { "name": "leftLeg",     "cubes": [ { "origin": [0, 0, -2],     "size": [4, 12, 4],  "uv": [16, 48] } ] },
+      { "name": "leftPants",   "cubes": [ { "origin": [0, 0, -2],     "size": [4, 12, 4],  "uv": [0, 48], "inflate": 0.25 } ] }
+    ]
+  } ]
+})";
+
+static void TestBedrockGeometry(const TestOptions&, TestProblems& problems) {
+  const ModelDesc parsed = ParseBedrockGeometry(kBedrockHumanoid);
+  const ModelDesc& builtIn = PlayerModel(false);
+  EXPECT(parsed.parts.size() == builtIn.parts.size(), "humanoid part count");
+  for (const PartDesc& b : builtIn.parts) {
+    const auto it = std::find_if(parsed.parts.begin(), parsed.parts.end(), [&](const PartDesc& p) { return p.name == b.name; });
+    if (it == parsed.parts.end()) {
+      problems.push_back(b.name + ": missing");
+      continue;
+    }
+    const PartDesc& p = *it;
+    EXPECT(p.center.x == b.center.x && p.center.y == b.center.y && p.center.z == b.center.z, b.name + ": center");
+    EXPECT(p.size.x == b.size.x && p.size.y == b.size.y && p.size.z == b.size.z, b.name + ": size");
+    EXPECT(p.u == b.u && p.v == b.v && p.layer == b.layer && p.inflate == b.inflate, b.name + ": uv, layer and inflate");
+    EXPECT(p.swapSides == b.swapSides && !memcmp(p.faceFlags, b.faceFlags, sizeof(p.faceFlags)), b.name + ": face mapping");
+  }
+
+  const ModelDesc nose = ParseBedrockGeometry(R"({ "geometry.nose": { "bones": [
+    { "name": "snout", "cubes": [ { "origin": [-1, 26, -6], "size": [2, 2, 2], "uv": [0, 0] } ] } ] } })");
+  EXPECT(nose.parts.size() == 1 && nose.parts[0].center.z == 5.0f, "a north-facing cube ends up in front");
+
+  const ModelDesc mirrored = ParseBedrockGeometry(R"({ "geometry.m": { "bones": [
+    { "name": "leftArm", "mirror": true, "cubes": [ { "origin": [4, 12, -2], "size": [4, 12, 4], "uv": [40, 16] } ] } ] } })");
+  EXPECT(!mirrored.parts[0].swapSides && mirrored.parts[0].faceFlags[Face_Front] == FaceFlipU, "mirror on top of a limb's mapping");
+
+  const std::string deep = std::string(100000, '[') + std::string(100000, ']');
+  bool rejected = false;
+  try {
+    ParseBedrockGeometry(deep);
+  } catch (const std::runtime_error& e) {
+    rejected = strstr(e.what(), "nested too deeply") != nullptr;
+  }
+  EXPECT(rejected, "deep nesting is rejected");
+}
+
+// ------------------------------
+// Archive limits
+// ------------------------------
+// Hostile inputs must fail with an error before they allocate what they
+// claim: deflate data that inflates past its declared size, tar metadata and
+// entries over the limits, and entries larger than the ingest budget.
+static std::vector<uint8_t> TarHeader(const std::string& name, uint64_t size, char type) {
+  std::vector<uint8_t> h(512, 0);
+  memcpy(h.data(), name.data(), std::min<size_t>(name.size(), 99));
+  snprintf((char*)&h[124], 12, "%011llo", (unsigned long long)size);
+  h[156] = (uint8_t)type;
+  memcpy(&h[257], "ustar", 6);
+  return h;
+}
+
+static void AppendTarFile(std::vector<uint8_t>& tar, const std::string& name, const std::vector<uint8_t>& data) {
+  const std::vector<uint8_t> h = TarHeader(name, data.size(), '0');
+  tar.insert(tar.end(), h.begin(), h.end());
+  tar.insert(tar.end(), data.begin(), data.end());
+  tar.resize((tar.size() + 511) & ~(size_t)511, 0);
+}
+
+static void TestArchiveLimits(const TestOptions& opt, TestProblems& problems) {
+  auto throwsWith = [](const std::function<void()>& fn, const char* text) {
+    try {
+      fn();
+    } catch (const std::runtime_error& e) {
+      return strstr(e.what(), text) != nullptr;
+    }
+    return false;
+  };
+
+  const SkinInfo skin = MakeGoldenSkin(kGoldenCases[0]);
+  std::vector<uint8_t> skinPng;
+  PngEncoder().Encode(skin.rgba.data(), skin.width, skin.height, PngEncodeOptions{}, skinPng);
+
+  // 4 MB of one colour deflates to a few KB; declared as 1000 bytes it must stop there.
+  {
+    const std::vector<uint8_t> flat((size_t)1024 * 1024 * 4, 0x55);
+    PngEncodeOptions po;
+    po.palette = false;
+    std::vector<uint8_t> png;
+    PngEncoder().Encode(flat.data(), 1024, 1024, po, png);
+    SkinSourceEntry e;
+    e.method = 8;
+    e.size = 1000;
+    for (size_t pos = 8; pos + 12 <= png.size();) {
+      const uint32_t len = (uint32_t)png[pos] << 24 | png[pos + 1] << 16 | png[pos + 2] << 8 | png[pos + 3];
+      if (!memcmp(&png[pos + 4], "IDAT", 4)) e.data.insert(e.data.end(), png.begin() + pos + 8, png.begin() + pos + 8 + len);
+      pos += 12 + (size_t)len;
+    }
+    e.data.erase(e.data.begin(), e.data.begin() + 2);   // zlib header; the raw deflate stream remains
+    EXPECT(throwsWith([&] { ExtractSkinSourceEntry(e); }, "more data than declared"), "inflate stops at the declared size");
+  }
+
+  const std::filesystem::path tarPath = opt.outDir / "archive_limits_test.tar";
+  auto ingest = [&](const std::vector<uint8_t>& tar, const IngestOptions& io) {
+    WriteFileBytes(tarPath, tar);
+    std::vector<IngestedSkin> out;
+    IngestSkins(tarPath, [&](IngestedSkin&& r) { out.push_back(std::move(r)); return true; }, io);
+    return out;
+  };
+
+  // A pax header that claims 1 GB fails the archive instead of allocating it.
+  {
+    std::vector<uint8_t> tar = TarHeader("pax", 1ull << 30, 'x');
+    tar.resize(4096, 0);
+    EXPECT(throwsWith([&] { ingest(tar, {}); }, "extended header"), "oversized pax header");
+  }
+
+  // An entry that claims 1 GB is reported without being read.
+  {
+    std::vector<uint8_t> tar = TarHeader("huge.png", 1ull << 30, '0');
+    tar.resize(2048, 0);
+    const std::vector<IngestedSkin> out = ingest(tar, {});
+    EXPECT(out.size() == 1 && out[0].error.find("entry limit") != std::string::npos, "oversized tar entry is reported");
+  }
+
+  // Entries larger than the in-flight budget are reported, not let through.
+  {
+    std::vector<uint8_t> tar;
+    AppendTarFile(tar, "a.png", skinPng);
+    AppendTarFile(tar, "b.png", skinPng);
+    tar.resize(tar.size() + 1024, 0);
+    IngestOptions io;
+    io.maxInFlightBytes = skinPng.size() - 1;
+    const std::vector<IngestedSkin> small = ingest(tar, io);
+    EXPECT(small.size() == 2 && !small[0].error.empty() && !small[1].error.empty(), "entries over the in-flight budget");
+    io.maxInFlightBytes = skinPng.size();
+    const std::vector<IngestedSkin> fits = ingest(tar, io);
+    EXPECT(fits.size() == 2 && fits[0].error.empty() && fits[1].error.empty(), "entries that just fit the budget decode");
+  }
+  std::filesystem::remove(tarPath);
+}
+
+// ------------------------------
+// Legacy hat (NotchTransparencyHack)
+// ------------------------------
+// A legacy skin whose hat is opaque keeps it when anything in the game's scan
+// rect (x 32..64, y 0..32) is transparent, here the unused 56..64 x 16..32
+// block; only a fully opaque rect drops the hat.
+static void TestLegacyHat(const TestOptions&, TestProblems& problems) {
+  for (uint32_t k : { 1u, 2u }) {
+    for (bool unusedClear : { true, false }) {
+      SkinInfo s;
+      s.width = 64 * k;
+      s.height = 32 * k;
+      s.rgba.assign((size_t)s.width * s.height * 4, 0xFF);
+      if (unusedClear) {
+        for (uint32_t y = 16 * k; y < 32 * k; ++y) memset(&s.rgba[((size_t)y * s.width + 56 * k) * 4], 0, (size_t)8 * k * 4);
+      }
+      PrepareDecodedSkin(s);
+      const std::string tag = std::to_string(s.width) + "x" + std::to_string(s.width) + (unusedClear ? " with" : " without") +
+                              " a transparent unused block";
+      EXPECT(s.height == s.width, tag + ": normalized to a square layout");
+      const uint8_t hatAlpha = s.rgba[((size_t)8 * k * s.width + 40 * k) * 4 + 3];
+      const uint8_t armAlpha = s.rgba[((size_t)20 * k * s.width + 44 * k) * 4 + 3];
+      EXPECT(hatAlpha == (unusedClear ? 255 : 0), tag + ": hat kept only when the scan rect has a transparent texel");
+      EXPECT(armAlpha == 255, tag + ": arm stays opaque");
+    }
+  }
+}
+
+// ------------------------------
+// Compositor cache (SkinCompositor)
+// ------------------------------
+// A slot emptied by RemoveLayer must not take the index entry of the same
+// stack composited again into another slot when it is later evicted.
+static void TestCompositorCache(const TestOptions&, TestProblems& problems) {
+  SkinCompositor comp(1, 3);
+  std::vector<uint8_t> rgba((size_t)comp.Size() * comp.Size() * 4, 0xFF);
+  for (uint64_t id = 1; id <= 6; ++id) comp.SetLayer(id, rgba.data());
+  const std::vector<uint64_t> a = { 1, 2 }, b = { 3, 4 }, c = { 5, 6 };
+  comp.Composite(a);
+  comp.Composite(b);
+  comp.RemoveLayer(1);
+  comp.SetLayer(1, rgba.data());
+  comp.Composite(a);   // a free slot, not the emptied one
+  comp.Composite(c);   // evicts the emptied slot
+  const uint64_t hits = comp.GetStats().hits;
+  comp.Composite(a);
+  EXPECT(comp.GetStats().hits == hits + 1, "stack recomposited after RemoveLayer stays cached past the emptied slot's eviction");
+}
+
+// ------------------------------
+// Main
+// ------------------------------
+struct TestCase {
+  const char* name;
+  TestFn run;
+};
+
+static const TestCase kTests[] = {
+  { "golden", TestGolden },
+  { "mesh-rebuild", TestMeshRebuild },
+  { "grid-layout", TestGridLayout },
+  { "phash-index", TestPHashIndex },
+  { "bedrock-geometry", TestBedrockGeometry },
+  { "archive-limits", TestArchiveLimits },
+  { "legacy-hat", TestLegacyHat },
+  { "compositor-cache", TestCompositorCache },
+};
+
+int main(int argc, char** argv) {
+  TestOptions opt;
+  std::vector<std::string> names;
+  for (int k = 1; k < argc; ++k) {
+    const std::string a = argv[k];
+    const char* v = k + 1 < argc ? argv[k + 1] : nullptr;
+    if (a == "--update") opt.update = true;
+    else if (a == "--golden-dir" && v) { opt.goldenDir = v; ++k; }
+    else if (a == "--out" && v) { opt.outDir = v; ++k; }
+    else if (a == "--budget-scale" && v) { opt.budgetScale = std::max(0.01, atof(v)); ++k; }
+    else if (a.rfind("--", 0) == 0) { fprintf(stderr, "unknown option %s\n", a.c_str()); return 2; }
+    else names.push_back(a);
+  }
+
+  int failed = 0, run = 0;
+  for (const TestCase& t : kTests) {
+    if (!names.empty() && std::find(names.begin(), names.end(), t.name) == names.end()) continue;
+    ++run;
+    TestProblems problems;
+    try {
+      t.run(opt, problems);
+    } catch (const std::exception& e) {
+      problems.push_back(std::string("exception: ") + e.what());
+    }
+    printf("%s %s\n", problems.empty() ? "PASS" : "FAIL", t.name);
+    for (const std::string& p : problems) printf("    %s\n", p.c_str());
+    failed += !problems.empty();
+  }
+  if (!run) {
+    fprintf(stderr, "no test matches\n");
+    return 2;
+  }
+  printf("%d of %d tests failed\n", failed, run);
+  return failed ? 1 : 0;
+}